@@ -5,6 +5,11 @@
 //changed to 5 columns
 #define NUM_COLS 5
 
+// Size of the whole spreadsheet. Cells are only allocated once used, and the
+// interface shows as much of it as fits on the terminal.
+#define SHEET_ROWS 1048576
+#define SHEET_COLS 16384
+
 // Rows of the spreadsheet.
 // NOTE: enums are 0-based, so the constant 'ROW_1' has the numerical value 0.
 typedef enum {
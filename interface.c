@@ -3,12 +3,52 @@
 
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <ncurses.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #define DEFAULT_EDIT_SIZE 128
 
+// Microseconds the recalculation thread works before letting the input loop in.
+#define RECALC_SLICE_US 2000
+
+// Key code for the start of a bracketed paste: the terminal sends pasted text
+// between ESC [200~ and ESC [201~ instead of as keys.
+#define KEY_PASTE (KEY_MAX + 1)
+#define PASTE_END "\033[201~"
+
+// Key codes for Ctrl+arrow, which jumps to the edge of the data, and for
+// Ctrl+Home and Ctrl+End, which go to the first cell and the end of the data.
+#define KEY_JUMP_UP (KEY_MAX + 2)
+#define KEY_JUMP_DOWN (KEY_MAX + 3)
+#define KEY_JUMP_LEFT (KEY_MAX + 4)
+#define KEY_JUMP_RIGHT (KEY_MAX + 5)
+#define KEY_SHEET_HOME (KEY_MAX + 6)
+#define KEY_SHEET_END (KEY_MAX + 7)
+
+// Key codes for Ctrl+Insert, which inserts columns, and for Ctrl+Delete and
+// Ctrl+Shift+Delete, which delete the selected rows and columns. Insert alone
+// inserts rows.
+#define KEY_INSERT_COLS (KEY_MAX + 8)
+#define KEY_DELETE_ROWS (KEY_MAX + 9)
+#define KEY_DELETE_COLS (KEY_MAX + 10)
+
+// Milliseconds to wait for more of a paste before giving up on its end marker.
+#define PASTE_TIMEOUT_MS 1000
+
+// First screen line of the cell rows; each row takes two lines (the cells and
+// the separator below them).
+#define FIRST_CELL_LINE 5
+
 // Current cur_row and column.
 static ROW cur_row = ROW_1;
 static COL cur_col = COL_A;
@@ -16,6 +56,12 @@ static COL cur_col = COL_A;
 // Column to return to when pressing <enter>.
 static COL return_col = COL_A;
 
+// The selection spans from the anchor cell to the current cell, while
+// 'selecting' (Shift+arrows).
+static bool selecting = false;
+static ROW anchor_row = ROW_1;
+static COL anchor_col = COL_A;
+
 // Current editable text.
 static char *edit_text = NULL;
 static size_t edit_text_capacity = 0;
@@ -23,9 +69,107 @@ static size_t edit_text_length = 0;
 static size_t edit_position = 0;
 static size_t edit_display_offset = 0;
 
+// The viewport: the part of the sheet that fits on the terminal, starting at
+// 'top_row' and 'left_col'. Only cells inside it are formatted and drawn.
+static ROW top_row = ROW_1;
+static COL left_col = COL_A;
+static int view_rows = 0;
+static int view_cols = 0;
+static size_t total_width = 0;
+static size_t total_height = 0;
+
+// String of total_width blanks.
+static char *blanks = NULL;
+
+// Damage-tracked cell display for the viewport, indexed by view row and
+// column. update_cell_display only records the latest text of a visible cell;
+// render_damage draws the damaged cells once per input cycle.
+static char (*cell_text)[CELL_DISPLAY_WIDTH + 1] = NULL;
+static bool *cell_damaged = NULL;
+static bool any_damage = false;
+
+// Recalculation runs on its own thread. 'model_lock' guards the model and the
+// frame buffer above, which the model writes through update_cell_display; the
+// input loop holds it except while waiting for a key.
+static pthread_mutex_t model_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t recalc_wanted = PTHREAD_COND_INITIALIZER;
+// Bumped after every key, so that the thread restarts from the viewport.
+static unsigned long recalc_generation = 0;
+static bool recalc_requested = false;
+// Set while the input loop waits for the lock, so the thread lets it in.
+static atomic_bool input_waiting = false;
+// The thread writes to 'wake_pipe' when it has damaged the display.
+static int wake_pipe[2] = {-1, -1};
+static bool wake_sent = false;
+// Percentage of the queued recalculation done, or -1 if there is none.
+static int recalc_percent = -1;
+static bool status_damaged = false;
+
+// Keys are recorded to 'record_file' with --record and read from 'replay_file'
+// instead of the terminal with --replay. A recording holds a line per key,
+// "<microseconds since start> <key code>"; for KEY_PASTE the line also holds
+// the length of the pasted text, which follows on the next line.
+static FILE *record_file = NULL;
+static FILE *replay_file = NULL;
+static long long start_time = 0;
+
+// Text of the last paste read, for KEY_PASTE.
+static char *pasted_text = NULL;
+static size_t pasted_length = 0;
+
+// Latencies measured by a replay, in microseconds: from reading a key to
+// presenting the frame drawn for it ('frame'), and to presenting the results
+// of the recalculation it started ('settled').
+static long long *frame_latencies = NULL;
+static long long *settled_latencies = NULL;
+static size_t latency_count = 0;
+static size_t latency_capacity = 0;
+static long long key_time = -1;
+// A replay fails if the 99th percentile of 'settled' exceeds this, if positive.
+static double latency_budget_ms = 0;
+// Signalled by the recalculation thread when it has nothing left to do.
+static pthread_cond_t recalc_done = PTHREAD_COND_INITIALIZER;
+
+// Text currently shown in the edit field, to skip redrawing it unchanged.
+static char *shown_edit_text = NULL;
+static size_t shown_edit_capacity = 0;
+static size_t shown_edit_length = 0;
+static bool edit_line_valid = false;
+
+static int cell_line(int view_row) {
+    return FIRST_CELL_LINE + 2 * view_row;
+}
+
+static int cell_column(int view_col) {
+    return (CELL_DISPLAY_WIDTH + 1) * (view_col + 1) + 1;
+}
+
+// Gets the selected block, which is the current cell when not selecting.
+static void get_selection(ROW *first_row, COL *first_col, ROW *last_row, COL *last_col) {
+    *first_row = *last_row = cur_row;
+    *first_col = *last_col = cur_col;
+    if (!selecting)
+        return;
+    if (anchor_row < cur_row)
+        *first_row = anchor_row;
+    else
+        *last_row = anchor_row;
+    if (anchor_col < cur_col)
+        *first_col = anchor_col;
+    else
+        *last_col = anchor_col;
+}
+
+// Sets the attributes of the visible cells of the selection.
 static void set_cell_attr(attr_t attr) {
-    mvchgat(2 * ((int) cur_row + 2) + 1, (CELL_DISPLAY_WIDTH + 1) * (cur_col + 1) + 1, CELL_DISPLAY_WIDTH, attr, 0,
-            NULL);
+    ROW first_row, last_row;
+    COL first_col, last_col;
+    get_selection(&first_row, &first_col, &last_row, &last_col);
+    for (int i = (int) first_row > (int) top_row ? (int) first_row - (int) top_row : 0;
+         i < view_rows && i <= (int) last_row - (int) top_row; i++)
+        for (int j = (int) first_col > (int) left_col ? (int) first_col - (int) left_col : 0;
+             j < view_cols && j <= (int) last_col - (int) left_col; j++)
+            mvchgat(cell_line(i), cell_column(j), CELL_DISPLAY_WIDTH, attr, 0, NULL);
 }
 
 static void ensure_edit_text_capacity(size_t capacity) {
@@ -47,98 +191,720 @@ static void ensure_edit_text_capacity(size_t capacity) {
     edit_text_capacity = capacity;
 }
 
-int main() {
-    /* INITIALIZATION */
+// Writes the name of a column ("A", ..., "Z", "AA", ...) into 'buffer'.
+static void column_name(COL col, char *buffer) {
+    char letters[8];
+    size_t count = 0;
+    for (int remaining = (int) col + 1; remaining > 0; remaining = (remaining - 1) / 26)
+        letters[count++] = (char) ('A' + (remaining - 1) % 26);
+    for (size_t i = 0; i < count; i++)
+        buffer[i] = letters[count - 1 - i];
+    buffer[count] = 0;
+}
 
-    // Initialize NCURSES.
-    initscr();
+static void render_damage() {
+    if (!any_damage)
+        return;
+    for (int i = 0; i < view_rows * view_cols; i++) {
+        if (!cell_damaged[i])
+            continue;
+        // Pad with blanks so one write replaces the previous text.
+        char padded[CELL_DISPLAY_WIDTH + 1];
+        size_t length = strlen(cell_text[i]);
+        memcpy(padded, cell_text[i], length);
+        memset(padded + length, ' ', CELL_DISPLAY_WIDTH - length);
+        padded[CELL_DISPLAY_WIDTH] = 0;
+        mvaddnstr(cell_line(i / view_cols), cell_column(i % view_cols), padded, CELL_DISPLAY_WIDTH);
+        cell_damaged[i] = false;
+    }
+    any_damage = false;
+}
 
-    // Enable raw characters for control sequences.
-    raw();
+static void present() {
+    // Push everything drawn during this input cycle in a single terminal update.
+    wnoutrefresh(stdscr);
+    doupdate();
+}
 
-    // Disable automatic echo of typed characters.
-    noecho();
+static void show_edit_line(const char *text, size_t length, size_t width) {
+    if (length > width)
+        length = width;
+    if (edit_line_valid && length == shown_edit_length && (length == 0 || memcmp(text, shown_edit_text, length) == 0))
+        return;
+    if (length > shown_edit_capacity) {
+        char *grown = realloc(shown_edit_text, length);
+        if (grown == NULL) {
+            endwin();
+            exit(ENOMEM);
+        }
+        shown_edit_text = grown;
+        shown_edit_capacity = length;
+    }
+    if (length > 0)
+        memcpy(shown_edit_text, text, length);
+    shown_edit_length = length;
+    edit_line_valid = true;
+    mvaddnstr(1, 1, blanks, width);
+    if (length > 0)
+        mvaddnstr(1, 1, text, length);
+}
 
-    // Enable input of function keys.
-    keypad(stdscr, true);
+// Draws the horizontal line below the cell line 'line', using 'cross' between columns.
+static void draw_separator(int line, chtype left, chtype cross, chtype right) {
+    mvaddch(line, 0, left);
+    for (int j = 0; j < view_cols + 1; j++) {
+        if (j > 0)
+            addch(cross);
+        for (size_t k = 0; k < CELL_DISPLAY_WIDTH; k++)
+            addch(ACS_HLINE);
+    }
+    addch(right);
+}
 
-    /* DRAW BORDERS */
+// Draws the borders and header of a view row and blanks its cells, along with
+// the separators around it.
+static void draw_row(int view_row) {
+    int line = cell_line(view_row);
+    char format_buffer[8];
+
+    mvaddch(line, 0, ACS_VLINE);
+    snprintf(format_buffer, sizeof(format_buffer), "%%%dd", CELL_DISPLAY_WIDTH);
+    mvprintw(line, 1, format_buffer, (int) top_row + view_row + 1);
+    for (int j = 0; j < view_cols; j++) {
+        mvaddch(line, cell_column(j) - 1, ACS_VLINE);
+        addnstr(blanks, CELL_DISPLAY_WIDTH);
+    }
+    mvaddch(line, total_width - 1, ACS_VLINE);
+
+    draw_separator(line - 1, ACS_LTEE, ACS_PLUS, ACS_RTEE);
+    if (view_row == view_rows - 1)
+        draw_separator(line + 1, ACS_LLCORNER, ACS_BTEE, ACS_LRCORNER);
+    else
+        draw_separator(line + 1, ACS_LTEE, ACS_PLUS, ACS_RTEE);
+}
+
+static void draw_column_headers() {
+    for (int j = 0; j < view_cols; j++) {
+        char name[8];
+        column_name(left_col + j, name);
+        mvaddnstr(3, cell_column(j), blanks, CELL_DISPLAY_WIDTH);
+        mvaddstr(3, cell_column(j) + (CELL_DISPLAY_WIDTH - (int) strlen(name)) / 2, name);
+    }
+}
+
+// Draws the instructions line, along with the progress of the recalculation.
+static void draw_status() {
+    char status[64];
+    int length = snprintf(status, sizeof(status), "Press Ctrl+C to exit.");
+    if (recalc_percent >= 0)
+        snprintf(status + length, sizeof(status) - length, "  Calculating %d%% (Esc to stop)", recalc_percent);
+    move(total_height, 0);
+    clrtoeol();
+    mvaddstr(total_height, 0, status);
+}
+
+// Redraws 'count' view rows starting at 'first' and asks the model for the
+// contents of their cells. Blank cells are not sent, so the rows start blank.
+static void show_rows(int first, int count) {
+    for (int i = first; i < first + count; i++) {
+        draw_row(i);
+        for (int j = 0; j < view_cols; j++) {
+            cell_text[i * view_cols + j][0] = 0;
+            cell_damaged[i * view_cols + j] = false;
+        }
+    }
+    redraw_cells(top_row + first, left_col, top_row + first + count - 1, left_col + view_cols - 1);
+}
+
+// Sizes the viewport to the terminal and draws everything.
+static void layout() {
+    // Leave a column to the left for row numbers, two rows on top for the edit
+    // field and column headers, and a line at the bottom for instructions.
+    view_cols = (COLS - 1) / (CELL_DISPLAY_WIDTH + 1) - 1;
+    view_rows = (LINES - 2) / 2 - 2;
+    if (view_cols < 1)
+        view_cols = 1;
+    if (view_rows < 1)
+        view_rows = 1;
+    if (view_cols > SHEET_COLS)
+        view_cols = SHEET_COLS;
+    if (view_rows > SHEET_ROWS)
+        view_rows = SHEET_ROWS;
+    total_width = (view_cols + 1) * (CELL_DISPLAY_WIDTH + 1) + 1;
+    total_height = (view_rows + 2) * 2 + 1;
+
+    free(blanks);
+    free(cell_text);
+    free(cell_damaged);
+    blanks = malloc(total_width + 1);
+    cell_text = calloc(view_rows * view_cols, sizeof(*cell_text));
+    cell_damaged = calloc(view_rows * view_cols, sizeof(bool));
+    if (blanks == NULL || cell_text == NULL || cell_damaged == NULL) {
+        endwin();
+        exit(ENOMEM);
+    }
+    memset(blanks, ' ', total_width);
+    blanks[total_width] = 0;
+    any_damage = false;
+    edit_line_valid = false;
 
-    // Include extra column to the left for cur_row numbers.
-    const size_t total_width = (NUM_COLS + 1) * (CELL_DISPLAY_WIDTH + 1) + 1;
-    // Include two extra rows on top for edit field and cur_row numbers.
-    const size_t total_height = (NUM_ROWS + 2) * 2 + 1;
+    // Keep the current cell in view.
+    if ((int) cur_row >= (int) top_row + view_rows)
+        top_row = cur_row - view_rows + 1;
+    if ((int) cur_col >= (int) left_col + view_cols)
+        left_col = cur_col - view_cols + 1;
 
-    // Resize window.
-    resizeterm(total_height + 1, total_width);
+    erase();
 
-    // Draw the top line.
-    addch(ACS_ULCORNER);
+    // Draw the top line and the edit field.
+    mvaddch(0, 0, ACS_ULCORNER);
     for (size_t i = 0; i < total_width - 2; i++)
         addch(ACS_HLINE);
     addch(ACS_URCORNER);
+    mvaddch(1, 0, ACS_VLINE);
+    mvaddch(1, total_width - 1, ACS_VLINE);
+
+    // Draw the header line.
+    draw_separator(2, ACS_LTEE, ACS_TTEE, ACS_RTEE);
+    mvaddch(3, 0, ACS_VLINE);
+    for (int j = 0; j <= view_cols; j++)
+        mvaddch(3, (CELL_DISPLAY_WIDTH + 1) * (j + 1), ACS_VLINE);
+    draw_column_headers();
+
+    // Draw exit instructions.
+    draw_status();
+
+    show_rows(0, view_rows);
+}
+
+// Moves the viewport so that its top left cell is 'row', 'col'.
+//
+// Vertical moves by less than a screen reuse the rows already drawn: the
+// terminal scrolls them and only the exposed rows are drawn.
+static void scroll_to(ROW row, COL col) {
+    int delta = (int) row - (int) top_row;
+
+    if (delta == 0 && col == left_col)
+        return;
+
+    if (col != left_col || abs(delta) >= view_rows) {
+        top_row = row;
+        left_col = col;
+        draw_column_headers();
+        show_rows(0, view_rows);
+        return;
+    }
+
+    // Scroll the cell rows and their separators (not the bottom border).
+    top_row = row;
+    scrollok(stdscr, true);
+    setscrreg(cell_line(0), cell_line(view_rows - 1));
+    scrl(2 * delta);
+    setscrreg(0, LINES - 1);
+    scrollok(stdscr, false);
+
+    // Scroll the frame buffer along with the screen.
+    size_t moved = (size_t) (view_rows - abs(delta)) * view_cols;
+    if (delta > 0) {
+        memmove(cell_text, cell_text + delta * view_cols, moved * sizeof(*cell_text));
+        memmove(cell_damaged, cell_damaged + delta * view_cols, moved * sizeof(bool));
+        show_rows(view_rows - delta, delta);
+    } else {
+        memmove(cell_text - delta * view_cols, cell_text, moved * sizeof(*cell_text));
+        memmove(cell_damaged - delta * view_cols, cell_damaged, moved * sizeof(bool));
+        show_rows(0, -delta);
+    }
+}
+
+// Scrolls the viewport as little as needed to show the current cell.
+static void ensure_visible() {
+    ROW row = top_row;
+    COL col = left_col;
+    if (cur_row < top_row)
+        row = cur_row;
+    else if ((int) cur_row >= (int) top_row + view_rows)
+        row = cur_row - view_rows + 1;
+    if (cur_col < left_col)
+        col = cur_col;
+    else if ((int) cur_col >= (int) left_col + view_cols)
+        col = cur_col - view_cols + 1;
+    scroll_to(row, col);
+}
+
+// Moves the current row by 'amount' rows, staying inside the sheet.
+static void move_rows(int amount) {
+    int row = (int) cur_row + amount;
+    if (row < 0)
+        row = 0;
+    if (row > SHEET_ROWS - 1)
+        row = SHEET_ROWS - 1;
+    cur_row = row;
+}
+
+// Locks the model for the input loop, ahead of the recalculation thread.
+static void lock_model() {
+    atomic_store(&input_waiting, true);
+    pthread_mutex_lock(&model_lock);
+    atomic_store(&input_waiting, false);
+}
+
+// Restarts recalculation from the viewport, to account for the last key.
+static void request_recalc() {
+    recalc_generation++;
+    recalc_requested = true;
+    pthread_cond_signal(&recalc_wanted);
+}
+
+// Lets the input loop in between two slices of recalculation, waking it first
+// if the display was damaged. Returns whether the recalculation is still
+// current, or was made obsolete by a newer key.
+static bool yield_to_input(unsigned long generation) {
+    if ((any_damage || status_damaged) && !wake_sent) {
+        wake_sent = true;
+        (void) !write(wake_pipe[1], "", 1);
+    }
+    pthread_mutex_unlock(&model_lock);
+    while (atomic_load(&input_waiting))
+        sched_yield();
+    pthread_mutex_lock(&model_lock);
+    return generation == recalc_generation;
+}
+
+// Updates the progress shown for the queued recalculation.
+static void update_progress() {
+    size_t done, total;
+    recalc_progress(&done, &total);
+    int percent = total == 0 ? -1 : (int) (done * 100 / total);
+    if (percent != recalc_percent) {
+        recalc_percent = percent;
+        status_damaged = true;
+    }
+}
+
+// Recalculates the formulas in view one row at a time, then the others queued
+// by the model in slices of RECALC_SLICE_US, starting over whenever a newer
+// key arrives.
+static void *recalc_thread(void *unused) {
+    (void) unused;
+    pthread_mutex_lock(&model_lock);
+    while (true) {
+        while (!recalc_requested)
+            pthread_cond_wait(&recalc_wanted, &model_lock);
+        unsigned long generation = recalc_generation;
+        bool current = true;
+        for (int i = 0; current && i < view_rows; i++) {
+            refresh_cells(top_row + i, left_col, top_row + i, left_col + view_cols - 1);
+            current = yield_to_input(generation);
+        }
+        while (current && recalc_slice(RECALC_SLICE_US)) {
+            update_progress();
+            current = yield_to_input(generation);
+        }
+        if (current) {
+            recalc_requested = false;
+            pthread_cond_broadcast(&recalc_done);
+            update_progress();
+            yield_to_input(generation);
+        }
+    }
+    return NULL;
+}
+
+// Starts the recalculation thread. Signals are left to the input loop so that
+// SIGWINCH interrupts its poll.
+static void start_recalc_thread() {
+    pthread_t thread;
+    sigset_t all;
+    sigset_t previous;
+    if (pipe(wake_pipe) != 0) {
+        endwin();
+        exit(errno);
+    }
+    fcntl(wake_pipe[0], F_SETFL, O_NONBLOCK);
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &previous);
+    if (pthread_create(&thread, NULL, recalc_thread, NULL) != 0) {
+        endwin();
+        exit(ENOMEM);
+    }
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+}
+
+// Draws the cells the recalculation thread updated since the last frame.
+// 'highlight' tells whether the current cell is highlighted.
+static void draw_landed(bool highlight) {
+    char drained[64];
+    while (read(wake_pipe[0], drained, sizeof(drained)) > 0) {
+    }
+    wake_sent = false;
+    int y, x;
+    getyx(stdscr, y, x);
+    render_damage();
+    if (status_damaged) {
+        draw_status();
+        status_damaged = false;
+    }
+    if (highlight)
+        set_cell_attr(A_REVERSE);
+    move(y, x);
+    present();
+}
+
+// Waits for the next key from the terminal. While waiting, the model is left
+// to the recalculation thread, and the cells it updates are drawn as they land.
+static int wait_for_key(bool highlight) {
+    while (true) {
+        // Keys handed back to NCURSES are not seen by poll.
+        timeout(0);
+        int c = getch();
+        timeout(-1);
+        if (c != ERR)
+            return c;
+
+        struct pollfd fds[2] = {{STDIN_FILENO, POLLIN, 0}, {wake_pipe[0], POLLIN, 0}};
+        pthread_mutex_unlock(&model_lock);
+        int ready = poll(fds, 2, -1);
+        // End the running slice early rather than let a key wait for it.
+        if (ready < 0 || (fds[0].revents & POLLIN))
+            preempt_recalc();
+        lock_model();
+
+        // A resize interrupts the poll and is then read as KEY_RESIZE.
+        if (ready < 0 || (fds[0].revents & POLLIN))
+            return getch();
+
+        if (fds[1].revents & POLLIN)
+            draw_landed(highlight);
+    }
+}
 
-    // Draw the left/right and interior lines.
-    for (size_t i = 0; i < NUM_ROWS + 2; i++) {
-        if (i > 0) {
-            mvaddch(2 * i, 0, ACS_LTEE);
-            for (size_t j = 0; j < NUM_COLS + 1; j++) {
-                if (j > 0)
-                    addch(i == 1 ? ACS_TTEE : ACS_PLUS);
-                for (size_t k = 0; k < CELL_DISPLAY_WIDTH; k++)
-                    addch(ACS_HLINE);
+// Copies 'length' characters of 'text' into a new string.
+static char *copy_text(const char *text, size_t length) {
+    char *copy = malloc(length + 1);
+    if (copy == NULL) {
+        endwin();
+        exit(ENOMEM);
+    }
+    memcpy(copy, text, length);
+    copy[length] = 0;
+    return copy;
+}
+
+// Reads the text of a bracketed paste up to its end marker, straight from the
+// terminal rather than key by key. Returns it as a new string of 'length'
+// characters, terminated.
+static char *read_paste(size_t *length) {
+    size_t capacity = 4096;
+    size_t used = 0;
+    size_t end = 0;
+    char *text = malloc(capacity + 1);
+    bool ended = false;
+
+    while (text != NULL && !ended) {
+        struct pollfd fd = {STDIN_FILENO, POLLIN, 0};
+        if (poll(&fd, 1, PASTE_TIMEOUT_MS) <= 0)
+            break;
+        if (used == capacity) {
+            capacity *= 2;
+            char *grown = realloc(text, capacity + 1);
+            if (grown == NULL)
+                free(text);
+            text = grown;
+            if (text == NULL)
+                break;
+        }
+        ssize_t count = read(STDIN_FILENO, text + used, capacity - used);
+        if (count <= 0)
+            break;
+        // The end marker may straddle two reads.
+        size_t from = used < sizeof(PASTE_END) - 1 ? 0 : used - (sizeof(PASTE_END) - 2);
+        used += count;
+        for (end = from; end + sizeof(PASTE_END) - 1 <= used; end++) {
+            if (memcmp(text + end, PASTE_END, sizeof(PASTE_END) - 1) == 0) {
+                ended = true;
+                break;
             }
-            addch(ACS_RTEE);
         }
-        mvaddch(2 * i + 1, 0, ACS_VLINE);
-        if (i > 0)
-            for (size_t j = 1; j < NUM_COLS + 1; j++)
-                mvaddch(2 * i + 1, (CELL_DISPLAY_WIDTH + 1) * j, ACS_VLINE);
-        mvaddch(2 * i + 1, total_width - 1, ACS_VLINE);
-    }
-
-    // Draw the bottom line.
-    mvaddch(total_height - 1, 0, ACS_LLCORNER);
-    for (size_t i = 0; i < NUM_COLS + 1; i++) {
-        if (i > 0)
-            addch(ACS_BTEE);
-        for (size_t j = 0; j < CELL_DISPLAY_WIDTH; j++)
-            addch(ACS_HLINE);
     }
-    addch(ACS_LRCORNER);
+    if (text == NULL) {
+        endwin();
+        exit(ENOMEM);
+    }
+    if (!ended)
+        end = used;
 
-    // Draw exit instructions.
-    mvaddstr(total_height, 0, "Press Ctrl+C to exit.");
+    // Hand keys typed after the paste back to NCURSES.
+    for (size_t i = used; i > end + sizeof(PASTE_END) - 1; i--)
+        ungetch((unsigned char) text[i - 1]);
+
+    text[end] = 0;
+    *length = end;
+    return text;
+}
 
-    /* HEADERS */
+// Sets the cells from the current one on to the tab separated values of
+// 'text', with one line per row, in a single write to the model.
+static void paste_block(const char *text, size_t length) {
+    size_t rows = 0;
+    size_t cols = 0;
+    size_t fields = 1;
 
-    // Print the column headers.
-    for (COL col = COL_A; col < NUM_COLS; col++)
-        mvaddch(3, (CELL_DISPLAY_WIDTH + 1) * (col + 1) + CELL_DISPLAY_WIDTH / 2 + 1, col + 'A');
+    // Size the block: lines end with "\r\n", "\r" or "\n", and the last one may
+    // not end at all.
+    for (size_t i = 0; i < length; i++) {
+        if (text[i] == '\t') {
+            fields++;
+        } else if (text[i] == '\r' || text[i] == '\n') {
+            if (text[i] == '\r' && i + 1 < length && text[i + 1] == '\n')
+                i++;
+            rows++;
+            if (fields > cols)
+                cols = fields;
+            fields = 1;
+        }
+    }
+    if (length > 0 && text[length - 1] != '\r' && text[length - 1] != '\n') {
+        rows++;
+        if (fields > cols)
+            cols = fields;
+    }
+    if (rows == 0)
+        return;
 
-    // Generate the format specifier for the cur_row headers.
-    char format_buffer[8];
-    snprintf(format_buffer, sizeof(format_buffer), "%%%dd", CELL_DISPLAY_WIDTH);
+    char **texts = calloc(rows * cols, sizeof(char *));
+    if (texts == NULL) {
+        endwin();
+        exit(ENOMEM);
+    }
+    size_t row = 0;
+    size_t col = 0;
+    size_t start = 0;
+    for (size_t i = 0; i <= length && row < rows; i++) {
+        if (i < length && text[i] != '\t' && text[i] != '\r' && text[i] != '\n')
+            continue;
+        if (i > start)
+            texts[row * cols + col] = copy_text(text + start, i - start);
+        if (i < length && text[i] == '\t') {
+            col++;
+        } else {
+            if (i + 1 < length && text[i] == '\r' && text[i + 1] == '\n')
+                i++;
+            row++;
+            col = 0;
+        }
+        start = i + 1;
+    }
 
-    // Print the cur_row headers.
-    for (ROW row = ROW_1; row < NUM_ROWS; row++)
-        mvprintw(2 * ((int) row + 2) + 1, 1, format_buffer, row + 1);
+    set_cell_block(cur_row, cur_col, rows, cols, texts);
+    free(texts);
+}
 
-    /* MAIN LOOP */
+static long long microseconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
 
-    // Initialize data structure.
+static void record_key(int c) {
+    fprintf(record_file, "%lld %d", microseconds() - start_time, c);
+    if (c == KEY_PASTE) {
+        fprintf(record_file, " %zu\n", pasted_length);
+        fwrite(pasted_text, 1, pasted_length, record_file);
+    }
+    fputc('\n', record_file);
+}
+
+// Reads the next key of a replay, once the previous one has been handled and
+// its recalculation has landed, and measures how long both took. The end of
+// the recording reads as Ctrl+C.
+static int replay_key(bool highlight) {
+    if (key_time >= 0) {
+        long long frame = microseconds() - key_time;
+        while (recalc_requested)
+            pthread_cond_wait(&recalc_done, &model_lock);
+        draw_landed(highlight);
+        if (latency_count == latency_capacity) {
+            latency_capacity = latency_capacity == 0 ? 256 : latency_capacity * 2;
+            frame_latencies = realloc(frame_latencies, latency_capacity * sizeof(long long));
+            settled_latencies = realloc(settled_latencies, latency_capacity * sizeof(long long));
+            if (frame_latencies == NULL || settled_latencies == NULL) {
+                endwin();
+                exit(ENOMEM);
+            }
+        }
+        frame_latencies[latency_count] = frame;
+        settled_latencies[latency_count] = microseconds() - key_time;
+        latency_count++;
+    }
+
+    long long recorded;
+    int c;
+    if (fscanf(replay_file, "%lld %d", &recorded, &c) != 2)
+        c = 3;
+    if (c == KEY_PASTE) {
+        free(pasted_text);
+        if (fscanf(replay_file, "%zu", &pasted_length) != 1 || fgetc(replay_file) != '\n')
+            pasted_length = 0;
+        pasted_text = malloc(pasted_length + 1);
+        if (pasted_text == NULL) {
+            endwin();
+            exit(ENOMEM);
+        }
+        pasted_length = fread(pasted_text, 1, pasted_length, replay_file);
+        pasted_text[pasted_length] = 0;
+    }
+    key_time = microseconds();
+    return c;
+}
+
+// Reads the next key, from the terminal or a replay, recording it if asked to.
+// For KEY_PASTE, the pasted text is left in 'pasted_text'.
+static int read_key(bool highlight) {
+    if (replay_file != NULL)
+        return replay_key(highlight);
+    int c = wait_for_key(highlight);
+    if (c == KEY_PASTE) {
+        free(pasted_text);
+        pasted_text = read_paste(&pasted_length);
+    }
+    if (record_file != NULL)
+        record_key(c);
+    return c;
+}
+
+static int compare_latencies(const void *first, const void *second) {
+    long long a = *(const long long *) first;
+    long long b = *(const long long *) second;
+    return (a > b) - (a < b);
+}
+
+// Sorts 'latencies' and prints their median, 99th percentile and maximum, in
+// milliseconds. Returns the 99th percentile.
+static double report_latencies(const char *name, long long *latencies) {
+    qsort(latencies, latency_count, sizeof(long long), compare_latencies);
+    double p50 = latencies[(latency_count * 50 + 99) / 100 - 1] / 1000.0;
+    double p99 = latencies[(latency_count * 99 + 99) / 100 - 1] / 1000.0;
+    double max = latencies[latency_count - 1] / 1000.0;
+    printf("%-8s p50 %8.3f ms  p99 %8.3f ms  max %8.3f ms\n", name, p50, p99, max);
+    return p99;
+}
+
+// Leaves the program. After a replay, reports the latencies measured, failing
+// if they exceed the budget given.
+_Noreturn static void quit() {
+    int status = 0;
+    endwin();
+    if (record_file != NULL)
+        fclose(record_file);
+    if (replay_file != NULL && latency_count > 0) {
+        printf("%zu keys replayed\n", latency_count);
+        report_latencies("frame", frame_latencies);
+        double p99 = report_latencies("settled", settled_latencies);
+        if (latency_budget_ms > 0 && p99 > latency_budget_ms) {
+            printf("p99 of %.3f ms exceeds the budget of %.3f ms\n", p99, latency_budget_ms);
+            status = 1;
+        }
+    }
+    exit(status);
+}
+
+// Turns bracketed paste off again when leaving.
+static void end_bracketed_paste() {
+    printf("\033[?2004l");
+    fflush(stdout);
+}
+
+int main(int argc, char **argv) {
+    /* INITIALIZATION */
+
+    // Parse the options for recording and replaying keys.
+    for (int i = 1; i < argc; i += 2) {
+        const char *option = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (value != NULL && strcmp(option, "--record") == 0)
+            record_file = fopen(value, "w");
+        else if (value != NULL && strcmp(option, "--replay") == 0)
+            replay_file = fopen(value, "r");
+        else if (value != NULL && strcmp(option, "--budget") == 0)
+            latency_budget_ms = atof(value);
+        else {
+            fprintf(stderr, "usage: %s [--record FILE] [--replay FILE [--budget MILLISECONDS]]\n", argv[0]);
+            return 2;
+        }
+        if ((strcmp(option, "--record") == 0 && record_file == NULL) ||
+            (strcmp(option, "--replay") == 0 && replay_file == NULL)) {
+            perror(value);
+            return 2;
+        }
+    }
+    start_time = microseconds();
+
+    // Initialize NCURSES. A replay runs without a terminal: it draws for a
+    // fixed terminal type to /dev/null, so that it is repeatable.
+    if (replay_file != NULL) {
+        FILE *null_output = fopen("/dev/null", "w");
+        FILE *null_input = fopen("/dev/null", "r");
+        if (null_output == NULL || null_input == NULL || newterm("xterm", null_output, null_input) == NULL) {
+            fprintf(stderr, "%s: cannot set up a screen to replay keys\n", argv[0]);
+            return 1;
+        }
+    } else
+        initscr();
+
+    // Enable raw characters for control sequences.
+    raw();
+
+    // Disable automatic echo of typed characters.
+    noecho();
+
+    // Enable input of function keys.
+    keypad(stdscr, true);
+
+    // Allow the terminal's own line scrolling to be used.
+    idlok(stdscr, true);
+
+    // Have pasted text marked, so it can be read as a block rather than as keys.
+    if (replay_file == NULL) {
+        putp("\033[?2004h");
+        fflush(stdout);
+        atexit(end_bracketed_paste);
+    }
+    define_key("\033[200~", KEY_PASTE);
+    define_key("\033[1;5A", KEY_JUMP_UP);
+    define_key("\033[1;5B", KEY_JUMP_DOWN);
+    define_key("\033[1;5D", KEY_JUMP_LEFT);
+    define_key("\033[1;5C", KEY_JUMP_RIGHT);
+    define_key("\033[1;5H", KEY_SHEET_HOME);
+    define_key("\033[1;5F", KEY_SHEET_END);
+    define_key("\033[2;5~", KEY_INSERT_COLS);
+    define_key("\033[3;5~", KEY_DELETE_ROWS);
+    define_key("\033[3;6~", KEY_DELETE_COLS);
+
+    // Initialize data structure. Formulas are evaluated by the recalculation
+    // thread, for the viewport first and then for the rest of the sheet.
     model_init();
+    set_calc_mode(CALC_BACKGROUND);
+    lock_model();
+    start_recalc_thread();
 
-    // String of blanks used by main loop.
-    char blanks[total_width + 1];
-    for (size_t i = 0; i < total_width; i++)
-        blanks[i] = ' ';
-    blanks[total_width] = 0;
+    /* DRAW BORDERS AND HEADERS */
+
+    layout();
+
+    /* MAIN LOOP */
 
     while (true) {
+        // Bring the displayed cells up to date, in the background.
+        ensure_visible();
+        request_recalc();
+
         // Print the current cell coordinates in top-left corner.
+        char name[8];
+        char coordinates[32];
+        column_name(cur_col, name);
+        snprintf(coordinates, sizeof(coordinates), "%*s%d", CELL_DISPLAY_WIDTH / 2, name, cur_row + 1);
         mvaddnstr(3, 1, blanks, CELL_DISPLAY_WIDTH);
-        mvprintw(3, CELL_DISPLAY_WIDTH / 2, "%c%d", cur_col + 'A', cur_row + 1);
+        mvaddnstr(3, 1, coordinates, CELL_DISPLAY_WIDTH);
 
         // Show the textual representation of the current cell in the edit field.
         if (edit_text != NULL)
@@ -146,65 +912,140 @@ int main() {
         edit_text = get_textual_value(cur_row, cur_col);
         edit_text_capacity = edit_text == NULL ? 0 : strlen(edit_text);
         edit_text_length = edit_text_capacity;
-        mvaddnstr(1, 1, blanks, total_width - 2);
-        if (edit_text != NULL)
-            mvaddnstr(1, 1, edit_text, total_width - 2);
+        show_edit_line(edit_text, edit_text_length, total_width - 2);
 
-        // Highlight the current cell.
+        // Draw the cells changed since the last key, then highlight the selection.
+        render_damage();
         set_cell_attr(A_REVERSE);
-        refresh();
+        present();
 
         // Read next key.
-        int c = getch();
+        int c = read_key(true);
         set_cell_attr(A_NORMAL);
 
-        // Handle key.
+        // Handle key. Shift+arrows extend the selection from the current cell,
+        // other keys but those acting on the selection end it.
         handle_key:
+        if (c == KEY_SR || c == KEY_SF || c == KEY_SLEFT || c == KEY_SRIGHT) {
+            if (!selecting) {
+                anchor_row = cur_row;
+                anchor_col = cur_col;
+                selecting = true;
+            }
+        } else if (c != KEY_DC && c != KEY_IC && c != KEY_INSERT_COLS && c != KEY_DELETE_ROWS
+                   && c != KEY_DELETE_COLS && c != KEY_RESIZE)
+            selecting = false;
         switch (c) {
             case 3: // Ctrl+C
-                endwin();
-                return 0;
+                quit();
+            case KEY_RESIZE:
+                layout();
+                continue;
             case KEY_UP:
-                if (cur_row > ROW_1)
-                    cur_row--;
+            case KEY_SR:
+                move_rows(-1);
                 continue;
             case KEY_DOWN:
-                if (cur_row < NUM_ROWS - 1)
-                    cur_row++;
+            case KEY_SF:
+                move_rows(1);
                 continue;
             case KEY_LEFT:
+            case KEY_SLEFT:
                 if (cur_col > COL_A)
                     cur_col--;
                 return_col = cur_col;
                 continue;
             case KEY_RIGHT:
-                if (cur_col < NUM_COLS - 1)
+            case KEY_SRIGHT:
+                if (cur_col < SHEET_COLS - 1)
                     cur_col++;
                 return_col = cur_col;
                 continue;
             case KEY_PPAGE:
-                cur_row = ROW_1;
+                move_rows(-view_rows);
                 continue;
             case KEY_NPAGE:
-                cur_row = NUM_ROWS - 1;
+                move_rows(view_rows);
                 continue;
             case KEY_HOME:
                 cur_col = COL_A;
                 return_col = COL_A;
                 continue;
             case KEY_END:
-                cur_col = NUM_COLS - 1;
-                return_col = NUM_COLS - 1;
+                cur_col = left_col + view_cols - 1;
+                return_col = cur_col;
+                continue;
+            case KEY_JUMP_UP:
+                find_data_edge(&cur_row, &cur_col, DIRECTION_UP);
+                continue;
+            case KEY_JUMP_DOWN:
+                find_data_edge(&cur_row, &cur_col, DIRECTION_DOWN);
+                continue;
+            case KEY_JUMP_LEFT:
+                find_data_edge(&cur_row, &cur_col, DIRECTION_LEFT);
+                return_col = cur_col;
+                continue;
+            case KEY_JUMP_RIGHT:
+                find_data_edge(&cur_row, &cur_col, DIRECTION_RIGHT);
+                return_col = cur_col;
                 continue;
+            case KEY_SHEET_HOME:
+                cur_row = ROW_1;
+                cur_col = COL_A;
+                return_col = COL_A;
+                continue;
+            case KEY_SHEET_END: {
+                // Go to the last row and column holding data.
+                ROW first_row;
+                COL first_col;
+                get_used_range(&first_row, &first_col, &cur_row, &cur_col);
+                return_col = cur_col;
+                continue;
+            }
             case '\t':
-                if (cur_col < NUM_COLS - 1)
+                if (cur_col < SHEET_COLS - 1)
                     cur_col++;
                 continue;
-            case KEY_DC:
-                clear_cell(cur_row, cur_col);
+            case KEY_DC: {
+                // Clear the selection.
+                ROW first_row, last_row;
+                COL first_col, last_col;
+                get_selection(&first_row, &first_col, &last_row, &last_col);
+                if (first_row == last_row && first_col == last_col)
+                    clear_cell(cur_row, cur_col);
+                else
+                    clear_range(first_row, first_col, last_row, last_col);
+                continue;
+            }
+            case KEY_IC:
+            case KEY_INSERT_COLS:
+            case KEY_DELETE_ROWS:
+            case KEY_DELETE_COLS: {
+                // Insert as many rows (or columns) as are selected before the
+                // selection, or delete the selected ones. Moved cells are not
+                // sent one by one, so the whole view is fetched again.
+                ROW first_row, last_row;
+                COL first_col, last_col;
+                get_selection(&first_row, &first_col, &last_row, &last_col);
+                if (c == KEY_IC)
+                    insert_rows(first_row, last_row - first_row + 1);
+                else if (c == KEY_INSERT_COLS)
+                    insert_cols(first_col, last_col - first_col + 1);
+                else if (c == KEY_DELETE_ROWS)
+                    delete_rows(first_row, last_row - first_row + 1);
+                else
+                    delete_cols(first_col, last_col - first_col + 1);
+                selecting = false;
+                show_rows(0, view_rows);
+                continue;
+            }
+            case 4: // Ctrl+D
+                // Fill the current cell from the cell above.
+                if (cur_row > ROW_1)
+                    fill_cells(cur_row - 1, cur_col, cur_row, cur_col);
                 continue;
             case '\n':
-                if (cur_row < NUM_ROWS - 1) {
+                if (cur_row < SHEET_ROWS - 1) {
                     cur_row++;
                     cur_col = return_col;
                 }
@@ -214,14 +1055,25 @@ int main() {
                 ensure_edit_text_capacity(1);
                 edit_position = edit_text_length;
                 break;
+            case KEY_PASTE: {
+                // Paste a block of tab separated values at the current cell.
+                paste_block(pasted_text, pasted_length);
+                continue;
+            }
+            case 0033: // Escape key.
+                // Stop the recalculation of formulas out of view; they are
+                // evaluated once shown.
+                cancel_recalc();
+                continue;
             default:
-                if (isgraph(c)) {
-                    // Clear the edit text and start typing a new value.
-                    ensure_edit_text_capacity(1);
-                    edit_text[0] = (char) c;
-                    edit_text_length = 1;
-                    edit_position = 1;
-                }
+                // Other keys do nothing.
+                if (!isgraph(c))
+                    continue;
+                // Clear the edit text and start typing a new value.
+                ensure_edit_text_capacity(1);
+                edit_text[0] = (char) c;
+                edit_text_length = 1;
+                edit_position = 1;
                 break;
         }
 
@@ -234,20 +1086,16 @@ int main() {
                 edit_display_offset = edit_position - total_width + 2;
 
             // Display edit text.
-            mvaddnstr(1, 1, blanks, total_width - 2);
-            size_t display_amount = edit_text_length - edit_display_offset;
-            if (display_amount > total_width - 2)
-                display_amount = total_width - 2;
-            mvaddnstr(1, 1, edit_text + edit_display_offset, display_amount);
+            show_edit_line(edit_text + edit_display_offset, edit_text_length - edit_display_offset, total_width - 2);
             move(1, edit_position - edit_display_offset + 1);
+            present();
 
             // Read next key of input.
-            c = getch();
+            c = read_key(false);
 
             switch (c) {
                 case 3: // Ctrl+C
-                    endwin();
-                    return 0;
+                    quit();
                 case KEY_LEFT:
                     if (edit_position > 0)
                         edit_position--;
@@ -262,10 +1110,22 @@ int main() {
                 case KEY_END:
                     edit_position = edit_text_length;
                     continue;
+                case KEY_PASTE: {
+                    // Insert the first value of the pasted text.
+                    size_t value_length = strcspn(pasted_text, "\t\r\n");
+                    ensure_edit_text_capacity(edit_text_length + value_length);
+                    memmove(edit_text + edit_position + value_length, edit_text + edit_position,
+                            edit_text_length - edit_position);
+                    memcpy(edit_text + edit_position, pasted_text, value_length);
+                    edit_position += value_length;
+                    edit_text_length += value_length;
+                    continue;
+                }
                 case KEY_UP:
                 case KEY_DOWN:
                 case KEY_PPAGE:
                 case KEY_NPAGE:
+                case KEY_RESIZE:
                 case 0033: // Escape key.
                     // Cancel edit and navigate as usual.
                     free(edit_text);
@@ -314,14 +1174,16 @@ int main() {
 }
 
 void update_cell_display(ROW row, COL col, const char *text) {
-    int console_row = 2 * ((int) row + 2) + 1;
-    int console_col = (CELL_DISPLAY_WIDTH + 1) * (col + 1) + 1;
-    char blanks[CELL_DISPLAY_WIDTH + 1];
-    for (size_t i = 0; i < CELL_DISPLAY_WIDTH; i++)
-        blanks[i] = ' ';
-    blanks[CELL_DISPLAY_WIDTH] = '\0';
-    mvaddstr(console_row, console_col, blanks);
-    mvaddnstr(console_row, console_col, text, CELL_DISPLAY_WIDTH);
+    // Cells outside the viewport are not shown; they are fetched again with
+    // redraw_cells when they scroll into view.
+    int view_row = (int) row - (int) top_row;
+    int view_col = (int) col - (int) left_col;
+    if (view_row < 0 || view_row >= view_rows || view_col < 0 || view_col >= view_cols)
+        return;
+    // Only the last text of a cell within an input cycle is drawn.
+    snprintf(cell_text[view_row * view_cols + view_col], CELL_DISPLAY_WIDTH + 1, "%s", text);
+    cell_damaged[view_row * view_cols + view_col] = true;
+    any_damage = true;
 }
 
 
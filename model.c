@@ -6,6 +6,16 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <ctype.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <strings.h>
+#include <unistd.h>
+#include <math.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 
 // #include "model.h"
 // #include "interface.h"
@@ -20,7 +30,7 @@
 //call an enumeration called the equation type and the cell content
 
 enum eqnType{
-    OPERATOR, OPERAND, INVALID, REF_CELL,
+    OPERATOR, OPERAND, INVALID, REF_CELL, FUNCTION_CALL,
 
 
 };
@@ -28,18 +38,113 @@ enum eqnType{
 
 enum cellContent{
     NUM, TXT, BLANK, EQN,
-    
 
+
+};
+
+
+//outcome of evaluating a formula cell
+enum evalStatus{
+    EVAL_OK, EVAL_INVALID, EVAL_CIRCULAR, EVAL_BAD_REFERENCE, EVAL_NOT_FOUND,
 };
 
 
+//cells are allocated in chunks of CHUNK_ROWS by CHUNK_COLS, once one of them is used
+#define CHUNK_ROWS 64
+#define CHUNK_COLS 16
+
+
 //structure to represent the excel spreadsheet
 struct excelSpreadSheet{
     int row;
 
     int col;
-    
-    struct cell** cells;
+
+    //chunks[i][j] holds the cells from row i * CHUNK_ROWS and column
+    //j * CHUNK_COLS; a NULL row of chunks or chunk means all its cells are blank
+    struct cellChunk*** chunks;
+
+    int chunkRows;
+
+    int chunkCols;
+};
+
+
+//structure that identifies a cell by its position
+struct cellPosition{
+    int row;
+
+    int col;
+};
+
+
+//structure that represent a reference to a cell inside a formula
+//
+//Unless marked absolute (a '$' in the formula text), 'row' and 'col' are
+//offsets from the cell holding the formula, so the same formula filled down a
+//column has the same representation in every row.
+struct cellReference{
+    int row;
+
+    int col;
+
+    bool absoluteRow;
+
+    bool absoluteCol;
+};
+
+
+//structure that represent a rectangular block of cells inside a formula, such as "A1:B3"
+struct cellRange{
+    struct cellReference first;
+
+    struct cellReference last;
+};
+
+
+//functions which can be called in formulas, in the order of 'functionNames'
+enum functionName{
+    FN_SUM, FN_VLOOKUP, FN_MATCH, FN_XLOOKUP, FN_SUMIF, FN_COUNTIF, FN_AVERAGEIF, FN_RAND,
+};
+
+static const char* const functionNames[] = {
+    "SUM", "VLOOKUP", "MATCH", "XLOOKUP", "SUMIF", "COUNTIF", "AVERAGEIF", "RAND",
+};
+
+//arguments each function takes, one letter per argument: 'K' a number or a
+//reference (a lookup key or a condition), 'R' a range, 'N' a number; lower
+//case letters are optional, and NULL means one or more arguments of any kind
+static const char* const functionArguments[] = {
+    NULL, "KRNn", "KRn", "KRRkn", "RKr", "RK", "RKr", "",
+};
+
+
+//kinds of arguments of a function call
+enum argumentType{
+    ARG_NUMBER, ARG_REF, ARG_RANGE,
+};
+
+
+//structure that represent an argument of a function call
+struct functionArgument{
+    enum argumentType type;
+
+    union{
+        double number;
+
+        //for ARG_REF only 'first' is used
+        struct cellRange range;
+    }value;
+};
+
+
+//structure that represent a function call inside a formula, such as "SUM(A1:A9)"
+struct functionCall{
+    enum functionName name;
+
+    size_t argumentCount;
+
+    struct functionArgument* arguments;
 };
 
 
@@ -48,451 +153,8743 @@ struct cell{
     enum cellContent type;
 
     union{
-    
+
         char* text;
         double number;
-    
+
     }celcontent;
 
-};
+    //shared formula of an EQN cell (NULL if the formula is invalid, in which
+    //case celcontent.text keeps what was typed)
+    struct formulaTemplate* formula;
+
+    //memoized result of an EQN cell, valid while 'dirty' is false; a dirty
+    //formula may still be up to date, see evaluateCell
+    double value;
+    enum evalStatus status;
+    bool dirty;
+    bool evaluating;
+
+    //revision at which the value of the cell last changed, and at which the
+    //memoized result of an EQN cell was last confirmed (0 if never computed)
+    unsigned long changedAt;
+    unsigned long verifiedAt;
+
+    //true when 'value' changed since it was last sent to update_cell_display
+    bool displayStale;
+
+    //with iterative calculation, the position of the cell on the component
+    //stack plus 1 while it is being solved, see evaluateComponentCell
+    unsigned componentIndex;
+
+    //cells whose formulas reference this cell on its own; formulas referencing
+    //it through a range are found in the range index instead
+    struct cellPosition* dependents;
+    size_t dependentCount;
+    size_t dependentCapacity;
+};
+
+
+//structure that represent a block of cells allocated together
+//
+//Under a memory budget (see set_memory_budget) the cells of a chunk may be
+//paged out to the spill file, leaving 'cells' NULL; the rest of the chunk
+//stays in memory. Cells are reached through residentChunk, which reads them
+//back, or modifiedChunk where they may change. A chunk whose cells are held
+//across an evaluation is pinned, see pinChunk.
+struct cellChunk{
+    //threads running simulation trials may page the cells in while others
+    //read them, so the pointer is published with release ordering once they
+    //are read back, and checked with acquire ordering before they are used
+    struct cell (* _Atomic cells)[CHUNK_COLS];
+
+    //bit j of occupied[i] is set when cells[i][j] is not blank (CHUNK_COLS <= 16)
+    uint16_t occupied[CHUNK_ROWS];
+
+    //number of cells with dependents; a chunk holding none and no non-blank
+    //cells can be freed
+    int linkedCells;
+
+    //physical position of the chunk, in chunks
+    int chunkRow;
+
+    int chunkCol;
+
+    //slot of the cells in the spill file (-1 if none), and whether the cells
+    //may have changed since they were last stored there, so that cells paged
+    //out unchanged are not written again
+    int64_t spillSlot;
+
+    atomic_bool modified;
+
+    //position among the resident chunks, and whether the cells were used
+    //since the clock hand last passed them
+    size_t residentIndex;
+
+    atomic_bool referenced;
+
+    //number of evaluations running that hold on to the cells
+    int pins;
+};
+
+
+//size of the cells of a chunk
+#define CHUNK_CELLS_SIZE (CHUNK_ROWS * CHUNK_COLS * sizeof(struct cell))
+
+//fewest chunks kept in memory under a budget, and most read ahead of a scan
+#define SPILL_MIN_CHUNKS 16
+#define SPILL_READ_AHEAD 8
+
+
+//structure that tracks which lines (rows or columns) of the spreadsheet hold
+//non-blank cells
+struct lineOccupancy{
+    //number of non-blank cells in each line
+    int* counts;
+
+    //bit set for each line holding non-blank cells, and in 'summary' for each
+    //word of 'lines' that is not zero
+    uint64_t* lines;
+
+    uint64_t* summary;
+
+    int lineCount;
+
+    //first and last line holding non-blank cells, or -1 if there are none
+    int first;
+
+    int last;
+};
+
+
+//structure that represent a run of lines (rows or columns) which keep their
+//order physically, the unit of a line map
+//
+//A run is a node of two treaps: one in the logical order of the lines, where
+//each node counts the lines of its subtree, and one ordered by physical line.
+struct lineRun{
+    //first physical line of the run, and its number of lines
+    int physical;
+
+    int length;
+
+    //number of lines in the subtree of the logical tree
+    int lines;
+
+    unsigned priority;
+
+    unsigned physicalPriority;
+
+    struct lineRun* left;
+
+    struct lineRun* right;
+
+    struct lineRun* parent;
+
+    //children in the physical tree
+    struct lineRun* lower;
+
+    struct lineRun* higher;
+};
+
+
+//structure that maps the logical lines (rows or columns) seen by the user to
+//the physical lines cells are stored at
+//
+//Inserting or deleting lines only moves runs of the logical tree, in
+//O(log n), so cells stay where they are and formulas, whose references are
+//compiled to physical lines, keep referring to the same cells.
+struct lineMap{
+    struct lineRun* root;
+
+    struct lineRun* physicalRoot;
+
+    int lineCount;
+
+    //false while every line is at its own physical position
+    bool moved;
+};
+
+
+//structure that represent equation's elements
+struct equationElemts{
+
+    enum eqnType type;
+
+    union{
+
+        struct cellReference referenceCell;
+
+        struct functionCall* call;
+
+        char operatorSymbol;
+
+        char operator;
+
+        double operand;
+
+
+    }celcontent2;
+
+
+};
+
+
+
+
+//operations of a compiled formula, applied in order to a running value
+enum formulaOp{
+    ADD_LOAD, SUB_LOAD, ADD_CONSTANT,
+};
+
+
+//structure that represent a value loaded by a compiled formula: either a
+//single cell or the result of a function call
+struct formulaLoad{
+    enum eqnType type;
+
+    union{
+        //for REF_CELL
+        struct cellReference reference;
+
+        //for FUNCTION_CALL, owned by the formula's elements
+        const struct functionCall* call;
+    }source;
+};
+
+
+//structure that represent one instruction of a compiled formula
+struct formulaInstruction{
+    enum formulaOp op;
+
+    union{
+        //index into the formula's loads
+        size_t load;
+
+        double constant;
+    }arg;
+};
+
+
+//shapes of compiled formulas which are evaluated by specialised code
+enum formulaShape{
+    //no references: the value is the folded constant
+    SHAPE_CONSTANT,
+
+    //the folded constant plus a sum of loads
+    SHAPE_SUM,
+
+    SHAPE_GENERAL,
+};
+
+
+//structure that represent a parsed formula shared by every cell holding the
+//same formula in relative form
+struct formulaTemplate{
+    //elements terminated by an element of type INVALID
+    struct equationElemts* elmnts;
+
+    size_t elementCount;
+
+    //compiled program, see compileFormula: the running value starts at
+    //'initialValue', each distinct reference or function call is loaded once
+    //into a slot of 'loads', then the instructions are applied
+    enum formulaShape shape;
+
+    double initialValue;
+
+    struct formulaLoad* loads;
+
+    size_t loadCount;
+
+    struct formulaInstruction* program;
+
+    size_t programLength;
+
+    unsigned long hash;
+
+    //number of cells using this template
+    size_t refCount;
+
+    //next template in the same bucket of the template table
+    struct formulaTemplate* next;
+};
+
+
+//hash table of the formula templates in use, so identical formulas share one
+#define TEMPLATE_BUCKETS 4096
+static struct formulaTemplate* templateTable[TEMPLATE_BUCKETS];
+
+
+//structure that records that the formula in 'dependent' references every cell
+//of a block through a range
+//
+//The block is held by the physical lines of its first and last rows and
+//columns, in logical order: inserting or deleting other lines keeps that order,
+//so the entry never has to be brought up to date.
+struct rangeDependency{
+    int firstRow;
+
+    int lastRow;
+
+    int firstCol;
+
+    int lastCol;
+
+    struct cellPosition dependent;
+};
+
+
+//node of the range index, a treap of the ranges ordered by logical first row
+//
+//Each node also points at the range of its subtree ending on the last row, so
+//a stabbing query skips the subtrees which end before the cell, and at those
+//spanning its first and last columns, so it skips the subtrees beside the
+//cell. The order of the nodes and these pointers are by logical lines, yet
+//stay valid as lines are inserted or deleted, since the lines the ranges start
+//and end on keep their relative order.
+struct rangeNode{
+    struct rangeDependency entry;
+
+    unsigned priority;
+
+    const struct rangeNode* lastEnding;
+
+    const struct rangeNode* firstColumn;
+
+    const struct rangeNode* lastColumn;
+
+    struct rangeNode* left;
+
+    struct rangeNode* right;
+};
+
+
+static struct rangeNode* rangeIndex = NULL;
+
+
+//kinds of cell values as lookups see them: numbers and texts are matched,
+//other cells are skipped
+enum lookupKind{
+    LOOKUP_NONE, LOOKUP_NUMBER, LOOKUP_TEXT, LOOKUP_FORMULA,
+};
+
+
+//structure that represent the value of a cell as lookups see it; texts are
+//matched regardless of case
+struct lookupKey{
+    enum lookupKind kind;
+
+    double number;
+
+    char* text;
+};
+
+
+//structure that holds the rows of a lookup index with the same value, as
+//offsets from the first row of the index in ascending order
+struct lookupSlot{
+    struct lookupKey key;
+
+    uint32_t* offsets;
+
+    size_t count;
+
+    size_t capacity;
+};
+
+
+//structure that indexes the values of a block of one column for lookups
+//
+//Indexes are built the first time a lookup probes the block, then shared by
+//every lookup probing it and kept up to date as its cells change. A hash
+//table of the distinct values serves exact matches; the rows sorted by value,
+//built on the first approximate match, serve the others. Formula values are
+//not indexed: a block holding formulas is scanned instead.
+struct lookupIndex{
+    //physical column, and physical first and last rows in logical order
+    int col;
+
+    int firstRow;
+
+    int lastRow;
+
+    //logical first row and number of rows when the index was built; lines
+    //being inserted or deleted drops every index
+    int logicalFirst;
+
+    int rowCount;
+
+    //revision at which a cell of the block last changed
+    unsigned long changedAt;
+
+    size_t formulaCount;
+
+    //value of each row, as indexed; texts are copies owned by the index
+    struct lookupKey* keys;
+
+    //open addressing table of the distinct values; slots left without rows
+    //keep their value until the table grows
+    struct lookupSlot* slots;
+
+    size_t slotCapacity;
+
+    size_t slotsUsed;
+
+    //offsets of the numbers and texts sorted by value then offset, if built
+    uint32_t* sorted;
+
+    size_t sortedCount;
+
+    bool hasSorted;
+
+    //next index, from the most recently used
+    struct lookupIndex* next;
+};
+
+
+//lookup indexes, most recently used first; blocks of fewer rows than
+//LOOKUP_INDEX_ROWS are scanned instead, and past LOOKUP_INDEX_LIMIT indexes
+//the least recently used is dropped
+#define LOOKUP_INDEX_ROWS 64
+#define LOOKUP_INDEX_LIMIT 64
+static struct lookupIndex* lookupIndexes = NULL;
+
+
+//structure that totals the rows of a condition index: how many there are,
+//and the sum and count of the numbers among their values
+//
+//The sum is compensated: 'error' carries the rounding errors of the additions
+//to 'sum', and the total is their sum. Rows removed thus take their value
+//out again even after a large one left no bits of the smaller ones in 'sum'.
+struct conditionTotal{
+    size_t count;
+
+    double sum;
+
+    double error;
+
+    size_t numbers;
+};
+
+
+//structure that totals the rows of a condition index with the same value
+struct conditionGroup{
+    struct lookupKey key;
+
+    struct conditionTotal total;
+};
+
+
+//structure that groups the rows of a block of one column by value, for
+//conditional aggregates such as SUMIF
+//
+//Each group totals the values, on the same rows, of a block of another (or
+//the same) column. Like lookup indexes, condition indexes are built the first
+//time a formula needs them, shared, and kept up to date as cells change; a
+//block holding formulas is scanned instead.
+struct conditionIndex{
+    //physical columns, and physical first and last rows in logical order, of
+    //the block grouped and of the block totalled
+    int col;
+
+    int firstRow;
+
+    int lastRow;
+
+    int valueCol;
+
+    int valueFirstRow;
+
+    int valueLastRow;
+
+    //logical first rows of both blocks and their number of rows when the
+    //index was built
+    int logicalFirst;
+
+    int valueLogicalFirst;
+
+    int rowCount;
+
+    //revision at which a cell of either block last changed
+    unsigned long changedAt;
+
+    size_t formulaCount;
+
+    //value of each row in both blocks, as indexed; texts are copies owned by
+    //the index in 'keys', and not kept in 'values'
+    struct lookupKey* keys;
+
+    struct lookupKey* values;
+
+    //totals of every row, and of the rows grouped by a blank
+    struct conditionTotal all;
+
+    struct conditionTotal blanks;
+
+    //open addressing table of the groups of the other values; groups left
+    //without rows keep their value until the table grows
+    struct conditionGroup* groups;
+
+    size_t groupCapacity;
+
+    size_t groupsUsed;
+
+    //next index, from the most recently used
+    struct conditionIndex* next;
+};
+
+
+//condition indexes, most recently used first, kept within the same limits as
+//lookup indexes
+static struct conditionIndex* conditionIndexes = NULL;
+
+
+//structure that aggregates the rows of a pivot table with the same key
+struct pivotGroup{
+    struct lookupKey key;
+
+    //number of rows, and the sum, number and extremes of the numbers among
+    //their values; the sum is compensated as in conditionTotal
+    size_t count;
+
+    double sum;
+
+    double error;
+
+    size_t numbers;
+
+    double min;
+
+    double max;
+
+    //first of the rows, as an offset into the source; the others follow
+    //through 'nextRow'
+    uint32_t firstRow;
+
+    //the sum and extremes need recounting from the rows, a number having been
+    //removed
+    bool stale;
+
+    //the results row of the group needs rewriting
+    bool changed;
+};
+
+
+//structure that holds the groups of a pivot table whose keys hash to the same
+//partition, in an open addressing table; groups left without rows keep their
+//key until the table grows
+struct pivotPartition{
+    struct pivotGroup* groups;
+
+    size_t capacity;
+
+    size_t used;
+};
+
+
+//partitions of the groups of a pivot table, aggregated on separate threads
+#define PIVOT_PARTITIONS 16
+
+//no row of a pivot group
+#define PIVOT_NO_ROW UINT32_MAX
+
+
+//structure that represent a pivot table written by group_range: the rows of a
+//source block grouped by their keys, with totals of their values, written to
+//the sheet and kept up to date as the source changes
+struct pivotTable{
+    //physical first and last rows of the source in logical order, and
+    //physical columns of its keys and values
+    int firstRow;
+
+    int lastRow;
+
+    int keyCol;
+
+    int valueCol;
+
+    //physical top left cell of the results
+    int outRow;
+
+    int outCol;
+
+    //logical first row and number of rows of the source when last read
+    int logicalFirst;
+
+    int rowCount;
+
+    //key and value of each row, as last read; keys are copies owned by the
+    //pivot table, values keep no text
+    struct lookupKey* keys;
+
+    struct lookupKey* values;
+
+    //rows of each group, linked both ways
+    uint32_t* nextRow;
+
+    uint32_t* previousRow;
+
+    struct pivotPartition partitions[PIVOT_PARTITIONS];
+
+    //rows holding formulas, read again on every refresh, and rows edited
+    //since the last refresh
+    uint32_t* formulaRows;
+
+    size_t formulaCount;
+
+    size_t formulaCapacity;
+
+    uint32_t* editedRows;
+
+    size_t editedCount;
+
+    size_t editedCapacity;
+
+    //the source must be read again, as lines were inserted or deleted
+    bool stale;
+
+    //groups were added or emptied, so the results must be sorted again
+    bool reorder;
+
+    //groups with rows in the order of the results, and the number of result
+    //rows last written
+    struct pivotGroup** order;
+
+    size_t orderCount;
+
+    size_t writtenRows;
+
+    struct pivotTable* next;
+};
+
+
+//pivot tables, in the order they were made
+static struct pivotTable* pivotTables = NULL;
+
+
+//kinds of the loads of a formula evaluated by a simulation
+enum simulationLoadKind{
+    //the same in every trial, computed once
+    SIM_CONSTANT,
+
+    //the value of a random cell
+    SIM_CELL,
+
+    //a number drawn by RAND
+    SIM_RAND,
+
+    //a call of SUM over random cells, added up over every trial at once
+    SIM_SUM,
+
+    //another function call reading random cells, made in every trial
+    SIM_CALL,
+};
+
+
+//structure that represent a term of a SUM over random cells: the value of a
+//random cell, or a value the same in every trial
+struct simulationTerm{
+    //slot of the random cell, or SIZE_MAX
+    size_t slot;
+
+    double value;
+
+    enum evalStatus status;
+};
+
+
+//structure that represent how a simulation gets a load of a formula
+struct simulationLoad{
+    enum simulationLoadKind kind;
+
+    //for SIM_CONSTANT, and for SIM_SUM the sum of the terms before the first
+    //random one
+    double value;
+
+    enum evalStatus status;
+
+    //for SIM_CELL, the slot of the random cell
+    size_t slot;
+
+    //for SIM_SUM, the terms from the first random one on, in the order SUM
+    //adds them; none follow a failing term, which every trial reaching it
+    //fails at
+    struct simulationTerm* terms;
+
+    size_t termCount;
+
+    size_t termCapacity;
+};
+
+
+//structure that represent a formula cell in the dependency cone of the cells
+//a simulation computes
+struct simulationNode{
+    //physical position
+    int row;
+
+    int col;
+
+    //whether the value differs between trials, as the cell is an input or
+    //its formula draws from RAND or reads random cells; a cell reached again
+    //through a cycle of references while its precedents are searched keeps
+    //its value instead
+    bool random;
+
+    bool visiting;
+
+    bool cyclic;
+
+    //for random cells, the position among them in order of evaluation, the
+    //position among the inputs (SIZE_MAX for a formula) and how the formula
+    //gets each of its loads
+    size_t slot;
+
+    size_t input;
+
+    const struct formulaTemplate* formula;
+
+    struct simulationLoad* loads;
+};
+
+
+//structure that represent the compiled dependency cone of a simulation
+//
+//A simulation evaluates its cells in many trials at once without changing the
+//sheet: each trial is a fork of it sharing every cell but the random ones,
+//whose values it keeps in vectors of its own. Random cells are those reading
+//RAND and the inputs, cells given a value in each trial, and their
+//dependents.
+struct simulation{
+    //whether RAND draws new numbers in each trial, from 'seed', rather than
+    //keep the numbers the sheet shows
+    bool drawing;
+
+    uint64_t seed;
+
+    //physical positions of the inputs, and their values trial by trial
+    size_t inputCount;
+
+    const int* inputRows;
+
+    const int* inputCols;
+
+    const double* inputValues;
+
+    //formula cells of the cone, and an open addressing table of their indexes
+    //by position
+    struct simulationNode* nodes;
+
+    size_t nodeCount;
+
+    size_t nodeCapacity;
+
+    size_t* table;
+
+    size_t tableCapacity;
+
+    //indexes of the random cells, every cell after its precedents
+    size_t* order;
+
+    size_t randomCount;
+
+    //number of trials evaluated together, and the most loads of a formula
+    size_t blockTrials;
+
+    size_t maxLoads;
+
+    //cells computed: the slot of each random one, or SIZE_MAX and its value
+    //(NaN for an error) and status
+    size_t outputCount;
+
+    size_t* outputSlots;
+
+    double* outputValues;
+
+    enum evalStatus* outputStatuses;
+
+    //results of the trials and, if not NULL, their statuses, trial by trial
+    size_t trials;
+
+    double* results;
+
+    enum evalStatus* resultStatuses;
+};
+
+
+//structure that represent the share of a simulation run by one thread
+struct simulationThread{
+    const struct simulation* simulation;
+
+    //values and statuses of the random cells over a block of trials, one
+    //vector per slot, and of the loads of the formula being evaluated
+    double* values;
+
+    unsigned char* statuses;
+
+    double* loadValues;
+
+    unsigned char* loadStatuses;
+
+    //trial being evaluated within the block
+    size_t trial;
+
+    //blocks of this thread: the first and every 'step'th after it
+    size_t firstBlock;
+
+    size_t step;
+};
+
+
+//share of a simulation run by the current thread, if any: formula cells of
+//the cone read through evaluateCell then take their value in the trial, and
+//shared indexes are only read
+static _Thread_local struct simulationThread* simulation = NULL;
+
+
+//structure that represent a formula cell on the component stack of iterative
+//calculation, with its memoized result from before it was solved
+struct componentEntry{
+    struct cellPosition position;
+
+    double value;
+
+    enum evalStatus status;
+
+    unsigned long verifiedAt;
+};
+
+
+//structure that represent a cell noted for a subscription: one whose value
+//changed, or a formula dirtied, to be evaluated when the changes are delivered
+struct subscriptionEntry{
+    struct cellPosition position;
+
+    bool dirtied;
+};
+
+
+//structure that represent a consumer of the changes to a block of cells, see
+//subscribe_range
+struct subscription{
+    //NULL once unsubscribed
+    CHANGE_HANDLER handler;
+
+    void* context;
+
+    DELIVERY delivery;
+
+    //logical block watched (inclusive)
+    int firstRow;
+
+    int firstCol;
+
+    int lastRow;
+
+    int lastCol;
+
+    //ring of the cells noted since the last delivery, 'mask' + 1 entries
+    //long; 'head' and 'tail' only grow
+    struct subscriptionEntry* entries;
+
+    size_t mask;
+
+    size_t head;
+
+    size_t tail;
+
+    //set when cells were missed: the next delivery sends the whole block
+    bool reset;
+};
+
+
+struct excelSpreadSheet* spreadsheet = NULL;
+
+//current calculation mode, see set_calc_mode
+static CALC_MODE calcMode = CALC_EAGER;
+
+//iterative calculation settings, see set_iterative_calc
+static bool iterationEnabled = false;
+static size_t iterationLimit = 100;
+static double iterationTolerance = 0.001;
+
+//formula cells being solved with iterative calculation, in the order they
+//were reached; those still on it when the evaluation of a cell ends form a
+//cycle with it or a cell reached before it
+static struct componentEntry* componentStack = NULL;
+static size_t componentCount = 0;
+static size_t componentCapacity = 0;
+
+//lowest position plus 1 on the component stack read by the formula being
+//evaluated and the cells it read, and whether it read any cell on it
+static size_t componentLow = 0;
+static bool componentReached = false;
+
+//formulas evaluated within each other before evaluateCell defers the next
+//dirty one, so that long chains of dependencies cannot exhaust the C stack
+#define EVALUATION_DEPTH 256
+
+//formula cells whose evaluation was deferred, each a precedent of the one
+//below it, the formulas being evaluated within each other, and whether their
+//evaluation is unwinding to compute the last cell deferred first
+static struct cellPosition* deferredCells = NULL;
+static size_t deferredCount = 0;
+static size_t deferredCapacity = 0;
+static unsigned evaluationDepth = 0;
+static bool evaluationDeferred = false;
+
+//revision of the spreadsheet, incremented by every edit
+static unsigned long revision = 0;
+
+//revision at which chunks were last freed; cells of freed chunks count as
+//changed then, since their own revisions are gone
+static unsigned long chunksFreedAt = 0;
+
+//chunks with their cells in memory, swept by the clock hand when the budget
+//of 'residentLimit' chunks (0 for none) is exceeded, see trimChunks
+static struct cellChunk** residentChunks = NULL;
+static size_t residentCount = 0;
+static size_t residentCapacity = 0;
+static size_t residentLimit = 0;
+static size_t clockHand = 0;
+
+//file the cells of chunks are paged out to, its number of slots and the slots
+//of freed chunks
+static FILE* spillFile = NULL;
+static int64_t spillSlots = 0;
+static int64_t* freeSlots = NULL;
+static size_t freeSlotCount = 0;
+static size_t freeSlotCapacity = 0;
+
+//chunk whose cells were last read back, to tell scans
+static struct cellChunk* lastPagedIn = NULL;
+
+//serializes reading cells back, which threads of a simulation may do
+static pthread_mutex_t pagingLock = PTHREAD_MUTEX_INITIALIZER;
+
+//subscriptions to changes, by identifier, and whether changes are being
+//delivered, which a handler must not cause again
+static struct subscription* subscriptions = NULL;
+static int subscriptionCount = 0;
+static int subscriptionCapacity = 0;
+static bool delivering = false;
+
+//shared memory mirror of the values of a block, see share_values: its
+//mapping, size and name, its subscription, whether it was never written, and
+//which tiles of the row of tiles being written are held
+static SHARED_VALUES_HEADER* sharedValues = NULL;
+static size_t sharedSize = 0;
+static char* sharedName = NULL;
+static int sharedSubscription = -1;
+static bool sharedFresh = false;
+static bool* sharedHeldTiles = NULL;
+
+//rows and columns holding non-blank cells, by physical line
+static struct lineOccupancy rowOccupancy;
+static struct lineOccupancy colOccupancy;
+
+//logical to physical rows and columns
+static struct lineMap rowMap;
+static struct lineMap colMap;
+
+//state of the generator of treap priorities
+static unsigned priorityState = 2463534242u;
+
+//Function that duplicates a string up to a specific length
+char *custom_strnduplicate(const char *string, size_t n){
+
+    size_t length = strlen(string);
+
+    if(length > n){
+        length = n;
+    }
+
+    char *duplicate = malloc(length+1);
+
+    if(duplicate != NULL){
+
+        strncpy(duplicate, string, length);
+
+        duplicate[length] = '\0';
+
+    }
+
+
+    return duplicate;
+
+
+
+}
+
+
+//Function that free memory allocated for a function call
+static void freeFunctionCall(struct functionCall* call){
+
+    if(call != NULL){
+        free(call->arguments);
+        free(call);
+    }
+
+}
+
+
+//Function that free memory allocated for the equation elements
+void freeEqnElmnts(struct equationElemts* elmnt){
+
+    for (size_t i = 0; elmnt[i].type != INVALID; i++){
+
+        if(elmnt[i].type == FUNCTION_CALL){
+
+            freeFunctionCall(elmnt[i].celcontent2.call);
+
+        }
+
+    }
+
+    free(elmnt);
+}
+
+static void releaseFormula(struct formulaTemplate* formula);
+
+//Function for clearing the cell memory of a cell
+void clearCellMemory(struct cell* cellVariable){
+
+    if(cellVariable->type == TXT || cellVariable->type == EQN){
+
+        free(cellVariable->celcontent.text);
+
+    }
+
+    if(cellVariable->formula != NULL){
+
+        releaseFormula(cellVariable->formula);
+
+        cellVariable->formula = NULL;
+
+    }
+
+    cellVariable->celcontent.text = NULL;
+
+    cellVariable->type = BLANK;
+
+    cellVariable->verifiedAt = 0;
+
+}
+
+//Function that allocates the occupancy of 'lineCount' lines, all empty
+static void initOccupancy(struct lineOccupancy* occupancy, int lineCount){
+
+    size_t words = ((size_t) lineCount + 63) / 64;
+
+    occupancy->counts = (int*)calloc(lineCount, sizeof(int));
+    occupancy->lines = (uint64_t*)calloc(words, sizeof(uint64_t));
+    occupancy->summary = (uint64_t*)calloc((words + 63) / 64, sizeof(uint64_t));
+    occupancy->lineCount = lineCount;
+    occupancy->first = -1;
+    occupancy->last = -1;
+
+    if(occupancy->counts == NULL || occupancy->lines == NULL || occupancy->summary == NULL){
+        fprintf(stderr, "Memory allocation error.\n");
+        exit(EXIT_FAILURE);
+    }
+
+}
+
+
+//Function that returns the first line from 'line' on holding non-blank cells, or -1
+static int nextOccupiedLine(const struct lineOccupancy* occupancy, int line){
+
+    size_t words = ((size_t) occupancy->lineCount + 63) / 64;
+    size_t word = (size_t) line / 64;
+    uint64_t bits = occupancy->lines[word] & (~(uint64_t)0 << (line % 64));
+
+    //the summary finds the next word holding lines 64 words at a time
+    while(bits == 0){
+        size_t summaryWord = ++word / 64;
+        uint64_t summaryBits;
+
+        if(word >= words){
+            return -1;
+        }
+        summaryBits = word % 64 == 0 ? occupancy->summary[summaryWord] : occupancy->summary[summaryWord] & (~(uint64_t)0 << (word % 64));
+        while(summaryBits == 0){
+            if(++summaryWord >= (words + 63) / 64){
+                return -1;
+            }
+            summaryBits = occupancy->summary[summaryWord];
+        }
+        word = summaryWord * 64 + __builtin_ctzll(summaryBits);
+        bits = occupancy->lines[word];
+    }
+
+    return (int) (word * 64 + __builtin_ctzll(bits));
+
+}
+
+
+//Function that returns the last line up to 'line' holding non-blank cells, or -1
+static int previousOccupiedLine(const struct lineOccupancy* occupancy, int line){
+
+    size_t word = (size_t) line / 64;
+    uint64_t bits = occupancy->lines[word] & (~(uint64_t)0 >> (63 - line % 64));
+
+    while(bits == 0){
+        size_t summaryWord;
+        uint64_t summaryBits;
+
+        if(word == 0){
+            return -1;
+        }
+        --word;
+        summaryWord = word / 64;
+        summaryBits = occupancy->summary[summaryWord] & (~(uint64_t)0 >> (63 - word % 64));
+        while(summaryBits == 0){
+            if(summaryWord == 0){
+                return -1;
+            }
+            summaryBits = occupancy->summary[--summaryWord];
+        }
+        word = summaryWord * 64 + 63 - __builtin_clzll(summaryBits);
+        bits = occupancy->lines[word];
+    }
+
+    return (int) (word * 64 + 63 - __builtin_clzll(bits));
+
+}
+
+
+//Function that counts a non-blank cell more ('change' 1) or less ('change' -1) in a line
+static void changeOccupancy(struct lineOccupancy* occupancy, int line, int change){
+
+    size_t word = (size_t) line / 64;
+
+    occupancy->counts[line] += change;
+
+    if(change > 0 && occupancy->counts[line] == 1){
+        occupancy->lines[word] |= (uint64_t)1 << (line % 64);
+        occupancy->summary[word / 64] |= (uint64_t)1 << (word % 64);
+        if(occupancy->first == -1 || line < occupancy->first){
+            occupancy->first = line;
+        }
+        if(line > occupancy->last){
+            occupancy->last = line;
+        }
+    }
+    else if(change < 0 && occupancy->counts[line] == 0){
+        occupancy->lines[word] &= ~((uint64_t)1 << (line % 64));
+        if(occupancy->lines[word] == 0){
+            occupancy->summary[word / 64] &= ~((uint64_t)1 << (word % 64));
+        }
+        //only emptying the first or last line moves the used range
+        if(line == occupancy->first){
+            occupancy->first = nextOccupiedLine(occupancy, line);
+        }
+        if(line == occupancy->last){
+            occupancy->last = previousOccupiedLine(occupancy, line);
+        }
+    }
+
+}
+
+
+//Function that returns a random priority for a treap node (xorshift)
+static unsigned nextPriority(){
+
+    priorityState ^= priorityState << 13;
+    priorityState ^= priorityState >> 17;
+    priorityState ^= priorityState << 5;
+
+    return priorityState;
+
+}
+
+
+//Function that returns the number of lines in a subtree of a line map
+static int subtreeLines(const struct lineRun* run){
+
+    return run == NULL ? 0 : run->lines;
+
+}
+
+
+//Function that recounts the lines of a run's subtree and adopts its children
+static void updateRun(struct lineRun* run){
+
+    run->lines = subtreeLines(run->left) + run->length + subtreeLines(run->right);
+
+    if(run->left != NULL){
+        run->left->parent = run;
+    }
+    if(run->right != NULL){
+        run->right->parent = run;
+    }
+
+}
+
+
+//Function that adds a run to the physical tree of a line map
+static struct lineRun* insertPhysicalRun(struct lineRun* root, struct lineRun* run){
+
+    struct lineRun* child;
+
+    if(root == NULL){
+        return run;
+    }
+
+    //rotate the run up while its priority is higher than its parent's
+    if(run->physical < root->physical){
+        root->lower = insertPhysicalRun(root->lower, run);
+        child = root->lower;
+        if(child->physicalPriority > root->physicalPriority){
+            root->lower = child->higher;
+            child->higher = root;
+            return child;
+        }
+    }
+    else{
+        root->higher = insertPhysicalRun(root->higher, run);
+        child = root->higher;
+        if(child->physicalPriority > root->physicalPriority){
+            root->higher = child->lower;
+            child->lower = root;
+            return child;
+        }
+    }
+
+    return root;
+
+}
+
+
+//Function that allocates a run of 'length' lines from 'physical' on, adding it to the physical tree
+static struct lineRun* newRun(struct lineMap* map, int physical, int length){
+
+    struct lineRun* run = (struct lineRun*)calloc(1, sizeof(struct lineRun));
+
+    if(run == NULL){
+        fprintf(stderr, "Memory allocation error.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    run->physical = physical;
+    run->length = length;
+    run->lines = length;
+    run->priority = nextPriority();
+    run->physicalPriority = nextPriority();
+    map->physicalRoot = insertPhysicalRun(map->physicalRoot, run);
+
+    return run;
+
+}
+
+
+//Function that initializes a map of 'lineCount' lines, each at its own physical position
+static void initLineMap(struct lineMap* map, int lineCount){
+
+    map->physicalRoot = NULL;
+    map->root = newRun(map, 0, lineCount);
+    map->lineCount = lineCount;
+    map->moved = false;
+
+}
+
+
+static struct lineRun* mergeRuns(struct lineRun* first, struct lineRun* second);
+
+//Function that splits a subtree of a line map into its first 'count' lines and the rest
+//
+//A run holding lines on both sides is cut in two, the second part joining the
+//rest as a new run.
+static void splitRuns(struct lineMap* map, struct lineRun* run, int count, struct lineRun** first, struct lineRun** rest){
+
+    if(run == NULL){
+        *first = NULL;
+        *rest = NULL;
+        return;
+    }
+
+    int before = subtreeLines(run->left);
+
+    if(count <= before){
+        splitRuns(map, run->left, count, first, &run->left);
+        updateRun(run);
+        *rest = run;
+    }
+    else if(count >= before + run->length){
+        splitRuns(map, run->right, count - before - run->length, &run->right, rest);
+        updateRun(run);
+        *first = run;
+    }
+    else{
+        struct lineRun* tail = newRun(map, run->physical + count - before, run->length - (count - before));
+        *rest = mergeRuns(tail, run->right);
+        run->right = NULL;
+        run->length = count - before;
+        updateRun(run);
+        *first = run;
+    }
+
+}
+
+
+//Function that joins two subtrees of a line map, the lines of 'first' coming first
+static struct lineRun* mergeRuns(struct lineRun* first, struct lineRun* second){
+
+    if(first == NULL){
+        return second;
+    }
+    if(second == NULL){
+        return first;
+    }
+
+    if(first->priority >= second->priority){
+        first->right = mergeRuns(first->right, second);
+        updateRun(first);
+        return first;
+    }
+
+    second->left = mergeRuns(first, second->left);
+    updateRun(second);
+    return second;
+
+}
+
+
+//Function that moves the 'count' lines from 'first' on so that they start at
+//'to', counted once they are taken out
+static void moveLines(struct lineMap* map, int first, int count, int to){
+
+    struct lineRun* before;
+    struct lineRun* moving;
+    struct lineRun* after;
+
+    if(count == 0 || first == to){
+        return;
+    }
+
+    splitRuns(map, map->root, first, &before, &after);
+    splitRuns(map, after, count, &moving, &after);
+    splitRuns(map, mergeRuns(before, after), to, &before, &after);
+
+    map->root = mergeRuns(mergeRuns(before, moving), after);
+    map->root->parent = NULL;
+    map->moved = true;
+
+}
+
+
+//Function that finds the run holding logical 'line', and the offset of the line in it
+static const struct lineRun* findRun(const struct lineMap* map, int line, int* offset){
+
+    const struct lineRun* run = map->root;
+
+    while(true){
+        int before = subtreeLines(run->left);
+        if(line < before){
+            run = run->left;
+        }
+        else if(line >= before + run->length){
+            line -= before + run->length;
+            run = run->right;
+        }
+        else{
+            *offset = line - before;
+            return run;
+        }
+    }
+
+}
+
+
+//Function that returns the physical line of a logical line
+static int physicalLine(const struct lineMap* map, int line){
+
+    int offset;
+
+    if(!map->moved){
+        return line;
+    }
+
+    const struct lineRun* run = findRun(map, line, &offset);
+    return run->physical + offset;
+
+}
+
+
+//Function that returns the logical line of a physical line
+static int logicalLine(const struct lineMap* map, int physical){
+
+    const struct lineRun* run = NULL;
+
+    if(!map->moved){
+        return physical;
+    }
+
+    //the run starting last at or before 'physical' holds it
+    for(const struct lineRun* node = map->physicalRoot; node != NULL;){
+        if(node->physical <= physical){
+            run = node;
+            node = node->higher;
+        }
+        else{
+            node = node->lower;
+        }
+    }
+
+    //add up the lines of the logical tree before the run
+    int line = subtreeLines(run->left) + physical - run->physical;
+    for(; run->parent != NULL; run = run->parent){
+        if(run == run->parent->right){
+            line += subtreeLines(run->parent->left) + run->parent->length;
+        }
+    }
+
+    return line;
+
+}
+
+
+//Function that returns how many logical lines from 'line' on, in the direction
+//of 'step' (1 or -1), follow each other physically as well, storing the
+//physical line of 'line' in 'physical'
+static int lineSegment(const struct lineMap* map, int line, int step, int* physical){
+
+    int offset;
+
+    if(!map->moved){
+        *physical = line;
+        return step > 0 ? map->lineCount - line : line + 1;
+    }
+
+    const struct lineRun* run = findRun(map, line, &offset);
+    *physical = run->physical + offset;
+    return step > 0 ? run->length - offset : offset + 1;
+
+}
+
+
+//Function that returns the first logical line from 'line' on whose physical
+//line holds non-blank cells, or -1
+static int nextOccupiedLogical(const struct lineMap* map, const struct lineOccupancy* occupancy, int line){
+
+    if(!map->moved || occupancy->first == -1){
+        return occupancy->first == -1 ? -1 : nextOccupiedLine(occupancy, line);
+    }
+
+    while(line < map->lineCount){
+        int physical;
+        int length = lineSegment(map, line, 1, &physical);
+        int found = nextOccupiedLine(occupancy, physical);
+        if(found != -1 && found < physical + length){
+            return line + found - physical;
+        }
+        line += length;
+    }
+
+    return -1;
+
+}
+
+
+//Function that returns the last logical line up to 'line' whose physical line
+//holds non-blank cells, or -1
+static int previousOccupiedLogical(const struct lineMap* map, const struct lineOccupancy* occupancy, int line){
+
+    if(!map->moved || occupancy->first == -1){
+        return occupancy->first == -1 ? -1 : previousOccupiedLine(occupancy, line);
+    }
+
+    while(line >= 0){
+        int physical;
+        int length = lineSegment(map, line, -1, &physical);
+        int found = previousOccupiedLine(occupancy, physical);
+        if(found != -1 && found > physical - length){
+            return line - (physical - found);
+        }
+        line -= length;
+    }
+
+    return -1;
+
+}
+
+
+//initialization of the model
+void model_init() {
+
+    //Allocate memory for the excel spreadsheet; chunks of cells are allocated on first use
+    int defineCols = SHEET_COLS;
+    int defineRows = SHEET_ROWS;
+
+    spreadsheet = (struct excelSpreadSheet*)malloc(sizeof(struct excelSpreadSheet));
+
+    spreadsheet->row = defineRows;
+
+    spreadsheet->col = defineCols;
+
+    spreadsheet->chunkRows = (defineRows + CHUNK_ROWS - 1) / CHUNK_ROWS;
+
+    spreadsheet->chunkCols = (defineCols + CHUNK_COLS - 1) / CHUNK_COLS;
+
+    spreadsheet->chunks = (struct cellChunk***)calloc(spreadsheet->chunkRows, sizeof(struct cellChunk**));
+
+    initOccupancy(&rowOccupancy, defineRows);
+
+    initOccupancy(&colOccupancy, defineCols);
+
+    initLineMap(&rowMap, defineRows);
+
+    initLineMap(&colMap, defineCols);
+
+
+}
+
+
+//Function that adds a chunk to the resident chunks
+static void addResidentChunk(struct cellChunk* chunk){
+
+    if(residentCount == residentCapacity){
+        size_t capacity = residentCapacity == 0 ? 64 : residentCapacity * 2;
+        struct cellChunk** grown = realloc(residentChunks, capacity * sizeof(struct cellChunk*));
+        if(grown == NULL){
+            fprintf(stderr, "Memory allocation error.\n");
+            exit(EXIT_FAILURE);
+        }
+        residentChunks = grown;
+        residentCapacity = capacity;
+    }
+
+    chunk->residentIndex = residentCount;
+    residentChunks[residentCount++] = chunk;
+}
+
+
+//Function that removes a chunk from the resident chunks, moving the last one in its place
+static void removeResidentChunk(struct cellChunk* chunk){
+
+    struct cellChunk* last = residentChunks[--residentCount];
+
+    residentChunks[chunk->residentIndex] = last;
+    last->residentIndex = chunk->residentIndex;
+}
+
+
+//Function that reads back the cells of a chunk paged out to the spill file
+//
+//When the chunk follows the one last read back in its column, as in a scan
+//down it, the chunks after it whose cells follow in the file are read with
+//the same call.
+static void pageChunkIn(struct cellChunk* chunk){
+
+    struct cellChunk* batch[SPILL_READ_AHEAD + 1];
+    struct iovec parts[SPILL_READ_AHEAD + 1];
+    size_t count = 1;
+
+    pthread_mutex_lock(&pagingLock);
+
+    if(atomic_load_explicit(&chunk->cells, memory_order_relaxed) != NULL){
+        pthread_mutex_unlock(&pagingLock);
+        return;
+    }
+
+    batch[0] = chunk;
+    if(lastPagedIn != NULL && lastPagedIn->chunkCol == chunk->chunkCol && lastPagedIn->chunkRow == chunk->chunkRow - 1){
+        while(count <= SPILL_READ_AHEAD && chunk->chunkRow + (int) count < spreadsheet->chunkRows){
+            struct cellChunk** chunkRow = spreadsheet->chunks[chunk->chunkRow + count];
+            struct cellChunk* next = chunkRow == NULL ? NULL : chunkRow[chunk->chunkCol];
+            if(next == NULL || atomic_load_explicit(&next->cells, memory_order_relaxed) != NULL || next->spillSlot != chunk->spillSlot + (int64_t) count){
+                break;
+            }
+            batch[count++] = next;
+        }
+    }
+
+    for(size_t i = 0; i < count; i++){
+        parts[i].iov_base = malloc(CHUNK_CELLS_SIZE);
+        parts[i].iov_len = CHUNK_CELLS_SIZE;
+        if(parts[i].iov_base == NULL){
+            fprintf(stderr, "Memory allocation error.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    if(preadv(fileno(spillFile), parts, (int) count, (off_t) (chunk->spillSlot * (int64_t) CHUNK_CELLS_SIZE)) != (ssize_t) (count * CHUNK_CELLS_SIZE)){
+        fprintf(stderr, "Spill file read error.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    //cells read ahead are the first paged out again if the scan stops
+    for(size_t i = 0; i < count; i++){
+        atomic_store(&batch[i]->modified, false);
+        atomic_store(&batch[i]->referenced, i == 0);
+        addResidentChunk(batch[i]);
+        atomic_store_explicit(&batch[i]->cells, parts[i].iov_base, memory_order_release);
+    }
+    lastPagedIn = batch[count - 1];
+
+    pthread_mutex_unlock(&pagingLock);
+}
+
+
+//Function that returns a chunk once its cells are in memory
+static struct cellChunk* residentChunk(struct cellChunk* chunk){
+
+    if(atomic_load_explicit(&chunk->cells, memory_order_acquire) == NULL){
+        pageChunkIn(chunk);
+    }
+    if(!atomic_load_explicit(&chunk->referenced, memory_order_relaxed)){
+        atomic_store_explicit(&chunk->referenced, true, memory_order_relaxed);
+    }
+
+    return chunk;
+}
+
+
+//Function that returns a chunk once its cells are in memory, noting that
+//they may be changed through the pointers handed out to them
+static struct cellChunk* modifiedChunk(struct cellChunk* chunk){
+
+    residentChunk(chunk);
+    if(!atomic_load_explicit(&chunk->modified, memory_order_relaxed)){
+        atomic_store_explicit(&chunk->modified, true, memory_order_relaxed);
+    }
+
+    return chunk;
+}
+
+
+//Function that keeps the cells of a resident chunk in memory until unpinChunk,
+//while they are held across formulas which may page other chunks in
+//
+//Chunks are only paged out outside simulation trials, so trials, which run on
+//several threads, do not pin them.
+static void pinChunk(struct cellChunk* chunk){
+
+    if(simulation == NULL){
+        ++chunk->pins;
+    }
+}
+
+
+//Function that releases a chunk pinned by pinChunk
+static void unpinChunk(struct cellChunk* chunk){
+
+    if(simulation == NULL){
+        --chunk->pins;
+    }
+}
+
+
+//Function that pages the cells of a resident chunk out to the spill file,
+//writing them only if they changed since they were last there. Returns false
+//if they could not be written.
+static bool pageChunkOut(struct cellChunk* chunk){
+
+    struct cell (*cells)[CHUNK_COLS] = chunk->cells;
+
+    if(chunk->spillSlot == -1 || atomic_load(&chunk->modified)){
+        if(chunk->spillSlot == -1){
+            chunk->spillSlot = freeSlotCount > 0 ? freeSlots[--freeSlotCount] : spillSlots++;
+        }
+        if(pwrite(fileno(spillFile), cells, CHUNK_CELLS_SIZE, (off_t) (chunk->spillSlot * (int64_t) CHUNK_CELLS_SIZE)) != (ssize_t) CHUNK_CELLS_SIZE){
+            return false;
+        }
+        atomic_store(&chunk->modified, false);
+    }
+
+    removeResidentChunk(chunk);
+    chunk->cells = NULL;
+    free(cells);
+    return true;
+}
+
+
+//Function that pages out the cells of chunks not used lately until the budget is met
+//
+//The chunks are swept in a circle (CLOCK): a chunk used since the hand last
+//passed it is spared once, others are paged out. Pinned chunks are spared
+//until a whole sweep finds nothing else to page out, leaving the budget
+//exceeded by them. This runs at the start of the functions of the interface
+//and before each cell or lookup key a formula loads, so that a formula
+//reading more chunks than the budget holds pages out those it read first.
+static void trimChunks(){
+
+    size_t spared = 0;
+
+    //trials read cells on several threads
+    if(simulation != NULL){
+        return;
+    }
+
+    while(residentLimit != 0 && residentCount > residentLimit && spared <= 2 * residentCount){
+        if(clockHand >= residentCount){
+            clockHand = 0;
+        }
+        struct cellChunk* chunk = residentChunks[clockHand];
+        if(chunk->pins > 0 || atomic_exchange(&chunk->referenced, false)){
+            ++clockHand;
+            ++spared;
+        }
+        else if(!pageChunkOut(chunk)){
+            return;
+        }
+        else{
+            spared = 0;
+        }
+    }
+}
+
+
+//Function that frees a chunk holding no cells, and its slot in the spill file
+static void freeChunk(struct cellChunk* chunk){
+
+    if(chunk->cells != NULL){
+        removeResidentChunk(chunk);
+    }
+
+    if(chunk->spillSlot != -1){
+        if(freeSlotCount == freeSlotCapacity){
+            size_t capacity = freeSlotCapacity == 0 ? 64 : freeSlotCapacity * 2;
+            int64_t* grown = realloc(freeSlots, capacity * sizeof(int64_t));
+            if(grown != NULL){
+                freeSlots = grown;
+                freeSlotCapacity = capacity;
+            }
+        }
+        if(freeSlotCount < freeSlotCapacity){
+            freeSlots[freeSlotCount++] = chunk->spillSlot;
+        }
+    }
+
+    if(lastPagedIn == chunk){
+        lastPagedIn = NULL;
+    }
+    free(chunk->cells);
+    free(chunk);
+}
+
+
+//Function that limits the memory taken by the cells of the spreadsheet
+//
+//Every chunk paged out is read back before the spill file is closed or
+//replaced.
+bool set_memory_budget(size_t bytes, const char *spill_path){
+
+    if(spillFile != NULL && (bytes == 0 || spill_path != NULL)){
+        for(int chunkRow = 0; chunkRow < spreadsheet->chunkRows; chunkRow++){
+            for(int chunkCol = 0; spreadsheet->chunks[chunkRow] != NULL && chunkCol < spreadsheet->chunkCols; chunkCol++){
+                struct cellChunk* chunk = spreadsheet->chunks[chunkRow][chunkCol];
+                if(chunk != NULL){
+                    residentChunk(chunk)->spillSlot = -1;
+                }
+            }
+        }
+        fclose(spillFile);
+        spillFile = NULL;
+        spillSlots = 0;
+        freeSlotCount = 0;
+        lastPagedIn = NULL;
+    }
+
+    residentLimit = 0;
+    if(bytes == 0){
+        return true;
+    }
+
+    if(spillFile == NULL){
+        spillFile = spill_path != NULL ? fopen(spill_path, "w+b") : tmpfile();
+        if(spillFile == NULL){
+            return false;
+        }
+    }
+
+    residentLimit = bytes / CHUNK_CELLS_SIZE > SPILL_MIN_CHUNKS ? bytes / CHUNK_CELLS_SIZE : SPILL_MIN_CHUNKS;
+    trimChunks();
+    return true;
+}
+
+
+//Function that returns the chunk holding the cell at 'row', 'col', or NULL if it was never allocated
+static struct cellChunk* findChunk(int row, int col){
+
+    struct cellChunk** chunkRow = spreadsheet->chunks[row / CHUNK_ROWS];
+
+    return chunkRow == NULL ? NULL : chunkRow[col / CHUNK_COLS];
+
+}
+
+
+//Function that returns the cell at 'row', 'col' to be changed, or NULL if it is blank and was never allocated
+static struct cell* findCell(int row, int col){
+
+    struct cellChunk* chunk = findChunk(row, col);
+
+    return chunk == NULL ? NULL : &modifiedChunk(chunk)->cells[row % CHUNK_ROWS][col % CHUNK_COLS];
+
+}
+
+
+//Function that returns the cell at 'row', 'col' to be read, or NULL if it is blank and was never allocated
+//
+//Unlike findCell, this leaves the chunk to be paged out without being written
+//again if nothing else changes it.
+static const struct cell* readCell(int row, int col){
+
+    struct cellChunk* chunk = findChunk(row, col);
+
+    return chunk == NULL ? NULL : &residentChunk(chunk)->cells[row % CHUNK_ROWS][col % CHUNK_COLS];
+
+}
+
+
+//Function that returns whether the cell at 'row', 'col' is not blank
+static bool isOccupied(int row, int col){
+
+    const struct cellChunk* chunk = findChunk(row, col);
+
+    return chunk != NULL && (chunk->occupied[row % CHUNK_ROWS] >> (col % CHUNK_COLS) & 1);
+
+}
+
+
+//Function that returns the cell at 'row', 'col', allocating its chunk if needed
+static struct cell* touchCell(int row, int col){
+
+    struct cellChunk*** chunkRow = &spreadsheet->chunks[row / CHUNK_ROWS];
+
+    if(*chunkRow == NULL){
+        *chunkRow = (struct cellChunk**)calloc(spreadsheet->chunkCols, sizeof(struct cellChunk*));
+        if(*chunkRow == NULL){
+            fprintf(stderr, "Memory allocation error.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    struct cellChunk** chunk = &(*chunkRow)[col / CHUNK_COLS];
+
+    if(*chunk == NULL){
+        *chunk = (struct cellChunk*)calloc(1, sizeof(struct cellChunk));
+        struct cell (*cells)[CHUNK_COLS] = calloc(1, CHUNK_CELLS_SIZE);
+        if(*chunk == NULL || cells == NULL){
+            fprintf(stderr, "Memory allocation error.\n");
+            exit(EXIT_FAILURE);
+        }
+
+        //initialize each cell to be blank
+        for(int i = 0; i < CHUNK_ROWS; i++){
+            for (int j = 0; j < CHUNK_COLS; j++){
+                cells[i][j].type = BLANK;
+            }
+        }
+        (*chunk)->cells = cells;
+        (*chunk)->chunkRow = row / CHUNK_ROWS;
+        (*chunk)->chunkCol = col / CHUNK_COLS;
+        (*chunk)->spillSlot = -1;
+        atomic_init(&(*chunk)->referenced, true);
+        atomic_init(&(*chunk)->modified, true);
+        addResidentChunk(*chunk);
+    }
+
+    return &modifiedChunk(*chunk)->cells[row % CHUNK_ROWS][col % CHUNK_COLS];
+
+}
+
+
+//Function that brings the occupancy of the cell at 'row', 'col' up to date with its type
+static void updateOccupancy(int row, int col){
+
+    struct cellChunk* chunk = findChunk(row, col);
+
+    if(chunk == NULL){
+        return;
+    }
+
+    uint16_t bit = (uint16_t) (1u << (col % CHUNK_COLS));
+    bool occupied = residentChunk(chunk)->cells[row % CHUNK_ROWS][col % CHUNK_COLS].type != BLANK;
+
+    if(occupied == ((chunk->occupied[row % CHUNK_ROWS] & bit) != 0)){
+        return;
+    }
+
+    chunk->occupied[row % CHUNK_ROWS] ^= bit;
+    changeOccupancy(&rowOccupancy, row, occupied ? 1 : -1);
+    changeOccupancy(&colOccupancy, col, occupied ? 1 : -1);
+
+}
+
+
+//Function that notes a change to the cell at physical 'row', 'col' for the
+//subscriptions watching it; 'dirtied' if it is a formula only marked dirty
+//
+//A subscription whose ring is full drops it and sends its whole block next.
+static void noteChange(int row, int col, bool dirtied){
+
+    int logicalRow = -1;
+    int logicalCol = -1;
+
+    for(int i = 0; i < subscriptionCount; i++){
+        struct subscription* watcher = &subscriptions[i];
+        if(watcher->handler == NULL || watcher->reset){
+            continue;
+        }
+        if(logicalRow == -1){
+            logicalRow = logicalLine(&rowMap, row);
+            logicalCol = logicalLine(&colMap, col);
+        }
+        if(logicalRow < watcher->firstRow || logicalRow > watcher->lastRow || logicalCol < watcher->firstCol || logicalCol > watcher->lastCol){
+            continue;
+        }
+        if(watcher->head - watcher->tail > watcher->mask){
+            watcher->reset = true;
+            continue;
+        }
+        watcher->entries[watcher->head & watcher->mask].position.row = row;
+        watcher->entries[watcher->head & watcher->mask].position.col = col;
+        watcher->entries[watcher->head & watcher->mask].dirtied = dirtied;
+        ++watcher->head;
+    }
+
+}
+
+
+//Function that makes every subscription send its whole block next, as when
+//lines move and the cells noted no longer tell which cells of it changed
+static void resetSubscriptions(){
+
+    for(int i = 0; i < subscriptionCount; i++){
+        subscriptions[i].reset = true;
+    }
+
+}
+
+
+
+//Function that reads the value of the cell at 'row', 'col' as lookups see it;
+//a text is not copied
+static void readLookupKey(int row, int col, struct lookupKey* key){
+
+    const struct cell* cellVariable = readCell(row, col);
+
+    key->kind = LOOKUP_NONE;
+    key->number = 0.0;
+    key->text = NULL;
+
+    if(cellVariable == NULL){
+        return;
+    }
+    switch(cellVariable->type){
+        case NUM:
+            key->kind = LOOKUP_NUMBER;
+            key->number = cellVariable->celcontent.number;
+            break;
+        case TXT:
+            key->kind = LOOKUP_TEXT;
+            key->text = cellVariable->celcontent.text;
+            break;
+        case EQN:
+            key->kind = LOOKUP_FORMULA;
+            break;
+        default:
+            break;
+    }
+}
+
+
+//Function that hashes a lookup value
+static unsigned long hashLookupKey(const struct lookupKey* key){
+
+    unsigned long hash = 5381;
+
+    if(key->kind == LOOKUP_TEXT){
+        for(const char* c = key->text; *c != '\0'; c++){
+            hash = hash * 33 + (unsigned char) tolower((unsigned char) *c);
+        }
+        return hash;
+    }
+
+    //-0 and 0 are equal, as are NaNs; whole numbers differ only in their high
+    //bits, which are mixed into the low ones the tables are indexed by
+    double number = isnan(key->number) ? NAN : key->number + 0.0;
+    uint64_t bits;
+    memcpy(&bits, &number, sizeof(bits));
+    bits = (bits ^ bits >> 33) * 0xff51afd7ed558ccdull;
+    bits = (bits ^ bits >> 33) * 0xc4ceb9fe1a85ec53ull;
+    return (unsigned long) (bits ^ bits >> 33);
+}
+
+
+//Function that orders two lookup values: numbers before texts, then by value;
+//NaNs come after the other numbers and equal each other only
+static int compareLookupKeys(const struct lookupKey* first, const struct lookupKey* second){
+
+    if(first->kind != second->kind){
+        return first->kind < second->kind ? -1 : 1;
+    }
+    if(first->kind == LOOKUP_TEXT){
+        return strcasecmp(first->text, second->text);
+    }
+    if(isnan(first->number) || isnan(second->number)){
+        return isnan(first->number) - isnan(second->number);
+    }
+    return first->number < second->number ? -1 : first->number > second->number;
+}
+
+
+//Function that returns whether lookup indexes hold a value in their slots and
+//sorted rows: texts, and numbers but NaN, which no key finds
+static bool indexedLookupKey(const struct lookupKey* key){
+
+    return key->kind == LOOKUP_TEXT || (key->kind == LOOKUP_NUMBER && !isnan(key->number));
+}
+
+
+//Function that returns the slot of a lookup index holding 'key', or the empty
+//slot where it belongs
+static struct lookupSlot* probeLookupSlot(const struct lookupIndex* index, const struct lookupKey* key){
+
+    size_t bucket = hashLookupKey(key) & (index->slotCapacity - 1);
+
+    while(index->slots[bucket].key.kind != LOOKUP_NONE && compareLookupKeys(&index->slots[bucket].key, key) != 0){
+        bucket = (bucket + 1) & (index->slotCapacity - 1);
+    }
+    return &index->slots[bucket];
+}
+
+
+//Function that returns the slot of a lookup index holding 'key', or if
+//'create', the empty slot where it belongs; NULL if there is none
+static struct lookupSlot* findLookupSlot(struct lookupIndex* index, const struct lookupKey* key, bool create){
+
+    if(create && 2 * (index->slotsUsed + 1) > index->slotCapacity){
+        //grow the table, dropping the slots left without rows
+        struct lookupSlot* slots = index->slots;
+        size_t capacity = index->slotCapacity;
+
+        index->slotCapacity = capacity == 0 ? 16 : capacity;
+        while(2 * (index->slotsUsed + 1) > index->slotCapacity){
+            index->slotCapacity *= 2;
+        }
+        index->slots = calloc(index->slotCapacity, sizeof(struct lookupSlot));
+        if(index->slots == NULL){
+            fprintf(stderr, "Memory allocation error.\n");
+            exit(EXIT_FAILURE);
+        }
+        index->slotsUsed = 0;
+        for(size_t i = 0; i < capacity; i++){
+            if(slots[i].count == 0){
+                free(slots[i].key.text);
+                free(slots[i].offsets);
+                continue;
+            }
+            *probeLookupSlot(index, &slots[i].key) = slots[i];
+            ++index->slotsUsed;
+        }
+        free(slots);
+    }
+
+    if(index->slotCapacity == 0){
+        return NULL;
+    }
+
+    struct lookupSlot* slot = probeLookupSlot(index, key);
+    return slot->key.kind == LOOKUP_NONE && !create ? NULL : slot;
+}
+
+
+//Function that finds where the sorted offsets of a lookup index reach 'key',
+//ordering the offsets with equal values by 'offset'
+static size_t findSortedLookup(const struct lookupIndex* index, const struct lookupKey* key, int64_t offset){
+
+    size_t low = 0;
+    size_t high = index->sortedCount;
+
+    while(low < high){
+        size_t middle = (low + high) / 2;
+        uint32_t current = index->sorted[middle];
+        int order = compareLookupKeys(&index->keys[current], key);
+        if(order < 0 || (order == 0 && (int64_t) current < offset)){
+            low = middle + 1;
+        }
+        else{
+            high = middle;
+        }
+    }
+    return low;
+}
+
+
+//Function that adds the row at 'offset' to a lookup index, by its value in 'keys'
+static void addLookupRow(struct lookupIndex* index, uint32_t offset){
+
+    const struct lookupKey* key = &index->keys[offset];
+
+    if(key->kind == LOOKUP_FORMULA){
+        ++index->formulaCount;
+    }
+    if(!indexedLookupKey(key)){
+        return;
+    }
+
+    struct lookupSlot* slot = findLookupSlot(index, key, true);
+    if(slot->key.kind == LOOKUP_NONE){
+        slot->key = *key;
+        if(key->kind == LOOKUP_TEXT){
+            slot->key.text = strdup(key->text);
+            if(slot->key.text == NULL){
+                fprintf(stderr, "Memory allocation error.\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        ++index->slotsUsed;
+    }
+    if(slot->count == slot->capacity){
+        slot->capacity = slot->capacity == 0 ? 4 : slot->capacity * 2;
+        slot->offsets = realloc(slot->offsets, slot->capacity * sizeof(uint32_t));
+        if(slot->offsets == NULL){
+            fprintf(stderr, "Memory allocation error.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    size_t position = slot->count;
+    while(position > 0 && slot->offsets[position - 1] > offset){
+        --position;
+    }
+    memmove(&slot->offsets[position + 1], &slot->offsets[position], (slot->count - position) * sizeof(uint32_t));
+    slot->offsets[position] = offset;
+    ++slot->count;
+
+    if(index->hasSorted){
+        position = findSortedLookup(index, key, offset);
+        memmove(&index->sorted[position + 1], &index->sorted[position], (index->sortedCount - position) * sizeof(uint32_t));
+        index->sorted[position] = offset;
+        ++index->sortedCount;
+    }
+}
+
+
+//Function that removes the row at 'offset' from a lookup index, by its value in 'keys'
+static void removeLookupRow(struct lookupIndex* index, uint32_t offset){
+
+    const struct lookupKey* key = &index->keys[offset];
+
+    if(key->kind == LOOKUP_FORMULA){
+        --index->formulaCount;
+    }
+    if(!indexedLookupKey(key)){
+        return;
+    }
+
+    struct lookupSlot* slot = findLookupSlot(index, key, false);
+    size_t position = 0;
+    while(slot->offsets[position] != offset){
+        ++position;
+    }
+    --slot->count;
+    memmove(&slot->offsets[position], &slot->offsets[position + 1], (slot->count - position) * sizeof(uint32_t));
+
+    if(index->hasSorted){
+        position = findSortedLookup(index, key, offset);
+        --index->sortedCount;
+        memmove(&index->sorted[position], &index->sorted[position + 1], (index->sortedCount - position) * sizeof(uint32_t));
+    }
+}
+
+
+//Function that sets an indexed value to 'key', copying a text
+static void copyLookupKey(struct lookupKey* target, const struct lookupKey* key){
+
+    free(target->text);
+    *target = *key;
+    if(key->kind == LOOKUP_TEXT){
+        target->text = strdup(key->text);
+        if(target->text == NULL){
+            fprintf(stderr, "Memory allocation error.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+
+//Function that frees a lookup index
+static void freeLookupIndex(struct lookupIndex* index){
+
+    for(int i = 0; i < index->rowCount; i++){
+        free(index->keys[i].text);
+    }
+    for(size_t i = 0; i < index->slotCapacity; i++){
+        free(index->slots[i].key.text);
+        free(index->slots[i].offsets);
+    }
+    free(index->keys);
+    free(index->slots);
+    free(index->sorted);
+    free(index);
+}
+
+
+//Function that drops every lookup index, once the lines they cover moved
+static void dropLookupIndexes(){
+
+    while(lookupIndexes != NULL){
+        struct lookupIndex* index = lookupIndexes;
+        lookupIndexes = index->next;
+        freeLookupIndex(index);
+    }
+}
+
+
+//Function that brings the lookup indexes covering the cell at 'row', 'col' up to date with its contents
+static void updateLookupIndexes(int row, int col){
+
+    for(struct lookupIndex* index = lookupIndexes; index != NULL; index = index->next){
+        if(index->col != col){
+            continue;
+        }
+        int offset = logicalLine(&rowMap, row) - index->logicalFirst;
+        if(offset < 0 || offset >= index->rowCount){
+            continue;
+        }
+
+        struct lookupKey key;
+        readLookupKey(row, col, &key);
+        index->changedAt = revision;
+        if(key.kind == index->keys[offset].kind && (key.kind == LOOKUP_NONE || key.kind == LOOKUP_FORMULA || compareLookupKeys(&key, &index->keys[offset]) == 0)){
+            continue;
+        }
+        removeLookupRow(index, (uint32_t) offset);
+        copyLookupKey(&index->keys[offset], &key);
+        addLookupRow(index, (uint32_t) offset);
+    }
+}
+
+
+//Function that returns the group of a condition index holding 'key', or the
+//empty group where it belongs
+static struct conditionGroup* probeConditionGroup(const struct conditionIndex* index, const struct lookupKey* key){
+
+    size_t bucket = hashLookupKey(key) & (index->groupCapacity - 1);
+
+    while(index->groups[bucket].key.kind != LOOKUP_NONE && compareLookupKeys(&index->groups[bucket].key, key) != 0){
+        bucket = (bucket + 1) & (index->groupCapacity - 1);
+    }
+    return &index->groups[bucket];
+}
+
+
+//Function that returns the group of a condition index holding 'key', or if
+//'create', the empty group where it belongs; NULL if there is none
+static struct conditionGroup* findConditionGroup(struct conditionIndex* index, const struct lookupKey* key, bool create){
+
+    if(create && 2 * (index->groupsUsed + 1) > index->groupCapacity){
+        //grow the table, dropping the groups left without rows
+        struct conditionGroup* groups = index->groups;
+        size_t capacity = index->groupCapacity;
+
+        index->groupCapacity = capacity == 0 ? 16 : capacity;
+        while(2 * (index->groupsUsed + 1) > index->groupCapacity){
+            index->groupCapacity *= 2;
+        }
+        index->groups = calloc(index->groupCapacity, sizeof(struct conditionGroup));
+        if(index->groups == NULL){
+            fprintf(stderr, "Memory allocation error.\n");
+            exit(EXIT_FAILURE);
+        }
+        index->groupsUsed = 0;
+        for(size_t i = 0; i < capacity; i++){
+            if(groups[i].total.count == 0){
+                free(groups[i].key.text);
+                continue;
+            }
+            *probeConditionGroup(index, &groups[i].key) = groups[i];
+            ++index->groupsUsed;
+        }
+        free(groups);
+    }
+
+    if(index->groupCapacity == 0){
+        return NULL;
+    }
+
+    struct conditionGroup* group = probeConditionGroup(index, key);
+    return group->key.kind == LOOKUP_NONE && !create ? NULL : group;
+}
+
+
+//Function that adds 'number' to the compensated sum 'sum', adding the rounding
+//error of the addition to 'error' (Neumaier's summation)
+static void addCompensated(double *sum, double *error, double number){
+
+    double total = *sum + number;
+
+    //past the largest double the errors are meaningless
+    if(isfinite(total)){
+        *error += fabs(*sum) >= fabs(number) ? (*sum - total) + number : (number - total) + *sum;
+    }
+    *sum = total;
+}
+
+
+//Function that adds the row at 'offset' of a condition index to its totals,
+//by its values in 'keys' and 'values', or removes it if 'sign' is negative
+static void countConditionRow(struct conditionIndex* index, uint32_t offset, int sign){
+
+    const struct lookupKey* key = &index->keys[offset];
+    const struct lookupKey* value = &index->values[offset];
+    struct conditionTotal* totals[2] = {&index->all, NULL};
+    size_t formulas = (key->kind == LOOKUP_FORMULA) + (value->kind == LOOKUP_FORMULA);
+
+    index->formulaCount = sign > 0 ? index->formulaCount + formulas : index->formulaCount - formulas;
+
+    if(key->kind == LOOKUP_NONE){
+        totals[1] = &index->blanks;
+    }
+    else if(key->kind != LOOKUP_FORMULA){
+        struct conditionGroup* group = findConditionGroup(index, key, sign > 0);
+        if(group->key.kind == LOOKUP_NONE){
+            copyLookupKey(&group->key, key);
+            ++index->groupsUsed;
+        }
+        totals[1] = &group->total;
+    }
+
+    for(int i = 0; i < 2 && totals[i] != NULL; i++){
+        struct conditionTotal* total = totals[i];
+        total->count = sign > 0 ? total->count + 1 : total->count - 1;
+        if(value->kind != LOOKUP_NUMBER){
+            continue;
+        }
+        addCompensated(&total->sum, &total->error, sign > 0 ? value->number : -value->number);
+        total->numbers = sign > 0 ? total->numbers + 1 : total->numbers - 1;
+
+        //leave no rounding error once the numbers are all gone
+        if(total->numbers == 0){
+            total->sum = 0.0;
+            total->error = 0.0;
+        }
+    }
+}
+
+
+//Function that frees a condition index
+static void freeConditionIndex(struct conditionIndex* index){
+
+    for(int i = 0; i < index->rowCount; i++){
+        free(index->keys[i].text);
+    }
+    for(size_t i = 0; i < index->groupCapacity; i++){
+        free(index->groups[i].key.text);
+    }
+    free(index->keys);
+    free(index->values);
+    free(index->groups);
+    free(index);
+}
+
+
+//Function that drops every condition index, once the lines they cover moved
+static void dropConditionIndexes(){
+
+    while(conditionIndexes != NULL){
+        struct conditionIndex* index = conditionIndexes;
+        conditionIndexes = index->next;
+        freeConditionIndex(index);
+    }
+}
+
+
+//Function that brings the condition indexes covering the cell at 'row', 'col' up to date with its contents
+static void updateConditionIndexes(int row, int col){
+
+    for(struct conditionIndex* index = conditionIndexes; index != NULL; index = index->next){
+        //the cell may be in the block grouped, the block totalled, or both
+        for(int side = 0; side < 2; side++){
+            int offset = logicalLine(&rowMap, row) - (side == 0 ? index->logicalFirst : index->valueLogicalFirst);
+            struct lookupKey key;
+
+            if(col != (side == 0 ? index->col : index->valueCol) || offset < 0 || offset >= index->rowCount){
+                continue;
+            }
+            readLookupKey(row, col, &key);
+            index->changedAt = revision;
+
+            countConditionRow(index, (uint32_t) offset, -1);
+            if(side == 0){
+                copyLookupKey(&index->keys[offset], &key);
+            }
+            else{
+                key.text = NULL;
+                index->values[offset] = key;
+            }
+            countConditionRow(index, (uint32_t) offset, 1);
+        }
+    }
+}
+
+
+//Function that records an edit of the cell at 'row', 'col' in the pivot
+//tables reading it, to be taken into account on their next refresh
+static void updatePivotTables(int row, int col){
+
+    for(struct pivotTable* pivot = pivotTables; pivot != NULL; pivot = pivot->next){
+        int offset = logicalLine(&rowMap, row) - pivot->logicalFirst;
+
+        if(pivot->stale || (col != pivot->keyCol && col != pivot->valueCol) || offset < 0 || offset >= pivot->rowCount){
+            continue;
+        }
+        if(pivot->editedCount == pivot->editedCapacity){
+            pivot->editedCapacity = pivot->editedCapacity == 0 ? 16 : pivot->editedCapacity * 2;
+            pivot->editedRows = realloc(pivot->editedRows, pivot->editedCapacity * sizeof(uint32_t));
+            if(pivot->editedRows == NULL){
+                fprintf(stderr, "Memory allocation error.\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        pivot->editedRows[pivot->editedCount++] = (uint32_t) offset;
+    }
+}
+
+
+//Function that brings the bookkeeping of the cell at 'row', 'col' up to date
+//with its contents, once they changed: its occupancy, the lookup and
+//condition indexes, and the pivot tables
+static void updateCellIndexes(int row, int col){
+
+    updateOccupancy(row, col);
+    updateLookupIndexes(row, col);
+    updateConditionIndexes(row, col);
+    updatePivotTables(row, col);
+}
+
+
+//Function that checks whether an input of the simulation the current thread
+//runs lies in the physical block of column 'col' from 'firstRow' to 'lastRow'
+static bool simulatingInputIn(int col, int firstRow, int lastRow){
+
+    const struct simulation* run = simulation->simulation;
+
+    for(size_t j = 0; j < run->inputCount; j++){
+        int line = logicalLine(&rowMap, run->inputRows[j]);
+        if(run->inputCols[j] == col && line >= logicalLine(&rowMap, firstRow) && line <= logicalLine(&rowMap, lastRow)){
+            return true;
+        }
+    }
+    return false;
+}
+
+
+//Function that returns the lookup index of the physical block of column
+//'col' from 'firstRow' to 'lastRow', building it if there is none (or
+//returning NULL while simulating)
+static struct lookupIndex* findLookupIndex(int col, int firstRow, int lastRow){
+
+    struct lookupIndex** link = &lookupIndexes;
+    size_t count = 0;
+
+    //the values of the inputs of a simulation are not indexed
+    if(simulation != NULL && simulatingInputIn(col, firstRow, lastRow)){
+        return NULL;
+    }
+
+    for(; *link != NULL; link = &(*link)->next, count++){
+        struct lookupIndex* index = *link;
+        if(index->col == col && index->firstRow == firstRow && index->lastRow == lastRow){
+            //move it to the front, unless simulating
+            if(simulation == NULL){
+                *link = index->next;
+                index->next = lookupIndexes;
+                lookupIndexes = index;
+            }
+            return index;
+        }
+    }
+
+    //a simulation, made on several threads, only reads the indexes built
+    //before it started
+    if(simulation != NULL){
+        return NULL;
+    }
+
+    //drop the least recently used index to make room
+    if(count >= LOOKUP_INDEX_LIMIT){
+        link = &lookupIndexes;
+        while((*link)->next != NULL){
+            link = &(*link)->next;
+        }
+        freeLookupIndex(*link);
+        *link = NULL;
+    }
+
+    struct lookupIndex* index = calloc(1, sizeof(struct lookupIndex));
+    if(index == NULL){
+        fprintf(stderr, "Memory allocation error.\n");
+        exit(EXIT_FAILURE);
+    }
+    index->col = col;
+    index->firstRow = firstRow;
+    index->lastRow = lastRow;
+    index->logicalFirst = logicalLine(&rowMap, firstRow);
+    index->rowCount = logicalLine(&rowMap, lastRow) - index->logicalFirst + 1;
+    index->changedAt = revision;
+    index->keys = calloc(index->rowCount, sizeof(struct lookupKey));
+    if(index->keys == NULL){
+        fprintf(stderr, "Memory allocation error.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for(int line = index->logicalFirst; line < index->logicalFirst + index->rowCount;){
+        int physical;
+        int length = lineSegment(&rowMap, line, 1, &physical);
+        for(int i = 0; i < length && line < index->logicalFirst + index->rowCount; i++, line++){
+            struct lookupKey key;
+            uint32_t offset = (uint32_t) (line - index->logicalFirst);
+            trimChunks();
+            readLookupKey(physical + i, col, &key);
+            copyLookupKey(&index->keys[offset], &key);
+            addLookupRow(index, offset);
+        }
+    }
+
+    index->next = lookupIndexes;
+    lookupIndexes = index;
+    return index;
+}
+
+
+//index whose rows compareSortedLookups orders, as qsort takes no context
+static const struct lookupIndex* sortingLookupIndex;
+
+//Function that orders two rows of a lookup index by value then offset, for qsort
+static int compareSortedLookups(const void* first, const void* second){
+
+    uint32_t a = *(const uint32_t*) first;
+    uint32_t b = *(const uint32_t*) second;
+    int order = compareLookupKeys(&sortingLookupIndex->keys[a], &sortingLookupIndex->keys[b]);
+
+    return order != 0 ? order : (a > b) - (a < b);
+}
+
+
+//Function that builds the rows of a lookup index sorted by value, if not built yet
+static void sortLookupIndex(struct lookupIndex* index){
+
+    if(index->hasSorted){
+        return;
+    }
+
+    index->sorted = malloc((index->rowCount == 0 ? 1 : index->rowCount) * sizeof(uint32_t));
+    if(index->sorted == NULL){
+        fprintf(stderr, "Memory allocation error.\n");
+        exit(EXIT_FAILURE);
+    }
+    for(int i = 0; i < index->rowCount; i++){
+        if(indexedLookupKey(&index->keys[i])){
+            index->sorted[index->sortedCount++] = (uint32_t) i;
+        }
+    }
+    sortingLookupIndex = index;
+    qsort(index->sorted, index->sortedCount, sizeof(uint32_t), compareSortedLookups);
+    index->hasSorted = true;
+}
+
+
+//Function that returns the condition index grouping the physical block of
+//column 'col' from 'firstRow' to 'lastRow', totalling the block of 'valueCol'
+//from 'valueFirstRow' to 'valueLastRow', building it if there is none (or
+//returning NULL while simulating)
+static struct conditionIndex* findConditionIndex(int col, int firstRow, int lastRow, int valueCol, int valueFirstRow, int valueLastRow){
+
+    struct conditionIndex** link = &conditionIndexes;
+    size_t count = 0;
+
+    if(simulation != NULL && (simulatingInputIn(col, firstRow, lastRow) || simulatingInputIn(valueCol, valueFirstRow, valueLastRow))){
+        return NULL;
+    }
+
+    for(; *link != NULL; link = &(*link)->next, count++){
+        struct conditionIndex* index = *link;
+        if(index->col == col && index->firstRow == firstRow && index->lastRow == lastRow
+           && index->valueCol == valueCol && index->valueFirstRow == valueFirstRow && index->valueLastRow == valueLastRow){
+            //move it to the front, unless simulating
+            if(simulation == NULL){
+                *link = index->next;
+                index->next = conditionIndexes;
+                conditionIndexes = index;
+            }
+            return index;
+        }
+    }
+
+    //a simulation, made on several threads, only reads the indexes built
+    //before it started
+    if(simulation != NULL){
+        return NULL;
+    }
+
+    //drop the least recently used index to make room
+    if(count >= LOOKUP_INDEX_LIMIT){
+        link = &conditionIndexes;
+        while((*link)->next != NULL){
+            link = &(*link)->next;
+        }
+        freeConditionIndex(*link);
+        *link = NULL;
+    }
+
+    struct conditionIndex* index = calloc(1, sizeof(struct conditionIndex));
+    if(index == NULL){
+        fprintf(stderr, "Memory allocation error.\n");
+        exit(EXIT_FAILURE);
+    }
+    index->col = col;
+    index->firstRow = firstRow;
+    index->lastRow = lastRow;
+    index->valueCol = valueCol;
+    index->valueFirstRow = valueFirstRow;
+    index->valueLastRow = valueLastRow;
+    index->logicalFirst = logicalLine(&rowMap, firstRow);
+    index->valueLogicalFirst = logicalLine(&rowMap, valueFirstRow);
+    index->rowCount = logicalLine(&rowMap, lastRow) - index->logicalFirst + 1;
+    index->changedAt = revision;
+    index->keys = calloc(index->rowCount, sizeof(struct lookupKey));
+    index->values = calloc(index->rowCount, sizeof(struct lookupKey));
+    if(index->keys == NULL || index->values == NULL){
+        fprintf(stderr, "Memory allocation error.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for(int side = 0; side < 2; side++){
+        int first = side == 0 ? index->logicalFirst : index->valueLogicalFirst;
+        for(int line = first; line < first + index->rowCount;){
+            int physical;
+            int length = lineSegment(&rowMap, line, 1, &physical);
+            for(int i = 0; i < length && line < first + index->rowCount; i++, line++){
+                struct lookupKey key;
+                trimChunks();
+                readLookupKey(physical + i, side == 0 ? col : valueCol, &key);
+                if(side == 0){
+                    copyLookupKey(&index->keys[line - first], &key);
+                }
+                else{
+                    key.text = NULL;
+                    index->values[line - first] = key;
+                }
+            }
+        }
+    }
+    for(int i = 0; i < index->rowCount; i++){
+        countConditionRow(index, (uint32_t) i, 1);
+    }
+
+    index->next = conditionIndexes;
+    conditionIndexes = index;
+    return index;
+}
+
+
+//Function that converts column letter to index
+int columnLetterToIndex(char letter){
+
+
+    return toupper(letter) - 'A';
+
+}
+
+//Function that converts cell reference to column and row indicies
+//
+//Returns the number of characters of the reference, or 0 if 'referenceCell'
+//does not start with a reference, or names a column or row past the last
+//one. '$' markers make the row and/or column absolute.
+size_t cellReferenceToIndicies(const char* referenceCell, int* row, int* col, bool* absoluteRow, bool* absoluteCol){
+
+    size_t length = 0;
+    char* end;
+
+    *absoluteCol = referenceCell[length] == '$';
+    if(*absoluteCol){
+        ++length;
+    }
+
+    if(!isalpha((unsigned char)referenceCell[length])){
+        return 0;
+    }
+    *col = 0;
+    while(isalpha((unsigned char)referenceCell[length])){
+        //stop before a long name overflows
+        if(*col > SHEET_COLS){
+            return 0;
+        }
+        *col = *col * 26 + columnLetterToIndex(referenceCell[length]) + 1;
+        ++length;
+    }
+    if(*col > SHEET_COLS){
+        return 0;
+    }
+    --*col;
+
+    *absoluteRow = referenceCell[length] == '$';
+    if(*absoluteRow){
+        ++length;
+    }
+
+    if(!isdigit((unsigned char)referenceCell[length])){
+        return 0;
+    }
+    //a number too large for a long reads as LONG_MAX
+    long number = strtol(&referenceCell[length], &end, 10);
+    if(number > SHEET_ROWS){
+        return 0;
+    }
+    *row = (int) number - 1;
+
+    return (size_t) (end - referenceCell);
+
+}
+
+
+//Function that appends the name of a column ("A", ..., "Z", "AA", ...) to a buffer
+static size_t formatColumnName(int col, char *buffer){
+
+    char letters[8];
+    size_t count = 0;
+
+    for(int remaining = col + 1; remaining > 0; remaining = (remaining - 1) / 26){
+        letters[count++] = (char)('A' + (remaining - 1) % 26);
+    }
+
+    for(size_t i = 0; i < count; i++){
+        buffer[i] = letters[count - 1 - i];
+    }
+
+    return count;
+
+}
+
+
+//Function that resolves a formula reference for the formula held by the cell at 'row', 'col'
+//
+//Positions are physical. Returns false if the reference falls outside the
+//spreadsheet, which can happen when a formula is filled towards an edge, or
+//was left there by the deletion of the cell it referenced.
+static bool resolveReference(const struct cellReference* reference, int row, int col, int* targetRow, int* targetCol){
+
+    *targetRow = reference->absoluteRow ? reference->row : row + reference->row;
+    *targetCol = reference->absoluteCol ? reference->col : col + reference->col;
+
+    return *targetRow >= 0 && *targetRow < spreadsheet->row && *targetCol >= 0 && *targetCol < spreadsheet->col;
+
+}
+
+
+//Function that parses a cell reference of a formula held by the cell at 'row', 'col'
+//
+//The text names a logical cell, which is compiled to its physical position;
+//the reference is stored relative to the physical position of the holding
+//cell unless marked absolute. Returns the number of characters parsed, or 0 if
+//the text does not start with a reference to a cell inside the spreadsheet.
+static size_t parseReference(const char* text, int row, int col, struct cellReference* reference){
+
+    size_t length = cellReferenceToIndicies(text, &reference->row, &reference->col, &reference->absoluteRow, &reference->absoluteCol);
+
+    if(length == 0 || reference->row < 0 || reference->row >= spreadsheet->row || reference->col < 0 || reference->col >= spreadsheet->col){
+        return 0;
+    }
+
+    reference->row = physicalLine(&rowMap, reference->row);
+    reference->col = physicalLine(&colMap, reference->col);
+
+    if(!reference->absoluteRow){
+        reference->row -= row;
+    }
+    if(!reference->absoluteCol){
+        reference->col -= col;
+    }
+
+    return length;
+
+}
+
+
+//Function that checks the arguments of a call against those its function takes
+static bool argumentsMatch(const struct functionCall* call){
+
+    const char* kinds = functionArguments[call->name];
+
+    if(kinds == NULL){
+        return call->argumentCount > 0;
+    }
+    if(call->argumentCount > strlen(kinds) || (call->argumentCount < strlen(kinds) && isupper((unsigned char) kinds[call->argumentCount]))){
+        return false;
+    }
+    for(size_t i = 0; i < call->argumentCount; i++){
+        enum argumentType type = call->arguments[i].type;
+        switch(toupper((unsigned char) kinds[i])){
+            case 'K':
+                if(type == ARG_RANGE){
+                    return false;
+                }
+                break;
+            case 'R':
+                if(type != ARG_RANGE){
+                    return false;
+                }
+                break;
+            default:
+                if(type != ARG_NUMBER){
+                    return false;
+                }
+                break;
+        }
+    }
+    return true;
+
+}
+
+
+//Function that parses the arguments of a call to 'name', starting after its '('
+//
+//Arguments are numbers, references and ranges separated by commas. Returns the
+//number of characters parsed including the closing ')', or 0 if the call is
+//malformed.
+static size_t parseFunctionCall(const char* text, enum functionName name, int row, int col, struct functionCall** result){
+
+    size_t length = 0;
+    struct functionCall* call = malloc(sizeof(struct functionCall));
+
+    if(call == NULL){
+        return 0;
+    }
+
+    //at most one argument per character, plus one
+    call->name = name;
+    call->argumentCount = 0;
+    call->arguments = malloc((strlen(text) + 1) * sizeof(struct functionArgument));
+    if(call->arguments == NULL){
+        freeFunctionCall(call);
+        return 0;
+    }
+
+    while(true){
+        struct functionArgument* argument = &call->arguments[call->argumentCount];
+        size_t argumentLength;
+
+        while(isspace((unsigned char)text[length])){
+            ++length;
+        }
+
+        //only a call without arguments, such as "RAND()", closes here
+        if(text[length] == ')' && call->argumentCount == 0){
+            break;
+        }
+
+        if(isalpha((unsigned char)text[length]) || text[length] == '$'){
+            argumentLength = parseReference(&text[length], row, col, &argument->value.range.first);
+            if(argumentLength == 0){
+                freeFunctionCall(call);
+                return 0;
+            }
+            length += argumentLength;
+            argument->type = ARG_REF;
+
+            if(text[length] == ':'){
+                argumentLength = parseReference(&text[length + 1], row, col, &argument->value.range.last);
+                if(argumentLength == 0){
+                    freeFunctionCall(call);
+                    return 0;
+                }
+                length += argumentLength + 1;
+                argument->type = ARG_RANGE;
+            }
+        }
+        else{
+            char* endptr;
+            argument->type = ARG_NUMBER;
+            argument->value.number = strtod(&text[length], &endptr);
+            if(endptr == &text[length]){
+                freeFunctionCall(call);
+                return 0;
+            }
+            length = endptr - text;
+        }
+        ++call->argumentCount;
+
+        while(isspace((unsigned char)text[length])){
+            ++length;
+        }
+
+        if(text[length] == ')'){
+            break;
+        }
+        if(text[length] != ','){
+            freeFunctionCall(call);
+            return 0;
+        }
+        ++length;
+    }
+
+    if(!argumentsMatch(call)){
+        freeFunctionCall(call);
+        return 0;
+    }
+
+    *result = call;
+    return length + 1;
+
+}
+
+
+//Function that looks up a function by the name at the start of 'text'
+//
+//Returns the index of the function, or -1 if the name is unknown.
+static int functionByName(const char* text, size_t length){
+
+    for(size_t i = 0; i < sizeof(functionNames) / sizeof(functionNames[0]); i++){
+        size_t j = 0;
+        while(j < length && toupper((unsigned char)text[j]) == functionNames[i][j]){
+            ++j;
+        }
+        if(j == length && functionNames[i][j] == '\0'){
+            return (int) i;
+        }
+    }
+
+    return -1;
+
+}
+
+
+//Function that parse an equation and returns its elements
+//
+//The equation is a sum of operands, cell references and function calls such
+//as "=A2+B2+0.4" or "=SUM(A1:A9)-A10"; the leading '=' is optional. References are stored relative to the cell at
+//physical 'row', 'col' which holds the formula. Returns NULL if the equation is
+//malformed or references a cell outside the spreadsheet. The returned array is
+//terminated by an element of type INVALID, and its length (excluding the
+//terminator) is stored in 'elementCount'.
+struct equationElemts* parse_eqn(const char* equation, int row, int col, size_t* elementCount){
+
+    size_t currentPosition = 0;
+
+    size_t elementIndex = 0;
+
+    size_t eqnLength = strlen(equation);
+
+    //an operand or reference is expected next (as opposed to an operator)
+    bool expectTerm = true;
+
+    struct equationElemts* elmnt = (struct equationElemts*)malloc((eqnLength + 1)*sizeof(struct equationElemts));
+
+    if(elmnt == NULL){
+        return NULL;
+    }
+
+    if(equation[0] == '='){
+        ++currentPosition;
+    }
+
+    while (currentPosition < eqnLength){
+
+        if(isspace((unsigned char)equation[currentPosition])){
+            ++currentPosition;
+            continue;
+        }
+
+        //check for the operator '+' and '-', which may also lead the equation as a sign
+        if (equation[currentPosition] == '-' || equation[currentPosition] == '+'){
+            if(expectTerm && elementIndex > 0){
+                elmnt[elementIndex].type = INVALID;
+                freeEqnElmnts(elmnt);
+                return NULL;
+            }
+            elmnt[elementIndex].type = OPERATOR;
+            elmnt[elementIndex].celcontent2.operatorSymbol = equation[currentPosition];
+            ++currentPosition;
+            expectTerm = true;
+        }
+
+        else if(expectTerm && (isalpha((unsigned char)equation[currentPosition]) || equation[currentPosition] == '$')){
+            size_t nameEnd = currentPosition;
+            while(isalpha((unsigned char)equation[nameEnd])){
+                ++nameEnd;
+            }
+
+            size_t termLength;
+            if(equation[nameEnd] == '('){
+                //check for a function call, a name followed by its arguments in parentheses
+                int name = functionByName(&equation[currentPosition], nameEnd - currentPosition);
+                elmnt[elementIndex].type = FUNCTION_CALL;
+                elmnt[elementIndex].celcontent2.call = NULL;
+                termLength = name < 0 ? 0 : parseFunctionCall(&equation[nameEnd + 1], (enum functionName) name, row, col, &elmnt[elementIndex].celcontent2.call);
+                if(termLength != 0){
+                    termLength += nameEnd + 1 - currentPosition;
+                }
+            }
+            else{
+                //check for references to another cell, a column letter followed by a row number
+                elmnt[elementIndex].type = REF_CELL;
+                termLength = parseReference(&equation[currentPosition], row, col, &elmnt[elementIndex].celcontent2.referenceCell);
+            }
+
+            if(termLength == 0){
+                elmnt[elementIndex].type = INVALID;
+                freeEqnElmnts(elmnt);
+                return NULL;
+            }
+
+            currentPosition += termLength;
+            expectTerm = false;
+        }
+
+        else if(expectTerm && (isdigit((unsigned char)equation[currentPosition]) || equation[currentPosition] == '.')){
+            //check for numeric operand
+            char *endptr;
+            elmnt[elementIndex].type = OPERAND;
+            elmnt[elementIndex].celcontent2.operand = strtod(&equation[currentPosition], &endptr);
+            if(endptr == &equation[currentPosition]){
+                elmnt[elementIndex].type = INVALID;
+                freeEqnElmnts(elmnt);
+                return NULL;
+            }
+
+            //move to end of numeric operand
+            currentPosition = endptr - equation;
+            expectTerm = false;
+        }
+
+        else{
+            //means invalid character in the equation
+            elmnt[elementIndex].type = INVALID;
+            freeEqnElmnts(elmnt);
+            return NULL;
+        }
+
+        ++elementIndex;
+    }
+
+    //an empty equation or a trailing operator is malformed
+    if(expectTerm){
+        elmnt[elementIndex].type = INVALID;
+        freeEqnElmnts(elmnt);
+        return NULL;
+    }
+
+    //mark the end of elements
+    elmnt[elementIndex].type = INVALID;
+    *elementCount = elementIndex;
+    return elmnt;
+}
+
+
+//Function that hashes a number of a formula
+//
+//Whole numbers differ only in the high bits of a double, which are folded
+//down for the buckets to tell them apart.
+static unsigned long hashNumber(double number){
+
+    uint64_t bits;
+
+    memcpy(&bits, &number, sizeof(bits));
+    bits ^= bits >> 32;
+    bits ^= bits >> 16;
+    return (unsigned long) bits;
+
+}
+
+
+//Function that hashes a formula reference
+static unsigned long hashReference(const struct cellReference* reference){
+
+    return ((unsigned long)reference->row * 31 + (unsigned long)reference->col) * 4 + reference->absoluteRow * 2 + reference->absoluteCol;
+
+}
+
+
+//Function that hashes a function call
+static unsigned long hashFunctionCall(const struct functionCall* call){
+
+    unsigned long hash = call->name;
+
+    for(size_t i = 0; i < call->argumentCount; i++){
+        const struct functionArgument* argument = &call->arguments[i];
+        unsigned long part = 0;
+        switch (argument->type){
+            case ARG_NUMBER:
+                part = hashNumber(argument->value.number);
+                break;
+            case ARG_RANGE:
+                part = hashReference(&argument->value.range.last) * 37;
+                //fall through
+            default:
+                part ^= hashReference(&argument->value.range.first);
+                break;
+        }
+        hash = (hash * 33) ^ (part + (unsigned long)argument->type);
+    }
+
+    return hash;
+
+}
+
+
+//Function that checks whether two formula references are identical
+static bool sameReference(const struct cellReference* first, const struct cellReference* second){
+
+    return first->row == second->row && first->col == second->col
+           && first->absoluteRow == second->absoluteRow && first->absoluteCol == second->absoluteCol;
+
+}
+
+
+//Function that checks whether two function calls are identical
+static bool sameFunctionCall(const struct functionCall* first, const struct functionCall* second){
+
+    if(first->name != second->name || first->argumentCount != second->argumentCount){
+        return false;
+    }
+
+    for(size_t i = 0; i < first->argumentCount; i++){
+        const struct functionArgument* firstArgument = &first->arguments[i];
+        const struct functionArgument* secondArgument = &second->arguments[i];
+        if(firstArgument->type != secondArgument->type){
+            return false;
+        }
+        switch (firstArgument->type){
+            case ARG_NUMBER:
+                if(memcmp(&firstArgument->value.number, &secondArgument->value.number, sizeof(double)) != 0){
+                    return false;
+                }
+                break;
+            case ARG_RANGE:
+                if(!sameReference(&firstArgument->value.range.last, &secondArgument->value.range.last)){
+                    return false;
+                }
+                //fall through
+            default:
+                if(!sameReference(&firstArgument->value.range.first, &secondArgument->value.range.first)){
+                    return false;
+                }
+                break;
+        }
+    }
+
+    return true;
+
+}
+
+
+//Function that hashes the elements of a parsed equation
+static unsigned long hashEqnElmnts(const struct equationElemts* elmnt, size_t elementCount){
+
+    unsigned long hash = 5381;
+
+    for(size_t i = 0; i < elementCount; i++){
+        unsigned long part = 0;
+        switch (elmnt[i].type){
+            case OPERATOR:
+                part = (unsigned char)elmnt[i].celcontent2.operatorSymbol;
+                break;
+            case OPERAND:
+                part = hashNumber(elmnt[i].celcontent2.operand);
+                break;
+            case REF_CELL:
+                part = hashReference(&elmnt[i].celcontent2.referenceCell);
+                break;
+            case FUNCTION_CALL:
+                part = hashFunctionCall(elmnt[i].celcontent2.call);
+                break;
+            default:
+                break;
+        }
+        hash = (hash * 33) ^ (part + (unsigned long)elmnt[i].type);
+    }
+
+    return hash;
+
+}
+
+
+//Function that checks whether two parsed equations are identical
+static bool sameEqnElmnts(const struct equationElemts* first, const struct equationElemts* second, size_t elementCount){
+
+    for(size_t i = 0; i < elementCount; i++){
+        if(first[i].type != second[i].type){
+            return false;
+        }
+        switch (first[i].type){
+            case OPERATOR:
+                if(first[i].celcontent2.operatorSymbol != second[i].celcontent2.operatorSymbol){
+                    return false;
+                }
+                break;
+            case OPERAND:
+                if(memcmp(&first[i].celcontent2.operand, &second[i].celcontent2.operand, sizeof(double)) != 0){
+                    return false;
+                }
+                break;
+            case REF_CELL:
+                if(!sameReference(&first[i].celcontent2.referenceCell, &second[i].celcontent2.referenceCell)){
+                    return false;
+                }
+                break;
+            case FUNCTION_CALL:
+                if(!sameFunctionCall(first[i].celcontent2.call, second[i].celcontent2.call)){
+                    return false;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+
+    return true;
+
+}
+
+
+//Function that compiles the elements of a formula template into its program
+//
+//Results stay bit-for-bit identical to evaluating the elements left to right:
+//  - constants before the first reference are folded, using the same
+//    operations in the same order;
+//  - '- c' becomes '+ (-c)', which IEEE 754 defines as the same operation;
+//  - '+ 0' and '- 0' are dropped, since the running value starts at +0 and so
+//    can never be -0, the only value they would change;
+//  - a reference or function call used several times is loaded once (common
+//    subexpressions).
+//Constants after a reference are not reassociated, as that changes rounding.
+static bool compileFormula(struct formulaTemplate* formula){
+
+    char operator = '+';
+    size_t i = 0;
+
+    formula->initialValue = 0.0;
+    formula->loadCount = 0;
+    formula->programLength = 0;
+    formula->loads = malloc((formula->elementCount + 1) * sizeof(struct formulaLoad));
+    formula->program = malloc((formula->elementCount + 1) * sizeof(struct formulaInstruction));
+    if(formula->loads == NULL || formula->program == NULL){
+        return false;
+    }
+
+    //fold the leading constants
+    for(; i < formula->elementCount && (formula->elmnts[i].type == OPERATOR || formula->elmnts[i].type == OPERAND); i++){
+        const struct equationElemts* element = &formula->elmnts[i];
+        if(element->type == OPERATOR){
+            operator = element->celcontent2.operatorSymbol;
+        }
+        else{
+            formula->initialValue = operator == '-' ? formula->initialValue - element->celcontent2.operand
+                                                    : formula->initialValue + element->celcontent2.operand;
+        }
+    }
+
+    for(; i < formula->elementCount; i++){
+        const struct equationElemts* element = &formula->elmnts[i];
+        struct formulaInstruction* instruction = &formula->program[formula->programLength];
+
+        if(element->type == OPERATOR){
+            operator = element->celcontent2.operatorSymbol;
+            continue;
+        }
+
+        if(element->type == OPERAND){
+            if(element->celcontent2.operand == 0.0){
+                continue;
+            }
+            instruction->op = ADD_CONSTANT;
+            instruction->arg.constant = operator == '-' ? -element->celcontent2.operand : element->celcontent2.operand;
+            ++formula->programLength;
+            continue;
+        }
+
+        //reuse the slot of an identical reference or call; each RAND draws
+        //a number of its own
+        size_t load = element->type == FUNCTION_CALL && element->celcontent2.call->name == FN_RAND ? formula->loadCount : 0;
+        while(load < formula->loadCount){
+            const struct formulaLoad* existing = &formula->loads[load];
+            if(existing->type == element->type
+               && (element->type == REF_CELL ? sameReference(&existing->source.reference, &element->celcontent2.referenceCell)
+                                             : sameFunctionCall(existing->source.call, element->celcontent2.call))){
+                break;
+            }
+            ++load;
+        }
+        if(load == formula->loadCount){
+            formula->loads[load].type = element->type;
+            if(element->type == REF_CELL){
+                formula->loads[load].source.reference = element->celcontent2.referenceCell;
+            }
+            else{
+                formula->loads[load].source.call = element->celcontent2.call;
+            }
+            ++formula->loadCount;
+        }
+
+        instruction->op = operator == '-' ? SUB_LOAD : ADD_LOAD;
+        instruction->arg.load = load;
+        ++formula->programLength;
+    }
+
+    formula->shape = SHAPE_SUM;
+    for(size_t j = 0; j < formula->programLength; j++){
+        if(formula->program[j].op != ADD_LOAD){
+            formula->shape = SHAPE_GENERAL;
+        }
+    }
+    if(formula->programLength == 0){
+        formula->shape = SHAPE_CONSTANT;
+    }
+
+    return true;
+
+}
+
+
+//Function that returns the shared template for a parsed equation
+//
+//Takes ownership of 'elmnt': it either becomes a new template or is freed in
+//favour of an identical template already in the table.
+static struct formulaTemplate* internFormula(struct equationElemts* elmnt, size_t elementCount){
+
+    unsigned long hash = hashEqnElmnts(elmnt, elementCount);
+    struct formulaTemplate** bucket = &templateTable[hash % TEMPLATE_BUCKETS];
+
+    for(struct formulaTemplate* formula = *bucket; formula != NULL; formula = formula->next){
+        if(formula->hash == hash && formula->elementCount == elementCount && sameEqnElmnts(formula->elmnts, elmnt, elementCount)){
+            freeEqnElmnts(elmnt);
+            ++formula->refCount;
+            return formula;
+        }
+    }
+
+    struct formulaTemplate* formula = malloc(sizeof(struct formulaTemplate));
+    if(formula == NULL){
+        freeEqnElmnts(elmnt);
+        return NULL;
+    }
+
+    formula->elmnts = elmnt;
+    formula->elementCount = elementCount;
+    formula->hash = hash;
+    formula->refCount = 1;
+    if(!compileFormula(formula)){
+        free(formula->loads);
+        free(formula->program);
+        freeEqnElmnts(elmnt);
+        free(formula);
+        return NULL;
+    }
+
+    formula->next = *bucket;
+    *bucket = formula;
+
+    return formula;
+
+}
+
+
+//Function that drops one cell's use of a formula template, freeing it when unused
+static void releaseFormula(struct formulaTemplate* formula){
+
+    if(--formula->refCount > 0){
+        return;
+    }
+
+    struct formulaTemplate** link = &templateTable[formula->hash % TEMPLATE_BUCKETS];
+    while(*link != formula){
+        link = &(*link)->next;
+    }
+    *link = formula->next;
+
+    freeEqnElmnts(formula->elmnts);
+    free(formula->loads);
+    free(formula->program);
+    free(formula);
+
+}
+
+
+//Function that writes a formula reference as seen from the cell at 'row', 'col'
+//
+//A reference falling outside the spreadsheet is written "#REF!".
+static size_t formatReference(const struct cellReference* reference, int row, int col, char* buffer){
+
+    int targetRow;
+    int targetCol;
+    size_t length = 0;
+
+    if(!resolveReference(reference, row, col, &targetRow, &targetCol)){
+        memcpy(buffer, "#REF!", 5);
+        return 5;
+    }
+    targetRow = logicalLine(&rowMap, targetRow);
+    targetCol = logicalLine(&colMap, targetCol);
+
+    if(reference->absoluteCol){
+        buffer[length++] = '$';
+    }
+    length += formatColumnName(targetCol, &buffer[length]);
+    if(reference->absoluteRow){
+        buffer[length++] = '$';
+    }
+    length += snprintf(&buffer[length], 16, "%d", targetRow + 1);
+
+    return length;
+
+}
+
+
+//Function that formats a number with the fewest significant digits reading
+//back as the same number
+static void formatRoundTrip(double number, char *buffer, size_t size){
+
+    for(int precision = 15; precision < 17; precision++){
+        snprintf(buffer, size, "%.*g", precision, number);
+        if(strtod(buffer, NULL) == number){
+            return;
+        }
+    }
+    snprintf(buffer, size, "%.17g", number);
+
+}
+
+
+//Function that writes the formula text of a template as seen from the cell at 'row', 'col'
+//
+//Numbers are written so that the text parses back to the same formula.
+static char* formulaToText(const struct formulaTemplate* formula, int row, int col){
+
+    //'=' and terminator, plus room for the longest operand, reference or call
+    //argument per element
+    size_t capacity = 2;
+    for(size_t i = 0; i < formula->elementCount; i++){
+        capacity += formula->elmnts[i].type == FUNCTION_CALL ? 16 + formula->elmnts[i].celcontent2.call->argumentCount * 64 : 32;
+    }
+
+    char* text = malloc(capacity);
+    size_t length = 0;
+
+    if(text == NULL){
+        return NULL;
+    }
+
+    text[length++] = '=';
+
+    for(size_t i = 0; i < formula->elementCount; i++){
+        const struct equationElemts* element = &formula->elmnts[i];
+        switch (element->type){
+            case OPERATOR:
+                text[length++] = element->celcontent2.operatorSymbol;
+                break;
+            case OPERAND:
+                formatRoundTrip(element->celcontent2.operand, &text[length], 32);
+                length += strlen(&text[length]);
+                break;
+            case REF_CELL:
+                length += formatReference(&element->celcontent2.referenceCell, row, col, &text[length]);
+                break;
+            case FUNCTION_CALL:{
+                const struct functionCall* call = element->celcontent2.call;
+                length += snprintf(&text[length], 16, "%s(", functionNames[call->name]);
+                for(size_t j = 0; j < call->argumentCount; j++){
+                    const struct functionArgument* argument = &call->arguments[j];
+                    if(j > 0){
+                        text[length++] = ',';
+                    }
+                    if(argument->type == ARG_NUMBER){
+                        formatRoundTrip(argument->value.number, &text[length], 32);
+                        length += strlen(&text[length]);
+                        continue;
+                    }
+                    length += formatReference(&argument->value.range.first, row, col, &text[length]);
+                    if(argument->type == ARG_RANGE){
+                        text[length++] = ':';
+                        length += formatReference(&argument->value.range.last, row, col, &text[length]);
+                    }
+                }
+                text[length++] = ')';
+                break;
+            }
+            default:
+                break;
+        }
+    }
+
+    text[length] = '\0';
+    return text;
+
+}
+
+
+//structure that describes how the references of a formula change when it is
+//rewritten for another cell, or when lines it references are deleted
+struct referenceMove{
+    //physical cell holding the formula before and after
+    int fromRow;
+
+    int fromCol;
+
+    int toRow;
+
+    int toCol;
+
+    //logical rows and columns relative references shift by
+    int rowShift;
+
+    int colShift;
+
+    //logical lines being deleted, rows or columns: single references to them
+    //are lost, and ranges shrink to the lines left
+    bool deletingRows;
+
+    int deletedFirst;
+
+    int deletedCount;
+};
+
+
+//Function that returns the logical line a reference targets along one axis
+//from the cell at physical line 'holder', or -1 outside the spreadsheet
+static int referenceLine(const struct lineMap* map, int value, bool absolute, int holder){
+
+    int physical = absolute ? value : holder + value;
+
+    return physical < 0 || physical >= map->lineCount ? -1 : logicalLine(map, physical);
+
+}
+
+
+//Function that points a reference at logical 'line' along one axis from the
+//cell at physical line 'holder', or outside the spreadsheet if 'line' is
+static void setReferenceLine(const struct lineMap* map, int* value, bool* absolute, int holder, int line){
+
+    if(line < 0 || line >= map->lineCount){
+        *absolute = true;
+        *value = -1;
+        return;
+    }
+
+    *value = *absolute ? physicalLine(map, line) : physicalLine(map, line) - holder;
+
+}
+
+
+//Function that rewrites a single reference ('last' NULL) or a range as described by 'move'
+static void relocateReference(struct cellReference* first, struct cellReference* last, const struct referenceMove* move){
+
+    struct cellReference* corners[2] = {first, last};
+    int rows[2];
+    int cols[2];
+    int count = last == NULL ? 1 : 2;
+
+    for(int k = 0; k < count; k++){
+        rows[k] = referenceLine(&rowMap, corners[k]->row, corners[k]->absoluteRow, move->fromRow);
+        cols[k] = referenceLine(&colMap, corners[k]->col, corners[k]->absoluteCol, move->fromCol);
+        if(rows[k] != -1 && !corners[k]->absoluteRow){
+            rows[k] += move->rowShift;
+        }
+        if(cols[k] != -1 && !corners[k]->absoluteCol){
+            cols[k] += move->colShift;
+        }
+    }
+
+    if(move->deletedCount > 0){
+        int* lines = move->deletingRows ? rows : cols;
+        int deletedLast = move->deletedFirst + move->deletedCount - 1;
+        int low = count == 2 && lines[1] < lines[0] ? 1 : 0;
+        int high = count == 2 ? 1 - low : 0;
+        bool lowDeleted = lines[low] >= move->deletedFirst && lines[low] <= deletedLast;
+        bool highDeleted = lines[high] >= move->deletedFirst && lines[high] <= deletedLast;
+
+        if(lowDeleted && highDeleted){
+            lines[low] = -1;
+            lines[high] = -1;
+        }
+        else if(lowDeleted){
+            lines[low] = deletedLast + 1;
+        }
+        else if(highDeleted){
+            lines[high] = move->deletedFirst - 1;
+        }
+    }
+
+    for(int k = 0; k < count; k++){
+        setReferenceLine(&rowMap, &corners[k]->row, &corners[k]->absoluteRow, move->toRow, rows[k]);
+        setReferenceLine(&colMap, &corners[k]->col, &corners[k]->absoluteCol, move->toCol, cols[k]);
+    }
+
+}
+
+
+//Function that returns the template of a formula rewritten as described by 'move'
+//
+//References are worked out in logical lines and compiled back to physical
+//ones, so this is what filling or deleting does once lines were moved.
+static struct formulaTemplate* relocateFormula(const struct formulaTemplate* formula, const struct referenceMove* move){
+
+    struct equationElemts* elmnt = malloc((formula->elementCount + 1) * sizeof(struct equationElemts));
+    struct formulaTemplate* relocated;
+
+    if(elmnt == NULL){
+        fprintf(stderr, "Memory allocation error.\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(elmnt, formula->elmnts, (formula->elementCount + 1) * sizeof(struct equationElemts));
+
+    for(size_t i = 0; i < formula->elementCount; i++){
+        if(elmnt[i].type == REF_CELL){
+            relocateReference(&elmnt[i].celcontent2.referenceCell, NULL, move);
+        }
+        if(elmnt[i].type != FUNCTION_CALL){
+            continue;
+        }
+
+        const struct functionCall* call = elmnt[i].celcontent2.call;
+        struct functionCall* copy = malloc(sizeof(struct functionCall));
+        struct functionArgument* arguments = malloc((call->argumentCount + 1) * sizeof(struct functionArgument));
+        if(copy == NULL || arguments == NULL){
+            fprintf(stderr, "Memory allocation error.\n");
+            exit(EXIT_FAILURE);
+        }
+        memcpy(arguments, call->arguments, call->argumentCount * sizeof(struct functionArgument));
+        copy->name = call->name;
+        copy->argumentCount = call->argumentCount;
+        copy->arguments = arguments;
+        elmnt[i].celcontent2.call = copy;
+
+        for(size_t j = 0; j < copy->argumentCount; j++){
+            if(arguments[j].type != ARG_NUMBER){
+                relocateReference(&arguments[j].value.range.first, arguments[j].type == ARG_RANGE ? &arguments[j].value.range.last : NULL, move);
+            }
+        }
+    }
+
+    relocated = internFormula(elmnt, formula->elementCount);
+    if(relocated == NULL){
+        fprintf(stderr, "Memory allocation error.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return relocated;
+
+}
+
+
+//Function that formats a number the way it is displayed in a cell, whether
+//typed, filled, computed or redrawn: exactly if that fits the width of a
+//cell, with %g otherwise
+void formatNumber(double number, char *buffer, size_t size){
+
+    formatRoundTrip(number, buffer, size);
+    if(strlen(buffer) > CELL_DISPLAY_WIDTH){
+        snprintf(buffer, size, "%g", number);
+    }
+
+}
+
+
+//Function that returns the message displayed for a failed formula
+const char *evalStatusMessage(enum evalStatus status){
+
+    switch (status){
+        case EVAL_CIRCULAR:
+            return "Error - Circular reference";
+        case EVAL_BAD_REFERENCE:
+            return "Error - Referenced cell is not a number";
+        case EVAL_NOT_FOUND:
+            return "Error - Not found";
+        default:
+            return "Error - Formula is invalid";
+    }
+
+}
+
+
+//Function that records 'dependent' as a dependent of the cell at 'row', 'col'
+static void addDependent(int row, int col, struct cellPosition dependent){
+
+    struct cell *precedent = touchCell(row, col);
+
+    if(precedent->dependentCount == 0){
+        ++findChunk(row, col)->linkedCells;
+    }
+
+    if(precedent->dependentCount == precedent->dependentCapacity){
+        size_t capacity = precedent->dependentCapacity == 0 ? 4 : precedent->dependentCapacity * 2;
+        struct cellPosition *grown = realloc(precedent->dependents, capacity * sizeof(struct cellPosition));
+        if(grown == NULL){
+            return;
+        }
+        precedent->dependents = grown;
+        precedent->dependentCapacity = capacity;
+    }
+
+    precedent->dependents[precedent->dependentCount++] = dependent;
+}
+
+
+//Function that removes 'dependent' from the dependents of the cell at 'row', 'col'
+static void removeDependent(int row, int col, struct cellPosition dependent){
+
+    struct cell *precedent = findCell(row, col);
+
+    if(precedent == NULL){
+        return;
+    }
+
+    for(size_t i = 0; i < precedent->dependentCount; i++){
+        if(precedent->dependents[i].row == dependent.row && precedent->dependents[i].col == dependent.col){
+            precedent->dependents[i] = precedent->dependents[--precedent->dependentCount];
+            if(precedent->dependentCount == 0){
+                free(precedent->dependents);
+                precedent->dependents = NULL;
+                precedent->dependentCapacity = 0;
+                --findChunk(row, col)->linkedCells;
+            }
+            return;
+        }
+    }
+}
+
+
+//Function that resolves a formula range for the formula held by the cell at 'row', 'col'
+//
+//The block is returned with its first row and column before its last ones,
+//whichever corners the formula names. Returns false if part of it falls
+//outside the spreadsheet.
+static bool resolveRange(const struct cellRange* range, int row, int col, struct rangeDependency* block){
+
+    int firstRow;
+    int firstCol;
+    int lastRow;
+    int lastCol;
+
+    if(!resolveReference(&range->first, row, col, &firstRow, &firstCol)
+       || !resolveReference(&range->last, row, col, &lastRow, &lastCol)){
+        return false;
+    }
+
+    bool rowsInOrder = logicalLine(&rowMap, firstRow) <= logicalLine(&rowMap, lastRow);
+    bool colsInOrder = logicalLine(&colMap, firstCol) <= logicalLine(&colMap, lastCol);
+
+    block->firstRow = rowsInOrder ? firstRow : lastRow;
+    block->lastRow = rowsInOrder ? lastRow : firstRow;
+    block->firstCol = colsInOrder ? firstCol : lastCol;
+    block->lastCol = colsInOrder ? lastCol : firstCol;
+
+    return true;
+
+}
+
+
+//Function that orders two range dependencies for the range index
+//
+//Ranges are ordered by logical first row; ties are broken on physical lines
+//and positions, which never move.
+static int compareRangeDependencies(const struct rangeDependency* first, const struct rangeDependency* second){
+
+    if(first->firstRow != second->firstRow){
+        return logicalLine(&rowMap, first->firstRow) < logicalLine(&rowMap, second->firstRow) ? -1 : 1;
+    }
+
+    int keys[2][5] = {
+        {first->lastRow, first->firstCol, first->lastCol, first->dependent.row, first->dependent.col},
+        {second->lastRow, second->firstCol, second->lastCol, second->dependent.row, second->dependent.col}
+    };
+    for(int i = 0; i < 5; i++){
+        if(keys[0][i] != keys[1][i]){
+            return keys[0][i] < keys[1][i] ? -1 : 1;
+        }
+    }
+    return 0;
+
+}
+
+
+//Function that recounts which ranges of the subtree of 'node' end on the last
+//row, and span its first and last columns
+static void updateRangeNode(struct rangeNode* node){
+
+    node->lastEnding = node->firstColumn = node->lastColumn = node;
+    for(int i = 0; i < 2; i++){
+        const struct rangeNode* child = i == 0 ? node->left : node->right;
+        if(child == NULL){
+            continue;
+        }
+        if(logicalLine(&rowMap, child->lastEnding->entry.lastRow) > logicalLine(&rowMap, node->lastEnding->entry.lastRow)){
+            node->lastEnding = child->lastEnding;
+        }
+        if(logicalLine(&colMap, child->firstColumn->entry.firstCol) < logicalLine(&colMap, node->firstColumn->entry.firstCol)){
+            node->firstColumn = child->firstColumn;
+        }
+        if(logicalLine(&colMap, child->lastColumn->entry.lastCol) > logicalLine(&colMap, node->lastColumn->entry.lastCol)){
+            node->lastColumn = child->lastColumn;
+        }
+    }
+
+}
+
+
+//Function that splits a subtree of the range index into the ranges ordered
+//before 'entry' and the others
+static void splitRangeNodes(struct rangeNode* node, const struct rangeDependency* entry, struct rangeNode** before, struct rangeNode** rest){
+
+    if(node == NULL){
+        *before = *rest = NULL;
+        return;
+    }
+
+    if(compareRangeDependencies(&node->entry, entry) < 0){
+        splitRangeNodes(node->right, entry, &node->right, rest);
+        *before = node;
+    }
+    else{
+        splitRangeNodes(node->left, entry, before, &node->left);
+        *rest = node;
+    }
+    updateRangeNode(node);
+
+}
+
+
+//Function that joins two subtrees of the range index, the first ordered before the second
+static struct rangeNode* mergeRangeNodes(struct rangeNode* first, struct rangeNode* second){
+
+    if(first == NULL || second == NULL){
+        return first == NULL ? second : first;
+    }
+
+    if(first->priority > second->priority){
+        first->right = mergeRangeNodes(first->right, second);
+        updateRangeNode(first);
+        return first;
+    }
+    second->left = mergeRangeNodes(first, second->left);
+    updateRangeNode(second);
+    return second;
+
+}
+
+
+//Function that adds a range dependency to the range index
+static void insertRangeDependency(const struct rangeDependency* entry){
+
+    struct rangeNode* node = calloc(1, sizeof(struct rangeNode));
+    struct rangeNode* before;
+    struct rangeNode* rest;
+
+    if(node == NULL){
+        return;
+    }
+    node->entry = *entry;
+    node->priority = nextPriority();
+    updateRangeNode(node);
+
+    splitRangeNodes(rangeIndex, entry, &before, &rest);
+    rangeIndex = mergeRangeNodes(mergeRangeNodes(before, node), rest);
+
+}
+
+
+//Function that removes a range dependency from a subtree of the range index,
+//returning the new root of the subtree
+static struct rangeNode* removeRangeNode(struct rangeNode* node, const struct rangeDependency* entry){
+
+    if(node == NULL){
+        return NULL;
+    }
+
+    int order = compareRangeDependencies(entry, &node->entry);
+
+    if(order == 0){
+        struct rangeNode* joined = mergeRangeNodes(node->left, node->right);
+        free(node);
+        return joined;
+    }
+    if(order < 0){
+        node->left = removeRangeNode(node->left, entry);
+    }
+    else{
+        node->right = removeRangeNode(node->right, entry);
+    }
+    updateRangeNode(node);
+    return node;
+
+}
+
+
+//Function that removes a range dependency from the range index
+static void removeRangeDependency(const struct rangeDependency* entry){
+
+    rangeIndex = removeRangeNode(rangeIndex, entry);
+
+}
+
+
+//Function that links or unlinks a formula cell from the cells its formula references
+//
+//Single references are recorded with the referenced cell; ranges are recorded
+//once each in the range index, whatever their size.
+static void updatePrecedentLinks(int row, int col, bool link){
+
+    const struct cell *cellVariable = readCell(row, col);
+    const struct formulaTemplate *formula = cellVariable == NULL ? NULL : cellVariable->formula;
+    struct cellPosition self = {row, col};
+
+    if(formula == NULL){
+        return;
+    }
+
+    //the compiled loads hold each distinct reference and call once
+    for(size_t i = 0; i < formula->loadCount; i++){
+        const struct formulaLoad *load = &formula->loads[i];
+        size_t argumentCount = load->type == FUNCTION_CALL ? load->source.call->argumentCount : 1;
+
+        for(size_t j = 0; j < argumentCount; j++){
+            const struct functionArgument *argument = load->type == FUNCTION_CALL ? &load->source.call->arguments[j] : NULL;
+            const struct cellReference *reference = argument == NULL ? &load->source.reference : &argument->value.range.first;
+            int targetRow;
+            int targetCol;
+
+            if(argument != NULL && argument->type == ARG_NUMBER){
+                continue;
+            }
+
+            if(argument != NULL && argument->type == ARG_RANGE){
+                struct rangeDependency entry;
+                if(!resolveRange(&argument->value.range, row, col, &entry)){
+                    continue;
+                }
+                entry.dependent = self;
+                if(link){
+                    insertRangeDependency(&entry);
+                }
+                else{
+                    removeRangeDependency(&entry);
+                }
+                continue;
+            }
+
+            if(!resolveReference(reference, row, col, &targetRow, &targetCol)){
+                continue;
+            }
+            if(link){
+                addDependent(targetRow, targetCol, self);
+            }
+            else{
+                removeDependent(targetRow, targetCol, self);
+            }
+        }
+    }
+}
+
+
+//Function that mixes the bits of a 64-bit number (the finalizer of MurmurHash3)
+static uint64_t mixBits(uint64_t bits){
+
+    bits = (bits ^ bits >> 33) * 0xff51afd7ed558ccdull;
+    bits = (bits ^ bits >> 33) * 0xc4ceb9fe1a85ec53ull;
+    return bits ^ bits >> 33;
+}
+
+
+//Function that returns the stream of random numbers of the 'draw'th load of
+//the formula at physical 'row', 'col' in a simulation from 'seed'
+//
+//The generator is counter based: the number of a trial is a hash of the
+//stream and the trial rather than the next state of a sequence, so any trial
+//can be drawn on any thread, in any order, with the same result. The sheet
+//shows trial 0 of seed 0.
+static uint64_t randomStream(uint64_t seed, int row, int col, size_t draw){
+
+    return mixBits(seed ^ mixBits(((uint64_t) (uint32_t) row << 32 | (uint32_t) col) + 0x9e3779b97f4a7c15ull * (draw + 1)));
+}
+
+
+//Function that draws the number of trial 'trial' from a stream, uniform in [0, 1)
+static double drawRandom(uint64_t stream, uint64_t trial){
+
+    return (double) (mixBits(stream + 0x9e3779b97f4a7c15ull * (trial + 1)) >> 11) * 0x1.0p-53;
+}
+
+
+//Function that returns the index of the node of the formula cell at physical
+//'row', 'col' in a simulation, or SIZE_MAX if it is not in its cone
+static size_t findSimulationNode(const struct simulation* run, int row, int col){
+
+    size_t mask = run->tableCapacity - 1;
+
+    for(size_t i = mixBits((uint64_t) (uint32_t) row << 32 | (uint32_t) col) & mask;; i = (i + 1) & mask){
+        size_t index = run->table[i];
+        if(index == SIZE_MAX || (run->nodes[index].row == row && run->nodes[index].col == col)){
+            return index;
+        }
+    }
+}
+
+
+//Function that reads the value of the cell at 'row', 'col' in the trial the
+//current thread simulates, if it is random
+static bool readSimulatedCell(int row, int col, double *result, enum evalStatus *status){
+
+    const struct simulation *run = simulation->simulation;
+    size_t index = findSimulationNode(run, row, col);
+
+    if(index == SIZE_MAX || !run->nodes[index].random){
+        return false;
+    }
+
+    size_t position = run->nodes[index].slot * run->blockTrials + simulation->trial;
+    *result = simulation->values[position];
+    *status = (enum evalStatus) simulation->statuses[position];
+    return true;
+}
+
+
+static enum evalStatus evaluateCell(int row, int col, double *result);
+
+//Function that evaluates a cell referenced by a formula, noting when it last changed
+static enum evalStatus loadCell(int row, int col, double *result, unsigned long *newestChange){
+
+    trimChunks();
+
+    enum evalStatus status = evaluateCell(row, col, result);
+    const struct cell *cellVariable = readCell(row, col);
+    unsigned long changedAt = cellVariable != NULL ? cellVariable->changedAt : chunksFreedAt;
+
+    if(changedAt > *newestChange){
+        *newestChange = changedAt;
+    }
+
+    return status;
+}
+
+
+//Function that adds the values of a physical block of cells to 'sum'
+//
+//The block is summed chunk by chunk, skipping chunks never allocated; blank
+//cells and text in a summed block are skipped rather than an error.
+static enum evalStatus sumBlock(int firstRow, int firstCol, int lastRow, int lastCol, double *sum, unsigned long *newestChange){
+
+    for(int chunkRow = firstRow / CHUNK_ROWS; chunkRow <= lastRow / CHUNK_ROWS; chunkRow++){
+        if(spreadsheet->chunks[chunkRow] == NULL){
+            if(chunksFreedAt > *newestChange){
+                *newestChange = chunksFreedAt;
+            }
+            continue;
+        }
+        for(int chunkCol = firstCol / CHUNK_COLS; chunkCol <= lastCol / CHUNK_COLS; chunkCol++){
+            struct cellChunk *chunk = spreadsheet->chunks[chunkRow][chunkCol];
+            if(chunk == NULL){
+                if(chunksFreedAt > *newestChange){
+                    *newestChange = chunksFreedAt;
+                }
+                continue;
+            }
+            pinChunk(residentChunk(chunk));
+
+            int rowStart = chunkRow * CHUNK_ROWS > firstRow ? chunkRow * CHUNK_ROWS : firstRow;
+            int rowEnd = chunkRow * CHUNK_ROWS + CHUNK_ROWS - 1 < lastRow ? chunkRow * CHUNK_ROWS + CHUNK_ROWS - 1 : lastRow;
+            int colStart = chunkCol * CHUNK_COLS > firstCol ? chunkCol * CHUNK_COLS : firstCol;
+            int colEnd = chunkCol * CHUNK_COLS + CHUNK_COLS - 1 < lastCol ? chunkCol * CHUNK_COLS + CHUNK_COLS - 1 : lastCol;
+
+            for(int j = rowStart; j <= rowEnd; j++){
+                for(int k = colStart; k <= colEnd; k++){
+                    const struct cell *cellVariable = &chunk->cells[j % CHUNK_ROWS][k % CHUNK_COLS];
+                    double value;
+                    if(cellVariable->type == BLANK || cellVariable->type == TXT){
+                        if(cellVariable->changedAt > *newestChange){
+                            *newestChange = cellVariable->changedAt;
+                        }
+                        continue;
+                    }
+                    enum evalStatus status = loadCell(j, k, &value, newestChange);
+                    if(status != EVAL_OK){
+                        unpinChunk(chunk);
+                        return status;
+                    }
+                    *sum += value;
+                }
+            }
+            unpinChunk(chunk);
+        }
+    }
+
+    return EVAL_OK;
+}
+
+
+//Function that evaluates a call of SUM, the sum of its arguments
+static enum evalStatus evaluateSum(const struct functionCall *call, int row, int col, double *result, unsigned long *newestChange){
+
+    double sum = 0.0;
+
+    for(size_t i = 0; i < call->argumentCount; i++){
+        const struct functionArgument *argument = &call->arguments[i];
+        struct rangeDependency block;
+        enum evalStatus status;
+
+        if(argument->type == ARG_NUMBER){
+            sum += argument->value.number;
+            continue;
+        }
+
+        if(argument->type == ARG_REF){
+            if(!resolveReference(&argument->value.range.first, row, col, &block.firstRow, &block.firstCol)){
+                return EVAL_BAD_REFERENCE;
+            }
+            status = sumBlock(block.firstRow, block.firstCol, block.firstRow, block.firstCol, &sum, newestChange);
+            if(status != EVAL_OK){
+                return status;
+            }
+            continue;
+        }
+
+        if(!resolveRange(&argument->value.range, row, col, &block)){
+            return EVAL_BAD_REFERENCE;
+        }
+
+        int lastRow = logicalLine(&rowMap, block.lastRow);
+        int lastCol = logicalLine(&colMap, block.lastCol);
+
+        //the logical block is summed a physically contiguous block at a time,
+        //which is the whole of it unless lines were inserted or deleted
+        for(int firstRow = logicalLine(&rowMap, block.firstRow); firstRow <= lastRow;){
+            int physicalRow;
+            int rows = lineSegment(&rowMap, firstRow, 1, &physicalRow);
+            if(rows > lastRow - firstRow + 1){
+                rows = lastRow - firstRow + 1;
+            }
+            for(int firstCol = logicalLine(&colMap, block.firstCol); firstCol <= lastCol;){
+                int physicalCol;
+                int cols = lineSegment(&colMap, firstCol, 1, &physicalCol);
+                if(cols > lastCol - firstCol + 1){
+                    cols = lastCol - firstCol + 1;
+                }
+                status = sumBlock(physicalRow, physicalCol, physicalRow + rows - 1, physicalCol + cols - 1, &sum, newestChange);
+                if(status != EVAL_OK){
+                    return status;
+                }
+                firstCol += cols;
+            }
+            firstRow += rows;
+        }
+    }
+
+    *result = sum;
+    return EVAL_OK;
+}
+
+
+//Function that reads the value of the cell at 'row', 'col' as lookups see it,
+//computing it for a formula, and notes when it last changed
+static enum evalStatus loadLookupKey(int row, int col, struct lookupKey *key, unsigned long *newestChange){
+
+    trimChunks();
+
+    const struct cell *cellVariable = readCell(row, col);
+    unsigned long changedAt = cellVariable != NULL ? cellVariable->changedAt : chunksFreedAt;
+    enum evalStatus simulated;
+
+    //an input or random cell of a simulation takes its value in the trial
+    if(simulation != NULL && readSimulatedCell(row, col, &key->number, &simulated)){
+        key->kind = LOOKUP_NUMBER;
+        key->text = NULL;
+        return simulated;
+    }
+
+    readLookupKey(row, col, key);
+    if(key->kind == LOOKUP_FORMULA){
+        key->kind = LOOKUP_NUMBER;
+        return loadCell(row, col, &key->number, newestChange);
+    }
+    if(changedAt > *newestChange){
+        *newestChange = changedAt;
+    }
+    return EVAL_OK;
+}
+
+
+//ways a lookup matches its key: the equal value, or failing that the largest
+//value below it or the smallest above it
+enum lookupMatch{
+    MATCH_EXACT, MATCH_BELOW, MATCH_ABOVE,
+};
+
+
+//Function that finds the row of a lookup index matching 'key'
+//
+//Of several rows with the same value, the first is returned, or the last if
+//'lastOfTies' (for a match below the key).
+static enum evalStatus probeLookupIndex(struct lookupIndex* index, const struct lookupKey* key, enum lookupMatch match, bool lastOfTies, int* offset){
+
+    if(match == MATCH_EXACT){
+        const struct lookupSlot* slot = findLookupSlot(index, key, false);
+        if(slot == NULL || slot->count == 0){
+            return EVAL_NOT_FOUND;
+        }
+        *offset = (int) slot->offsets[0];
+        return EVAL_OK;
+    }
+
+    sortLookupIndex(index);
+
+    //the first row past the key, or the first row at it
+    size_t position = findSortedLookup(index, key, match == MATCH_BELOW ? INT64_MAX : -1);
+    if(match == MATCH_BELOW){
+        if(position == 0){
+            return EVAL_NOT_FOUND;
+        }
+        --position;
+    }
+    if(position == index->sortedCount || index->keys[index->sorted[position]].kind != key->kind){
+        return EVAL_NOT_FOUND;
+    }
+    if(match == MATCH_BELOW && !lastOfTies){
+        position = findSortedLookup(index, &index->keys[index->sorted[position]], -1);
+    }
+    *offset = (int) index->sorted[position];
+    return EVAL_OK;
+}
+
+
+//Function that finds the row of the first column of a physical block matching
+//'key', as an offset from its first row
+//
+//Large blocks are probed through their lookup index, unless they hold
+//formulas; the others are scanned, noting when the cells read last changed.
+static enum evalStatus findLookupOffset(const struct rangeDependency* block, const struct lookupKey* key, enum lookupMatch match, bool lastOfTies, int* offset, unsigned long* newestChange){
+
+    int first = logicalLine(&rowMap, block->firstRow);
+    int count = logicalLine(&rowMap, block->lastRow) - first + 1;
+    struct lookupKey best = {LOOKUP_NONE, 0.0, NULL};
+
+    if(!indexedLookupKey(key)){
+        return EVAL_NOT_FOUND;
+    }
+
+    if(count >= LOOKUP_INDEX_ROWS){
+        struct lookupIndex* index = findLookupIndex(block->firstCol, block->firstRow, block->lastRow);
+        if(index != NULL && index->formulaCount == 0 && (match == MATCH_EXACT || index->hasSorted || simulation == NULL)){
+            if(index->changedAt > *newestChange){
+                *newestChange = index->changedAt;
+            }
+            return probeLookupIndex(index, key, match, lastOfTies, offset);
+        }
+    }
+
+    for(int line = first; line < first + count;){
+        int physical;
+        int length = lineSegment(&rowMap, line, 1, &physical);
+
+        for(int i = 0; i < length && line < first + count; i++, line++){
+            struct lookupKey value;
+            enum evalStatus status = loadLookupKey(physical + i, block->firstCol, &value, newestChange);
+
+            if(status == EVAL_CIRCULAR){
+                return status;
+            }
+            if(status != EVAL_OK){
+                continue;
+            }
+
+            if(value.kind != key->kind || !indexedLookupKey(&value)){
+                continue;
+            }
+            int order = compareLookupKeys(&value, key);
+            if(match == MATCH_EXACT ? order != 0 : match == MATCH_BELOW ? order > 0 : order < 0){
+                continue;
+            }
+
+            //the cells after the first exact match cannot change the result
+            if(match == MATCH_EXACT){
+                *offset = line - first;
+                return EVAL_OK;
+            }
+            int closer = best.kind == LOOKUP_NONE ? 1 : compareLookupKeys(&value, &best) * (match == MATCH_BELOW ? 1 : -1);
+            if(closer > 0 || (closer == 0 && lastOfTies && match == MATCH_BELOW)){
+                best = value;
+                *offset = line - first;
+            }
+        }
+    }
+
+    return best.kind == LOOKUP_NONE ? EVAL_NOT_FOUND : EVAL_OK;
+}
+
+
+//Function that evaluates a call of VLOOKUP, MATCH or XLOOKUP
+//
+//  VLOOKUP(key, table, column[, approximate]) is the value in the given column
+//  of the table, on the row where the key is found in its first column; the
+//  match is approximate (the largest value not above the key) unless the last
+//  argument is 0.
+//  MATCH(key, column[, type]) is the position of the key in the column: 0
+//  matches it exactly, 1 (the default) approximately, and -1 approximately
+//  from above (the smallest value not below the key).
+//  XLOOKUP(key, column, results[, missing[, mode]]) is the value of the
+//  results on the row where the key is found in the column, or 'missing'; the
+//  match is exact unless 'mode' is -1 (or the next smaller) or 1 (or the next
+//  larger).
+//The key is a number, or a reference to a number or text; texts are matched
+//regardless of case.
+static enum evalStatus evaluateLookup(const struct functionCall *call, int row, int col, double *result, unsigned long *newestChange){
+
+    const struct functionArgument *arguments = call->arguments;
+    struct rangeDependency table;
+    struct rangeDependency results;
+    struct lookupKey key = {LOOKUP_NUMBER, 0.0, NULL};
+    enum lookupMatch match = MATCH_EXACT;
+    enum evalStatus status = EVAL_OK;
+    int targetRow;
+    int targetCol;
+    int offset = 0;
+
+    if(arguments[0].type == ARG_NUMBER){
+        key.number = arguments[0].value.number;
+    }
+    else if(!resolveReference(&arguments[0].value.range.first, row, col, &targetRow, &targetCol)){
+        return EVAL_BAD_REFERENCE;
+    }
+    else{
+        status = loadLookupKey(targetRow, targetCol, &key, newestChange);
+    }
+    if(status != EVAL_OK){
+        return status;
+    }
+
+    if(!resolveRange(&arguments[1].value.range, row, col, &table)){
+        return EVAL_BAD_REFERENCE;
+    }
+    if(call->name != FN_VLOOKUP && table.firstCol != table.lastCol){
+        return EVAL_INVALID;
+    }
+
+    //a column outside the table is reported whether or not the key is found
+    if(call->name == FN_VLOOKUP && !(arguments[2].value.number >= 1.0
+       && arguments[2].value.number < logicalLine(&colMap, table.lastCol) - logicalLine(&colMap, table.firstCol) + 2)){
+        return EVAL_BAD_REFERENCE;
+    }
+
+    switch(call->name){
+        case FN_VLOOKUP:
+            match = call->argumentCount < 4 || arguments[3].value.number != 0.0 ? MATCH_BELOW : MATCH_EXACT;
+            break;
+        case FN_MATCH:
+            if(call->argumentCount < 3 || arguments[2].value.number > 0.0){
+                match = MATCH_BELOW;
+            }
+            else if(arguments[2].value.number < 0.0){
+                match = MATCH_ABOVE;
+            }
+            break;
+        default:
+            if(!resolveRange(&arguments[2].value.range, row, col, &results)){
+                return EVAL_BAD_REFERENCE;
+            }
+            if(results.firstCol != results.lastCol
+               || logicalLine(&rowMap, results.lastRow) - logicalLine(&rowMap, results.firstRow) != logicalLine(&rowMap, table.lastRow) - logicalLine(&rowMap, table.firstRow)){
+                return EVAL_INVALID;
+            }
+            if(call->argumentCount == 5 && arguments[4].value.number != 0.0){
+                match = arguments[4].value.number < 0.0 ? MATCH_BELOW : MATCH_ABOVE;
+            }
+            break;
+    }
+
+    //approximate matches of VLOOKUP and MATCH take the last of equal values,
+    //as a binary search of sorted values would
+    status = findLookupOffset(&table, &key, match, call->name != FN_XLOOKUP, &offset, newestChange);
+
+    if(status == EVAL_NOT_FOUND && call->name == FN_XLOOKUP && call->argumentCount >= 4){
+        if(arguments[3].type == ARG_NUMBER){
+            *result = arguments[3].value.number;
+            return EVAL_OK;
+        }
+        if(!resolveReference(&arguments[3].value.range.first, row, col, &targetRow, &targetCol)){
+            return EVAL_BAD_REFERENCE;
+        }
+        return loadCell(targetRow, targetCol, result, newestChange);
+    }
+    if(status != EVAL_OK){
+        return status;
+    }
+
+    switch(call->name){
+        case FN_MATCH:
+            *result = offset + 1;
+            return EVAL_OK;
+        case FN_VLOOKUP:
+            targetRow = physicalLine(&rowMap, logicalLine(&rowMap, table.firstRow) + offset);
+            targetCol = physicalLine(&colMap, logicalLine(&colMap, table.firstCol) + (int) arguments[2].value.number - 1);
+            break;
+        default:
+            targetRow = physicalLine(&rowMap, logicalLine(&rowMap, results.firstRow) + offset);
+            targetCol = results.firstCol;
+            break;
+    }
+    return loadCell(targetRow, targetCol, result, newestChange);
+}
+
+
+//tests a condition of a conditional aggregate makes of a value
+enum conditionTest{
+    TEST_EQUAL, TEST_NOT_EQUAL, TEST_LESS, TEST_LESS_EQUAL, TEST_GREATER, TEST_GREATER_EQUAL,
+};
+
+
+//structure that represent the condition of a conditional aggregate: a test
+//against a number, a text, or a blank
+struct condition{
+    enum conditionTest test;
+
+    struct lookupKey key;
+};
+
+
+//Function that reads a condition from a text: a value the cells must equal, or
+//one following a comparison, as in ">=10" or "<>done"; "=" alone stands for
+//blank cells, and "<>" alone for the others
+static void parseCondition(char *text, struct condition *condition){
+
+    static const char *const tests[] = {"<>", "<=", ">=", "=", "<", ">"};
+    static const enum conditionTest testValues[] = {TEST_NOT_EQUAL, TEST_LESS_EQUAL, TEST_GREATER_EQUAL, TEST_EQUAL, TEST_LESS, TEST_GREATER};
+    char *end;
+
+    condition->test = TEST_EQUAL;
+    for(size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++){
+        if(strncmp(text, tests[i], strlen(tests[i])) == 0){
+            condition->test = testValues[i];
+            text += strlen(tests[i]);
+            break;
+        }
+    }
+
+    condition->key.kind = LOOKUP_NONE;
+    condition->key.number = 0.0;
+    condition->key.text = NULL;
+    if(*text == '\0'){
+        return;
+    }
+    condition->key.number = strtod(text, &end);
+    if(end != text && *end == '\0'){
+        condition->key.kind = LOOKUP_NUMBER;
+        return;
+    }
+    condition->key.kind = LOOKUP_TEXT;
+    condition->key.text = text;
+}
+
+
+//Function that checks whether a number, text or blank passes a condition;
+//values of another kind only pass a test of inequality
+static bool matchesCondition(const struct condition *condition, const struct lookupKey *value){
+
+    if(value->kind != condition->key.kind){
+        return condition->test == TEST_NOT_EQUAL;
+    }
+
+    int order = value->kind == LOOKUP_NONE ? 0 : compareLookupKeys(value, &condition->key);
+
+    switch(condition->test){
+        case TEST_EQUAL:
+            return order == 0;
+        case TEST_NOT_EQUAL:
+            return order != 0;
+        case TEST_LESS:
+            return value->kind != LOOKUP_NONE && order < 0;
+        case TEST_LESS_EQUAL:
+            return value->kind != LOOKUP_NONE && order <= 0;
+        case TEST_GREATER:
+            return value->kind != LOOKUP_NONE && order > 0;
+        default:
+            return value->kind != LOOKUP_NONE && order >= 0;
+    }
+}
+
+
+//Function that totals the rows of a condition index passing a condition
+//
+//A test of equality reads one group, and of inequality the rest; comparisons
+//visit every group.
+static struct conditionTotal totalConditionIndex(struct conditionIndex *index, const struct condition *condition){
+
+    struct conditionTotal total = {0, 0.0, 0.0, 0};
+
+    if(condition->test == TEST_EQUAL || condition->test == TEST_NOT_EQUAL){
+        const struct conditionGroup *group = NULL;
+
+        if(condition->key.kind == LOOKUP_NONE){
+            total = index->blanks;
+        }
+        else if((group = findConditionGroup(index, &condition->key, false)) != NULL){
+            total = group->total;
+        }
+        if(condition->test == TEST_NOT_EQUAL){
+            struct conditionTotal rest = index->all;
+
+            rest.count -= total.count;
+            rest.numbers -= total.numbers;
+            addCompensated(&rest.sum, &rest.error, -total.sum);
+            rest.error -= total.error;
+            if(rest.numbers == 0){
+                rest.sum = 0.0;
+                rest.error = 0.0;
+            }
+            total = rest;
+        }
+        return total;
+    }
+
+    for(size_t i = 0; i < index->groupCapacity; i++){
+        const struct conditionGroup *group = &index->groups[i];
+        if(group->total.count == 0 || !matchesCondition(condition, &group->key)){
+            continue;
+        }
+        total.count += group->total.count;
+        addCompensated(&total.sum, &total.error, group->total.sum);
+        total.error += group->total.error;
+        total.numbers += group->total.numbers;
+    }
+    return total;
+}
+
+
+//Function that evaluates a call of SUMIF, COUNTIF or AVERAGEIF
+//
+//  SUMIF(range, condition[, values]) is the sum of the numbers of the values
+//  (by default, of the range) on the rows where the range passes the
+//  condition.
+//  COUNTIF(range, condition) is the number of cells of the range passing it.
+//  AVERAGEIF(range, condition[, values]) is the average of the same numbers
+//  as SUMIF.
+//The condition is a number, or a reference to a number, a blank, or a text
+//parsed by parseCondition. Ranges are single columns of the same height;
+//large ones are totalled through a condition index shared by every formula
+//over them, which needs one read of a group per formula for an equality.
+static enum evalStatus evaluateCondition(const struct functionCall *call, int row, int col, double *result, unsigned long *newestChange){
+
+    const struct functionArgument *arguments = call->arguments;
+    struct rangeDependency range;
+    struct rangeDependency values;
+    struct condition condition = {TEST_EQUAL, {LOOKUP_NUMBER, 0.0, NULL}};
+    struct conditionTotal total = {0, 0.0, 0.0, 0};
+    int targetRow;
+    int targetCol;
+
+    if(!resolveRange(&arguments[0].value.range, row, col, &range)){
+        return EVAL_BAD_REFERENCE;
+    }
+    values = range;
+    if(call->argumentCount == 3 && !resolveRange(&arguments[2].value.range, row, col, &values)){
+        return EVAL_BAD_REFERENCE;
+    }
+
+    int first = logicalLine(&rowMap, range.firstRow);
+    int valueFirst = logicalLine(&rowMap, values.firstRow);
+    int count = logicalLine(&rowMap, range.lastRow) - first + 1;
+
+    if(range.firstCol != range.lastCol || values.firstCol != values.lastCol || logicalLine(&rowMap, values.lastRow) - valueFirst + 1 != count){
+        return EVAL_INVALID;
+    }
+
+    if(arguments[1].type == ARG_NUMBER){
+        condition.key.number = arguments[1].value.number;
+    }
+    else if(!resolveReference(&arguments[1].value.range.first, row, col, &targetRow, &targetCol)){
+        return EVAL_BAD_REFERENCE;
+    }
+    else{
+        enum evalStatus status = loadLookupKey(targetRow, targetCol, &condition.key, newestChange);
+        if(status != EVAL_OK){
+            return status;
+        }
+        if(condition.key.kind == LOOKUP_TEXT){
+            parseCondition(condition.key.text, &condition);
+        }
+    }
+
+    struct conditionIndex *index = NULL;
+    if(count >= LOOKUP_INDEX_ROWS){
+        index = findConditionIndex(range.firstCol, range.firstRow, range.lastRow, values.firstCol, values.firstRow, values.lastRow);
+        if(index != NULL && index->formulaCount > 0){
+            index = NULL;
+        }
+    }
+
+    if(index != NULL){
+        if(index->changedAt > *newestChange){
+            *newestChange = index->changedAt;
+        }
+        total = totalConditionIndex(index, &condition);
+    }
+    else{
+        //formulas failing to compute are left out
+        for(int i = 0; i < count; i++){
+            struct lookupKey key;
+            struct lookupKey value;
+            enum evalStatus status = loadLookupKey(physicalLine(&rowMap, first + i), range.firstCol, &key, newestChange);
+
+            if(status == EVAL_OK && matchesCondition(&condition, &key)){
+                status = loadLookupKey(physicalLine(&rowMap, valueFirst + i), values.firstCol, &value, newestChange);
+                if(status == EVAL_OK){
+                    ++total.count;
+                    if(value.kind == LOOKUP_NUMBER){
+                        addCompensated(&total.sum, &total.error, value.number);
+                        ++total.numbers;
+                    }
+                }
+            }
+            if(status == EVAL_CIRCULAR){
+                return status;
+            }
+        }
+    }
+
+    switch(call->name){
+        case FN_COUNTIF:
+            *result = (double) total.count;
+            return EVAL_OK;
+        case FN_SUMIF:
+            *result = total.sum + total.error;
+            return EVAL_OK;
+        default:
+            if(total.numbers == 0){
+                return EVAL_NOT_FOUND;
+            }
+            *result = (total.sum + total.error) / (double) total.numbers;
+            return EVAL_OK;
+    }
+}
+
+
+//Function that evaluates a function call of the formula held by the cell at 'row', 'col'
+static enum evalStatus evaluateFunctionCall(const struct functionCall *call, int row, int col, double *result, unsigned long *newestChange){
+
+    switch(call->name){
+        case FN_SUM:
+            return evaluateSum(call, row, col, result, newestChange);
+        case FN_SUMIF:
+        case FN_COUNTIF:
+        case FN_AVERAGEIF:
+            return evaluateCondition(call, row, col, result, newestChange);
+        case FN_RAND:
+            //runFormula draws each RAND of a formula itself, this is the first
+            *result = drawRandom(randomStream(0, row, col, 0), 0);
+            return EVAL_OK;
+        default:
+            return evaluateLookup(call, row, col, result, newestChange);
+    }
+}
+
+
+//Function that runs the compiled program of the formula held by the cell at 'row', 'col'
+//
+//If 'since' is not 0 and none of the referenced cells changed after that
+//revision, the program is not run and 'unchanged' is set instead.
+static enum evalStatus runFormula(const struct formulaTemplate *formula, int row, int col, unsigned long since, double *result, bool *unchanged){
+
+    double stackValues[16];
+    double *values = stackValues;
+    enum evalStatus status = EVAL_OK;
+    double value = formula->initialValue;
+    unsigned long newestChange = 0;
+
+    if(formula->loadCount > sizeof(stackValues) / sizeof(stackValues[0])){
+        values = malloc(formula->loadCount * sizeof(double));
+        if(values == NULL){
+            return EVAL_INVALID;
+        }
+    }
+
+    //gather the referenced values and call results, in order of first use
+    for(size_t i = 0; status == EVAL_OK && i < formula->loadCount; i++){
+        int targetRow;
+        int targetCol;
+        if(formula->loads[i].type == FUNCTION_CALL && formula->loads[i].source.call->name == FN_RAND){
+            values[i] = drawRandom(randomStream(0, row, col, i), 0);
+        }
+        else if(formula->loads[i].type == FUNCTION_CALL){
+            status = evaluateFunctionCall(formula->loads[i].source.call, row, col, &values[i], &newestChange);
+        }
+        else if(!resolveReference(&formula->loads[i].source.reference, row, col, &targetRow, &targetCol)){
+            status = EVAL_BAD_REFERENCE;
+        }
+        else{
+            status = loadCell(targetRow, targetCol, &values[i], &newestChange);
+        }
+    }
+
+    *unchanged = status == EVAL_OK && since != 0 && newestChange <= since;
+
+    if(status == EVAL_OK && !*unchanged){
+        switch (formula->shape){
+            case SHAPE_SUM:
+                for(size_t i = 0; i < formula->programLength; i++){
+                    value += values[formula->program[i].arg.load];
+                }
+                break;
+            case SHAPE_GENERAL:
+                for(size_t i = 0; i < formula->programLength; i++){
+                    const struct formulaInstruction *instruction = &formula->program[i];
+                    switch (instruction->op){
+                        case ADD_LOAD:
+                            value += values[instruction->arg.load];
+                            break;
+                        case SUB_LOAD:
+                            value -= values[instruction->arg.load];
+                            break;
+                        default:
+                            value += instruction->arg.constant;
+                            break;
+                    }
+                }
+                break;
+            default:
+                break;
+        }
+    }
+
+    if(values != stackValues){
+        free(values);
+    }
+
+    *result = value;
+    return status;
+}
+
+
+//Function that settles the result of a formula cell taken off the component
+//stack, noting a change from its memoized result as evaluateCell does
+static void settleComponentCell(const struct componentEntry *entry){
+
+    struct cell *cellVariable = findCell(entry->position.row, entry->position.col);
+
+    if(entry->verifiedAt == 0 || cellVariable->status != entry->status || memcmp(&cellVariable->value, &entry->value, sizeof(double)) != 0){
+        cellVariable->changedAt = revision;
+        noteChange(entry->position.row, entry->position.col, false);
+        cellVariable->displayStale = true;
+    }
+
+    cellVariable->dirty = false;
+    cellVariable->verifiedAt = revision;
+    cellVariable->componentIndex = 0;
+}
+
+
+//Function that iterates the cycle formed by the cells of the component stack
+//from position 'first' (counting from 1) on
+//
+//Each sweep recomputes the cells from the last reached back to the first, each
+//reading the latest values of the others (Gauss-Seidel), until no value moves
+//by more than the tolerance or the iteration limit is reached; the first
+//evaluation of the cells counts as the first sweep. Only the cells of the
+//cycle are recomputed, the others they read being settled already. Cells a
+//formula reaches for the first time during a sweep join the next ones.
+static void solveComponent(size_t first){
+
+    for(size_t iteration = 1; iteration < iterationLimit; iteration++){
+        double change = 0.0;
+
+        for(size_t i = componentCount; i >= first; i--){
+            struct cellPosition position = componentStack[i - 1].position;
+            struct cellChunk *chunk = findChunk(position.row, position.col);
+            struct cell *cellVariable = findCell(position.row, position.col);
+            double value;
+            bool unchanged;
+
+            pinChunk(chunk);
+            enum evalStatus status = runFormula(cellVariable->formula, position.row, position.col, 0, &value, &unchanged);
+            unpinChunk(chunk);
+
+            if(status != EVAL_OK){
+                value = 0.0;
+            }
+            if(status != cellVariable->status){
+                change = HUGE_VAL;
+            }
+            else if(fabs(value - cellVariable->value) > change){
+                change = fabs(value - cellVariable->value);
+            }
+            cellVariable->value = value;
+            cellVariable->status = status;
+        }
+
+        if(change <= iterationTolerance){
+            return;
+        }
+    }
+}
+
+
+//Function that evaluates a dirty formula cell with iterative calculation
+//
+//This runs Tarjan's algorithm along the evaluation. The cell is pushed on the
+//component stack, and a formula reading a cell still on it takes its latest
+//value and notes its position. A cell whose formula read, itself or through
+//the cells it evaluated, a cell pushed before it is on that cell's cycle: it
+//stays on the stack, holding its first value. Otherwise the cell and those
+//left above it are a strongly connected component, solved by solveComponent
+//if the cell was read back on the way, then settled and popped. Cells on no
+//cycle are thus computed once, in the same order as without iterative
+//calculation, and each cycle is iterated on its own.
+static enum evalStatus evaluateComponentCell(int row, int col, double *result){
+
+    struct cellChunk *chunk = findChunk(row, col);
+    struct cell *cellVariable = findCell(row, col);
+
+    if(componentCount == componentCapacity){
+        size_t capacity = componentCapacity == 0 ? 64 : componentCapacity * 2;
+        struct componentEntry *grown = realloc(componentStack, capacity * sizeof(struct componentEntry));
+        if(grown == NULL){
+            fprintf(stderr, "Memory allocation error.\n");
+            exit(EXIT_FAILURE);
+        }
+        componentStack = grown;
+        componentCapacity = capacity;
+    }
+
+    size_t index = ++componentCount;
+    struct componentEntry entry = {{row, col}, cellVariable->value, cellVariable->status, cellVariable->verifiedAt};
+    size_t outerLow = componentLow;
+    bool outerReached = componentReached;
+    double value;
+    bool unchanged;
+
+    componentStack[index - 1] = entry;
+    cellVariable->componentIndex = (unsigned) index;
+
+    //a cycle is iterated from its last results, or from 0 where they failed
+    if(entry.verifiedAt == 0 || entry.status != EVAL_OK){
+        cellVariable->value = 0.0;
+        cellVariable->status = EVAL_OK;
+    }
+
+    componentLow = index;
+    componentReached = false;
+    pinChunk(chunk);
+    enum evalStatus status = runFormula(cellVariable->formula, row, col, entry.verifiedAt, &value, &unchanged);
+
+    if(unchanged){
+        value = entry.value;
+        status = entry.status;
+    }
+    cellVariable->value = status == EVAL_OK ? value : 0.0;
+    cellVariable->status = status;
+
+    if(componentLow == index && componentReached){
+        solveComponent(index);
+    }
+    unpinChunk(chunk);
+
+    //on the cycle of a cell pushed before, which solves it
+    if(componentLow < index){
+        componentLow = componentLow < outerLow ? componentLow : outerLow;
+        componentReached = true;
+        *result = cellVariable->value;
+        return cellVariable->status;
+    }
+
+    for(size_t i = index; i <= componentCount; i++){
+        settleComponentCell(&componentStack[i - 1]);
+    }
+    componentCount = index - 1;
+    componentLow = outerLow;
+    componentReached = outerReached;
+
+    *result = cellVariable->value;
+    return cellVariable->status;
+}
+
+
+//Function that pushes a dirty formula cell on the stack of deferred cells
+//
+//It stays marked as being evaluated while on it, as it is in the chain of
+//formulas evaluated within each other, and the evaluation running unwinds.
+static void deferCell(int row, int col){
+
+    if(deferredCount == deferredCapacity){
+        size_t capacity = deferredCapacity == 0 ? 64 : deferredCapacity * 2;
+        struct cellPosition *grown = realloc(deferredCells, capacity * sizeof(struct cellPosition));
+        if(grown == NULL){
+            fprintf(stderr, "Memory allocation error.\n");
+            exit(EXIT_FAILURE);
+        }
+        deferredCells = grown;
+        deferredCapacity = capacity;
+    }
+
+    deferredCells[deferredCount].row = row;
+    deferredCells[deferredCount].col = col;
+    ++deferredCount;
+    findCell(row, col)->evaluating = true;
+    evaluationDeferred = true;
+}
+
+
+static void recomputeCell(int row, int col);
+
+//Function that evaluates a dirty formula cell from outside any formula
+//
+//The cell is the first on the stack of deferred cells. The last is evaluated
+//until it completes, every dirty precedent evaluated more than
+//EVALUATION_DEPTH formulas deep being deferred on the way, and popped. The
+//formulas nested in an evaluation cut short are left dirty and met again
+//once the stack has come back to them, with the cells they read up to date.
+static enum evalStatus evaluateDeferredCells(int row, int col, double *result){
+
+    deferCell(row, col);
+
+    while(deferredCount > 0){
+        struct cellPosition position = deferredCells[deferredCount - 1];
+
+        evaluationDeferred = false;
+        recomputeCell(position.row, position.col);
+        findCell(position.row, position.col)->evaluating = evaluationDeferred;
+        if(!evaluationDeferred){
+            --deferredCount;
+        }
+    }
+    evaluationDeferred = false;
+
+    const struct cell *cellVariable = readCell(row, col);
+    *result = cellVariable->value;
+    return cellVariable->status;
+}
+
+
+//Function that evaluates the value of a cell as seen by a formula
+//
+//Formula cells are evaluated on demand: a dirty formula first brings its
+//precedents up to date, and is only recomputed if one of them actually changed
+//value since the formula was last confirmed. The result is memoized until one
+//of its precedents changes again. A recomputed value equal to the memoized one
+//does not count as a change, so propagation stops there (early cutoff) and
+//the cell is not redisplayed. Precedents are brought up to date without
+//nesting more than EVALUATION_DEPTH formulas, see evaluateDeferredCells.
+static enum evalStatus evaluateCell(int row, int col, double *result){
+
+    const struct cell *cellVariable = readCell(row, col);
+    enum evalStatus simulated;
+
+    if(cellVariable == NULL){
+        *result = 0.0;
+        return EVAL_OK;
+    }
+
+    if(simulation != NULL && (cellVariable->type == EQN || simulation->simulation->inputCount > 0) && readSimulatedCell(row, col, result, &simulated)){
+        return simulated;
+    }
+
+    switch (cellVariable->type){
+        case BLANK:
+            *result = 0.0;
+            return EVAL_OK;
+        case NUM:
+            *result = cellVariable->celcontent.number;
+            return EVAL_OK;
+        case TXT:
+            return EVAL_BAD_REFERENCE;
+        default:
+            break;
+    }
+
+    if(!cellVariable->dirty){
+        *result = cellVariable->value;
+        return cellVariable->status;
+    }
+
+    //with iterative calculation, a cell being solved reads as its latest value
+    if(cellVariable->componentIndex != 0){
+        if(cellVariable->componentIndex < componentLow){
+            componentLow = cellVariable->componentIndex;
+        }
+        componentReached = true;
+        *result = cellVariable->value;
+        return cellVariable->status;
+    }
+
+    //reached the cell again while evaluating its own precedents
+    if(cellVariable->evaluating){
+        return EVAL_CIRCULAR;
+    }
+
+    if(iterationEnabled && cellVariable->formula != NULL){
+        return evaluateComponentCell(row, col, result);
+    }
+
+    if(evaluationDepth == 0){
+        return evaluateDeferredCells(row, col, result);
+    }
+
+    //the evaluation unwinds, or goes too deep: the cell is left dirty
+    if(evaluationDeferred || evaluationDepth >= EVALUATION_DEPTH){
+        if(!evaluationDeferred){
+            deferCell(row, col);
+        }
+        *result = 0.0;
+        return EVAL_INVALID;
+    }
+
+    recomputeCell(row, col);
+
+    cellVariable = readCell(row, col);
+    *result = cellVariable->value;
+    return cellVariable->status;
+}
+
+
+//Function that recomputes a dirty formula cell, unless its evaluation is deferred
+static void recomputeCell(int row, int col){
+
+    struct cellChunk *chunk = findChunk(row, col);
+    struct cell *cellVariable = findCell(row, col);
+    enum evalStatus status = EVAL_OK;
+    double value = 0.0;
+    bool unchanged = false;
+
+    if(cellVariable->formula == NULL){
+        status = EVAL_INVALID;
+    }
+    else{
+        cellVariable->evaluating = true;
+        ++evaluationDepth;
+        pinChunk(chunk);
+        status = runFormula(cellVariable->formula, row, col, cellVariable->verifiedAt, &value, &unchanged);
+        unpinChunk(chunk);
+        --evaluationDepth;
+        cellVariable->evaluating = false;
+    }
+
+    //a precedent was deferred, the value read for it is not its own
+    if(evaluationDeferred){
+        return;
+    }
+
+    if(!unchanged){
+        if(status != EVAL_OK){
+            value = 0.0;
+        }
+
+        //compare bit patterns, so that e.g. -0 and 0 are told apart
+        if(cellVariable->verifiedAt == 0 || status != cellVariable->status || memcmp(&value, &cellVariable->value, sizeof(double)) != 0){
+            cellVariable->value = value;
+            cellVariable->status = status;
+            cellVariable->changedAt = revision;
+            noteChange(row, col, false);
+            cellVariable->displayStale = true;
+        }
+    }
+
+    cellVariable->dirty = false;
+    cellVariable->verifiedAt = revision;
+}
+
+
+//Function that sends the text displayed for the cell at physical 'row', 'col' to the interface
+static void displayCell(int row, int col, const char *text){
+
+    update_cell_display(logicalLine(&rowMap, row), logicalLine(&colMap, col), text);
+
+}
+
+
+//Function that sends the memoized value of a formula cell to the display
+static void displayFormulaCell(int row, int col){
+
+    const struct cell *cellVariable = readCell(row, col);
+
+    if(cellVariable->status == EVAL_OK){
+        char resultString[32];
+        formatNumber(cellVariable->value, resultString, sizeof(resultString));
+        displayCell(row, col, resultString);
+    }
+    else{
+        displayCell(row, col, evalStatusMessage(cellVariable->status));
+    }
+
+    if(cellVariable->displayStale){
+        findCell(row, col)->displayStale = false;
+    }
+}
+
+
+//Function that brings a dirty formula cell and its display up to date
+static void refreshCell(int row, int col){
+
+    trimChunks();
+
+    const struct cell *cellVariable = readCell(row, col);
+    double value;
+
+    if(cellVariable == NULL || cellVariable->type != EQN){
+        return;
+    }
+
+    if(cellVariable->dirty){
+        evaluateCell(row, col, &value);
+    }
+
+    if(readCell(row, col)->displayStale){
+        displayFormulaCell(row, col);
+    }
+}
+
+
+//structure that collects changed cells and the formulas dirtied by them
+struct changeSet{
+    struct cellPosition* cells;
+
+    size_t count;
+
+    size_t capacity;
+};
+
+
+//Function that appends a cell to a change set
+static bool appendChange(struct changeSet *changes, int row, int col){
+
+    if(changes->count == changes->capacity){
+        size_t capacity = changes->capacity == 0 ? 16 : changes->capacity * 2;
+        struct cellPosition *grown = realloc(changes->cells, capacity * sizeof(struct cellPosition));
+        if(grown == NULL){
+            return false;
+        }
+        changes->cells = grown;
+        changes->capacity = capacity;
+    }
+
+    changes->cells[changes->count].row = row;
+    changes->cells[changes->count].col = col;
+    ++changes->count;
+    return true;
+}
+
+
+//Function that marks a formula cell as dirty, queueing it in a change set if it was not already
+static void markDirty(struct changeSet *changes, struct cellPosition dependent){
+
+    if(!readCell(dependent.row, dependent.col)->dirty && appendChange(changes, dependent.row, dependent.col)){
+        findCell(dependent.row, dependent.col)->dirty = true;
+
+        //in eager mode it is noted once evaluated, if it changed
+        if(calcMode != CALC_EAGER){
+            noteChange(dependent.row, dependent.col, true);
+        }
+    }
+}
+
+
+//Function that marks dirty the formulas of a subtree of the range index whose
+//ranges contain the cell at logical position 'current'
+static void stabRangeIndex(const struct rangeNode *node, struct cellPosition current, struct changeSet *changes){
+
+    while(node != NULL && logicalLine(&rowMap, node->lastEnding->entry.lastRow) >= current.row
+          && logicalLine(&colMap, node->firstColumn->entry.firstCol) <= current.col
+          && logicalLine(&colMap, node->lastColumn->entry.lastCol) >= current.col){
+        const struct rangeDependency *entry = &node->entry;
+
+        stabRangeIndex(node->left, current, changes);
+
+        //this range and those after it start after the cell
+        if(logicalLine(&rowMap, entry->firstRow) > current.row){
+            return;
+        }
+        if(logicalLine(&rowMap, entry->lastRow) >= current.row
+           && logicalLine(&colMap, entry->firstCol) <= current.col && logicalLine(&colMap, entry->lastCol) >= current.col){
+            markDirty(changes, entry->dependent);
+        }
+        node = node->right;
+    }
+}
+
+
+//Function that marks every formula depending on the cells of a change set as dirty
+//
+//Dirty here means "may be stale": evaluateCell decides whether a dirty formula
+//really needs recomputing. Cells that become dirty are appended to the change
+//set, which doubles as the work queue of the walk. A dirty cell's dependents
+//are always dirty too, so the walk stops at cells which already are.
+static void markDependentsDirty(struct changeSet *changes){
+
+    for(size_t next = 0; next < changes->count; next++){
+        struct cellPosition current = changes->cells[next];
+        const struct cell *cellVariable = readCell(current.row, current.col);
+
+        for(size_t i = 0; cellVariable != NULL && i < cellVariable->dependentCount; i++){
+            markDirty(changes, cellVariable->dependents[i]);
+        }
+
+        //the range index is by logical lines
+        current.row = logicalLine(&rowMap, current.row);
+        current.col = logicalLine(&colMap, current.col);
+        stabRangeIndex(rangeIndex, current, changes);
+    }
+}
+
+
+//dirty formulas waiting for recalc_pending, from pendingHead on; entries
+//which have been evaluated since they were queued are skipped
+static struct changeSet pendingCells = {NULL, 0, 0};
+static size_t pendingHead = 0;
+
+//entries dropped from the front of the queue since it was last empty, for
+//recalc_progress
+static size_t pendingDropped = 0;
+
+//set by preempt_recalc to end the running slice of recalculation
+static atomic_bool preemptRequested = false;
+
+//queue entries processed between two readings of the clock in recalc_slice
+#define RECALC_CLOCK_ENTRIES 32
+
+
+//Function that queues the dirtied cells of a change set for recalc_pending
+static void queuePending(const struct changeSet *changes){
+
+    //drop the entries already done before growing the queue
+    if(pendingHead > 0 && pendingHead >= pendingCells.count / 2){
+        memmove(pendingCells.cells, pendingCells.cells + pendingHead, (pendingCells.count - pendingHead) * sizeof(struct cellPosition));
+        pendingCells.count -= pendingHead;
+        pendingDropped += pendingHead;
+        pendingHead = 0;
+    }
+
+    for(size_t i = 0; i < changes->count; i++){
+        if(!appendChange(&pendingCells, changes->cells[i].row, changes->cells[i].col)){
+            return;
+        }
+    }
+}
+
+
+static void refreshPivots();
+static void publishChanges();
+
+//Function that propagates the changes of a change set to their dependents and frees it
+static void propagateChanges(struct changeSet *changes){
+
+    markDependentsDirty(changes);
+
+    //in lazy mode the dirty cells wait until something reads them; in
+    //background mode they also wait in a queue for recalc_pending
+    if(calcMode == CALC_EAGER){
+        for(size_t i = 0; i < changes->count; i++){
+            refreshCell(changes->cells[i].row, changes->cells[i].col);
+        }
+    }
+    else if(calcMode == CALC_BACKGROUND){
+        queuePending(changes);
+    }
+
+    free(changes->cells);
+
+    refreshPivots();
+
+    publishChanges();
+
+    trimChunks();
+}
+
+
+//Function that empties the queue of recalc_pending
+static void clearPending(){
+
+    pendingCells.count = 0;
+    pendingHead = 0;
+    pendingDropped = 0;
+
+}
+
+
+//Function that returns the current time in nanoseconds
+static long long monotonicNanoseconds(){
+
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long) now.tv_sec * 1000000000LL + now.tv_nsec;
+
+}
+
+
+//Function that evaluates queued dirty formulas until 'budget' of them were
+//evaluated, 'deadline' (if not 0) has passed or preempt_recalc was called
+//
+//Returns whether any queued formulas are left.
+static bool runPending(size_t budget, long long deadline){
+
+    size_t sinceClock = 0;
+
+    while(pendingHead < pendingCells.count && budget > 0){
+        if(atomic_exchange(&preemptRequested, false)){
+            break;
+        }
+        if(deadline != 0 && ++sinceClock == RECALC_CLOCK_ENTRIES){
+            sinceClock = 0;
+            if(monotonicNanoseconds() >= deadline){
+                break;
+            }
+        }
+
+        struct cellPosition next = pendingCells.cells[pendingHead++];
+        const struct cell *cellVariable = readCell(next.row, next.col);
+
+        //cells shown since they were queued are already up to date; cells only
+        //read by other formulas since then just need displaying
+        if(cellVariable == NULL || cellVariable->type != EQN || (!cellVariable->dirty && !cellVariable->displayStale)){
+            continue;
+        }
+
+        refreshCell(next.row, next.col);
+        --budget;
+    }
+
+    publishChanges();
+
+    if(pendingHead == pendingCells.count){
+        clearPending();
+        return false;
+    }
+
+    return true;
+}
+
+
+//Function that evaluates up to 'budget' queued dirty formulas, returning whether any are left
+bool recalc_pending(size_t budget){
+
+    return runPending(budget, 0);
+
+}
+
+
+//Function that evaluates queued dirty formulas for about 'microseconds', returning whether any are left
+bool recalc_slice(long microseconds){
+
+    return runPending((size_t) -1, monotonicNanoseconds() + microseconds * 1000LL);
+
+}
+
+
+//Function that makes the running or next slice of recalculation return early
+void preempt_recalc(){
+
+    atomic_store(&preemptRequested, true);
+
+}
+
+
+//Function that drops the queued recalculation, leaving its formulas dirty
+void cancel_recalc(){
+
+    clearPending();
+
+}
+
+
+//Function that reports how much of the queued recalculation is done
+void recalc_progress(size_t *done, size_t *total){
+
+    *done = pendingDropped + pendingHead;
+    *total = pendingDropped + pendingCells.count;
+
+}
+
+
+//Function that propagates a change of the cell at 'row', 'col' to its dependents
+static void propagateChange(int row, int col){
+
+    struct changeSet changes = {NULL, 0, 0};
+
+    appendChange(&changes, row, col);
+    propagateChanges(&changes);
+}
+
+
+//Function that sets the calculation mode
+void set_calc_mode(CALC_MODE mode){
+
+    calcMode = mode;
+
+}
+
+
+//Function that sets how formulas on cycles of references are calculated
+//
+//Formulas on cycles failed without iterative calculation and hold iterated
+//values with it, so switching it on or off computes every formula again.
+void set_iterative_calc(bool enabled, size_t max_iterations, double max_change){
+
+    bool switched = enabled != iterationEnabled;
+
+    iterationEnabled = enabled;
+    iterationLimit = max_iterations > 0 ? max_iterations : 1;
+    iterationTolerance = max_change;
+
+    if(!switched){
+        return;
+    }
+
+    struct changeSet changes = {NULL, 0, 0};
+
+    ++revision;
+    for(int chunkRow = 0; chunkRow < spreadsheet->chunkRows; chunkRow++){
+        for(int chunkCol = 0; spreadsheet->chunks[chunkRow] != NULL && chunkCol < spreadsheet->chunkCols; chunkCol++){
+            struct cellChunk *chunk = spreadsheet->chunks[chunkRow][chunkCol];
+            for(int i = 0; chunk != NULL && i < CHUNK_ROWS; i++){
+                for(unsigned occupied = chunk->occupied[i]; occupied != 0; occupied &= occupied - 1){
+                    int j = __builtin_ctz(occupied);
+                    if(residentChunk(chunk)->cells[i][j].type == EQN && appendChange(&changes, chunkRow * CHUNK_ROWS + i, chunkCol * CHUNK_COLS + j)){
+                        struct cell *cellVariable = &modifiedChunk(chunk)->cells[i][j];
+                        cellVariable->dirty = true;
+                        cellVariable->verifiedAt = 0;
+                        noteChange(chunkRow * CHUNK_ROWS + i, chunkCol * CHUNK_COLS + j, true);
+                    }
+                }
+            }
+        }
+    }
+
+    propagateChanges(&changes);
+}
+
+
+//Function that calls 'visit' for every non-blank cell of a physical block, chunk by chunk
+//
+//The block is first narrowed to the used range, and chunks never allocated and
+//blank cells are skipped through the occupancy masks.
+static void forEachOccupiedCellIn(int firstRow, int firstCol, int lastRow, int lastCol, void (*visit)(int row, int col)){
+
+    if(rowOccupancy.first == -1){
+        return;
+    }
+    if(firstRow < rowOccupancy.first){
+        firstRow = rowOccupancy.first;
+    }
+    if(lastRow > rowOccupancy.last){
+        lastRow = rowOccupancy.last;
+    }
+    if(firstCol < colOccupancy.first){
+        firstCol = colOccupancy.first;
+    }
+    if(lastCol > colOccupancy.last){
+        lastCol = colOccupancy.last;
+    }
+    if(firstRow > lastRow || firstCol > lastCol){
+        return;
+    }
+
+    for(int chunkRow = firstRow / CHUNK_ROWS; chunkRow <= lastRow / CHUNK_ROWS; chunkRow++){
+        if(spreadsheet->chunks[chunkRow] == NULL){
+            continue;
+        }
+        for(int chunkCol = firstCol / CHUNK_COLS; chunkCol <= lastCol / CHUNK_COLS; chunkCol++){
+            const struct cellChunk *chunk = spreadsheet->chunks[chunkRow][chunkCol];
+            if(chunk == NULL){
+                continue;
+            }
+            int rowEnd = chunkRow * CHUNK_ROWS + CHUNK_ROWS - 1 < lastRow ? chunkRow * CHUNK_ROWS + CHUNK_ROWS - 1 : lastRow;
+            int colStart = chunkCol * CHUNK_COLS > firstCol ? chunkCol * CHUNK_COLS : firstCol;
+            int colEnd = chunkCol * CHUNK_COLS + CHUNK_COLS - 1 < lastCol ? chunkCol * CHUNK_COLS + CHUNK_COLS - 1 : lastCol;
+            unsigned columns = (0xffffu >> (CHUNK_COLS - 1 - colEnd % CHUNK_COLS)) & (0xffffu << colStart % CHUNK_COLS);
+            for(int i = chunkRow * CHUNK_ROWS > firstRow ? chunkRow * CHUNK_ROWS : firstRow; i <= rowEnd; i++){
+                for(unsigned occupied = chunk->occupied[i % CHUNK_ROWS] & columns; occupied != 0; occupied &= occupied - 1){
+                    visit(i, chunkCol * CHUNK_COLS + __builtin_ctz(occupied));
+                }
+            }
+        }
+    }
+
+}
+
+
+//Function that calls 'visit' with the physical position of every non-blank cell of a logical block
+static void forEachOccupiedCell(int firstRow, int firstCol, int lastRow, int lastCol, void (*visit)(int row, int col)){
+
+    for(int row = firstRow; row <= lastRow;){
+        int physicalRow;
+        int rows = lineSegment(&rowMap, row, 1, &physicalRow);
+        if(rows > lastRow - row + 1){
+            rows = lastRow - row + 1;
+        }
+        for(int col = firstCol; col <= lastCol;){
+            int physicalCol;
+            int cols = lineSegment(&colMap, col, 1, &physicalCol);
+            if(cols > lastCol - col + 1){
+                cols = lastCol - col + 1;
+            }
+            forEachOccupiedCellIn(physicalRow, physicalCol, physicalRow + rows - 1, physicalCol + cols - 1, visit);
+            col += cols;
+        }
+        row += rows;
+    }
+
+}
+
+
+//Function that brings the displayed values of a block of cells up to date
+void refresh_cells(ROW first_row, COL first_col, ROW last_row, COL last_col){
+
+    forEachOccupiedCell(first_row, first_col, last_row, last_col, refreshCell);
+
+    publishChanges();
+}
+
+
+//Function that sends the displayed value of a non-blank cell to the display
+static void redrawCell(int row, int col){
+
+    trimChunks();
+
+    const struct cell *cellVariable = readCell(row, col);
+    char numberStr[32];
+
+    switch (cellVariable->type){
+        case NUM:
+            formatNumber(cellVariable->celcontent.number, numberStr, sizeof(numberStr));
+            displayCell(row, col, numberStr);
+            break;
+        case TXT:
+            displayCell(row, col, cellVariable->celcontent.text);
+            break;
+        case EQN:
+            refreshCell(row, col);
+            displayFormulaCell(row, col);
+            break;
+        default:
+            break;
+    }
+
+}
+
+
+//Function that sends the displayed values of the non-blank cells of a block to the display
+void redraw_cells(ROW first_row, COL first_col, ROW last_row, COL last_col){
+
+    forEachOccupiedCell(first_row, first_col, last_row, last_col, redrawCell);
+
+    publishChanges();
+}
+
+
+static int comparePositions(const void *first, const void *second);
+
+//cells being delivered to a subscription
+static struct changeSet deliveredCells = {NULL, 0, 0};
+
+
+//Function that evaluates a cell about to be delivered if it is a dirty formula
+static void evaluateDeliveredCell(int row, int col){
+
+    const struct cell *cellVariable = readCell(row, col);
+    double value;
+
+    if(cellVariable != NULL && cellVariable->type == EQN && cellVariable->dirty){
+        evaluateCell(row, col, &value);
+    }
+
+}
+
+
+//Function that adds a non-blank cell of the block of a subscription sent whole to the cells delivered
+static void collectDeliveredCell(int row, int col){
+
+    evaluateDeliveredCell(row, col);
+    appendChange(&deliveredCells, row, col);
+
+}
+
+
+//Function that reads the value of the cell at physical 'row', 'col' for a subscriber
+static void readDeliveredCell(int row, int col, CELL_CHANGE *change){
+
+    const struct cell *cellVariable = readCell(row, col);
+
+    change->row = (ROW) logicalLine(&rowMap, row);
+    change->col = (COL) logicalLine(&colMap, col);
+    change->type = VALUE_BLANK;
+    change->number = 0.0;
+    change->text = NULL;
+
+    if(cellVariable == NULL){
+        return;
+    }
+    switch(cellVariable->type){
+        case NUM:
+            change->type = VALUE_NUMBER;
+            change->number = cellVariable->celcontent.number;
+            break;
+        case TXT:
+            change->type = VALUE_TEXT;
+            change->text = cellVariable->celcontent.text;
+            break;
+        case EQN:
+            if(cellVariable->status == EVAL_OK){
+                change->type = VALUE_NUMBER;
+                change->number = cellVariable->value;
+            }
+            else{
+                change->type = VALUE_ERROR;
+                change->text = evalStatusMessage(cellVariable->status);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+
+//Function that compares the changes delivered to a subscriber by row then column, for qsort
+static int compareDeliveredChanges(const void *first, const void *second){
+
+    const CELL_CHANGE *a = first;
+    const CELL_CHANGE *b = second;
+
+    if(a->row != b->row){
+        return a->row < b->row ? -1 : 1;
+    }
+    return a->col < b->col ? -1 : a->col > b->col;
+}
+
+
+//Function that delivers the changes noted for a subscription to its handler
+//
+//The dirty formulas noted are evaluated first, which notes those whose values
+//changed in turn; then each cell noted as changed is sent once, with its
+//latest value.
+static void deliverSubscription(int index){
+
+    struct subscription *watcher = &subscriptions[index];
+    size_t head = watcher->head;
+    bool reset = watcher->reset;
+
+    delivering = true;
+
+    for(size_t k = watcher->tail; k != head && !watcher->reset; k++){
+        struct cellPosition position = watcher->entries[k & watcher->mask].position;
+        evaluateDeliveredCell(position.row, position.col);
+    }
+
+    //a ring which filled while evaluating still needs the whole block
+    if(watcher->reset){
+        reset = true;
+        forEachOccupiedCell(watcher->firstRow, watcher->firstCol, watcher->lastRow, watcher->lastCol, collectDeliveredCell);
+        watcher->reset = false;
+    }
+    else{
+        size_t kept = 0;
+        for(size_t k = watcher->tail; k != watcher->head; k++){
+            if(!watcher->entries[k & watcher->mask].dirtied){
+                appendChange(&deliveredCells, watcher->entries[k & watcher->mask].position.row, watcher->entries[k & watcher->mask].position.col);
+            }
+        }
+        if(deliveredCells.count > 0){
+            qsort(deliveredCells.cells, deliveredCells.count, sizeof(struct cellPosition), comparePositions);
+        }
+        for(size_t i = 0; i < deliveredCells.count; i++){
+            if(kept == 0 || comparePositions(&deliveredCells.cells[kept - 1], &deliveredCells.cells[i]) != 0){
+                deliveredCells.cells[kept++] = deliveredCells.cells[i];
+            }
+        }
+        deliveredCells.count = kept;
+    }
+    watcher->tail = watcher->head;
+
+    if(deliveredCells.count > 0 || reset){
+        CELL_CHANGE *changes = malloc((deliveredCells.count > 0 ? deliveredCells.count : 1) * sizeof(CELL_CHANGE));
+        if(changes == NULL){
+            fprintf(stderr, "Memory allocation error.\n");
+            exit(EXIT_FAILURE);
+        }
+        for(size_t i = 0; i < deliveredCells.count; i++){
+            readDeliveredCell(deliveredCells.cells[i].row, deliveredCells.cells[i].col, &changes[i]);
+        }
+        qsort(changes, deliveredCells.count, sizeof(CELL_CHANGE), compareDeliveredChanges);
+        watcher->handler(watcher->context, changes, deliveredCells.count, reset);
+        free(changes);
+    }
+
+    deliveredCells.count = 0;
+    delivering = false;
+}
+
+
+//Function that delivers the pending changes of the subscriptions delivered on commit
+static void publishChanges(){
+
+    if(delivering){
+        return;
+    }
+
+    for(int i = 0; i < subscriptionCount; i++){
+        const struct subscription *watcher = &subscriptions[i];
+        if(watcher->handler != NULL && watcher->delivery == DELIVER_ON_COMMIT && (watcher->reset || watcher->head != watcher->tail)){
+            deliverSubscription(i);
+        }
+    }
+
+}
+
+
+//Function that subscribes a handler to the changes to a block of cells
+int subscribe_range(ROW first_row, COL first_col, ROW last_row, COL last_col, size_t capacity, DELIVERY delivery, CHANGE_HANDLER handler, void *context){
+
+    int index = 0;
+    size_t size = 16;
+
+    if(handler == NULL || delivering || first_row > last_row || first_col > last_col || (int) last_row >= spreadsheet->row || (int) last_col >= spreadsheet->col){
+        return -1;
+    }
+
+    while(index < subscriptionCount && subscriptions[index].handler != NULL){
+        ++index;
+    }
+    if(index == subscriptionCapacity){
+        int grownCapacity = subscriptionCapacity == 0 ? 4 : subscriptionCapacity * 2;
+        struct subscription *grown = realloc(subscriptions, grownCapacity * sizeof(struct subscription));
+        if(grown == NULL){
+            return -1;
+        }
+        subscriptions = grown;
+        subscriptionCapacity = grownCapacity;
+    }
+
+    //the ring is indexed by masking, so its size is a power of two
+    while(size < capacity){
+        size *= 2;
+    }
+
+    struct subscription *watcher = &subscriptions[index];
+    watcher->entries = malloc(size * sizeof(struct subscriptionEntry));
+    if(watcher->entries == NULL){
+        return -1;
+    }
+    watcher->handler = handler;
+    watcher->context = context;
+    watcher->delivery = delivery;
+    watcher->firstRow = first_row;
+    watcher->firstCol = first_col;
+    watcher->lastRow = last_row;
+    watcher->lastCol = last_col;
+    watcher->mask = size - 1;
+    watcher->head = 0;
+    watcher->tail = 0;
+    watcher->reset = true;
+    if(index == subscriptionCount){
+        ++subscriptionCount;
+    }
+
+    if(delivery == DELIVER_ON_COMMIT){
+        deliverSubscription(index);
+    }
+
+    return index;
+}
+
+
+//Function that delivers the pending changes of a subscription now
+void deliver_changes(int subscription){
+
+    if(subscription < 0 || subscription >= subscriptionCount || subscriptions[subscription].handler == NULL || delivering){
+        return;
+    }
+
+    trimChunks();
+
+    if(subscriptions[subscription].reset || subscriptions[subscription].head != subscriptions[subscription].tail){
+        deliverSubscription(subscription);
+    }
+}
+
+
+//Function that cancels a subscription
+void unsubscribe_range(int subscription){
+
+    if(subscription < 0 || subscription >= subscriptionCount || subscriptions[subscription].handler == NULL){
+        return;
+    }
+
+    free(subscriptions[subscription].entries);
+    subscriptions[subscription].entries = NULL;
+    subscriptions[subscription].handler = NULL;
+}
+
+
+//entries of the ring of the subscription of the shared memory mirror
+#define SHARED_VALUES_RING 65536
+
+
+//Function that returns a tile of the shared memory mirror
+static SHARED_VALUES_TILE* sharedTile(uint32_t tileRow, uint32_t tileCol){
+
+    return (SHARED_VALUES_TILE*) ((char*) sharedValues + sharedValues->tiles_offset + ((size_t) tileRow * sharedValues->tiles_across + tileCol) * sharedValues->tile_size);
+
+}
+
+
+//Function that starts writing a tile of the shared memory mirror, making its
+//sequence odd so that readers retry
+static void holdSharedTile(uint32_t tileRow, uint32_t tileCol){
+
+    _Atomic uint64_t* sequence = (_Atomic uint64_t*) &sharedTile(tileRow, tileCol)->sequence;
+
+    atomic_store_explicit(sequence, atomic_load_explicit(sequence, memory_order_relaxed) + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    sharedHeldTiles[tileCol] = true;
+}
+
+
+//Function that ends writing the tiles held along a row of tiles of the shared
+//memory mirror, making their sequences even again
+static void releaseSharedTiles(uint32_t tileRow){
+
+    for(uint32_t tileCol = 0; tileCol < sharedValues->tiles_across; tileCol++){
+        if(sharedHeldTiles[tileCol]){
+            _Atomic uint64_t* sequence = (_Atomic uint64_t*) &sharedTile(tileRow, tileCol)->sequence;
+            atomic_store_explicit(sequence, atomic_load_explicit(sequence, memory_order_relaxed) + 1, memory_order_release);
+            sharedHeldTiles[tileCol] = false;
+        }
+    }
+}
+
+
+//Function that writes the changes delivered to the shared memory mirror
+//
+//The changes come by row, so they are written a row of tiles at a time, the
+//tiles written being held until the row is done: a reader sees either all or
+//none of the changes of a commit to a tile. When the whole block is sent, each
+//tile is blanked first, unless it was never written.
+static void writeSharedValues(void* context, const CELL_CHANGE* changes, size_t count, bool reset){
+
+    uint32_t tileRow = 0;
+    size_t next = 0;
+
+    (void) context;
+
+    reset = reset && !sharedFresh;
+    sharedFresh = false;
+
+    while(reset ? tileRow < sharedValues->tiles_down : next < count){
+        if(!reset){
+            tileRow = changes[next].row / SHARED_TILE_ROWS;
+        }
+        for(uint32_t tileCol = 0; reset && tileCol < sharedValues->tiles_across; tileCol++){
+            SHARED_VALUES_TILE* tile = sharedTile(tileRow, tileCol);
+            holdSharedTile(tileRow, tileCol);
+            memset(tile->values, 0, sizeof(tile->values));
+            memset(tile->types, 0, sizeof(tile->types));
+        }
+        for(; next < count && changes[next].row / SHARED_TILE_ROWS == tileRow; next++){
+            uint32_t tileCol = changes[next].col / SHARED_TILE_COLS;
+            SHARED_VALUES_TILE* tile = sharedTile(tileRow, tileCol);
+            size_t cell = (changes[next].row % SHARED_TILE_ROWS) * SHARED_TILE_COLS + changes[next].col % SHARED_TILE_COLS;
+            if(!sharedHeldTiles[tileCol]){
+                holdSharedTile(tileRow, tileCol);
+            }
+            tile->values[cell] = changes[next].type == VALUE_NUMBER ? changes[next].number : 0.0;
+            tile->types[cell] = (uint8_t) changes[next].type;
+        }
+        releaseSharedTiles(tileRow);
+        ++tileRow;
+    }
+
+    atomic_fetch_add_explicit((_Atomic uint64_t*) &sharedValues->commits, 1, memory_order_release);
+}
+
+
+//Function that mirrors the values of a block into a shared memory object
+//
+//The object is sized for the whole block, so that readers never need to map
+//it again; tiles never written stay blank.
+bool share_values(const char *name, size_t rows, size_t cols){
+
+    if(sharedValues != NULL){
+        unsubscribe_range(sharedSubscription);
+        munmap(sharedValues, sharedSize);
+        shm_unlink(sharedName);
+        free(sharedName);
+        free(sharedHeldTiles);
+        sharedValues = NULL;
+        sharedName = NULL;
+        sharedHeldTiles = NULL;
+        sharedSubscription = -1;
+    }
+
+    if(name == NULL){
+        return true;
+    }
+    if(delivering || rows == 0 || cols == 0 || rows > (size_t) spreadsheet->row || cols > (size_t) spreadsheet->col){
+        return false;
+    }
+
+    uint32_t across = (uint32_t) ((cols + SHARED_TILE_COLS - 1) / SHARED_TILE_COLS);
+    uint32_t down = (uint32_t) ((rows + SHARED_TILE_ROWS - 1) / SHARED_TILE_ROWS);
+
+    //tiles start on their own cache lines, so that writing one does not make
+    //readers of its neighbours retry
+    size_t headerSize = (sizeof(SHARED_VALUES_HEADER) + 63) / 64 * 64;
+    size_t tileSize = (sizeof(SHARED_VALUES_TILE) + 63) / 64 * 64;
+    size_t size = headerSize + (size_t) across * down * tileSize;
+
+    int descriptor = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(descriptor == -1){
+        return false;
+    }
+    void* mapping = ftruncate(descriptor, (off_t) size) == 0 ? mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0) : MAP_FAILED;
+    close(descriptor);
+
+    sharedName = strdup(name);
+    sharedHeldTiles = calloc(across, sizeof(bool));
+    if(mapping == MAP_FAILED || sharedName == NULL || sharedHeldTiles == NULL){
+        if(mapping != MAP_FAILED){
+            munmap(mapping, size);
+        }
+        shm_unlink(name);
+        free(sharedName);
+        free(sharedHeldTiles);
+        sharedName = NULL;
+        sharedHeldTiles = NULL;
+        return false;
+    }
+
+    sharedValues = mapping;
+    sharedSize = size;
+    sharedFresh = true;
+    sharedValues->version = SHARED_VALUES_VERSION;
+    sharedValues->rows = (uint32_t) rows;
+    sharedValues->cols = (uint32_t) cols;
+    sharedValues->tiles_across = across;
+    sharedValues->tiles_down = down;
+    sharedValues->tile_size = tileSize;
+    sharedValues->tiles_offset = headerSize;
+
+    //the magic number last, once the rest of the header can be read
+    atomic_store_explicit((_Atomic uint32_t*) &sharedValues->magic, SHARED_VALUES_MAGIC, memory_order_release);
+
+    sharedSubscription = subscribe_range((ROW) 0, (COL) 0, (ROW) (rows - 1), (COL) (cols - 1), SHARED_VALUES_RING, DELIVER_ON_COMMIT, writeSharedValues, NULL);
+    if(sharedSubscription == -1){
+        share_values(NULL, 0, 0);
+        return false;
+    }
+
+    return true;
+}
+
+
+//Function that stores a value typed by the user in a cell, taking ownership of 'text'
+//
+//An empty or NULL value clears the cell. The change is not propagated to the
+//cell's dependents; the caller does that once it has stored all the values it
+//sets, under the same revision. Returns false if the cell was left as it was,
+//being cleared while blank.
+static bool storeCellValue(int row, int col, char *text){
+
+    if(text == NULL || text[0] == '\0'){
+        struct cell *target = findCell(row, col);
+
+        free(text);
+        displayCell(row, col, "");
+        if(target == NULL || target->type == BLANK){
+            return false;
+        }
+        updatePrecedentLinks(row, col, false);
+        clearCellMemory(target);
+        target->changedAt = revision;
+        noteChange(row, col, false);
+        updateCellIndexes(row, col);
+        return true;
+    }
+
+    struct cell *cellVariable2 = touchCell(row, col);
+
+    //unlink the previous formula and clear cell memory
+    updatePrecedentLinks(row, col, false);
+    clearCellMemory(cellVariable2);
+
+    if (text[0] == '=') {
+        //if input starts with '=', then treat it as an equation, which takes ownership of 'text'
+        cellVariable2->type = EQN;
+
+        size_t elementCount;
+        struct equationElemts *elmnt = parse_eqn(text, row, col, &elementCount);
+
+        //a valid formula is kept as a shared template; an invalid one keeps its text
+        if(elmnt != NULL){
+            cellVariable2->formula = internFormula(elmnt, elementCount);
+        }
+        if(cellVariable2->formula != NULL){
+            free(text);
+        }
+        else{
+            cellVariable2->celcontent.text = text;
+        }
+
+        cellVariable2->dirty = true;
+        noteChange(row, col, true);
+
+        updatePrecedentLinks(row, col, true);
+
+        updateCellIndexes(row, col);
+
+        return true;
+
+    }
+
+    //if not staring with '=', then check if it is a text or a numeric
+    char *endptr;
+
+    double number = strtod(text, &endptr);
+
+    //is a numeric value
+    if (*endptr == '\0') {
+        cellVariable2->type = NUM;
+
+        cellVariable2->celcontent.number = number;
+
+        //shown as it is once redrawn, rather than as typed
+        char numberStr[32];
+        formatNumber(number, numberStr, sizeof(numberStr));
+        displayCell(row, col, numberStr);
+
+        free(text);
+    }
+
+    //is a text, which takes ownership of 'text'
+    else {
+        cellVariable2->type = TXT;
+
+        cellVariable2->celcontent.text = text;
+
+        displayCell(row, col, text);
+    }
+
+    cellVariable2->changedAt = revision;
+    noteChange(row, col, false);
+
+    updateCellIndexes(row, col);
+
+    return true;
+}
+
+
+//Function that stores a value in the cell at physical 'row', 'col' as
+//set_cell_value does, appending the cell to a change set if it changed
+static void writeCellValue(int row, int col, char *text, struct changeSet *changes){
+
+    if(storeCellValue(row, col, text)){
+        appendChange(changes, row, col);
+    }
+}
+
+
+//Function that sets the value of a cell based on user input
+void set_cell_value(ROW row, COL col, char *text) {
+
+    int physicalRow = physicalLine(&rowMap, row);
+    int physicalCol = physicalLine(&colMap, col);
+
+    ++revision;
+
+    if(storeCellValue(physicalRow, physicalCol, text)){
+        propagateChange(physicalRow, physicalCol);
+    }
+}
+
+
+//Function that sets the values of a block of cells at once, as when pasting
+//
+//All the cells change under one revision and their dependents are dirtied and
+//recalculated once for the whole block, not once per cell.
+void set_cell_block(ROW row, COL col, size_t rows, size_t cols, char **texts) {
+
+    struct changeSet changes = {NULL, 0, 0};
+
+    ++revision;
+
+    for(size_t i = 0; i < rows; i++){
+        for(size_t j = 0; j < cols; j++){
+            char *text = texts[i * cols + j];
+            int targetRow = row + (int) i;
+            int targetCol = col + (int) j;
+
+            if(targetRow >= spreadsheet->row || targetCol >= spreadsheet->col){
+                free(text);
+                continue;
+            }
+            writeCellValue(physicalLine(&rowMap, targetRow), physicalLine(&colMap, targetCol), text, &changes);
+        }
+    }
+
+    propagateChanges(&changes);
+}
+
+
+//Function that clears the contents of a cell
+void clear_cell(ROW row, COL col) {
+    //get cell variable; a cell never allocated is already blank
+    int physicalRow = physicalLine(&rowMap, row);
+    int physicalCol = physicalLine(&colMap, col);
+    struct cell *cellVariable3 = findCell(physicalRow, physicalCol);
+
+    if(cellVariable3 == NULL){
+        update_cell_display(row, col, "");
+        return;
+    }
+
+    ++revision;
+
+    //unlink the formula and clear memory of cell, which sets its type to blank
+    updatePrecedentLinks(physicalRow, physicalCol, false);
+    clearCellMemory(cellVariable3);
+    cellVariable3->changedAt = revision;
+    noteChange(physicalRow, physicalCol, false);
+    updateCellIndexes(physicalRow, physicalCol);
+
+    //update ddisplay with empty string
+    update_cell_display(row, col, "");
+
+    propagateChange(physicalRow, physicalCol);
+}
+
+//Function that clears every cell of a physical block, appending those which were not blank to 'changes'
+//
+//Only the non-blank cells of allocated chunks are visited. Chunks left without
+//non-blank cells or cells with dependents are freed whole.
+static void clearBlock(int firstRow, int firstCol, int lastRow, int lastCol, struct changeSet *changes){
+
+    for(int chunkRow = firstRow / CHUNK_ROWS; chunkRow <= lastRow / CHUNK_ROWS; chunkRow++){
+        struct cellChunk **chunks = spreadsheet->chunks[chunkRow];
+        bool freed = false;
+
+        if(chunks == NULL){
+            continue;
+        }
+        for(int chunkCol = firstCol / CHUNK_COLS; chunkCol <= lastCol / CHUNK_COLS; chunkCol++){
+            struct cellChunk *chunk = chunks[chunkCol];
+            if(chunk == NULL){
+                continue;
+            }
+
+            int rowStart = chunkRow * CHUNK_ROWS > firstRow ? chunkRow * CHUNK_ROWS : firstRow;
+            int rowEnd = chunkRow * CHUNK_ROWS + CHUNK_ROWS - 1 < lastRow ? chunkRow * CHUNK_ROWS + CHUNK_ROWS - 1 : lastRow;
+            int colStart = chunkCol * CHUNK_COLS > firstCol ? chunkCol * CHUNK_COLS : firstCol;
+            int colEnd = chunkCol * CHUNK_COLS + CHUNK_COLS - 1 < lastCol ? chunkCol * CHUNK_COLS + CHUNK_COLS - 1 : lastCol;
+            unsigned columns = (0xffffu >> (CHUNK_COLS - 1 - colEnd % CHUNK_COLS)) & (0xffffu << colStart % CHUNK_COLS);
+            bool empty = true;
+
+            for(int i = rowStart; i <= rowEnd; i++){
+                unsigned occupied = chunk->occupied[i % CHUNK_ROWS] & columns;
+                for(; occupied != 0; occupied &= occupied - 1){
+                    int j = chunkCol * CHUNK_COLS + __builtin_ctz(occupied);
+
+                    updatePrecedentLinks(i, j, false);
+                    clearCellMemory(&modifiedChunk(chunk)->cells[i % CHUNK_ROWS][j % CHUNK_COLS]);
+                    chunk->cells[i % CHUNK_ROWS][j % CHUNK_COLS].changedAt = revision;
+                    noteChange(i, j, false);
+                    updateCellIndexes(i, j);
+                    displayCell(i, j, "");
+                    appendChange(changes, i, j);
+                }
+            }
+
+            for(int i = 0; i < CHUNK_ROWS && empty; i++){
+                empty = chunk->occupied[i] == 0;
+            }
+            if(empty && chunk->linkedCells == 0){
+                freeChunk(chunk);
+                chunks[chunkCol] = NULL;
+                chunksFreedAt = revision;
+                freed = true;
+            }
+        }
+
+        //free the row of chunks too once none is left in it
+        for(int chunkCol = 0; freed && chunkCol < spreadsheet->chunkCols; chunkCol++){
+            freed = chunks[chunkCol] == NULL;
+        }
+        if(freed){
+            free(chunks);
+            spreadsheet->chunks[chunkRow] = NULL;
+        }
+    }
+}
+
+//Function that clears every cell of a block
+//
+//Only the non-blank cells of allocated chunks are visited, and the dependents
+//of the block are dirtied once.
+void clear_range(ROW first_row, COL first_col, ROW last_row, COL last_col) {
+
+    struct changeSet changes = {NULL, 0, 0};
+    int lastRow = (int) last_row < spreadsheet->row ? (int) last_row : spreadsheet->row - 1;
+    int lastCol = (int) last_col < spreadsheet->col ? (int) last_col : spreadsheet->col - 1;
+
+    ++revision;
+
+    //the block is cleared a physically contiguous block at a time
+    for(int row = first_row; row <= lastRow;){
+        int physicalRow;
+        int rows = lineSegment(&rowMap, row, 1, &physicalRow);
+        if(rows > lastRow - row + 1){
+            rows = lastRow - row + 1;
+        }
+        for(int col = first_col; col <= lastCol;){
+            int physicalCol;
+            int cols = lineSegment(&colMap, col, 1, &physicalCol);
+            if(cols > lastCol - col + 1){
+                cols = lastCol - col + 1;
+            }
+            clearBlock(physicalRow, physicalCol, physicalRow + rows - 1, physicalCol + cols - 1, &changes);
+            col += cols;
+        }
+        row += rows;
+    }
+
+    propagateChanges(&changes);
+}
+
+//Function that copies the cell at 'row', 'col' to every cell of a block
+//
+//Formulas are copied by sharing the source cell's template, so relative
+//references shift with each copy and filling a column costs a few pointer
+//updates per row. Once lines were inserted or deleted, neighbouring logical
+//cells may not be physical neighbours, so each copy is relocated instead.
+void fill_cells(ROW row, COL col, ROW last_row, COL last_col) {
+
+    int sourceRow = physicalLine(&rowMap, row);
+    int sourceCol = physicalLine(&colMap, col);
+    const struct cell *source = touchCell(sourceRow, sourceCol);
+    struct changeSet changes = {NULL, 0, 0};
+    bool relocate = rowMap.moved || colMap.moved;
+
+    ++revision;
+
+    for(int logicalRow = row; logicalRow <= (int) last_row && logicalRow < spreadsheet->row; logicalRow++){
+        int i = physicalLine(&rowMap, logicalRow);
+        for(int logicalCol = col; logicalCol <= (int) last_col && logicalCol < spreadsheet->col; logicalCol++){
+            int j = physicalLine(&colMap, logicalCol);
+            struct cell *target = touchCell(i, j);
+            char numberStr[32];
+
+            if(target == source){
+                continue;
+            }
+
+            updatePrecedentLinks(i, j, false);
+            clearCellMemory(target);
+
+            target->type = source->type;
+            switch (source->type){
+                case NUM:
+                    target->celcontent.number = source->celcontent.number;
+                    formatNumber(target->celcontent.number, numberStr, sizeof(numberStr));
+                    displayCell(i, j, numberStr);
+                    break;
+                case TXT:
+                    target->celcontent.text = strdup(source->celcontent.text);
+                    displayCell(i, j, target->celcontent.text);
+                    break;
+                case EQN:
+                    if(source->formula != NULL && relocate){
+                        struct referenceMove move = {sourceRow, sourceCol, i, j, logicalRow - row, logicalCol - col, false, 0, 0};
+                        target->formula = relocateFormula(source->formula, &move);
+                    }
+                    else if(source->formula != NULL){
+                        target->formula = source->formula;
+                        ++target->formula->refCount;
+                    }
+                    else{
+                        target->celcontent.text = strdup(source->celcontent.text);
+                    }
+                    target->dirty = true;
+                    updatePrecedentLinks(i, j, true);
+                    break;
+                default:
+                    displayCell(i, j, "");
+                    break;
+            }
+
+            target->changedAt = revision;
+            noteChange(i, j, false);
+            updateCellIndexes(i, j);
+            appendChange(&changes, i, j);
+        }
+    }
+
+    propagateChanges(&changes);
+}
+
+//Function that compares cell positions, for qsort
+static int comparePositions(const void *first, const void *second){
+
+    const struct cellPosition *a = first;
+    const struct cellPosition *b = second;
+
+    if(a->row != b->row){
+        return a->row < b->row ? -1 : 1;
+    }
+    return a->col < b->col ? -1 : a->col > b->col;
+}
+
+
+//Function that appends the formulas of a subtree of the range index whose
+//ranges overlap the logical lines 'first' to 'last', rows or columns
+static void collectRangeDependents(const struct rangeNode *node, bool rows, int first, int last, struct changeSet *dependents){
+
+    while(node != NULL && (!rows || logicalLine(&rowMap, node->lastEnding->entry.lastRow) >= first)){
+        const struct rangeDependency *entry = &node->entry;
+
+        collectRangeDependents(node->left, rows, first, last, dependents);
+
+        //by rows, this range and those after it start after the lines
+        if(rows && logicalLine(&rowMap, entry->firstRow) > last){
+            return;
+        }
+        if(rows ? logicalLine(&rowMap, entry->lastRow) >= first
+                : logicalLine(&colMap, entry->firstCol) <= last && logicalLine(&colMap, entry->lastCol) >= first){
+            appendChange(dependents, entry->dependent.row, entry->dependent.col);
+        }
+        node = node->right;
+    }
+}
+
+
+//Function that collects the formulas referencing the 'count' logical lines
+//from 'first', rows or columns, other than those held in these lines
+static void collectLineDependents(bool rows, int first, int count, struct changeSet *dependents){
+
+    const struct lineMap *map = rows ? &rowMap : &colMap;
+    size_t kept = 0;
+
+    //single references are recorded with the cells of the lines
+    for(int line = first; line < first + count;){
+        int physical;
+        int length = lineSegment(map, line, 1, &physical);
+        if(length > first + count - line){
+            length = first + count - line;
+        }
+        int firstRow = rows ? physical : 0;
+        int lastRow = rows ? physical + length - 1 : spreadsheet->row - 1;
+        int firstCol = rows ? 0 : physical;
+        int lastCol = rows ? spreadsheet->col - 1 : physical + length - 1;
+
+        for(int chunkRow = firstRow / CHUNK_ROWS; chunkRow <= lastRow / CHUNK_ROWS; chunkRow++){
+            struct cellChunk **chunks = spreadsheet->chunks[chunkRow];
+            if(chunks == NULL){
+                continue;
+            }
+            for(int chunkCol = firstCol / CHUNK_COLS; chunkCol <= lastCol / CHUNK_COLS; chunkCol++){
+                struct cellChunk *chunk = chunks[chunkCol];
+                if(chunk == NULL || chunk->linkedCells == 0){
+                    continue;
+                }
+                residentChunk(chunk);
+                for(int i = chunkRow * CHUNK_ROWS; i < chunkRow * CHUNK_ROWS + CHUNK_ROWS; i++){
+                    for(int j = chunkCol * CHUNK_COLS; j < chunkCol * CHUNK_COLS + CHUNK_COLS; j++){
+                        const struct cell *cellVariable = &chunk->cells[i % CHUNK_ROWS][j % CHUNK_COLS];
+                        if(i < firstRow || i > lastRow || j < firstCol || j > lastCol){
+                            continue;
+                        }
+                        for(size_t k = 0; k < cellVariable->dependentCount; k++){
+                            appendChange(dependents, cellVariable->dependents[k].row, cellVariable->dependents[k].col);
+                        }
+                    }
+                }
+            }
+        }
+        line += length;
+    }
+
+    collectRangeDependents(rangeIndex, rows, first, first + count - 1, dependents);
+
+    //keep each formula once, and drop those about to be cleared
+    if(dependents->count > 0){
+        qsort(dependents->cells, dependents->count, sizeof(struct cellPosition), comparePositions);
+    }
+    for(size_t i = 0; i < dependents->count; i++){
+        struct cellPosition position = dependents->cells[i];
+        int line = rows ? logicalLine(map, position.row) : logicalLine(map, position.col);
+        if((kept > 0 && comparePositions(&dependents->cells[kept - 1], &position) == 0) || (line >= first && line < first + count)){
+            continue;
+        }
+        dependents->cells[kept++] = position;
+    }
+    dependents->count = kept;
+}
+
+
+static void movePivotTables(bool rows, int first, int count);
+
+//Function that empties the 'count' logical lines from 'first', rows or
+//columns, and moves them so that they start at 'to'
+//
+//This is how lines are deleted (moving them to the end) and inserted (moving
+//blank lines from the end). Cells stay where they are stored: only the map of
+//lines changes, which leaves the range index in order. The formulas
+//referencing the emptied lines are the only ones rewritten: single references
+//to them are lost, and ranges shrink to the lines left.
+static void recycleLines(bool rows, int first, int count, int to){
+
+    struct lineMap *map = rows ? &rowMap : &colMap;
+    struct changeSet dependents = {NULL, 0, 0};
+    struct changeSet cleared = {NULL, 0, 0};
+    struct changeSet changes = {NULL, 0, 0};
+    struct referenceMove move = {0, 0, 0, 0, 0, 0, rows, first, count};
+
+    ++revision;
+
+    dropLookupIndexes();
+    dropConditionIndexes();
+    movePivotTables(rows, first, count);
+    resetSubscriptions();
+    collectLineDependents(rows, first, count, &dependents);
+
+    for(size_t i = 0; i < dependents.count; i++){
+        struct cellPosition position = dependents.cells[i];
+        struct cell *cellVariable = findCell(position.row, position.col);
+        struct formulaTemplate *formula;
+
+        move.fromRow = move.toRow = position.row;
+        move.fromCol = move.toCol = position.col;
+        formula = relocateFormula(cellVariable->formula, &move);
+
+        //the formula must be recomputed even if none of the cells left changed
+        updatePrecedentLinks(position.row, position.col, false);
+        releaseFormula(cellVariable->formula);
+        cellVariable->formula = formula;
+        cellVariable->verifiedAt = 0;
+    }
+
+    for(int line = first; line < first + count;){
+        int physical;
+        int length = lineSegment(map, line, 1, &physical);
+        if(length > first + count - line){
+            length = first + count - line;
+        }
+        if(rows){
+            clearBlock(physical, 0, physical + length - 1, spreadsheet->col - 1, &cleared);
+        }
+        else{
+            clearBlock(0, physical, spreadsheet->row - 1, physical + length - 1, &cleared);
+        }
+        line += length;
+    }
+    free(cleared.cells);
+
+    moveLines(map, first, count, to);
+
+    //ranges the lines land within grow by them without any of their cells
+    //changing, which still moves the positions MATCH returns and adds blanks
+    //COUNTIF may count
+    size_t moved = dependents.count;
+    collectRangeDependents(rangeIndex, rows, to, to + count - 1, &dependents);
+    for(size_t i = moved; i < dependents.count; i++){
+        findCell(dependents.cells[i].row, dependents.cells[i].col)->verifiedAt = 0;
+        markDirty(&changes, dependents.cells[i]);
+    }
+    dependents.count = moved;
+
+    for(size_t i = 0; i < dependents.count; i++){
+        updatePrecedentLinks(dependents.cells[i].row, dependents.cells[i].col, true);
+        markDirty(&changes, dependents.cells[i]);
+    }
+    free(dependents.cells);
+
+    propagateChanges(&changes);
+}
+
+
+//Function that inserts blank rows, dropping as many from the end of the spreadsheet
+void insert_rows(ROW row, size_t count) {
+
+    if((int) row >= spreadsheet->row || count == 0){
+        return;
+    }
+    if(count > (size_t) (spreadsheet->row - (int) row)){
+        count = spreadsheet->row - (int) row;
+    }
+
+    recycleLines(true, spreadsheet->row - (int) count, (int) count, row);
+}
+
+
+//Function that deletes rows, moving the following ones up
+void delete_rows(ROW row, size_t count) {
+
+    if((int) row >= spreadsheet->row || count == 0){
+        return;
+    }
+    if(count > (size_t) (spreadsheet->row - (int) row)){
+        count = spreadsheet->row - (int) row;
+    }
+
+    recycleLines(true, row, (int) count, spreadsheet->row - (int) count);
+}
+
+
+//Function that inserts blank columns, dropping as many from the end of the spreadsheet
+void insert_cols(COL col, size_t count) {
+
+    if((int) col >= spreadsheet->col || count == 0){
+        return;
+    }
+    if(count > (size_t) (spreadsheet->col - (int) col)){
+        count = spreadsheet->col - (int) col;
+    }
+
+    recycleLines(false, spreadsheet->col - (int) count, (int) count, col);
+}
+
+
+//Function that deletes columns, moving the following ones left
+void delete_cols(COL col, size_t count) {
+
+    if((int) col >= spreadsheet->col || count == 0){
+        return;
+    }
+    if(count > (size_t) (spreadsheet->col - (int) col)){
+        count = spreadsheet->col - (int) col;
+    }
+
+    recycleLines(false, col, (int) count, spreadsheet->col - (int) count);
+}
+
+//most threads work is split among, and fewest items worth splitting
+#define PARALLEL_THREADS 16
+#define PARALLEL_ITEMS 65536
+
+//Function that returns how many threads to split work on 'count' items among
+static int parallelThreads(size_t count){
+
+    long processors = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if(count < PARALLEL_ITEMS || processors < 2){
+        return 1;
+    }
+    return processors < PARALLEL_THREADS ? (int) processors : PARALLEL_THREADS;
+}
+
+
+//Function that runs 'task' on each of the 'count' contexts of 'size' bytes
+//at 'contexts', each on its own thread, and waits for all of them
+//
+//The calling thread runs the first task, and any task whose thread cannot be
+//started.
+static void runParallel(void* (*task)(void*), void* contexts, size_t size, int count){
+
+    pthread_t threads[PARALLEL_THREADS];
+    bool started[PARALLEL_THREADS] = {false};
+
+    for(int i = 1; i < count; i++){
+        started[i] = pthread_create(&threads[i], NULL, task, (char*) contexts + i * size) == 0;
+    }
+    for(int i = 0; i < count; i++){
+        if(!started[i]){
+            task((char*) contexts + i * size);
+        }
+    }
+    for(int i = 1; i < count; i++){
+        if(started[i]){
+            pthread_join(threads[i], NULL);
+        }
+    }
+}
+
+
+//key of a row being sorted: the order of its sort key as an unsigned number,
+//and the row's offset in the sorted block
+struct sortKey{
+    uint64_t key;
+
+    uint32_t row;
+};
+
+
+//structure that hands a thread its slice of a radix sort pass
+struct radixSlice{
+    const struct sortKey* source;
+
+    struct sortKey* target;
+
+    size_t first;
+
+    size_t last;
+
+    int shift;
+
+    //count of each digit in the slice, then where the slice's keys with that
+    //digit go
+    size_t offsets[256];
+};
+
+
+//Function that counts the digits of a slice of a radix sort pass
+static void* countRadixSlice(void* argument){
+
+    struct radixSlice* slice = argument;
+
+    memset(slice->offsets, 0, sizeof(slice->offsets));
+    for(size_t i = slice->first; i < slice->last; i++){
+        ++slice->offsets[slice->source[i].key >> slice->shift & 0xff];
+    }
+    return NULL;
+}
+
+
+//Function that moves the keys of a slice of a radix sort pass to their place
+static void* scatterRadixSlice(void* argument){
+
+    struct radixSlice* slice = argument;
+
+    for(size_t i = slice->first; i < slice->last; i++){
+        slice->target[slice->offsets[slice->source[i].key >> slice->shift & 0xff]++] = slice->source[i];
+    }
+    return NULL;
+}
+
+
+//Function that sorts keys by 'key', keeping rows with equal keys in order
+//
+//This is a least significant digit radix sort, a byte per pass, skipping the
+//bytes all keys share. Each pass is split among threads: each counts the
+//digits of its slice, then scatters the slice from its own offsets, which
+//follow those of the slices before it.
+static void radixSortKeys(struct sortKey* keys, size_t count){
+
+    struct radixSlice slices[PARALLEL_THREADS];
+    int threads = parallelThreads(count);
+    struct sortKey* source = keys;
+    struct sortKey* target;
+    uint64_t same = ~(uint64_t) 0;
+
+    if(count < 2){
+        return;
+    }
+
+    //bits set in every key or in none do not need a pass
+    for(size_t i = 1; i < count; i++){
+        same &= ~(keys[i].key ^ keys[0].key);
+    }
+
+    target = malloc(count * sizeof(struct sortKey));
+    if(target == NULL){
+        fprintf(stderr, "Memory allocation error.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for(int shift = 0; shift < 64; shift += 8){
+        size_t offset = 0;
+
+        if((same >> shift & 0xff) == 0xff){
+            continue;
+        }
+
+        for(int i = 0; i < threads; i++){
+            slices[i].source = source;
+            slices[i].target = target;
+            slices[i].first = count * i / threads;
+            slices[i].last = count * (i + 1) / threads;
+            slices[i].shift = shift;
+        }
+        runParallel(countRadixSlice, slices, sizeof(struct radixSlice), threads);
+
+        for(int digit = 0; digit < 256; digit++){
+            for(int i = 0; i < threads; i++){
+                size_t digits = slices[i].offsets[digit];
+                slices[i].offsets[digit] = offset;
+                offset += digits;
+            }
+        }
+        runParallel(scatterRadixSlice, slices, sizeof(struct radixSlice), threads);
+
+        struct sortKey* swap = source;
+        source = target;
+        target = swap;
+    }
+
+    if(source != keys){
+        memcpy(keys, source, count * sizeof(struct sortKey));
+        target = source;
+    }
+    free(target);
+}
+
+
+//Function that returns the sort key of a number: the order of the keys of
+//numbers is the order of the numbers
+static uint64_t numberSortKey(double number){
+
+    uint64_t bits;
+
+    //-0 and 0 are equal
+    number += 0.0;
+    memcpy(&bits, &number, sizeof(bits));
+    return bits >> 63 ? ~bits : bits | (uint64_t) 1 << 63;
+}
+
+
+//Function that compares two strings the way text is sorted, for qsort:
+//regardless of case, then with upper case first
+static int compareSortText(const void* first, const void* second){
+
+    const char* a = *(const char* const*) first;
+    const char* b = *(const char* const*) second;
+    int order = strcasecmp(a, b);
+
+    return order != 0 ? order : strcmp(a, b);
+}
+
+
+//Function that returns the bucket of a hash table of texts holding 'text', or
+//the empty bucket where it belongs
+static size_t findTextBucket(const char** table, size_t buckets, const char* text){
+
+    unsigned long hash = 5381;
+
+    for(const char* c = text; *c != '\0'; c++){
+        hash = hash * 33 + (unsigned char) *c;
+    }
+
+    size_t bucket = hash & (buckets - 1);
+    while(table[bucket] != NULL && strcmp(table[bucket], text) != 0){
+        bucket = (bucket + 1) & (buckets - 1);
+    }
+    return bucket;
+}
+
+
+//Function that sets the key of each of 'count' rows to the rank of its text
+//in 'texts', indexed by row
+//
+//Texts are interned through a hash table so that each distinct text is sorted
+//once, whatever the number of rows holding it.
+static void rankSortTexts(struct sortKey* keys, const char** texts, size_t count){
+
+    size_t buckets = 16;
+    const char** table;
+    uint64_t* ranks;
+    const char** distinct;
+    size_t distinctCount = 0;
+
+    while(buckets < 2 * count){
+        buckets *= 2;
+    }
+    table = calloc(buckets, sizeof(const char*));
+    ranks = malloc(buckets * sizeof(uint64_t));
+    distinct = malloc((count == 0 ? 1 : count) * sizeof(const char*));
+    if(table == NULL || ranks == NULL || distinct == NULL){
+        fprintf(stderr, "Memory allocation error.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    //intern the texts, keeping the bucket of each row's text as its key for now
+    for(size_t i = 0; i < count; i++){
+        size_t bucket = findTextBucket(table, buckets, texts[keys[i].row]);
+        if(table[bucket] == NULL){
+            table[bucket] = texts[keys[i].row];
+            distinct[distinctCount++] = table[bucket];
+        }
+        keys[i].key = bucket;
+    }
+
+    if(distinctCount > 1){
+        qsort(distinct, distinctCount, sizeof(const char*), compareSortText);
+    }
+    for(size_t i = 0; i < distinctCount; i++){
+        ranks[findTextBucket(table, buckets, distinct[i])] = i;
+    }
+    for(size_t i = 0; i < count; i++){
+        keys[i].key = ranks[keys[i].key];
+    }
+
+    free(table);
+    free(ranks);
+    free(distinct);
+}
+
+
+//Function that returns the physical line of each of 'count' logical lines from 'first'
+static int* physicalLines(const struct lineMap* map, int first, int count){
+
+    int* lines = malloc((count == 0 ? 1 : count) * sizeof(int));
+
+    if(lines == NULL){
+        fprintf(stderr, "Memory allocation error.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for(int line = first; line < first + count;){
+        int physical;
+        int length = lineSegment(map, line, 1, &physical);
+        for(int i = 0; i < length && line < first + count; i++, line++){
+            lines[line - first] = physical + i;
+        }
+    }
+    return lines;
+}
+
+
+//Function that takes the contents of 'width' cells of physical 'row' into
+//'contents', unlinking their formulas, and leaves the cells blank
+//
+//The dependents of the cells stay with them, as they belong to the position.
+static void takeRowContents(int row, const int* cols, int width, struct cell* contents){
+
+    for(int j = 0; j < width; j++){
+        struct cell* cellVariable = findCell(row, cols[j]);
+
+        if(cellVariable == NULL){
+            memset(&contents[j], 0, sizeof(struct cell));
+            contents[j].type = BLANK;
+            continue;
+        }
+        updatePrecedentLinks(row, cols[j], false);
+        contents[j] = *cellVariable;
+        cellVariable->type = BLANK;
+        cellVariable->celcontent.text = NULL;
+        cellVariable->formula = NULL;
+    }
+}
+
+
+//Function that puts contents taken by takeRowContents into the cells of
+//physical 'row', keeping their dependents
+static void putRowContents(int row, const int* cols, int width, const struct cell* contents){
+
+    for(int j = 0; j < width; j++){
+        struct cell* cellVariable = findCell(row, cols[j]);
+
+        if(contents[j].type == BLANK && cellVariable == NULL){
+            continue;
+        }
+        cellVariable = touchCell(row, cols[j]);
+
+        struct cellPosition* dependents = cellVariable->dependents;
+        size_t dependentCount = cellVariable->dependentCount;
+        size_t dependentCapacity = cellVariable->dependentCapacity;
+        *cellVariable = contents[j];
+        cellVariable->dependents = dependents;
+        cellVariable->dependentCount = dependentCount;
+        cellVariable->dependentCapacity = dependentCapacity;
+        cellVariable->evaluating = false;
+    }
+}
+
+
+//Function that sorts the rows of a block by the values of one of its columns
+//
+//The keys are read into an array of integers ordered as the values are: the
+//bits of numbers, and the ranks of interned texts. Each kind is radix sorted
+//on its own, then whole rows are moved, the cells of a row being next to each
+//other in their chunk. The dependents of a position stay with it, so only the
+//formulas moved are relinked. As when inserting lines, the cells moved are not
+//sent to the display.
+void sort_range(ROW first_row, COL first_col, ROW last_row, COL last_col, COL key_col, bool descending) {
+
+    int lastRow = (int) last_row < spreadsheet->row ? (int) last_row : spreadsheet->row - 1;
+    int lastCol = (int) last_col < spreadsheet->col ? (int) last_col : spreadsheet->col - 1;
+    int count = lastRow - (int) first_row + 1;
+    int width = lastCol - (int) first_col + 1;
+
+    if(count < 2 || width < 1 || key_col < first_col || (int) key_col > lastCol){
+        return;
+    }
+
+    int* rows = physicalLines(&rowMap, first_row, count);
+    int* cols = physicalLines(&colMap, first_col, width);
+    int keyCol = cols[key_col - first_col];
+    struct sortKey* numbers = malloc(count * sizeof(struct sortKey));
+    struct sortKey* texts = malloc(count * sizeof(struct sortKey));
+    const char** textValues = malloc(count * sizeof(const char*));
+    int* order = malloc(count * sizeof(int));
+    uint32_t* errors = malloc(count * sizeof(uint32_t));
+    uint32_t* blanks = malloc(count * sizeof(uint32_t));
+    struct cell* held = malloc(width * sizeof(struct cell));
+    struct cell* moved = malloc(width * sizeof(struct cell));
+    bool* done = calloc(count, sizeof(bool));
+    size_t numberCount = 0;
+    size_t textCount = 0;
+    size_t errorCount = 0;
+    size_t blankCount = 0;
+    int next = 0;
+    bool relocate = rowMap.moved || colMap.moved;
+    struct changeSet changes = {NULL, 0, 0};
+
+    if(numbers == NULL || texts == NULL || textValues == NULL || order == NULL || errors == NULL || blanks == NULL
+       || held == NULL || moved == NULL || done == NULL){
+        fprintf(stderr, "Memory allocation error.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    //numbers come before texts, then errors, then blanks; descending reverses
+    //all but the blanks
+    for(int i = 0; i < count; i++){
+        const struct cell* key = readCell(rows[i], keyCol);
+        double value;
+
+        if(key == NULL || key->type == BLANK){
+            blanks[blankCount++] = (uint32_t) i;
+        }
+        else if(key->type == TXT){
+            textValues[i] = key->celcontent.text;
+            texts[textCount++].row = (uint32_t) i;
+        }
+        else if(key->type == NUM){
+            numbers[numberCount].key = numberSortKey(key->celcontent.number);
+            numbers[numberCount++].row = (uint32_t) i;
+        }
+        else if(evaluateCell(rows[i], keyCol, &value) == EVAL_OK){
+            numbers[numberCount].key = numberSortKey(value);
+            numbers[numberCount++].row = (uint32_t) i;
+        }
+        else{
+            errors[errorCount++] = (uint32_t) i;
+        }
+    }
+
+    rankSortTexts(texts, textValues, textCount);
+    for(size_t i = 0; descending && i < numberCount; i++){
+        numbers[i].key = ~numbers[i].key;
+    }
+    for(size_t i = 0; descending && i < textCount; i++){
+        texts[i].key = ~texts[i].key;
+    }
+    radixSortKeys(numbers, numberCount);
+    radixSortKeys(texts, textCount);
+
+    for(size_t i = 0; descending && i < errorCount; i++){
+        order[next++] = (int) errors[i];
+    }
+    for(size_t i = 0; i < (descending ? textCount : numberCount); i++){
+        order[next++] = (int) (descending ? texts : numbers)[i].row;
+    }
+    for(size_t i = 0; i < (descending ? numberCount : textCount); i++){
+        order[next++] = (int) (descending ? numbers : texts)[i].row;
+    }
+    for(size_t i = 0; !descending && i < errorCount; i++){
+        order[next++] = (int) errors[i];
+    }
+    for(size_t i = 0; i < blankCount; i++){
+        order[next++] = (int) blanks[i];
+    }
+
+    ++revision;
+
+    //rows are moved along the cycles of the permutation, so that only one row
+    //is held aside at a time
+    for(int i = 0; i < count; i++){
+        if(order[i] == i || done[i]){
+            continue;
+        }
+        takeRowContents(rows[i], cols, width, held);
+        int target = i;
+        for(; order[target] != i; target = order[target]){
+            takeRowContents(rows[order[target]], cols, width, moved);
+            putRowContents(rows[target], cols, width, moved);
+            done[target] = true;
+        }
+        putRowContents(rows[target], cols, width, held);
+        done[target] = true;
+    }
+
+    for(int i = 0; i < count; i++){
+        for(int j = 0; order[i] != i && j < width; j++){
+            struct cell* target = findCell(rows[i], cols[j]);
+
+            if(target == NULL){
+                continue;
+            }
+            if(target->type == EQN){
+                if(target->formula != NULL && relocate){
+                    struct referenceMove move = {rows[order[i]], cols[j], rows[i], cols[j], i - order[i], 0, false, 0, 0};
+                    struct formulaTemplate* formula = relocateFormula(target->formula, &move);
+                    releaseFormula(target->formula);
+                    target->formula = formula;
+                }
+                target->dirty = true;
+                target->verifiedAt = 0;
+                target->displayStale = true;
+                updatePrecedentLinks(rows[i], cols[j], true);
+            }
+            target->changedAt = revision;
+            noteChange(rows[i], cols[j], false);
+            updateCellIndexes(rows[i], cols[j]);
+            appendChange(&changes, rows[i], cols[j]);
+        }
+    }
+
+    free(rows);
+    free(cols);
+    free(numbers);
+    free(texts);
+    free(textValues);
+    free(order);
+    free(errors);
+    free(blanks);
+    free(held);
+    free(moved);
+    free(done);
+
+    propagateChanges(&changes);
+}
+
+
+//Function that returns the partition of a pivot table holding the group of a key with the given hash
+static size_t pivotPartitionOf(unsigned long hash){
+
+    //the high bits of the product depend on every bit of the hash
+    return (size_t) ((hash * 0x9e3779b97f4a7c15ul) >> 32) % PIVOT_PARTITIONS;
+}
+
+
+//Function that returns the group of a pivot partition holding 'key', or the
+//empty group where it belongs
+static struct pivotGroup* probePivotGroup(const struct pivotPartition* partition, const struct lookupKey* key, unsigned long hash){
+
+    size_t bucket = hash & (partition->capacity - 1);
+
+    while(partition->groups[bucket].key.kind != LOOKUP_NONE && compareLookupKeys(&partition->groups[bucket].key, key) != 0){
+        bucket = (bucket + 1) & (partition->capacity - 1);
+    }
+    return &partition->groups[bucket];
+}
+
+
+//Function that returns the group of a pivot partition holding 'key', adding
+//one if there is none
+static struct pivotGroup* findPivotGroup(struct pivotPartition* partition, const struct lookupKey* key, unsigned long hash){
+
+    if(2 * (partition->used + 1) > partition->capacity){
+        //grow the table, dropping the groups left without rows
+        struct pivotGroup* groups = partition->groups;
+        size_t capacity = partition->capacity;
+
+        partition->capacity = capacity == 0 ? 16 : capacity;
+        while(2 * (partition->used + 1) > partition->capacity){
+            partition->capacity *= 2;
+        }
+        partition->groups = calloc(partition->capacity, sizeof(struct pivotGroup));
+        if(partition->groups == NULL){
+            fprintf(stderr, "Memory allocation error.\n");
+            exit(EXIT_FAILURE);
+        }
+        partition->used = 0;
+        for(size_t i = 0; i < capacity; i++){
+            if(groups[i].count == 0){
+                free(groups[i].key.text);
+                continue;
+            }
+            *probePivotGroup(partition, &groups[i].key, hashLookupKey(&groups[i].key)) = groups[i];
+            ++partition->used;
+        }
+        free(groups);
+    }
+
+    struct pivotGroup* group = probePivotGroup(partition, key, hash);
+    if(group->key.kind == LOOKUP_NONE){
+        copyLookupKey(&group->key, key);
+        group->firstRow = PIVOT_NO_ROW;
+        ++partition->used;
+    }
+    return group;
+}
+
+
+//Function that adds the row at 'offset' of a pivot table to the group of its
+//key, by its key and value as last read, returning whether the group had no
+//rows before
+//
+//Only the partition of the key is written, so rows of different partitions
+//may be added on different threads.
+static bool addPivotRow(struct pivotTable* pivot, uint32_t offset){
+
+    const struct lookupKey* key = &pivot->keys[offset];
+    const struct lookupKey* value = &pivot->values[offset];
+
+    if(key->kind != LOOKUP_NUMBER && key->kind != LOOKUP_TEXT){
+        return false;
+    }
+
+    unsigned long hash = hashLookupKey(key);
+    struct pivotGroup* group = findPivotGroup(&pivot->partitions[pivotPartitionOf(hash)], key, hash);
+
+    pivot->previousRow[offset] = PIVOT_NO_ROW;
+    pivot->nextRow[offset] = group->firstRow;
+    if(group->firstRow != PIVOT_NO_ROW){
+        pivot->previousRow[group->firstRow] = offset;
+    }
+    group->firstRow = offset;
+    group->changed = true;
+
+    if(value->kind == LOOKUP_NUMBER){
+        if(group->numbers == 0 || value->number < group->min){
+            group->min = value->number;
+        }
+        if(group->numbers == 0 || value->number > group->max){
+            group->max = value->number;
+        }
+        addCompensated(&group->sum, &group->error, value->number);
+        ++group->numbers;
+    }
+    return group->count++ == 0;
+}
+
+
+//Function that removes the row at 'offset' of a pivot table from the group of
+//its key, by its key and value as last read, returning whether the group is
+//left without rows
+static bool removePivotRow(struct pivotTable* pivot, uint32_t offset){
+
+    const struct lookupKey* key = &pivot->keys[offset];
+    const struct lookupKey* value = &pivot->values[offset];
+
+    if(key->kind != LOOKUP_NUMBER && key->kind != LOOKUP_TEXT){
+        return false;
+    }
+
+    unsigned long hash = hashLookupKey(key);
+    struct pivotGroup* group = probePivotGroup(&pivot->partitions[pivotPartitionOf(hash)], key, hash);
+    uint32_t previous = pivot->previousRow[offset];
+    uint32_t next = pivot->nextRow[offset];
+
+    if(previous == PIVOT_NO_ROW){
+        group->firstRow = next;
+    }
+    else{
+        pivot->nextRow[previous] = next;
+    }
+    if(next != PIVOT_NO_ROW){
+        pivot->previousRow[next] = previous;
+    }
+    group->changed = true;
+
+    //taking the number out of the sum could leave the rounding errors of
+    //adding it, so the group is recounted instead
+    if(value->kind == LOOKUP_NUMBER){
+        --group->numbers;
+        group->stale = group->numbers > 0;
+        if(group->numbers == 0){
+            group->sum = 0.0;
+            group->error = 0.0;
+        }
+    }
+    return --group->count == 0;
+}
+
+
+//Function that recounts the sum and extremes of the numbers of a pivot group from its rows
+static void recountPivotGroup(const struct pivotTable* pivot, struct pivotGroup* group){
+
+    bool first = true;
+
+    group->sum = 0.0;
+    group->error = 0.0;
+    for(uint32_t offset = group->firstRow; offset != PIVOT_NO_ROW; offset = pivot->nextRow[offset]){
+        const struct lookupKey* value = &pivot->values[offset];
+        if(value->kind != LOOKUP_NUMBER){
+            continue;
+        }
+        addCompensated(&group->sum, &group->error, value->number);
+        if(first || value->number < group->min){
+            group->min = value->number;
+        }
+        if(first || value->number > group->max){
+            group->max = value->number;
+        }
+        first = false;
+    }
+    group->stale = false;
+}
+
+
+//Function that reads the key and value of the row at 'offset' of a pivot
+//table from the physical 'row', computing formulas; a formula failing to
+//compute reads as a blank. Returns whether either is a formula.
+static bool readPivotRow(struct pivotTable* pivot, uint32_t offset, int row){
+
+    bool formula = false;
+
+    for(int side = 0; side < 2; side++){
+        int col = side == 0 ? pivot->keyCol : pivot->valueCol;
+        struct lookupKey key;
+
+        trimChunks();
+        readLookupKey(row, col, &key);
+        if(key.kind == LOOKUP_FORMULA){
+            formula = true;
+            key.kind = evaluateCell(row, col, &key.number) == EVAL_OK ? LOOKUP_NUMBER : LOOKUP_NONE;
+        }
+        if(side == 0){
+            copyLookupKey(&pivot->keys[offset], &key);
+        }
+        else{
+            key.text = NULL;
+            pivot->values[offset] = key;
+        }
+    }
+    return formula;
+}
+
+
+//Function that frees what a pivot table holds of its source and groups
+static void clearPivotTable(struct pivotTable* pivot){
+
+    for(int i = 0; pivot->keys != NULL && i < pivot->rowCount; i++){
+        free(pivot->keys[i].text);
+    }
+    for(int i = 0; i < PIVOT_PARTITIONS; i++){
+        struct pivotPartition* partition = &pivot->partitions[i];
+        for(size_t j = 0; j < partition->capacity; j++){
+            free(partition->groups[j].key.text);
+        }
+        free(partition->groups);
+        partition->groups = NULL;
+        partition->capacity = partition->used = 0;
+    }
+    free(pivot->keys);
+    free(pivot->values);
+    free(pivot->nextRow);
+    free(pivot->previousRow);
+    free(pivot->order);
+    pivot->keys = pivot->values = NULL;
+    pivot->nextRow = pivot->previousRow = NULL;
+    pivot->order = NULL;
+    pivot->orderCount = 0;
+    pivot->formulaCount = 0;
+    pivot->editedCount = 0;
+}
+
+
+//Function that frees a pivot table
+static void freePivotTable(struct pivotTable* pivot){
+
+    clearPivotTable(pivot);
+    free(pivot->formulaRows);
+    free(pivot->editedRows);
+    free(pivot);
+}
+
+
+//structure that hands a thread the partitions of a pivot table it aggregates:
+//those from 'first' on, every 'step'
+struct pivotSlice{
+    struct pivotTable* pivot;
+
+    const uint8_t* partitionOf;
+
+    int first;
+
+    int step;
+};
+
+
+//Function that adds the rows of a slice of partitions of a pivot table to their groups, run on a thread
+static void* aggregatePivotSlice(void* context){
+
+    const struct pivotSlice* slice = context;
+
+    for(int offset = 0; offset < slice->pivot->rowCount; offset++){
+        int partition = slice->partitionOf[offset];
+        if(partition < PIVOT_PARTITIONS && partition % slice->step == slice->first){
+            addPivotRow(slice->pivot, (uint32_t) offset);
+        }
+    }
+    return NULL;
+}
+
+
+//Function that appends the row at 'offset' to the rows of a pivot table holding formulas
+static void addPivotFormulaRow(struct pivotTable* pivot, uint32_t offset){
+
+    if(pivot->formulaCount == pivot->formulaCapacity){
+        pivot->formulaCapacity = pivot->formulaCapacity == 0 ? 16 : pivot->formulaCapacity * 2;
+        pivot->formulaRows = realloc(pivot->formulaRows, pivot->formulaCapacity * sizeof(uint32_t));
+        if(pivot->formulaRows == NULL){
+            fprintf(stderr, "Memory allocation error.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    pivot->formulaRows[pivot->formulaCount++] = offset;
+}
+
+
+//Function that reads the whole source of a pivot table and groups its rows
+//
+//The cells are read in order, then the rows are added to their groups by
+//partition, each partition on one thread, so that no two threads write the
+//same table.
+static void readPivotSource(struct pivotTable* pivot){
+
+    clearPivotTable(pivot);
+
+    pivot->logicalFirst = logicalLine(&rowMap, pivot->firstRow);
+    pivot->rowCount = logicalLine(&rowMap, pivot->lastRow) - pivot->logicalFirst + 1;
+    pivot->keys = calloc(pivot->rowCount, sizeof(struct lookupKey));
+    pivot->values = calloc(pivot->rowCount, sizeof(struct lookupKey));
+    pivot->nextRow = malloc(pivot->rowCount * sizeof(uint32_t));
+    pivot->previousRow = malloc(pivot->rowCount * sizeof(uint32_t));
+    uint8_t* partitionOf = malloc(pivot->rowCount);
+    if(pivot->keys == NULL || pivot->values == NULL || pivot->nextRow == NULL || pivot->previousRow == NULL || partitionOf == NULL){
+        fprintf(stderr, "Memory allocation error.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for(int line = pivot->logicalFirst; line < pivot->logicalFirst + pivot->rowCount;){
+        int physical;
+        int length = lineSegment(&rowMap, line, 1, &physical);
+        for(int i = 0; i < length && line < pivot->logicalFirst + pivot->rowCount; i++, line++){
+            uint32_t offset = (uint32_t) (line - pivot->logicalFirst);
+            const struct lookupKey* key = &pivot->keys[offset];
+
+            if(readPivotRow(pivot, offset, physical + i)){
+                addPivotFormulaRow(pivot, offset);
+            }
+            partitionOf[offset] = key->kind == LOOKUP_NUMBER || key->kind == LOOKUP_TEXT ? (uint8_t) pivotPartitionOf(hashLookupKey(key)) : PIVOT_PARTITIONS;
+        }
+    }
+
+    int threads = parallelThreads((size_t) pivot->rowCount);
+    struct pivotSlice slices[PARALLEL_THREADS];
+    for(int i = 0; i < threads; i++){
+        slices[i] = (struct pivotSlice) {pivot, partitionOf, i, threads};
+    }
+    runParallel(aggregatePivotSlice, slices, sizeof(struct pivotSlice), threads);
+    free(partitionOf);
+
+    pivot->stale = false;
+    pivot->reorder = true;
+}
+
+
+//Function that orders two pivot groups by key, for qsort
+static int comparePivotGroups(const void* first, const void* second){
+
+    return compareLookupKeys(&(*(struct pivotGroup* const*) first)->key, &(*(struct pivotGroup* const*) second)->key);
+}
+
+
+//Function that returns a number as a text for a cell, reading back as the
+//same number, or NULL for none
+static char* pivotNumberText(double number, bool present){
+
+    char* text;
+
+    if(!present){
+        return NULL;
+    }
+    text = malloc(32);
+    if(text == NULL){
+        fprintf(stderr, "Memory allocation error.\n");
+        exit(EXIT_FAILURE);
+    }
+    formatRoundTrip(number, text, 32);
+    return text;
+}
+
+
+//number of columns of the results of a pivot table
+#define PIVOT_COLUMNS 6
+
+//Function that writes the results row 'position' of a pivot table for a
+//group, or clears it if 'group' is NULL: the key, then the sum, count,
+//minimum, maximum and mean of the numbers
+static void writePivotRow(const struct pivotTable* pivot, size_t position, const struct pivotGroup* group, struct changeSet* changes){
+
+    int row = logicalLine(&rowMap, pivot->outRow) + (int) position;
+    int col = logicalLine(&colMap, pivot->outCol);
+    char* texts[PIVOT_COLUMNS] = {NULL};
+
+    if(group != NULL){
+        bool numbers = group->numbers > 0;
+        texts[0] = group->key.kind == LOOKUP_TEXT ? strdup(group->key.text) : pivotNumberText(group->key.number, true);
+        texts[1] = pivotNumberText(group->sum + group->error, true);
+        texts[2] = pivotNumberText((double) group->count, true);
+        texts[3] = pivotNumberText(group->min, numbers);
+        texts[4] = pivotNumberText(group->max, numbers);
+        texts[5] = pivotNumberText(numbers ? (group->sum + group->error) / (double) group->numbers : 0.0, numbers);
+    }
+
+    for(int j = 0; j < PIVOT_COLUMNS; j++){
+        if(row >= spreadsheet->row || col + j >= spreadsheet->col){
+            free(texts[j]);
+            continue;
+        }
+        writeCellValue(physicalLine(&rowMap, row), physicalLine(&colMap, col + j), texts[j], changes);
+    }
+}
+
+
+//Function that orders two offsets, for qsort
+static int compareOffsets(const void* first, const void* second){
+
+    uint32_t a = *(const uint32_t*) first;
+    uint32_t b = *(const uint32_t*) second;
+
+    return (a > b) - (a < b);
+}
+
+
+//Function that brings a pivot table up to date with its source and writes
+//the results that changed, returning whether any were written
+//
+//Only the rows edited since the last refresh, and those holding formulas, are
+//read again. If no group was added or emptied, only the results rows of the
+//groups changed are written; otherwise the groups are sorted again and every
+//results row is written.
+static bool refreshPivotTable(struct pivotTable* pivot, struct changeSet* changes){
+
+    bool written = false;
+
+    if(pivot->stale){
+        readPivotSource(pivot);
+    }
+    else{
+        size_t formulas = pivot->formulaCount;
+        size_t edited = pivot->editedCount;
+
+        //rows no longer holding formulas are only dropped from the list on a full read
+        for(size_t i = 0; i < formulas + edited; i++){
+            uint32_t offset = i < formulas ? pivot->formulaRows[i] : pivot->editedRows[i - formulas];
+            bool formula;
+
+            pivot->reorder |= removePivotRow(pivot, offset);
+            formula = readPivotRow(pivot, offset, physicalLine(&rowMap, pivot->logicalFirst + (int) offset));
+            pivot->reorder |= addPivotRow(pivot, offset);
+            if(formula && i >= formulas){
+                addPivotFormulaRow(pivot, offset);
+            }
+        }
+        pivot->editedCount = 0;
+
+        //keep each row with a formula once
+        if(pivot->formulaCount > 1){
+            size_t kept = 1;
+            qsort(pivot->formulaRows, pivot->formulaCount, sizeof(uint32_t), compareOffsets);
+            for(size_t i = 1; i < pivot->formulaCount; i++){
+                if(pivot->formulaRows[i] != pivot->formulaRows[kept - 1]){
+                    pivot->formulaRows[kept++] = pivot->formulaRows[i];
+                }
+            }
+            pivot->formulaCount = kept;
+        }
+    }
+
+    if(pivot->reorder){
+        size_t count = 0;
+
+        for(int i = 0; i < PIVOT_PARTITIONS; i++){
+            count += pivot->partitions[i].used;
+        }
+        free(pivot->order);
+        pivot->order = malloc((count == 0 ? 1 : count) * sizeof(struct pivotGroup*));
+        if(pivot->order == NULL){
+            fprintf(stderr, "Memory allocation error.\n");
+            exit(EXIT_FAILURE);
+        }
+        pivot->orderCount = 0;
+        for(int i = 0; i < PIVOT_PARTITIONS; i++){
+            for(size_t j = 0; j < pivot->partitions[i].capacity; j++){
+                struct pivotGroup* group = &pivot->partitions[i].groups[j];
+                if(group->key.kind != LOOKUP_NONE && group->count > 0){
+                    group->changed = true;
+                    pivot->order[pivot->orderCount++] = group;
+                }
+            }
+        }
+        if(pivot->orderCount > 1){
+            qsort(pivot->order, pivot->orderCount, sizeof(struct pivotGroup*), comparePivotGroups);
+        }
+    }
+
+    for(size_t i = 0; i < pivot->orderCount; i++){
+        struct pivotGroup* group = pivot->order[i];
+        if(!group->changed){
+            continue;
+        }
+        if(group->stale){
+            recountPivotGroup(pivot, group);
+        }
+        writePivotRow(pivot, i, group, changes);
+        group->changed = false;
+        written = true;
+    }
+
+    //clear the rows of the groups gone
+    if(pivot->reorder){
+        for(size_t i = pivot->orderCount; i < pivot->writtenRows; i++){
+            writePivotRow(pivot, i, NULL, changes);
+            written = true;
+        }
+        pivot->writtenRows = pivot->orderCount;
+        pivot->reorder = false;
+    }
+    return written;
+}
+
+
+//whether the pivot tables are being refreshed, as writing their results
+//propagates changes again
+static bool refreshingPivots = false;
+
+//Function that brings every pivot table up to date with its source
+//
+//Results may feed the source of other pivot tables, so this goes over them
+//until none has edits left, at most once more than there are tables should
+//they feed each other in a cycle.
+static void refreshPivots(){
+
+    size_t passes = 1;
+
+    if(refreshingPivots){
+        return;
+    }
+    refreshingPivots = true;
+
+    for(struct pivotTable* pivot = pivotTables; pivot != NULL; pivot = pivot->next){
+        ++passes;
+    }
+    for(bool pending = true; pending && passes > 0; passes--){
+        pending = false;
+        for(struct pivotTable* pivot = pivotTables; pivot != NULL; pivot = pivot->next){
+            struct changeSet changes = {NULL, 0, 0};
+
+            if(!pivot->stale && pivot->editedCount == 0 && pivot->formulaCount == 0){
+                continue;
+            }
+
+            //results are newer than the values they are computed from
+            ++revision;
+            if(refreshPivotTable(pivot, &changes)){
+                propagateChanges(&changes);
+            }
+        }
+        for(struct pivotTable* pivot = pivotTables; pivot != NULL; pivot = pivot->next){
+            pending |= pivot->stale || pivot->editedCount > 0;
+        }
+    }
+
+    refreshingPivots = false;
+}
+
 
+//Function that unlinks and frees the pivot table writing its results at physical 'row', 'col', if any,
+//returning how many results rows it had written
+static size_t removePivotTable(int row, int col){
 
-//structure that represent equation's elements 
-struct equationElemts{
+    for(struct pivotTable** link = &pivotTables; *link != NULL; link = &(*link)->next){
+        struct pivotTable* pivot = *link;
+        if(pivot->outRow == row && pivot->outCol == col){
+            size_t writtenRows = pivot->writtenRows;
+            *link = pivot->next;
+            freePivotTable(pivot);
+            return writtenRows;
+        }
+    }
+    return 0;
+}
 
-    enum eqnType type;
-    
-    union{
 
-        char* referenceCell;
-    
-        char operatorSymbol;
-    
-        char operator;
-    
-        double operand;
+//Function that prepares the pivot tables for the 'count' logical lines from
+//'first', rows or columns, being emptied and moved
+//
+//A table whose source ends or key, value or results are on these lines is
+//dropped, leaving its results as values; the others read their source again
+//on the next refresh.
+static void movePivotTables(bool rows, int first, int count){
 
-    
-    }celcontent2;
+    struct pivotTable** link = &pivotTables;
 
+    while(*link != NULL){
+        struct pivotTable* pivot = *link;
+        const struct lineMap* map = rows ? &rowMap : &colMap;
+        int anchors[3] = {rows ? pivot->firstRow : pivot->keyCol, rows ? pivot->lastRow : pivot->valueCol, rows ? pivot->outRow : pivot->outCol};
+        bool dropped = false;
 
-};
+        for(int i = 0; i < 3; i++){
+            int line = logicalLine(map, anchors[i]);
+            dropped |= line >= first && line < first + count;
+        }
+        if(dropped){
+            *link = pivot->next;
+            freePivotTable(pivot);
+            continue;
+        }
+        pivot->stale = true;
+        link = &pivot->next;
+    }
+}
 
 
+//Function that groups the rows of a block by key and writes their totals, kept up to date
+void group_range(ROW first_row, ROW last_row, COL key_col, COL value_col, ROW out_row, COL out_col) {
 
+    if(first_row > last_row || (int) last_row >= spreadsheet->row || (int) key_col >= spreadsheet->col || (int) value_col >= spreadsheet->col
+       || (int) out_row >= spreadsheet->row || (int) out_col >= spreadsheet->col){
+        return;
+    }
 
-struct excelSpreadSheet* spreadsheet = NULL;
+    struct pivotTable* pivot = calloc(1, sizeof(struct pivotTable));
+    if(pivot == NULL){
+        fprintf(stderr, "Memory allocation error.\n");
+        exit(EXIT_FAILURE);
+    }
+    pivot->firstRow = physicalLine(&rowMap, first_row);
+    pivot->lastRow = physicalLine(&rowMap, last_row);
+    pivot->keyCol = physicalLine(&colMap, key_col);
+    pivot->valueCol = physicalLine(&colMap, value_col);
+    pivot->outRow = physicalLine(&rowMap, out_row);
+    pivot->outCol = physicalLine(&colMap, out_col);
+    pivot->stale = true;
+
+    //take over the results of the table written there before, if any
+    pivot->writtenRows = removePivotTable(pivot->outRow, pivot->outCol);
+
+    struct pivotTable** link = &pivotTables;
+    while(*link != NULL){
+        link = &(*link)->next;
+    }
+    *link = pivot;
 
-//Function that duplicates a string up to a specific length
-char *custom_strnduplicate(const char *string, size_t n){
+    refreshPivots();
+}
 
-    size_t length = strlen(string);
 
-    char *duplicate = malloc(length+1);
+//Function that stops keeping the results of group_range at 'out_row', 'out_col' up to date
+void ungroup_range(ROW out_row, COL out_col) {
 
-    if(duplicate != NULL){
-    
-        strncpy(duplicate, string, length);
-    
-        duplicate[length] = '\0';
-    
+    if((int) out_row >= spreadsheet->row || (int) out_col >= spreadsheet->col){
+        return;
     }
+    removePivotTable(physicalLine(&rowMap, out_row), physicalLine(&colMap, out_col));
+}
 
 
-    return duplicate;
+//trials a simulation evaluates together, and the most values of random cells
+//a thread keeps for them
+#define SIMULATION_BLOCK 256
+#define SIMULATION_VALUES 1048576
+
+//Function that adds the formula cell at physical 'row', 'col' to a simulation,
+//returning the index of its node
+static size_t addSimulationNode(struct simulation* run, int row, int col){
 
+    if(run->nodeCount == run->nodeCapacity){
+        run->nodeCapacity *= 2;
+        run->nodes = realloc(run->nodes, run->nodeCapacity * sizeof(struct simulationNode));
+        run->order = realloc(run->order, run->nodeCapacity * sizeof(size_t));
+        if(run->nodes == NULL || run->order == NULL){
+            fprintf(stderr, "Memory allocation error.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
 
+    //keep the table at most half full
+    if(2 * (run->nodeCount + 1) > run->tableCapacity){
+        free(run->table);
+        run->tableCapacity *= 2;
+        run->table = malloc(run->tableCapacity * sizeof(size_t));
+        if(run->table == NULL){
+            fprintf(stderr, "Memory allocation error.\n");
+            exit(EXIT_FAILURE);
+        }
+        memset(run->table, 0xff, run->tableCapacity * sizeof(size_t));
+        for(size_t i = 0; i < run->nodeCount; i++){
+            size_t slot = mixBits((uint64_t) (uint32_t) run->nodes[i].row << 32 | (uint32_t) run->nodes[i].col) & (run->tableCapacity - 1);
+            while(run->table[slot] != SIZE_MAX){
+                slot = (slot + 1) & (run->tableCapacity - 1);
+            }
+            run->table[slot] = i;
+        }
+    }
 
+    size_t slot = mixBits((uint64_t) (uint32_t) row << 32 | (uint32_t) col) & (run->tableCapacity - 1);
+    while(run->table[slot] != SIZE_MAX){
+        slot = (slot + 1) & (run->tableCapacity - 1);
+    }
+    run->table[slot] = run->nodeCount;
+
+    struct simulationNode* node = &run->nodes[run->nodeCount];
+    node->row = row;
+    node->col = col;
+    node->random = false;
+    node->visiting = false;
+    node->cyclic = false;
+    node->slot = 0;
+    node->input = SIZE_MAX;
+    node->formula = NULL;
+    node->loads = NULL;
+    return run->nodeCount++;
 }
 
 
-//Function that free memory allocated for the equation elements
-void freeEqnElmnts(struct equationElemts* elmnt){
+static bool visitSimulationCell(struct simulation* run, int row, int col);
 
-    for (size_t i = 0; elmnt[i].type != INVALID; i++){
+//Function that adds a term to a SUM over random cells, unless a term every
+//trial reaching it fails at was already added
+static void addSimulationTerm(struct simulationLoad* sum, size_t slot, double value, enum evalStatus status){
 
-        if(elmnt[i].type == REF_CELL){
-        
-            free(elmnt[i].celcontent2.referenceCell);
-        
+    if(sum->termCount > 0 && sum->terms[sum->termCount - 1].status != EVAL_OK){
+        return;
+    }
+    if(slot == SIZE_MAX && sum->termCount == 0){
+        if(sum->status == EVAL_OK){
+            sum->value += value;
+            sum->status = status;
         }
-    
+        return;
     }
-    
-    
-    free(elmnt);
+
+    if(sum->termCount == sum->termCapacity){
+        sum->termCapacity = sum->termCapacity == 0 ? 16 : 2 * sum->termCapacity;
+        sum->terms = realloc(sum->terms, sum->termCapacity * sizeof(struct simulationTerm));
+        if(sum->terms == NULL){
+            fprintf(stderr, "Memory allocation error.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    sum->terms[sum->termCount].slot = slot;
+    sum->terms[sum->termCount].value = value;
+    sum->terms[sum->termCount].status = status;
+    ++sum->termCount;
 }
 
-//Function for clearing the cell memory of a cell 
-void clearCellMemory(struct cell cellVariable){
 
-    if(cellVariable.type == TXT){
+//Function that adds the formula cells of a physical block to a simulation,
+//returning whether any of them is random
+//
+//If 'sum' is not NULL, the block is added to it as sumBlock adds it up.
+static bool visitSimulationBlock(struct simulation* run, int firstRow, int firstCol, int lastRow, int lastCol, struct simulationLoad* sum){
 
-        free(cellVariable.celcontent.text);
+    bool random = false;
 
+    for(int chunkRow = firstRow / CHUNK_ROWS; chunkRow <= lastRow / CHUNK_ROWS; chunkRow++){
+        if(spreadsheet->chunks[chunkRow] == NULL){
+            continue;
+        }
+        for(int chunkCol = firstCol / CHUNK_COLS; chunkCol <= lastCol / CHUNK_COLS; chunkCol++){
+            struct cellChunk *chunk = spreadsheet->chunks[chunkRow][chunkCol];
+            if(chunk == NULL){
+                continue;
+            }
+            pinChunk(residentChunk(chunk));
+
+            int rowStart = chunkRow * CHUNK_ROWS > firstRow ? chunkRow * CHUNK_ROWS : firstRow;
+            int rowEnd = chunkRow * CHUNK_ROWS + CHUNK_ROWS - 1 < lastRow ? chunkRow * CHUNK_ROWS + CHUNK_ROWS - 1 : lastRow;
+            int colStart = chunkCol * CHUNK_COLS > firstCol ? chunkCol * CHUNK_COLS : firstCol;
+            int colEnd = chunkCol * CHUNK_COLS + CHUNK_COLS - 1 < lastCol ? chunkCol * CHUNK_COLS + CHUNK_COLS - 1 : lastCol;
+
+            for(int j = rowStart; j <= rowEnd; j++){
+                for(int k = colStart; k <= colEnd; k++){
+                    enum cellContent type = chunk->cells[j % CHUNK_ROWS][k % CHUNK_COLS].type;
+                    unsigned long newestChange = 0;
+                    double value;
+
+                    if((type == EQN || run->inputCount > 0) && visitSimulationCell(run, j, k)){
+                        random = true;
+                        if(sum != NULL){
+                            addSimulationTerm(sum, run->nodes[findSimulationNode(run, j, k)].slot, 0.0, EVAL_OK);
+                        }
+                    }
+                    else if(sum != NULL && (type == EQN || type == NUM)){
+                        enum evalStatus status = loadCell(j, k, &value, &newestChange);
+                        addSimulationTerm(sum, SIZE_MAX, value, status);
+                    }
+                }
+            }
+            unpinChunk(chunk);
+        }
     }
 
+    return random;
 }
 
-//initialization of the model
-void model_init() {
 
-    //Allocate memory for the excel spreadsheet
-    int defineCols = 7;
-    int defineRows = 10;
+//Function that adds the formula cells read by a function call of the formula
+//at physical 'row', 'col' to a simulation, returning whether any of them is
+//random
+//
+//If 'sum' is not NULL, the call is a SUM, whose terms are added to it.
+static bool visitSimulationCall(struct simulation* run, const struct functionCall* call, int row, int col, struct simulationLoad* sum){
 
-    spreadsheet = (struct excelSpreadSheet*)malloc(sizeof(struct excelSpreadSheet));
+    bool random = false;
 
-    spreadsheet->cells = (struct cell**)malloc(defineRows * sizeof(struct cell*));
-    
-    spreadsheet->row = defineRows;
-    
-    spreadsheet->col = defineCols;
+    for(size_t i = 0; i < call->argumentCount; i++){
+        const struct functionArgument *argument = &call->arguments[i];
+        struct rangeDependency block;
+
+        if(argument->type == ARG_NUMBER){
+            if(sum != NULL){
+                addSimulationTerm(sum, SIZE_MAX, argument->value.number, EVAL_OK);
+            }
+            continue;
+        }
+        if(argument->type == ARG_REF){
+            if(!resolveReference(&argument->value.range.first, row, col, &block.firstRow, &block.firstCol)){
+                if(sum != NULL){
+                    addSimulationTerm(sum, SIZE_MAX, 0.0, EVAL_BAD_REFERENCE);
+                }
+            }
+            else if(visitSimulationBlock(run, block.firstRow, block.firstCol, block.firstRow, block.firstCol, sum)){
+                random = true;
+            }
+            continue;
+        }
+        if(!resolveRange(&argument->value.range, row, col, &block)){
+            if(sum != NULL){
+                addSimulationTerm(sum, SIZE_MAX, 0.0, EVAL_BAD_REFERENCE);
+            }
+            continue;
+        }
 
-    //initialize each cell to be blank
-    for(int i = 0; i < defineRows; i++){
+        //a physically contiguous block at a time, as for evaluateSum
+        int lastRow = logicalLine(&rowMap, block.lastRow);
+        int lastCol = logicalLine(&colMap, block.lastCol);
+        for(int firstRow = logicalLine(&rowMap, block.firstRow); firstRow <= lastRow;){
+            int physicalRow;
+            int rows = lineSegment(&rowMap, firstRow, 1, &physicalRow);
+            if(rows > lastRow - firstRow + 1){
+                rows = lastRow - firstRow + 1;
+            }
+            for(int firstCol = logicalLine(&colMap, block.firstCol); firstCol <= lastCol;){
+                int physicalCol;
+                int cols = lineSegment(&colMap, firstCol, 1, &physicalCol);
+                if(cols > lastCol - firstCol + 1){
+                    cols = lastCol - firstCol + 1;
+                }
+                if(visitSimulationBlock(run, physicalRow, physicalCol, physicalRow + rows - 1, physicalCol + cols - 1, sum)){
+                    random = true;
+                }
+                firstCol += cols;
+            }
+            firstRow += rows;
+        }
+    }
 
-        spreadsheet->cells[i] = (struct cell*)malloc(defineCols * sizeof(struct cell));
-        for (int j = 0; j < defineCols; j++){
+    return random;
+}
 
-            spreadsheet->cells[i][j].type = BLANK;
 
-            spreadsheet->cells[i][j].celcontent.text = NULL;
-        }
+//Function that frees the loads of a formula in a simulation
+static void freeSimulationLoads(struct simulationLoad* loads, size_t count){
 
+    for(size_t i = 0; i < count; i++){
+        free(loads[i].terms);
     }
+    free(loads);
+}
 
 
-    
-}
+//Function that adds the cell at physical 'row', 'col' to a simulation, if it
+//holds a formula, after the formula cells it depends on; returns whether its
+//value differs between trials
+//
+//Each cell is brought up to date on the way, so that trials only ever read
+//the memoized values of the cells they do not compute. The loads of a random
+//formula that are the same in every trial are computed once here.
+static bool visitSimulationCell(struct simulation* run, int row, int col){
 
+    const struct cell* cellVariable = readCell(row, col);
+    size_t index = findSimulationNode(run, row, col);
+    double value;
 
+    if(index != SIZE_MAX){
+        if(run->nodes[index].visiting){
+            run->nodes[index].cyclic = true;
+        }
+        return run->nodes[index].random;
+    }
+    if(cellVariable == NULL || cellVariable->type != EQN){
+        return false;
+    }
+    index = addSimulationNode(run, row, col);
 
+    //the evaluation may have paged the cell out
+    if(evaluateCell(row, col, &value) == EVAL_CIRCULAR || readCell(row, col)->formula == NULL){
+        return false;
+    }
 
+    const struct formulaTemplate* formula = readCell(row, col)->formula;
+    struct simulationLoad* loads = malloc((formula->loadCount + 1) * sizeof(struct simulationLoad));
+    bool random = false;
 
-//Function that parse an equation and returns its elements
-struct equationElemts* parse_eqn(const char* equation){
+    if(loads == NULL){
+        fprintf(stderr, "Memory allocation error.\n");
+        exit(EXIT_FAILURE);
+    }
 
-    size_t currentPosition = 0;
+    run->nodes[index].visiting = true;
+    for(size_t i = 0; i < formula->loadCount; i++){
+        const struct formulaLoad* load = &formula->loads[i];
+        unsigned long newestChange = 0;
+        int targetRow;
+        int targetCol;
+
+        loads[i].kind = SIM_CONSTANT;
+        loads[i].value = 0.0;
+        loads[i].status = EVAL_OK;
+        loads[i].slot = 0;
+        loads[i].terms = NULL;
+        loads[i].termCount = 0;
+        loads[i].termCapacity = 0;
+
+        if(load->type == FUNCTION_CALL && load->source.call->name == FN_RAND){
+            if(run->drawing){
+                loads[i].kind = SIM_RAND;
+            }
+            else{
+                loads[i].value = drawRandom(randomStream(0, row, col, i), 0);
+            }
+        }
+        else if(load->type == FUNCTION_CALL && load->source.call->name == FN_SUM){
+            //a SUM failing before its first random term fails in every trial
+            if(visitSimulationCall(run, load->source.call, row, col, &loads[i]) && loads[i].status == EVAL_OK){
+                loads[i].kind = SIM_SUM;
+            }
+        }
+        else if(load->type == FUNCTION_CALL){
+            if(visitSimulationCall(run, load->source.call, row, col, NULL)){
+                loads[i].kind = SIM_CALL;
+            }
+            //made once here even if random, to build the indexes trials read
+            loads[i].status = evaluateFunctionCall(load->source.call, row, col, &loads[i].value, &newestChange);
+        }
+        else if(!resolveReference(&load->source.reference, row, col, &targetRow, &targetCol)){
+            loads[i].status = EVAL_BAD_REFERENCE;
+        }
+        else if(visitSimulationCell(run, targetRow, targetCol)){
+            loads[i].kind = SIM_CELL;
+            loads[i].slot = run->nodes[findSimulationNode(run, targetRow, targetCol)].slot;
+        }
+        else{
+            loads[i].status = loadCell(targetRow, targetCol, &loads[i].value, &newestChange);
+        }
 
-    size_t elementIndex = 0;
-    
-    size_t eqnLength = strlen(equation);
-    
-    struct equationElemts* elmnt = (struct equationElemts*)malloc((eqnLength + 1)*sizeof(struct equationElemts));
+        if(loads[i].kind != SIM_CONSTANT){
+            random = true;
+        }
+    }
+    run->nodes[index].visiting = false;
 
+    //a cell on a cycle keeps its value, as the cells reading it took it to
+    if(!random || run->nodes[index].cyclic){
+        freeSimulationLoads(loads, formula->loadCount);
+        return false;
+    }
 
-    while (currentPosition < eqnLength){
+    struct simulationNode* node = &run->nodes[index];
+    node->random = true;
+    node->slot = run->randomCount;
+    node->formula = formula;
+    node->loads = loads;
+    run->order[run->randomCount++] = index;
+    if(formula->loadCount > run->maxLoads){
+        run->maxLoads = formula->loadCount;
+    }
+    return true;
+}
 
-        //check for the operator '+' and '-'
-        if (equation[currentPosition] == '-' || equation[currentPosition] == '+'){
-            elmnt[elementIndex].type = OPERATOR;
-            elmnt[elementIndex].celcontent2.operatorSymbol = equation[currentPosition];
-            ++currentPosition;
+
+//Function that evaluates a random cell of a simulation in 'count' trials from
+//'first' on, the block of trials its thread is at
+//
+//The formula is run as by runFormula, one load or instruction at a time over
+//every trial of the block rather than one trial at a time, so that the values
+//of a trial are the same whichever way its trials are split.
+static void evaluateSimulationNode(struct simulationThread* thread, const struct simulationNode* node, size_t first, size_t count){
+
+    const struct simulation* run = thread->simulation;
+    const struct formulaTemplate* formula = node->formula;
+    size_t block = run->blockTrials;
+    double* value = &thread->values[node->slot * block];
+    unsigned char* status = &thread->statuses[node->slot * block];
+
+    if(node->input != SIZE_MAX){
+        for(size_t t = 0; t < count; t++){
+            value[t] = run->inputValues[(first + t) * run->inputCount + node->input];
+            status[t] = EVAL_OK;
         }
+        return;
+    }
 
-        else if(isalpha(equation[currentPosition])){
-            //check for references to another cell
-            elmnt[elementIndex].type = REF_CELL;
+    for(size_t t = 0; t < count; t++){
+        value[t] = formula->initialValue;
+        status[t] = EVAL_OK;
+    }
 
-            //find the end of the cell references
-            size_t cellReferenceEnd = currentPosition + 1;
-            while(isalpha(equation[cellReferenceEnd])){
-                ++cellReferenceEnd;
+    //gather the loads, keeping the first error of each trial
+    for(size_t i = 0; i < formula->loadCount; i++){
+        const struct simulationLoad* load = &node->loads[i];
+        double* loadValue = &thread->loadValues[i * block];
+        const unsigned char* loadStatus = &thread->loadStatuses[i * block];
+
+        switch(load->kind){
+            case SIM_CONSTANT:
+                if(load->status == EVAL_OK){
+                    continue;
+                }
+                for(size_t t = 0; t < count; t++){
+                    if(status[t] == EVAL_OK){
+                        status[t] = (unsigned char) load->status;
+                    }
+                }
+                continue;
+            case SIM_RAND:{
+                uint64_t stream = randomStream(run->seed, node->row, node->col, i);
+                for(size_t t = 0; t < count; t++){
+                    loadValue[t] = drawRandom(stream, first + t);
+                }
+                continue;
+            }
+            case SIM_CELL:
+                loadStatus = &thread->statuses[load->slot * block];
+                break;
+            case SIM_SUM:
+                for(size_t t = 0; t < count; t++){
+                    loadValue[t] = load->value;
+                    thread->loadStatuses[i * block + t] = EVAL_OK;
+                }
+                for(size_t j = 0; j < load->termCount; j++){
+                    const struct simulationTerm* term = &load->terms[j];
+                    unsigned char* sumStatus = &thread->loadStatuses[i * block];
+                    if(term->slot == SIZE_MAX){
+                        for(size_t t = 0; t < count; t++){
+                            loadValue[t] += term->value;
+                            sumStatus[t] = sumStatus[t] == EVAL_OK ? (unsigned char) term->status : sumStatus[t];
+                        }
+                        continue;
+                    }
+                    const double* termValue = &thread->values[term->slot * block];
+                    const unsigned char* termStatus = &thread->statuses[term->slot * block];
+                    for(size_t t = 0; t < count; t++){
+                        loadValue[t] += termValue[t];
+                        sumStatus[t] = sumStatus[t] == EVAL_OK ? termStatus[t] : sumStatus[t];
+                    }
+                }
+                break;
+            default:
+                for(size_t t = 0; t < count; t++){
+                    unsigned long newestChange = 0;
+                    thread->trial = t;
+                    thread->loadStatuses[i * block + t] = (unsigned char) evaluateFunctionCall(formula->loads[i].source.call, node->row, node->col, &loadValue[t], &newestChange);
+                }
+                break;
+        }
+        for(size_t t = 0; t < count; t++){
+            if(status[t] == EVAL_OK){
+                status[t] = loadStatus[t];
             }
+        }
+    }
 
-            //duplicate the reference cell's string
-            elmnt[elementIndex].celcontent2.referenceCell = custom_strnduplicate(&equation[currentPosition], (cellReferenceEnd-currentPosition));
+    for(size_t j = 0; j < formula->programLength; j++){
+        const struct formulaInstruction* instruction = &formula->program[j];
 
-            currentPosition = cellReferenceEnd;
+        if(instruction->op == ADD_CONSTANT){
+            for(size_t t = 0; t < count; t++){
+                value[t] += instruction->arg.constant;
+            }
+            continue;
         }
 
-        else if(isdigit(equation[currentPosition])){
-            //check for numeric operand
-            elmnt[elementIndex].type = OPERAND;
-            elmnt[elementIndex].celcontent2.operand = atof(&equation[currentPosition]);
-
-            //move to end of numeric operand
-            while (equation[currentPosition] == '.' || isdigit(equation[currentPosition])){
-                ++currentPosition;
+        const struct simulationLoad* load = &node->loads[instruction->arg.load];
+        if(load->kind == SIM_CONSTANT){
+            for(size_t t = 0; t < count; t++){
+                value[t] = instruction->op == ADD_LOAD ? value[t] + load->value : value[t] - load->value;
             }
+            continue;
         }
 
+        const double* operand = load->kind == SIM_CELL ? &thread->values[load->slot * block] : &thread->loadValues[instruction->arg.load * block];
+        if(instruction->op == ADD_LOAD){
+            for(size_t t = 0; t < count; t++){
+                value[t] += operand[t];
+            }
+        }
         else{
-            //means invalid character in the equation
-            elmnt[elementIndex].type = INVALID;
-            ++currentPosition;
+            for(size_t t = 0; t < count; t++){
+                value[t] -= operand[t];
+            }
         }
+    }
 
-        ++elementIndex;
+    for(size_t t = 0; t < count; t++){
+        if(status[t] != EVAL_OK){
+            value[t] = 0.0;
+        }
     }
+}
 
-    //mark the end of elements 
-    elmnt[elementIndex].type = INVALID;
-    return elmnt;
+
+//Function that runs the blocks of trials of a simulation given to a thread
+static void* runSimulationBlocks(void* context){
+
+    struct simulationThread* thread = context;
+    const struct simulation* run = thread->simulation;
+    size_t block = run->blockTrials;
+
+    thread->values = malloc((run->randomCount * block + 1) * sizeof(double));
+    thread->statuses = malloc(run->randomCount * block + 1);
+    thread->loadValues = malloc((run->maxLoads * block + 1) * sizeof(double));
+    thread->loadStatuses = malloc(run->maxLoads * block + 1);
+    if(thread->values == NULL || thread->statuses == NULL || thread->loadValues == NULL || thread->loadStatuses == NULL){
+        fprintf(stderr, "Memory allocation error.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    simulation = thread;
+    for(size_t first = thread->firstBlock * block; first < run->trials; first += thread->step * block){
+        size_t count = run->trials - first < block ? run->trials - first : block;
+
+        for(size_t i = 0; i < run->randomCount; i++){
+            evaluateSimulationNode(thread, &run->nodes[run->order[i]], first, count);
+        }
+
+        for(size_t t = 0; t < count; t++){
+            double* results = &run->results[(first + t) * run->outputCount];
+            for(size_t k = 0; k < run->outputCount; k++){
+                size_t slot = run->outputSlots[k];
+                enum evalStatus status = run->outputStatuses[k];
+                if(slot == SIZE_MAX){
+                    results[k] = run->outputValues[k];
+                }
+                else{
+                    status = (enum evalStatus) thread->statuses[slot * block + t];
+                    results[k] = status == EVAL_OK ? thread->values[slot * block + t] : NAN;
+                }
+                if(run->resultStatuses != NULL){
+                    run->resultStatuses[(first + t) * run->outputCount + k] = status;
+                }
+            }
+        }
+    }
+    simulation = NULL;
+
+    free(thread->values);
+    free(thread->statuses);
+    free(thread->loadValues);
+    free(thread->loadStatuses);
+    return NULL;
 }
 
 
+//Function that compiles the cone of the 'count' cells at physical 'rows[i]',
+//'cols[i]' for a simulation in which the 'inputCount' cells at physical
+//'inputRows[j]', 'inputCols[j]' are given a value in each trial, and RAND
+//draws new numbers from 'seed' if 'drawing'
+//
+//The cone is brought up to date on the way. The input cells are allocated if
+//they were not, so that ranges over them find them.
+static void compileSimulation(struct simulation* run, const int* rows, const int* cols, size_t count, const int* inputRows, const int* inputCols, size_t inputCount, bool drawing, uint64_t seed){
+
+    memset(run, 0, sizeof(struct simulation));
+    run->drawing = drawing;
+    run->seed = seed;
+    run->nodeCapacity = 64;
+    run->tableCapacity = 128;
+    run->nodes = malloc(run->nodeCapacity * sizeof(struct simulationNode));
+    run->order = malloc(run->nodeCapacity * sizeof(size_t));
+    run->table = malloc(run->tableCapacity * sizeof(size_t));
+    run->outputSlots = malloc((count + 1) * sizeof(size_t));
+    run->outputValues = malloc((count + 1) * sizeof(double));
+    run->outputStatuses = malloc((count + 1) * sizeof(enum evalStatus));
+    if(run->nodes == NULL || run->order == NULL || run->table == NULL || run->outputSlots == NULL || run->outputValues == NULL || run->outputStatuses == NULL){
+        fprintf(stderr, "Memory allocation error.\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(run->table, 0xff, run->tableCapacity * sizeof(size_t));
+    run->outputCount = count;
+    run->inputCount = inputCount;
+    run->inputRows = inputRows;
+    run->inputCols = inputCols;
+
+    //inputs come first, as they depend on nothing
+    for(size_t j = 0; j < inputCount; j++){
+        size_t index = addSimulationNode(run, inputRows[j], inputCols[j]);
+        touchCell(inputRows[j], inputCols[j]);
+        run->nodes[index].random = true;
+        run->nodes[index].input = j;
+        run->nodes[index].slot = run->randomCount;
+        run->order[run->randomCount++] = index;
+    }
 
-//Function that converts column letter to index
-int columnLetterToIndex(char letter){
+    //cells outside the sheet, at row -1, fail to compute
+    for(size_t k = 0; k < count; k++){
+        run->outputSlots[k] = SIZE_MAX;
+        run->outputValues[k] = NAN;
+        run->outputStatuses[k] = EVAL_BAD_REFERENCE;
+        if(rows[k] < 0){
+            continue;
+        }
+        if(visitSimulationCell(run, rows[k], cols[k])){
+            run->outputSlots[k] = run->nodes[findSimulationNode(run, rows[k], cols[k])].slot;
+        }
+        else if((run->outputStatuses[k] = evaluateCell(rows[k], cols[k], &run->outputValues[k])) != EVAL_OK){
+            run->outputValues[k] = NAN;
+        }
+    }
 
+    run->blockTrials = run->randomCount == 0 ? SIMULATION_BLOCK : SIMULATION_VALUES / run->randomCount;
+    if(run->blockTrials > SIMULATION_BLOCK){
+        run->blockTrials = SIMULATION_BLOCK;
+    }
+    if(run->blockTrials == 0){
+        run->blockTrials = 1;
+    }
+}
 
-    return toupper(letter) - 'A';
 
+//Function that runs 'trials' trials of a compiled simulation, storing the
+//values of its cells in 'results' and, if it is not NULL, their statuses in
+//'statuses', trial by trial; 'inputs' holds the values of its inputs, trial
+//by trial
+static void runSimulation(struct simulation* run, size_t trials, const double* inputs, double* results, enum evalStatus* statuses){
+
+    run->trials = trials;
+    run->inputValues = inputs;
+    run->results = results;
+    run->resultStatuses = statuses;
+
+    //threads take every so many blocks of trials; as a trial draws the same
+    //numbers wherever it runs, the results do not depend on how many there are
+    size_t blocks = (trials + run->blockTrials - 1) / run->blockTrials;
+    struct simulationThread threads[PARALLEL_THREADS];
+    int threadCount = parallelThreads(trials * run->randomCount);
+    if((size_t) threadCount > blocks){
+        threadCount = blocks == 0 ? 1 : (int) blocks;
+    }
+    for(int i = 0; i < threadCount; i++){
+        threads[i].simulation = run;
+        threads[i].trial = 0;
+        threads[i].firstBlock = (size_t) i;
+        threads[i].step = (size_t) threadCount;
+    }
+    runParallel(runSimulationBlocks, threads, sizeof(struct simulationThread), threadCount);
 }
 
-//Function that converts cell reference to column and row indicies 
-void cellReferenceToIndicies(const char* referenceCell, int* row, int* col){
-   
-    *col = columnLetterToIndex(referenceCell[0]);
-    *row = atoi(&referenceCell[1]) - 1;
 
+//Function that frees a compiled simulation
+static void freeSimulation(struct simulation* run){
+
+    for(size_t i = 0; i < run->randomCount; i++){
+        const struct simulationNode* node = &run->nodes[run->order[i]];
+        if(node->input == SIZE_MAX){
+            freeSimulationLoads(node->loads, node->formula->loadCount);
+        }
+    }
+    free(run->nodes);
+    free(run->order);
+    free(run->table);
+    free(run->outputSlots);
+    free(run->outputValues);
+    free(run->outputStatuses);
 }
 
-//Function that evaluates an equation's element
-double evaluateEqnElmnt(const struct equationElemts element, const struct cell* cells){
-    
-    int col;
-    
-    int row;
- 
-    switch (element.type){
 
-        //evaluate reference to another cell
-        case REF_CELL:
-            cellReferenceToIndicies(element.celcontent2.referenceCell, &row, &col);
-            return cells[col].celcontent.number;
+//Function that computes the values of the given cells in 'trials' trials, in which every RAND draws a new number
+void simulate_cells(const ROW *rows, const COL *cols, size_t count, size_t trials, unsigned long long seed, double *results) {
 
-        
+    trimChunks();
 
-        //evaluate subtraction and addition
-        case OPERATOR:
-            if(element.celcontent2.operatorSymbol == '-'){
-                return evaluateEqnElmnt(element, &cells[0]) - evaluateEqnElmnt(element, &cells[1]);
-            }
+    struct simulation run;
+    int* physicalRows = malloc((count + 1) * sizeof(int));
+    int* physicalCols = malloc((count + 1) * sizeof(int));
 
-            else if(element.celcontent2.operatorSymbol == '+'){
-                return evaluateEqnElmnt(element, &cells[0]) + evaluateEqnElmnt(element, &cells[1]);
-            }
+    if(physicalRows == NULL || physicalCols == NULL){
+        fprintf(stderr, "Memory allocation error.\n");
+        exit(EXIT_FAILURE);
+    }
+    for(size_t k = 0; k < count; k++){
+        bool inside = (int) rows[k] < spreadsheet->row && (int) cols[k] < spreadsheet->col;
+        physicalRows[k] = inside ? physicalLine(&rowMap, rows[k]) : -1;
+        physicalCols[k] = inside ? physicalLine(&colMap, cols[k]) : -1;
+    }
 
-         
+    compileSimulation(&run, physicalRows, physicalCols, count, NULL, NULL, 0, true, seed);
+    runSimulation(&run, trials, NULL, results, NULL);
+    freeSimulation(&run);
 
-            break;
-        
+    free(physicalRows);
+    free(physicalCols);
+}
 
 
-        case OPERAND:
-            //return numeric operand
-            return element.celcontent2.operand;
+//Function that writes the results of a data table to the 'rows' by 'cols'
+//cells below and right of its first row and column, as values
+static void writeDataTable(ROW first_row, COL first_col, size_t rows, size_t cols, const double* results, const enum evalStatus* statuses){
 
-        
+    struct changeSet changes = {NULL, 0, 0};
 
-        default:
-            //default case then return 0.0
-            return 0.0;
-            break;
+    ++revision;
+
+    for(size_t i = 0; i < rows; i++){
+        for(size_t j = 0; j < cols; j++){
+            size_t position = i * cols + j;
+            char* text = statuses[position] == EVAL_OK ? pivotNumberText(results[position], true) : custom_strnduplicate(evalStatusMessage(statuses[position]), 64);
+            writeCellValue(physicalLine(&rowMap, first_row + 1 + (int) i), physicalLine(&colMap, first_col + 1 + (int) j), text, &changes);
+        }
     }
+
+    propagateChanges(&changes);
 }
 
 
-//Function that evaluates an expression
-bool evalExpression(char **express, float *result, int *err){
-    char operator =  *express[0];
+//Function that reads the value of the cell at logical 'row', 'col' as a data
+//table takes it for an input
+static enum evalStatus readDataTableInput(int row, int col, double* value){
 
-    //advance(express, 1);
+    return evaluateCell(physicalLine(&rowMap, row), physicalLine(&colMap, col), value);
+}
 
-    float leftValue = 0;
 
-    float rightValue;
+//Function that fills a data table of one input: each value down its first
+//column is put in the input cell in turn, and the cells along its first row are
+//computed for it
+void data_table(ROW first_row, COL first_col, ROW last_row, COL last_col, ROW input_row, COL input_col) {
 
-    //check for non-valid inputs, then *error = 1;
-    if(operator != '+' || operator != '-' || operator != '=' ){
-        *err = 1;
+    trimChunks();
 
+    if(first_row >= last_row || first_col >= last_col || (int) last_row >= spreadsheet->row || (int) last_col >= spreadsheet->col
+       || (int) input_row >= spreadsheet->row || (int) input_col >= spreadsheet->col){
+        return;
     }
 
-    //evaluate whether the character is an equal sign
-    if(operator == '='){
-        *result = leftValue;
-        //return evalExpression(express, result, err);
+    size_t rows = last_row - first_row;
+    size_t cols = last_col - first_col;
+    int inputRow = physicalLine(&rowMap, input_row);
+    int inputCol = physicalLine(&colMap, input_col);
+    int* outputRows = malloc(cols * sizeof(int));
+    int* outputCols = malloc(cols * sizeof(int));
+    double* inputs = malloc(rows * sizeof(double));
+    enum evalStatus* inputStatuses = malloc(rows * sizeof(enum evalStatus));
+    double* results = malloc(rows * cols * sizeof(double));
+    enum evalStatus* statuses = malloc(rows * cols * sizeof(enum evalStatus));
+    struct simulation run;
+
+    if(outputRows == NULL || outputCols == NULL || inputs == NULL || inputStatuses == NULL || results == NULL || statuses == NULL){
+        fprintf(stderr, "Memory allocation error.\n");
+        exit(EXIT_FAILURE);
+    }
 
+    for(size_t j = 0; j < cols; j++){
+        outputRows[j] = physicalLine(&rowMap, first_row);
+        outputCols[j] = physicalLine(&colMap, first_col + 1 + (int) j);
+    }
+    for(size_t i = 0; i < rows; i++){
+        inputStatuses[i] = readDataTableInput(first_row + 1 + (int) i, first_col, &inputs[i]);
     }
 
-    //evaluate whether the character is an addition sign
-    if(operator == '+'){
-        *result += leftValue;
-        //return evalExpression(express, result, err);
+    compileSimulation(&run, outputRows, outputCols, cols, &inputRow, &inputCol, 1, false, 0);
+    runSimulation(&run, rows, inputs, results, statuses);
+    freeSimulation(&run);
 
+    //a row whose value fails gets its error
+    for(size_t i = 0; i < rows; i++){
+        for(size_t j = 0; j < cols && inputStatuses[i] != EVAL_OK; j++){
+            statuses[i * cols + j] = inputStatuses[i];
+        }
     }
+    writeDataTable(first_row, first_col, rows, cols, results, statuses);
+
+    free(outputRows);
+    free(outputCols);
+    free(inputs);
+    free(inputStatuses);
+    free(results);
+    free(statuses);
+}
+
 
-    //evaluate whether the character is a subtraction sign
-    if(operator == '-'){
-        *result -= leftValue;
-        //return evalExpression(express, result, err);
+//Function that fills a data table of two inputs: each pair of a value along its
+//first row and a value down its first column is put in the two input cells, and
+//the cell at its top left is computed for it
+void data_table_2d(ROW first_row, COL first_col, ROW last_row, COL last_col, ROW row_input_row, COL row_input_col, ROW col_input_row, COL col_input_col) {
 
+    trimChunks();
 
+    if(first_row >= last_row || first_col >= last_col || (int) last_row >= spreadsheet->row || (int) last_col >= spreadsheet->col
+       || (int) row_input_row >= spreadsheet->row || (int) row_input_col >= spreadsheet->col
+       || (int) col_input_row >= spreadsheet->row || (int) col_input_col >= spreadsheet->col
+       || (row_input_row == col_input_row && row_input_col == col_input_col)){
+        return;
     }
 
+    size_t rows = last_row - first_row;
+    size_t cols = last_col - first_col;
+    int outputRow = physicalLine(&rowMap, first_row);
+    int outputCol = physicalLine(&colMap, first_col);
+    int inputRows[2] = {physicalLine(&rowMap, row_input_row), physicalLine(&rowMap, col_input_row)};
+    int inputCols[2] = {physicalLine(&colMap, row_input_col), physicalLine(&colMap, col_input_col)};
+    double* inputs = malloc(2 * rows * cols * sizeof(double));
+    enum evalStatus* inputStatuses = malloc(rows * cols * sizeof(enum evalStatus));
+    double* rowValues = malloc(cols * sizeof(double));
+    enum evalStatus* rowStatuses = malloc(cols * sizeof(enum evalStatus));
+    double* results = malloc(rows * cols * sizeof(double));
+    enum evalStatus* statuses = malloc(rows * cols * sizeof(enum evalStatus));
+    struct simulation run;
+
+    if(inputs == NULL || inputStatuses == NULL || rowValues == NULL || rowStatuses == NULL || results == NULL || statuses == NULL){
+        fprintf(stderr, "Memory allocation error.\n");
+        exit(EXIT_FAILURE);
+    }
 
+    //a trial per cell of the table, row by row
+    for(size_t j = 0; j < cols; j++){
+        rowStatuses[j] = readDataTableInput(first_row, first_col + 1 + (int) j, &rowValues[j]);
+    }
+    for(size_t i = 0; i < rows; i++){
+        double value;
+        enum evalStatus status = readDataTableInput(first_row + 1 + (int) i, first_col, &value);
+        for(size_t j = 0; j < cols; j++){
+            inputs[2 * (i * cols + j)] = rowValues[j];
+            inputs[2 * (i * cols + j) + 1] = value;
+            inputStatuses[i * cols + j] = status != EVAL_OK ? status : rowStatuses[j];
+        }
+    }
 
-    //If the input is a number
-    if(isdigit(*express[0])){
+    compileSimulation(&run, &outputRow, &outputCol, 1, inputRows, inputCols, 2, false, 0);
+    runSimulation(&run, rows * cols, inputs, results, statuses);
+    freeSimulation(&run);
 
-        char *endptr;
-        float number = strtof(*express, &endptr);
-        if (*endptr == '\0') {
-            //it will successfully convert to a number
-            leftValue = number;
-            //advance(express, 1); //move to the next character after the number
-            return evalExpression(express, result, err);
-        } else {
-            //invalid numeric value, then *error = 1
-            *err = 1;
-            return false;
+    //a cell whose values fail gets their error
+    for(size_t i = 0; i < rows * cols; i++){
+        if(inputStatuses[i] != EVAL_OK){
+            statuses[i] = inputStatuses[i];
         }
     }
+    writeDataTable(first_row, first_col, rows, cols, results, statuses);
+
+    free(inputs);
+    free(inputStatuses);
+    free(rowValues);
+    free(rowStatuses);
+    free(results);
+    free(statuses);
+}
+
+
+//points goal seek tries at once, the most rounds of them, and how close to
+//the target a value must be, relative to it
+#define GOAL_SEEK_POINTS 16
+#define GOAL_SEEK_ROUNDS 100
+#define GOAL_SEEK_TOLERANCE 1e-9
 
-   
+//structure that represent a value tried by goal seek, and how far the result
+//for it is from the target
+struct goalPoint{
+    double input;
 
-    //If the expression given is valid, then that means there is no error
-    *err = 0;
+    double error;
 
+    bool failed;
+};
+
+
+//Function that tries the 'count' values of 'points' in a compiled simulation of
+//one cell and one input, all at once, noting the closest to the target in
+//'best'
+static void tryGoalPoints(struct simulation* run, double target, struct goalPoint* points, size_t count, struct goalPoint* best){
+
+    double inputs[2 * GOAL_SEEK_POINTS + 2];
+    double results[2 * GOAL_SEEK_POINTS + 2];
+    enum evalStatus statuses[2 * GOAL_SEEK_POINTS + 2];
 
+    for(size_t i = 0; i < count; i++){
+        inputs[i] = points[i].input;
+    }
+    runSimulation(run, count, inputs, results, statuses);
+    for(size_t i = 0; i < count; i++){
+        points[i].error = results[i] - target;
+        points[i].failed = statuses[i] != EVAL_OK;
+        if(!points[i].failed && (best->failed || fabs(points[i].error) < fabs(best->error))){
+            *best = points[i];
+        }
+    }
 }
 
 
-//Function that evaluates an equation and return its result as a string
-const char* evaluateEquation(const char* text, const struct cell* cells){
-    struct equationElemts* elmnt = parse_eqn(text);
+//Function that finds, among points sorted by input, the narrowest pair of
+//neighbours which do not fail and between which the result crosses the target,
+//returning false if there is none
+static bool findGoalBracket(const struct goalPoint* points, size_t count, struct goalPoint* low, struct goalPoint* high){
+
+    bool found = false;
 
-    //check for invalid formula
-    if(elmnt == NULL || elmnt[0].type == INVALID){
-        return "Error - Formula is invalid";
+    for(size_t i = 0; i < count; i++){
+        if(points[i].failed){
+            continue;
+        }
+        size_t j = i + 1;
+        while(j < count && points[j].failed){
+            ++j;
+        }
+        if(j == count){
+            break;
+        }
+        if((points[i].error < 0.0) != (points[j].error < 0.0)
+           && (!found || points[j].input - points[i].input < high->input - low->input)){
+            *low = points[i];
+            *high = points[j];
+            found = true;
+        }
+    }
+    return found;
+}
+
+
+//Function that searches a compiled simulation of one cell and one input for an
+//input at which the cell equals 'target', starting from 'start', returning
+//false if there is none within reach
+//
+//Values are tried a round at a time, on as many threads as the cone is worth:
+//first steps growing away from the start on both sides, until the result
+//crosses the target, then points across the bracket found (evenly spaced, plus
+//the secant estimate), each round keeping the narrowest crossing. The bracket
+//shrinks by at least GOAL_SEEK_POINTS each round, and the secant estimate homes
+//in on smooth functions in a few.
+static bool seekGoal(struct simulation* run, double target, double start, double* solution){
+
+    struct goalPoint points[2 * GOAL_SEEK_POINTS + 2];
+    struct goalPoint best = {start, HUGE_VAL, true};
+    struct goalPoint low;
+    struct goalPoint high;
+    double tolerance = GOAL_SEEK_TOLERANCE * (1.0 + fabs(target));
+    double step = start != 0.0 ? fabs(start) * 1e-3 : 1e-3;
+    size_t count = 0;
+
+    //the start, with steps of 4^k times 'step' either side, in increasing order
+    for(int k = 0; k < GOAL_SEEK_POINTS; k++){
+        points[GOAL_SEEK_POINTS - 1 - k].input = start - step;
+        points[GOAL_SEEK_POINTS + 1 + k].input = start + step;
+        step *= 4;
     }
+    points[GOAL_SEEK_POINTS].input = start;
+    count = 2 * GOAL_SEEK_POINTS + 1;
+    tryGoalPoints(run, target, points, count, &best);
 
+    bool bracketed = findGoalBracket(points, count, &low, &high);
+    for(int round = 0; bracketed && !(fabs(best.error) <= tolerance) && round < GOAL_SEEK_ROUNDS; round++){
+        double width = high.input - low.input;
+        double secant = low.input - low.error * width / (high.error - low.error);
 
+        //stop once the bracket cannot be split further
+        if(low.input + width / 2 <= low.input || low.input + width / 2 >= high.input){
+            break;
+        }
 
-    //allocation of a static buffer for result
-    static char resultString[32];
+        count = 0;
+        points[count++] = low;
+        for(int i = 1; i < GOAL_SEEK_POINTS; i++){
+            double input = low.input + width * i / GOAL_SEEK_POINTS;
+            //the secant estimate, in its place among the even points
+            if(secant > points[count - 1].input && secant < input){
+                points[count++].input = secant;
+            }
+            points[count++].input = input;
+        }
+        if(secant > points[count - 1].input && secant < high.input){
+            points[count++].input = secant;
+        }
+        tryGoalPoints(run, target, &points[1], count - 1, &best);
+        points[count++] = high;
+        bracketed = findGoalBracket(points, count, &low, &high);
+    }
 
-    //free memory allocated for equation(s) elements
-    freeEqnElmnts(elmnt);
+    *solution = best.input;
+    return !best.failed && (fabs(best.error) <= tolerance || bracketed);
+}
 
 
-    //evaluate equation and format result
-    double result = evaluateEqnElmnt(elmnt[0], cells);
+//Function that sets the input cell to a value for which the cell at 'row',
+//'col' equals 'target', returning false if none was found
+bool goal_seek(ROW row, COL col, double target, ROW input_row, COL input_col) {
 
-    snprintf(resultString, sizeof(resultString), "%0.2f", result);
+    trimChunks();
 
-    return resultString;
+    if((int) row >= spreadsheet->row || (int) col >= spreadsheet->col || (int) input_row >= spreadsheet->row || (int) input_col >= spreadsheet->col){
+        return false;
+    }
 
+    int outputRow = physicalLine(&rowMap, row);
+    int outputCol = physicalLine(&colMap, col);
+    int inputRow = physicalLine(&rowMap, input_row);
+    int inputCol = physicalLine(&colMap, input_col);
+    const struct cell* input = readCell(inputRow, inputCol);
+    struct simulation run;
+    double start = input != NULL && input->type == NUM ? input->celcontent.number : 0.0;
+    double solution = 0.0;
+    bool found = false;
+
+    //the input must hold a number, or nothing
+    if(input != NULL && input->type != NUM && input->type != BLANK){
+        return false;
+    }
 
+    compileSimulation(&run, &outputRow, &outputCol, 1, &inputRow, &inputCol, 1, false, 0);
+    if(run.outputSlots[0] != SIZE_MAX){
+        found = seekGoal(&run, target, start, &solution);
+    }
+    freeSimulation(&run);
 
+    if(found){
+        char* text = malloc(32);
+        if(text == NULL){
+            fprintf(stderr, "Memory allocation error.\n");
+            exit(EXIT_FAILURE);
+        }
+        snprintf(text, 32, "%.17g", solution);
+        set_cell_value(input_row, input_col, text);
+    }
+    return found;
 }
 
 
-//Function that sets the value of a cell based on text inputs
-void set_cell_value(ROW row, COL col, char *text) {
-   
-    struct cell *cellVariable2 = &spreadsheet->cells[row][col];
+//Function that gets the block holding every non-blank cell, returning false if there are none
+bool get_used_range(ROW *first_row, COL *first_col, ROW *last_row, COL *last_col) {
 
-    //clear cell memory
-    clearCellMemory(*cellVariable2);
+    if(rowOccupancy.first == -1){
+        return false;
+    }
 
-    if (text[0] == '=') {
-        //if input starts with '=', then treat it as an equation
-        cellVariable2->type = EQN;
-        
-        free(cellVariable2->celcontent.text);
-        
-        cellVariable2->celcontent.text = strdup(text);
-        
-        //evaluate equation and update display
-        const char *result = evaluateEquation(cellVariable2->celcontent.text, &spreadsheet->cells[0][0]);
-        
-        update_cell_display(row, col, result);
-        
+    if(!rowMap.moved && !colMap.moved){
+        *first_row = rowOccupancy.first;
+        *first_col = colOccupancy.first;
+        *last_row = rowOccupancy.last;
+        *last_col = colOccupancy.last;
+        return true;
+    }
 
+    //once lines were moved, look for the first and last ones through their runs
+    *first_row = nextOccupiedLogical(&rowMap, &rowOccupancy, 0);
+    *first_col = nextOccupiedLogical(&colMap, &colOccupancy, 0);
+    *last_row = previousOccupiedLogical(&rowMap, &rowOccupancy, spreadsheet->row - 1);
+    *last_col = previousOccupiedLogical(&colMap, &colOccupancy, spreadsheet->col - 1);
+    return true;
+}
 
 
-    } 
-    
-    else {
+//Function that finds the first cell from 'row', 'col' on, stepping by 'rowStep', 'colStep',
+//which is non-blank if 'occupied' or blank otherwise
+//
+//Positions are logical. Returns false if there is none before the edge of the
+//spreadsheet. Looking for a non-blank cell skips lines without any and chunks
+//never allocated whole.
+static bool findOccupancy(int *row, int *col, int rowStep, int colStep, bool occupied){
 
-        //if not staring with '=', then check if it is a text or a numeric 
-        char *endptr;
-        
-        double number = strtod(text, &endptr);
-        
-        //is a numeric value
-        if (*endptr == '\0') {
-            cellVariable2->type = NUM;
-            
-            cellVariable2->celcontent.number = number;
-        } 
-        
-        //is a text
-        else {
-            cellVariable2->type = TXT;
-            
-            cellVariable2->celcontent.text = strdup(text);
-        }
+    int i = *row;
+    int j = *col;
+    int physicalRow = physicalLine(&rowMap, i);
+    int physicalCol = physicalLine(&colMap, j);
+
+    if(occupied && (rowStep != 0 ? colOccupancy.counts[physicalCol] : rowOccupancy.counts[physicalRow]) == 0){
+        return false;
+    }
+
+    while(i >= 0 && i < spreadsheet->row && j >= 0 && j < spreadsheet->col){
+        //lines ahead which are physical neighbours as well
+        int ahead = rowStep != 0 ? lineSegment(&rowMap, i, rowStep, &physicalRow) : lineSegment(&colMap, j, colStep, &physicalCol);
+        const struct cellChunk *chunk = findChunk(physicalRow, physicalCol);
 
-        //update the display with input value 
-        printf("Text val: %s\n", text);  // Debug print statement
-       
-       
-        update_cell_display(row, col, text);
+        if(chunk == NULL && occupied){
+            int skip;
+            if(rowStep != 0){
+                skip = rowStep > 0 ? CHUNK_ROWS - physicalRow % CHUNK_ROWS : physicalRow % CHUNK_ROWS + 1;
+            }
+            else{
+                skip = colStep > 0 ? CHUNK_COLS - physicalCol % CHUNK_COLS : physicalCol % CHUNK_COLS + 1;
+            }
+            skip = skip < ahead ? skip : ahead;
+            i += rowStep * skip;
+            j += colStep * skip;
+            continue;
+        }
+        if((chunk != NULL && (chunk->occupied[physicalRow % CHUNK_ROWS] >> (physicalCol % CHUNK_COLS) & 1)) == occupied){
+            *row = i;
+            *col = j;
+            return true;
+        }
+        i += rowStep;
+        j += colStep;
     }
 
-    //free memory allocated for text inputs
-    free(text);
+    return false;
 }
 
 
-//Function that clears the contents of a cell
-void clear_cell(ROW row, COL col) {
-    //get cell variable
-    struct cell cellVariable3 = spreadsheet->cells[row][col];
+//Function that finds where a jump to the edge of the data (Ctrl+arrow) from a cell lands
+void find_data_edge(ROW *row, COL *col, DIRECTION direction) {
 
-    //clear memory of cell
-    clearCellMemory(cellVariable3);
-    
-    //set cell type to blank
-    cellVariable3.type = BLANK;
+    int rowStep = direction == DIRECTION_DOWN ? 1 : direction == DIRECTION_UP ? -1 : 0;
+    int colStep = direction == DIRECTION_RIGHT ? 1 : direction == DIRECTION_LEFT ? -1 : 0;
+    int i = (int) *row + rowStep;
+    int j = (int) *col + colStep;
 
-    //update ddisplay with empty string 
-    update_cell_display(row, col, "");
+    if(i < 0 || i >= spreadsheet->row || j < 0 || j >= spreadsheet->col){
+        return;
+    }
+
+    //inside a run of non-blank cells, stop at its last cell; otherwise stop at
+    //the next non-blank cell
+    if(isOccupied(physicalLine(&rowMap, *row), physicalLine(&colMap, *col)) && isOccupied(physicalLine(&rowMap, i), physicalLine(&colMap, j))){
+        if(findOccupancy(&i, &j, rowStep, colStep, false)){
+            i -= rowStep;
+            j -= colStep;
+        }
+        else{
+            i = rowStep > 0 ? spreadsheet->row - 1 : rowStep < 0 ? 0 : i;
+            j = colStep > 0 ? spreadsheet->col - 1 : colStep < 0 ? 0 : j;
+        }
+    }
+    else if(!findOccupancy(&i, &j, rowStep, colStep, true)){
+        i = rowStep > 0 ? spreadsheet->row - 1 : rowStep < 0 ? 0 : i;
+        j = colStep > 0 ? spreadsheet->col - 1 : colStep < 0 ? 0 : j;
+    }
+
+    *row = i;
+    *col = j;
 }
 
+
 //Function that gets the textual value of a cell
 char *get_textual_value(ROW row, COL col) {
-    
-    //get cell variable 
-    const struct cell (cellVariable3) = spreadsheet->cells[row][col];
 
-    //check type of cell and return its corresponding value 
-    if(cellVariable3.type == NUM){
+    trimChunks();
+
+    //get cell variable
+    int physicalRow = physicalLine(&rowMap, row);
+    int physicalCol = physicalLine(&colMap, col);
+    const struct cell *cellVariable3 = readCell(physicalRow, physicalCol);
+
+    if(cellVariable3 == NULL){
+        return NULL;
+    }
+
+    //check type of cell and return its corresponding value
+    if(cellVariable3->type == NUM){
         //is a numeric value, so format as string
-        static char numberStr[100];
-        snprintf(numberStr, sizeof(numberStr), "%0.2f", cellVariable3.celcontent.number);
-        return numberStr;
+        char numberStr[100];
+        formatRoundTrip(cellVariable3->celcontent.number, numberStr, sizeof(numberStr));
+        return strdup(numberStr);
     }
 
-    //is text value 
-    else if(cellVariable3.type == TXT){
-        return cellVariable3.celcontent.text;
+    //is the formula of an equation, written out for this cell
+    else if(cellVariable3->type == EQN && cellVariable3->formula != NULL){
+        return formulaToText(cellVariable3->formula, physicalRow, physicalCol);
 
     }
 
- 
+    //is text value or an invalid formula
+    else if(cellVariable3->type == TXT || cellVariable3->type == EQN){
+        return strdup(cellVariable3->celcontent.text);
+
+    }
+
+
 
     else{
         //blank cell, so return NULL
         return NULL;
     }
-  
+
 }
 
 
@@ -505,7 +8902,7 @@ bool starts_with(const char *text, const char *prefix) {
     if(text == NULL || prefix  == NULL){
         printf("Error: NULL pointer.\n");
     }
-    
+
     //recursive function to check each character in an expression
     return (starts_with(text + 1, prefix + 1) && *text == *prefix) || *prefix == '\0';
 }
@@ -513,7 +8910,7 @@ bool starts_with(const char *text, const char *prefix) {
 //Function that advances to the next character in the input
 void advance(const char **input, int step) {
 
-    //increment input pointer by specific num of steps    
+    //increment input pointer by specific num of steps
     for(int k = 0; k < step; k++){
         ++*input;
     }
@@ -521,6 +8918,8 @@ void advance(const char **input, int step) {
 
 
 
+
+
 // #include "model.h"
 // #include "interface.h"
 // #include <stdlib.h>
@@ -1,8 +1,116 @@
 #ifndef ASSIGNMENT_MODEL_H
 #define ASSIGNMENT_MODEL_H
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
 #include "defs.h"
 
+// How formula cells are recalculated after a change.
+typedef enum {
+    // Every formula affected by a change is recalculated and redisplayed
+    // immediately.
+    CALC_EAGER,
+    // Affected formulas are only marked dirty; each is evaluated when something
+    // reads it (a dependent formula or 'refresh_cells') and the result is
+    // memoized until one of its precedents changes again.
+    CALC_LAZY,
+    // As CALC_LAZY, but affected formulas are also queued so that those not read
+    // through 'refresh_cells' can be finished later by 'recalc_pending'. The
+    // interface refreshes the cells it shows first, so the latency of an edit
+    // depends on the visible formulas and their precedents only.
+    CALC_BACKGROUND,
+} CALC_MODE;
+
+// Directions for 'find_data_edge'.
+typedef enum {
+    DIRECTION_UP,
+    DIRECTION_DOWN,
+    DIRECTION_LEFT,
+    DIRECTION_RIGHT,
+} DIRECTION;
+
+// Types of the values in a 'CELL_CHANGE'.
+typedef enum {
+    VALUE_BLANK,
+    VALUE_NUMBER,
+    VALUE_TEXT,
+    // A formula which failed to compute.
+    VALUE_ERROR,
+} VALUE_TYPE;
+
+// The value of a cell, as delivered to the subscribers of 'subscribe_range'.
+typedef struct {
+    ROW row;
+    COL col;
+    VALUE_TYPE type;
+    // The number, for VALUE_NUMBER.
+    double number;
+    // The text, or the message of the error (as displayed), for VALUE_TEXT and
+    // VALUE_ERROR. It is only valid until the handler returns.
+    const char *text;
+} CELL_CHANGE;
+
+// When the changes of a subscription are delivered.
+typedef enum {
+    // At the end of every call which changed or recalculated cells in its
+    // block.
+    DELIVER_ON_COMMIT,
+    // Only when the subscriber calls 'deliver_changes'.
+    DELIVER_ON_REQUEST,
+} DELIVERY;
+
+// Receives the cells of a subscription whose values changed since its last
+// delivery, each once, with their latest values, by row then column. When
+// 'reset' is set, the changes are instead the values of every non-blank cell
+// of the block, and any other cell of it is blank.
+typedef void (*CHANGE_HANDLER)(void *context, const CELL_CHANGE *changes, size_t count, bool reset);
+
+// Layout of the shared memory segment written by 'share_values', version 1.
+//
+// The segment starts with a SHARED_VALUES_HEADER. The mirrored block is split
+// into tiles of SHARED_TILE_ROWS by SHARED_TILE_COLS cells, stored row of
+// tiles by row of tiles from 'tiles_offset' on, each 'tile_size' bytes apart:
+// the cell at 'row', 'col' is cell (row % SHARED_TILE_ROWS) * SHARED_TILE_COLS
+// + col % SHARED_TILE_COLS of tile (row / SHARED_TILE_ROWS) * 'tiles_across' +
+// col / SHARED_TILE_COLS. Readers must check 'magic' and 'version', and use
+// the sizes and offsets of the header rather than their own.
+//
+// Each tile is guarded by its 'sequence' (a seqlock): it is odd while the tile
+// is being written. To read cells of a tile, load 'sequence' (acquire) and
+// retry if it is odd, copy the cells, then load it again after an acquire
+// fence and retry if it changed. No call into the model is needed.
+#define SHARED_VALUES_MAGIC 0x53564c53u
+#define SHARED_VALUES_VERSION 1
+#define SHARED_TILE_ROWS 64
+#define SHARED_TILE_COLS 16
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    // Rows and columns mirrored, from the top left cell of the sheet.
+    uint32_t rows;
+    uint32_t cols;
+    // Tiles along a row of tiles, and down a column of them.
+    uint32_t tiles_across;
+    uint32_t tiles_down;
+    uint64_t tile_size;
+    uint64_t tiles_offset;
+    // Incremented (release) once the changes of each commit are all written,
+    // so that readers may poll it to tell when to read again.
+    uint64_t commits;
+} SHARED_VALUES_HEADER;
+
+typedef struct {
+    uint64_t sequence;
+    uint64_t reserved;
+    // The number of each cell of type VALUE_NUMBER, 0 for the others.
+    double values[SHARED_TILE_ROWS * SHARED_TILE_COLS];
+    // The VALUE_TYPE of each cell.
+    uint8_t types[SHARED_TILE_ROWS * SHARED_TILE_COLS];
+} SHARED_VALUES_TILE;
+
 // Initializes the data structure.
 //
 // This is called once, at program start.
@@ -12,12 +120,167 @@ void model_init();
 //
 // The string referred to by 'text' is now owned by this function and/or the
 // cell contents data structure; it is its responsibility to ensure it is freed
-// once it is no longer needed.
+// once it is no longer needed. An empty value clears the cell, as
+// 'clear_cell' does.
+//
+// Besides SUM, formulas may look values up in a column of a table with
+// VLOOKUP(key, table, column[, approximate]), MATCH(key, column[, type]) and
+// XLOOKUP(key, column, results[, missing[, mode]]), and total the rows of a
+// column passing a condition such as ">=10" with SUMIF(range, condition[,
+// values]), COUNTIF(range, condition) and AVERAGEIF(range, condition[,
+// values]). Long columns share indexes kept up to date as cells change.
+// RAND() is a number drawn uniformly from [0, 1); on the sheet each call keeps
+// the number drawn for its cell, and 'simulate_cells' draws new ones in every
+// trial.
 void set_cell_value(ROW row, COL col, char *text);
 
+// Sets the values of the block of 'rows' by 'cols' cells whose top left cell is
+// at 'row', 'col', as when pasting. 'texts' holds the values row by row; an
+// empty or NULL value clears its cell, and values falling outside the sheet are
+// dropped. The strings in 'texts' are owned as for 'set_cell_value', the array
+// itself remains owned by the caller.
+//
+// This is equivalent to setting each cell in turn, but formulas depending on
+// the block are only recalculated once.
+void set_cell_block(ROW row, COL col, size_t rows, size_t cols, char **texts);
+
+// Copies the value of the cell at 'row', 'col' to every other cell in the block
+// from that cell to 'last_row', 'last_col' (inclusive), as when filling a
+// formula down a column. Relative references in a copied formula shift with
+// each copy; references marked with '$' (e.g. "$A$1") do not.
+void fill_cells(ROW row, COL col, ROW last_row, COL last_col);
+
 // Clears the value of a cell.
 void clear_cell(ROW row, COL col);
 
+// Clears every cell in the given block (inclusive). Only the non-blank cells
+// are visited and sent to 'update_cell_display', and formulas depending on the
+// block are only recalculated once. Storage left unused is freed.
+void clear_range(ROW first_row, COL first_col, ROW last_row, COL last_col);
+
+// Inserts 'count' blank rows before 'row', moving the rows from there on down;
+// rows moved past the end of the sheet are deleted. Cells are not moved where
+// they are stored: rows are mapped to their storage through a tree, which this
+// updates in O(log n), and formula references, compiled to stored rows, keep
+// referring to the same cells. The cells moved are not sent to
+// 'update_cell_display'; the interface redraws the cells it shows.
+void insert_rows(ROW row, size_t count);
+
+// Deletes 'count' rows from 'row' on, moving the rows after them up as for
+// 'insert_rows'. References to deleted cells become "#REF!" and ranges shrink
+// to the rows left; the formulas affected are recalculated.
+void delete_rows(ROW row, size_t count);
+
+// As 'insert_rows', for columns before 'col'.
+void insert_cols(COL col, size_t count);
+
+// As 'delete_rows', for columns from 'col' on.
+void delete_cols(COL col, size_t count);
+
+// Sorts the rows of the given block (inclusive) by the values in column
+// 'key_col', which must be within the block: numbers first, then text
+// (regardless of case), then errors, then blank cells. 'descending' reverses
+// the order of all but the blank cells. Rows with equal values keep their
+// order. The cells of a row move together, and relative references in moved
+// formulas shift with them as when filling; references to the block from
+// elsewhere keep referring to the same positions. As for 'insert_rows', the
+// cells moved are not sent to 'update_cell_display'.
+void sort_range(ROW first_row, COL first_col, ROW last_row, COL last_col, COL key_col, bool descending);
+
+// Groups the rows from 'first_row' to 'last_row' (inclusive) by their value in
+// column 'key_col', and writes one row per distinct value from 'out_row',
+// 'out_col' on: the value, then the sum, number of rows, minimum, maximum and
+// mean of the numbers in column 'value_col' on its rows. Values are sorted as
+// by 'sort_range' and texts grouped regardless of case; rows with a blank key
+// are left out. The results are written as values, and kept up to date as the
+// source changes: only the rows edited are grouped again, and only the results
+// rows that changed are rewritten. Large blocks are grouped on several
+// threads. Grouping again at the same 'out_row', 'out_col' replaces the
+// results; inserting or deleting the lines of the first or last source row,
+// the key or value column, or the top left results cell stops the updates.
+void group_range(ROW first_row, ROW last_row, COL key_col, COL value_col, ROW out_row, COL out_col);
+
+// Stops keeping the results of 'group_range' at 'out_row', 'out_col' up to
+// date; they stay as values.
+void ungroup_range(ROW out_row, COL out_col);
+
+// Computes the values of the 'count' cells at 'rows[i]', 'cols[i]' in each of
+// 'trials' trials, in which every RAND draws a new number, and stores them in
+// 'results', trial by trial: the value of cell 'i' in trial 't' is
+// 'results[t * count + i]', or NaN if it fails to compute. The sheet is left
+// as it is. Only the formulas the cells depend on through RAND are evaluated
+// in each trial, over many trials at once and on several threads for large
+// runs. The numbers drawn depend on 'seed', the trial and the position of the
+// call only, so the results are the same for a seed however the trials are
+// split between threads; trial 0 of seed 0 is the sheet.
+void simulate_cells(const ROW *rows, const COL *cols, size_t count, size_t trials, unsigned long long seed, double *results);
+
+// Fills the block from 'first_row', 'first_col' to 'last_row', 'last_col'
+// (inclusive) as a data table of one input: for each value down its first
+// column, the cells along its first row are computed as if the cell at
+// 'input_row', 'input_col' held that value, and the results written on the
+// value's row below them. The results are written as values, and failing
+// ones as their error; the sheet is otherwise left as it is. Each value is
+// computed on a fork of the sheet sharing every cell but those depending on
+// the input, only those being evaluated again, and large tables on several
+// threads. RAND keeps the numbers the sheet shows.
+void data_table(ROW first_row, COL first_col, ROW last_row, COL last_col, ROW input_row, COL input_col);
+
+// As 'data_table', for two inputs: the cell at the top left of the block is
+// computed for each pair of a value along its first row, put in the cell at
+// 'row_input_row', 'row_input_col', and a value down its first column, put in
+// the cell at 'col_input_row', 'col_input_col'; the result is written where
+// the value's column and row cross.
+void data_table_2d(ROW first_row, COL first_col, ROW last_row, COL last_col, ROW row_input_row, COL row_input_col, ROW col_input_row, COL col_input_col);
+
+// Sets the cell at 'input_row', 'input_col', which must hold a number or
+// nothing, to a value for which the cell at 'row', 'col' equals 'target', as
+// close to its current value as found. Values are tried many at a time, as
+// for 'data_table'. Returns false, leaving the input as it is, if the cell
+// does not depend on the input or no such value was found.
+bool goal_seek(ROW row, COL col, double target, ROW input_row, COL input_col);
+
+// Limits the memory taken by the cells of the sheet to about 'bytes': cells in
+// the blocks used least recently beyond it are paged out to the file at
+// 'spill_path', created or emptied, and read back when used again, so that a
+// sheet larger than memory slows down with the share of it paged out rather
+// than failing. Scans down a column read the blocks after the one they reach
+// ahead. A formula reading more blocks than the budget holds pages out those
+// it read first as it goes; only the blocks of the formulas being computed
+// stay in memory until they are done. Texts, formulas and the links between cells are not paged. A NULL
+// 'spill_path' keeps the current file, or uses a temporary one; a budget of 0
+// lifts the limit, reading every cell back. Returns false if the file cannot
+// be opened.
+bool set_memory_budget(size_t bytes, const char *spill_path);
+
+// Subscribes 'handler' to the changes to the values of the cells in the given
+// block (inclusive), delivered as set by 'delivery'. The cells changed between
+// deliveries are kept in a ring of 'capacity' entries; if it fills, or rows or
+// columns are inserted or deleted, the next delivery sends the whole block
+// instead. The first delivery does too. Formulas dirty in the block are
+// evaluated when their changes are delivered, so that in CALC_LAZY mode the
+// block is kept up to date like the cells the interface shows, and values are
+// not formatted. Any number of subscriptions may watch overlapping blocks.
+// Returns an identifier for the subscription, or -1 if it cannot be made.
+//
+// Handlers must not change the spreadsheet.
+int subscribe_range(ROW first_row, COL first_col, ROW last_row, COL last_col, size_t capacity, DELIVERY delivery, CHANGE_HANDLER handler, void *context);
+
+// Delivers the changes pending for a subscription now, whatever its delivery.
+void deliver_changes(int subscription);
+
+// Cancels a subscription; its pending changes are dropped.
+void unsubscribe_range(int subscription);
+
+// Mirrors the values of the first 'rows' rows and 'cols' columns of the sheet
+// into the POSIX shared memory object 'name' (as for 'shm_open'), created or
+// replaced, in the layout of SHARED_VALUES_HEADER, so that other processes
+// may map it and read values as the model computes them. The mirror is kept
+// up to date as by a subscription delivered on commit. Only one block is
+// mirrored at a time: a NULL 'name' stops mirroring and removes the object.
+// Returns false if it cannot be created.
+bool share_values(const char *name, size_t rows, size_t cols);
+
 // Gets a textual representation of the value of a cell, for editing.
 //
 // The returned string must have been allocated using 'malloc' and is now owned
@@ -25,4 +288,65 @@ void clear_cell(ROW row, COL col);
 // retain any reference to it after the function returns.
 char *get_textual_value(ROW row, COL col);
 
+// Gets the smallest block holding every non-blank cell. Returns false, leaving
+// the arguments unchanged, if every cell is blank. This takes constant time.
+bool get_used_range(ROW *first_row, COL *first_col, ROW *last_row, COL *last_col);
+
+// Moves 'row', 'col' the way Ctrl+arrow does in the given direction: from a
+// non-blank cell followed by another, to the last non-blank cell of that run;
+// otherwise to the next non-blank cell, or to the edge of the sheet if there
+// is none.
+void find_data_edge(ROW *row, COL *col, DIRECTION direction);
+
+// Sets the calculation mode. The default is CALC_EAGER.
+void set_calc_mode(CALC_MODE mode);
+
+// Sets whether formulas referring back to themselves, directly or through other
+// formulas, are solved by iteration instead of failing as circular. The
+// formulas of each cycle are computed again in turn, each from the latest
+// values of the others, until none moves by more than 'max_change' or
+// 'max_iterations' rounds were run, and keep the values of the last round.
+// Only formulas on cycles are iterated; the others are computed once. It is off
+// by default; switching it on or off recalculates every formula.
+void set_iterative_calc(bool enabled, size_t max_iterations, double max_change);
+
+// Brings the displayed values of the cells in the given block (inclusive) up to
+// date, evaluating any dirty formulas in it and the cells they depend on.
+//
+// In CALC_LAZY mode the interface calls this for the cells it is showing.
+void refresh_cells(ROW first_row, COL first_col, ROW last_row, COL last_col);
+
+// Sends the displayed value of every non-blank cell in the given block
+// (inclusive) to 'update_cell_display', evaluating dirty formulas first.
+//
+// The interface calls this for cells coming into view; it is responsible for
+// blanking them beforehand.
+void redraw_cells(ROW first_row, COL first_col, ROW last_row, COL last_col);
+
+// Evaluates up to 'budget' of the formulas queued in CALC_BACKGROUND mode that
+// are still dirty, in the order they were dirtied. Returns whether any queued
+// formulas are left.
+//
+// The interface calls this while it waits for input.
+bool recalc_pending(size_t budget);
+
+// As 'recalc_pending', but evaluates queued formulas for about 'microseconds'
+// instead of a number of them, so that input is handled at a steady rate no
+// matter how many formulas an edit dirtied.
+bool recalc_slice(long microseconds);
+
+// Makes the running slice of recalculation return after the formula it is
+// evaluating; if none is running, the next one returns immediately. Unlike the
+// other functions, this may be called from another thread.
+void preempt_recalc();
+
+// Drops the queued recalculation. The formulas in it stay dirty and are
+// evaluated once read, as in CALC_LAZY mode.
+void cancel_recalc();
+
+// Reports how many of the formulas queued since the queue was last empty have
+// been processed ('done') out of how many were queued ('total'). Both are 0
+// when nothing is queued.
+void recalc_progress(size_t *done, size_t *total);
+
 #endif //ASSIGNMENT_MODEL_H
@@ -14,11 +14,14 @@ static char display[NUM_ROWS][NUM_COLS][CELL_DISPLAY_WIDTH + 1];
 
 int main() {
     memset(display, 0, sizeof(display));
+    model_init();
     run_tests();
     return 0;
 }
 
 void update_cell_display(ROW row, COL col, const char *text) {
+    if (row >= NUM_ROWS || col >= NUM_COLS)
+        return;
     snprintf(display[row][col], CELL_DISPLAY_WIDTH + 1, "%s", text);
 }
 
@@ -1,9 +1,43 @@
+#include <assert.h>
+#include <fcntl.h>
+#include <malloc.h>
+#include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#include "interface.h"
 #include "model.h"
 #include "testrunner.h"
 #include "tests.h"
 
+// Bytes allocated on the heap.
+static size_t heap_in_use(void) {
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+}
+
+// Changes delivered to a subscription by 'record_changes'.
+struct change_log {
+    size_t calls;
+    size_t count;
+    bool reset;
+    CELL_CHANGE changes[8];
+    char texts[8][16];
+};
+
+static void record_changes(void *context, const CELL_CHANGE *changes, size_t count, bool reset) {
+    struct change_log *log = context;
+    log->calls++;
+    log->count = count;
+    log->reset = reset;
+    for (size_t i = 0; i < count && i < 8; i++) {
+        log->changes[i] = changes[i];
+        snprintf(log->texts[i], sizeof(log->texts[i]), "%s", changes[i].text != NULL ? changes[i].text : "");
+    }
+}
+
 void run_tests() {
     set_cell_value(ROW_2, COL_A, strdup("1.4"));
     assert_display_text(ROW_2, COL_A, strdup("1.4"));
@@ -14,6 +48,758 @@ void run_tests() {
     assert_display_text(ROW_2, COL_C, strdup("4.7"));
     set_cell_value(ROW_2, COL_B, strdup("3.1"));
     assert_display_text(ROW_2, COL_C, strdup("4.9"));
-}
 
+    // Numbers are displayed the same whether typed, redrawn or filled.
+    set_cell_value(ROW_9, COL_D, strdup("1234567"));
+    assert_display_text(ROW_9, COL_D, "1234567");
+    redraw_cells(ROW_9, COL_D, ROW_9, COL_D);
+    assert_display_text(ROW_9, COL_D, "1234567");
+    fill_cells(ROW_9, COL_D, ROW_9, COL_E);
+    assert_display_text(ROW_9, COL_E, "1234567");
+    clear_range(ROW_9, COL_D, ROW_9, COL_E);
+
+    // The edit text of a formula parses back to the same formula.
+    set_cell_value(ROW_9, COL_D, strdup("=0.30000000000000004-0.3"));
+    assert_edit_text(ROW_9, COL_D, "=0.30000000000000004-0.3");
+    set_cell_value(ROW_9, COL_D, get_textual_value(ROW_9, COL_D));
+    assert_display_text(ROW_9, COL_D, "5.55112e-17");
+    clear_cell(ROW_9, COL_D);
+
+    // References past the last column or row, however long, are not cells.
+    set_cell_value(ROW_9, COL_D, strdup("=XFD1048576+1"));
+    assert_display_text(ROW_9, COL_D, "1");
+    set_cell_value(ROW_9, COL_D, strdup("=XFE1+1"));
+    assert_display_text(ROW_9, COL_D, "Error - For");
+    set_cell_value(ROW_9, COL_D, strdup("=AAAAAAAAAAAAAAAA1+1"));
+    assert_display_text(ROW_9, COL_D, "Error - For");
+    set_cell_value(ROW_9, COL_D, strdup("=MWLQKWW1+1"));
+    assert_display_text(ROW_9, COL_D, "Error - For");
+    set_cell_value(ROW_9, COL_D, strdup("=A1048577+1"));
+    assert_display_text(ROW_9, COL_D, "Error - For");
+    set_cell_value(ROW_9, COL_D, strdup("=A4294967297+1"));
+    assert_display_text(ROW_9, COL_D, "Error - For");
+    set_cell_value(ROW_9, COL_D, strdup("=A99999999999999999999+1"));
+    assert_display_text(ROW_9, COL_D, "Error - For");
+    clear_cell(ROW_9, COL_D);
+
+    // Lazy mode: dependents are only evaluated once they are read.
+    set_calc_mode(CALC_LAZY);
+    set_cell_value(ROW_3, COL_C, strdup("=C2-A2"));
+    set_cell_value(ROW_2, COL_A, strdup("2"));
+    assert_display_text(ROW_2, COL_C, strdup("4.9"));
+    refresh_cells(ROW_3, COL_C, ROW_3, COL_C);
+    assert_display_text(ROW_3, COL_C, strdup("3.5"));
+    refresh_cells(ROW_1, COL_A, ROW_10, COL_E);
+    assert_display_text(ROW_2, COL_C, strdup("5.5"));
+    set_calc_mode(CALC_EAGER);
+
+    // An empty value clears the cell, which formulas then read as 0.
+    set_cell_value(ROW_9, COL_A, strdup("7"));
+    set_cell_value(ROW_9, COL_B, strdup("=A9+1"));
+    assert_display_text(ROW_9, COL_B, "8");
+    set_cell_value(ROW_9, COL_A, strdup(""));
+    assert_display_text(ROW_9, COL_A, "");
+    assert_display_text(ROW_9, COL_B, "1");
+    clear_cell(ROW_9, COL_B);
+
+    // A long chain of dependencies read in lazy or background mode is
+    // evaluated without nesting its formulas within each other.
+    set_calc_mode(CALC_LAZY);
+    set_cell_value((ROW) 0, (COL) 5, strdup("1"));
+    for(int i = 1; i < 100000; i++){
+        char text[16];
+        snprintf(text, sizeof(text), "=F%d+1", i);
+        set_cell_value((ROW) i, (COL) 5, strdup(text));
+    }
+    set_cell_value(ROW_9, COL_A, strdup("=F100000+0"));
+    refresh_cells(ROW_9, COL_A, ROW_9, COL_A);
+    assert_display_text(ROW_9, COL_A, "100000");
+    set_calc_mode(CALC_BACKGROUND);
+    set_cell_value((ROW) 0, (COL) 5, strdup("2"));
+    refresh_cells(ROW_9, COL_A, ROW_9, COL_A);
+    assert_display_text(ROW_9, COL_A, "100001");
+    set_calc_mode(CALC_EAGER);
+    clear_range((ROW) 0, (COL) 5, (ROW) 99999, (COL) 5);
+    clear_cell(ROW_9, COL_A);
+
+    // Circular references are reported rather than evaluated.
+    set_cell_value(ROW_4, COL_A, strdup("=B4"));
+    set_cell_value(ROW_4, COL_B, strdup("=A4+1"));
+    assert_display_text(ROW_4, COL_B, strdup("Error - Cir"));
+    set_cell_value(ROW_4, COL_A, strdup("1"));
+    assert_display_text(ROW_4, COL_B, strdup("2"));
+
+    // Filling a formula down shifts relative references but not absolute ones.
+    set_cell_value(ROW_5, COL_A, strdup("1"));
+    set_cell_value(ROW_6, COL_A, strdup("2"));
+    set_cell_value(ROW_7, COL_A, strdup("3"));
+    set_cell_value(ROW_5, COL_B, strdup("=A5+$A$5"));
+    fill_cells(ROW_5, COL_B, ROW_7, COL_B);
+    assert_edit_text(ROW_7, COL_B, "=A7+$A$5");
+    assert_display_text(ROW_6, COL_B, "3");
+    assert_display_text(ROW_7, COL_B, "4");
+    set_cell_value(ROW_5, COL_A, strdup("10"));
+    assert_display_text(ROW_7, COL_B, "13");
+
+    // Compiled formulas match left-to-right evaluation exactly.
+    set_cell_value(ROW_8, COL_A, strdup("0.1"));
+    set_cell_value(ROW_8, COL_B, strdup("=0.4+1.6-A8+0.2+A8-A8"));
+    assert_display_text(ROW_8, COL_B, "2.1");
+    assert_edit_text(ROW_8, COL_B, "=0.4+1.6-A8+0.2+A8-A8");
+    set_cell_value(ROW_8, COL_C, strdup("=-A8-0"));
+    assert_display_text(ROW_8, COL_C, "-0.1");
+
+    // A recomputed value equal to the previous one is neither redisplayed nor
+    // propagated further.
+    set_cell_value(ROW_9, COL_A, strdup("1"));
+    set_cell_value(ROW_9, COL_B, strdup("=A9-A9"));
+    set_cell_value(ROW_9, COL_C, strdup("=B9+1"));
+    update_cell_display(ROW_9, COL_B, "unchanged");
+    update_cell_display(ROW_9, COL_C, "unchanged");
+    set_cell_value(ROW_9, COL_A, strdup("2"));
+    assert_display_text(ROW_9, COL_B, "unchanged");
+    assert_display_text(ROW_9, COL_C, "unchanged");
+    set_cell_value(ROW_9, COL_B, strdup("=A9"));
+    assert_display_text(ROW_9, COL_C, "3");
+
+    // Ranges: every cell of the block is a precedent of the formula.
+    set_cell_value(ROW_10, COL_D, strdup("=SUM(A5:A7,B9)+1"));
+    assert_display_text(ROW_10, COL_D, "18");
+    assert_edit_text(ROW_10, COL_D, "=SUM(A5:A7,B9)+1");
+    set_cell_value(ROW_6, COL_A, strdup("x"));
+    assert_display_text(ROW_10, COL_D, "16");
+    set_cell_value(ROW_10, COL_E, strdup("=SUM(D10:D10)"));
+    assert_display_text(ROW_10, COL_E, "16");
+    set_cell_value(ROW_10, COL_D, strdup("=sum(E10)"));
+    assert_display_text(ROW_10, COL_E, "Error - Cir");
+    clear_cell(ROW_10, COL_D);
+    assert_display_text(ROW_10, COL_E, "0");
+
+    // Cells far outside the displayed block are stored and referenced like any other.
+    set_cell_value((ROW) 999999, (COL) 16000, strdup("7"));
+    set_cell_value(ROW_10, COL_E, strdup("=SUM(WQK1:WQK1048576)+WQK1000000+3"));
+    assert_display_text(ROW_10, COL_E, "17");
+    assert_edit_text(ROW_10, COL_E, "=SUM(WQK1:WQK1048576)+WQK1000000+3");
+    clear_cell((ROW) 999999, (COL) 16000);
+    assert_display_text(ROW_10, COL_E, "3");
+
+    // Background mode: formulas being shown are refreshed first, the others
+    // are finished later by recalc_pending.
+    set_calc_mode(CALC_BACKGROUND);
+    set_cell_value(ROW_1, COL_A, strdup("1"));
+    set_cell_value(ROW_1, COL_B, strdup("=A1+1"));
+    set_cell_value(ROW_1, COL_C, strdup("=B1+1"));
+    refresh_cells(ROW_1, COL_A, ROW_1, COL_C);
+    while (recalc_pending(1)) {
+    }
+    assert_display_text(ROW_1, COL_C, "3");
+    set_cell_value(ROW_1, COL_A, strdup("5"));
+    assert_display_text(ROW_1, COL_C, "3");
+    refresh_cells(ROW_1, COL_C, ROW_1, COL_C);
+    assert_display_text(ROW_1, COL_B, "2");
+    assert_display_text(ROW_1, COL_C, "7");
+    assert(!recalc_pending(10));
+    assert_display_text(ROW_1, COL_B, "6");
+    set_cell_value(ROW_1, COL_A, strdup("6"));
+    assert(recalc_pending(1));
+    assert_display_text(ROW_1, COL_B, "7");
+    assert_display_text(ROW_1, COL_C, "7");
+    assert(!recalc_pending(1));
+    assert_display_text(ROW_1, COL_C, "8");
+
+    // Queued recalculation reports its progress and can be preempted or
+    // cancelled; cancelled formulas are evaluated once read.
+    size_t done, total;
+    set_cell_value(ROW_1, COL_A, strdup("7"));
+    recalc_progress(&done, &total);
+    assert(done == 0 && total == 3);
+    preempt_recalc();
+    assert(recalc_slice(1000000));
+    assert_display_text(ROW_1, COL_B, "7");
+    assert(recalc_pending(1));
+    recalc_progress(&done, &total);
+    assert(done == 2 && total == 3);
+    assert_display_text(ROW_1, COL_B, "8");
+    cancel_recalc();
+    recalc_progress(&done, &total);
+    assert(done == 0 && total == 0);
+    assert(!recalc_slice(1000000));
+    assert_display_text(ROW_1, COL_C, "8");
+    refresh_cells(ROW_1, COL_C, ROW_1, COL_C);
+    assert_display_text(ROW_1, COL_C, "9");
+    set_cell_value(ROW_1, COL_A, strdup("8"));
+    assert(!recalc_slice(1000000));
+    assert_display_text(ROW_1, COL_C, "10");
+    set_calc_mode(CALC_EAGER);
 
+    // A block is written at once: formulas in and depending on it see all of
+    // its values, and empty values clear their cells.
+    char *block[] = {strdup("2"), strdup("=C3+1"), NULL, strdup("=C3-D3"), strdup("x"), strdup("")};
+    set_cell_value(ROW_4, COL_E, strdup("1"));
+    set_cell_value(ROW_5, COL_E, strdup("=C3+D3+C4"));
+    set_cell_block(ROW_3, COL_C, 2, 3, block);
+    assert_display_text(ROW_3, COL_C, "2");
+    assert_display_text(ROW_3, COL_D, "3");
+    assert_display_text(ROW_3, COL_E, "");
+    assert_display_text(ROW_4, COL_C, "-1");
+    assert_display_text(ROW_4, COL_D, "x");
+    assert_display_text(ROW_4, COL_E, "");
+    assert_display_text(ROW_5, COL_E, "4");
+    assert(get_textual_value(ROW_4, COL_E) == NULL);
+
+    // The used range follows cells being set and cleared.
+    ROW first_row, last_row;
+    COL first_col, last_col;
+    set_cell_value((ROW) 5000, (COL) 300, strdup("1"));
+    assert(get_used_range(&first_row, &first_col, &last_row, &last_col));
+    assert(first_row == ROW_1 && first_col == COL_A && last_row == 5000 && last_col == 300);
+    clear_cell((ROW) 5000, (COL) 300);
+    assert(get_used_range(&first_row, &first_col, &last_row, &last_col));
+    assert(last_row == ROW_10 && last_col == COL_E);
+
+    // Jumping to the edge of the data stops at the ends of runs of non-blank
+    // cells, and at the edge of the sheet past the last one.
+    ROW row = ROW_1;
+    COL col = (COL) 200;
+    for (int i = 100; i <= 104; i++)
+        set_cell_value((ROW) i, col, strdup("1"));
+    set_cell_value((ROW) 3000, col, strdup("x"));
+    find_data_edge(&row, &col, DIRECTION_DOWN);
+    assert(row == 100);
+    find_data_edge(&row, &col, DIRECTION_DOWN);
+    assert(row == 104);
+    find_data_edge(&row, &col, DIRECTION_DOWN);
+    assert(row == 3000);
+    find_data_edge(&row, &col, DIRECTION_DOWN);
+    assert(row == SHEET_ROWS - 1);
+    find_data_edge(&row, &col, DIRECTION_DOWN);
+    assert(row == SHEET_ROWS - 1);
+    find_data_edge(&row, &col, DIRECTION_UP);
+    assert(row == 3000);
+    find_data_edge(&row, &col, DIRECTION_UP);
+    assert(row == 104);
+    find_data_edge(&row, &col, DIRECTION_UP);
+    assert(row == 100);
+    find_data_edge(&row, &col, DIRECTION_LEFT);
+    assert(row == 100 && col == COL_A);
+    find_data_edge(&row, &col, DIRECTION_RIGHT);
+    assert(col == 200);
+    find_data_edge(&row, &col, DIRECTION_RIGHT);
+    assert(col == SHEET_COLS - 1);
+
+    // Clearing a block clears its cells once, and formulas reading it see the
+    // change even where its storage was freed.
+    for (int i = 2000; i < 2200; i++)
+        for (int j = 400; j < 420; j++)
+            set_cell_value((ROW) i, (COL) j, strdup(j == 419 ? "=OK2001+1" : "1"));
+    set_cell_value(ROW_6, COL_D, strdup("=SUM(OK2001:PC2200)"));
+    set_cell_value(ROW_6, COL_E, strdup("=OK2101"));
+    set_cell_value(ROW_7, COL_D, strdup("=PD2200"));
+    assert_display_text(ROW_6, COL_D, "3800");
+    assert_display_text(ROW_6, COL_E, "1");
+    assert_display_text(ROW_7, COL_D, "2");
+    clear_range((ROW) 2000, (COL) 400, (ROW) 2199, (COL) 419);
+    assert_display_text(ROW_6, COL_D, "0");
+    assert_display_text(ROW_6, COL_E, "0");
+    assert_display_text(ROW_7, COL_D, "0");
+    assert(get_used_range(&first_row, &first_col, &last_row, &last_col));
+    assert(last_row == 3000 && last_col == 200);
+    set_cell_value((ROW) 2050, (COL) 405, strdup("5"));
+    assert_display_text(ROW_6, COL_D, "5");
+    clear_range((ROW) 2050, (COL) 405, (ROW) 2050, (COL) 405);
+    assert_display_text(ROW_6, COL_D, "0");
+
+    // Inserting and deleting lines moves cells along with the references to
+    // them; references to deleted cells are lost and ranges shrink.
+    set_cell_value((ROW) 50, COL_F, strdup("1"));
+    set_cell_value((ROW) 51, COL_F, strdup("2"));
+    set_cell_value((ROW) 52, COL_F, strdup("3"));
+    set_cell_value(ROW_8, COL_D, strdup("=SUM(F51:F53)"));
+    set_cell_value(ROW_8, COL_E, strdup("=F53+1"));
+    insert_rows((ROW) 51, 1);
+    assert_edit_text(ROW_8, COL_D, "=SUM(F51:F54)");
+    assert_edit_text(ROW_8, COL_E, "=F54+1");
+    assert(get_textual_value((ROW) 51, COL_F) == NULL);
+    assert_edit_text((ROW) 52, COL_F, "2");
+    set_cell_value((ROW) 51, COL_F, strdup("10"));
+    assert_display_text(ROW_8, COL_D, "16");
+    delete_rows((ROW) 51, 1);
+    assert_display_text(ROW_8, COL_D, "6");
+    assert_edit_text(ROW_8, COL_E, "=F53+1");
+    delete_rows((ROW) 52, 1);
+    assert_edit_text(ROW_8, COL_D, "=SUM(F51:F52)");
+    assert_edit_text(ROW_8, COL_E, "=#REF!+1");
+    assert_display_text(ROW_8, COL_D, "3");
+    assert_display_text(ROW_8, COL_E, "Error - Ref");
+    insert_cols(COL_F, 1);
+    assert_edit_text(ROW_8, COL_D, "=SUM(G51:G52)");
+    set_cell_value(ROW_9, COL_D, strdup("=G51+$G$51"));
+    fill_cells(ROW_9, COL_D, ROW_10, COL_D);
+    assert_edit_text(ROW_10, COL_D, "=G52+$G$51");
+    assert_display_text(ROW_10, COL_D, "3");
+    row = (ROW) 49;
+    col = COL_G;
+    find_data_edge(&row, &col, DIRECTION_DOWN);
+    assert(row == 50);
+    find_data_edge(&row, &col, DIRECTION_DOWN);
+    assert(row == 51);
+
+    // Sorting moves whole rows of the block: numbers, then text regardless of
+    // case, then errors, then blanks. Moved formulas keep their relative
+    // references; references from outside keep their positions. Moved cells
+    // are redrawn, as by the interface.
+    clear_range(ROW_1, COL_A, ROW_10, COL_E);
+    set_cell_value(ROW_1, COL_A, strdup("3"));
+    set_cell_value(ROW_1, COL_B, strdup("=A1+A1"));
+    set_cell_value(ROW_1, COL_C, strdup("x"));
+    set_cell_value(ROW_2, COL_A, strdup("apple"));
+    set_cell_value(ROW_3, COL_A, strdup("1"));
+    set_cell_value(ROW_3, COL_B, strdup("=A3+A3"));
+    set_cell_value(ROW_4, COL_A, strdup("Banana"));
+    set_cell_value(ROW_5, COL_A, strdup("=C5+1"));
+    set_cell_value(ROW_5, COL_C, strdup("1"));
+    set_cell_value(ROW_6, COL_B, strdup("tail"));
+    set_cell_value(ROW_7, COL_A, strdup("=1+"));
+    set_cell_value(ROW_1, COL_D, strdup("=A1"));
+    sort_range(ROW_1, COL_A, ROW_7, COL_C, COL_A, false);
+    redraw_cells(ROW_1, COL_A, ROW_7, COL_C);
+    assert_edit_text(ROW_1, COL_B, "=A1+A1");
+    assert_display_text(ROW_1, COL_B, "2");
+    assert_edit_text(ROW_2, COL_A, "=C2+1");
+    assert_display_text(ROW_2, COL_A, "2");
+    assert_display_text(ROW_3, COL_B, "6");
+    assert_display_text(ROW_3, COL_C, "x");
+    assert_display_text(ROW_4, COL_A, "apple");
+    assert_display_text(ROW_5, COL_A, "Banana");
+    assert_edit_text(ROW_6, COL_A, "=1+");
+    assert(get_textual_value(ROW_7, COL_A) == NULL);
+    assert_display_text(ROW_7, COL_B, "tail");
+    assert_display_text(ROW_1, COL_D, "1");
+    sort_range(ROW_1, COL_A, ROW_7, COL_C, COL_A, true);
+    redraw_cells(ROW_1, COL_A, ROW_7, COL_C);
+    assert_edit_text(ROW_1, COL_A, "=1+");
+    assert_display_text(ROW_2, COL_A, "Banana");
+    assert_display_text(ROW_3, COL_A, "apple");
+    assert_display_text(ROW_4, COL_B, "6");
+    assert_display_text(ROW_5, COL_A, "2");
+    assert_display_text(ROW_6, COL_B, "2");
+    assert_display_text(ROW_7, COL_B, "tail");
+
+    // Lookups find a key in the first column of a table, exactly or as the
+    // closest value below (or above) it; tables of many rows share an index of
+    // their column, kept up to date by edits.
+    clear_range(ROW_1, COL_A, ROW_10, COL_E);
+    for(int i = 0; i < 100; i++){
+        char text[16];
+        snprintf(text, sizeof(text), "%d", 2 * i);
+        set_cell_value((ROW) (100 + i), (COL) 7, strdup(text));
+        snprintf(text, sizeof(text), "%d", 1000 + i);
+        set_cell_value((ROW) (100 + i), (COL) 8, strdup(text));
+        snprintf(text, sizeof(text), "n%d", i);
+        set_cell_value((ROW) (100 + i), (COL) 9, strdup(text));
+    }
+    set_cell_value(ROW_1, COL_A, strdup("=VLOOKUP(10,H101:I200,2)"));
+    set_cell_value(ROW_2, COL_A, strdup("N7"));
+    set_cell_value(ROW_2, COL_B, strdup("=XLOOKUP(A2,J101:J200,I101:I200)"));
+    set_cell_value(ROW_3, COL_A, strdup("=MATCH(11,H101:H200)"));
+    set_cell_value(ROW_4, COL_A, strdup("=MATCH(11,H101:H200,0)"));
+    set_cell_value(ROW_5, COL_A, strdup("=MATCH(11,H101:H200,-1)"));
+    set_cell_value(ROW_6, COL_A, strdup("=XLOOKUP(11,H101:H200,I101:I200,-1)"));
+    set_cell_value(ROW_7, COL_A, strdup("=VLOOKUP(10,H101:I200,3)"));
+    set_cell_value(ROW_8, COL_A, strdup("=MATCH(1,H101:I200)"));
+    set_cell_value(ROW_9, COL_A, strdup("=VLOOKUP(H101:H102,H101:I200,2)"));
+    set_cell_value(ROW_10, COL_A, strdup("=MATCH(C1,A3:A5,0)"));
+    set_cell_value(ROW_1, COL_C, strdup("7"));
+    assert_display_text(ROW_1, COL_A, "1005");
+    assert_display_text(ROW_2, COL_B, "1007");
+    assert_display_text(ROW_3, COL_A, "6");
+    assert_display_text(ROW_4, COL_A, "Error - Not");
+    assert_display_text(ROW_5, COL_A, "7");
+    assert_display_text(ROW_6, COL_A, "-1");
+    assert_display_text(ROW_7, COL_A, "Error - Ref");
+    assert_display_text(ROW_8, COL_A, "Error - For");
+    assert_edit_text(ROW_9, COL_A, "=VLOOKUP(H101:H102,H101:I200,2)");
+    assert_display_text(ROW_9, COL_A, "Error - For");
+    assert_display_text(ROW_10, COL_A, "3");
+    set_cell_value((ROW) 105, (COL) 7, strdup("11"));
+    assert_display_text(ROW_1, COL_A, "1004");
+    assert_display_text(ROW_4, COL_A, "6");
+    assert_display_text(ROW_5, COL_A, "6");
+    assert_display_text(ROW_10, COL_A, "Error - Not");
+    set_cell_value((ROW) 107, (COL) 9, strdup("N7"));
+    assert_display_text(ROW_2, COL_B, "1007");
+    set_cell_value((ROW) 106, (COL) 9, strdup("n7"));
+    assert_display_text(ROW_2, COL_B, "1006");
+    delete_rows((ROW) 100, 1);
+    assert_edit_text(ROW_1, COL_A, "=VLOOKUP(10,H101:I199,2)");
+    assert_display_text(ROW_1, COL_A, "1004");
+    assert_display_text(ROW_3, COL_A, "5");
+    insert_rows((ROW) 101, 1);
+    assert_display_text(ROW_3, COL_A, "6");
+    assert_display_text(ROW_4, COL_A, "6");
+
+    // A column outside the table is reported even if the key is missing, and
+    // NaN is left out of the index, so that no key finds it.
+    set_cell_value(ROW_7, COL_A, strdup("=VLOOKUP(1,H101:I200,3,0)"));
+    set_cell_value(ROW_8, COL_A, strdup("=VLOOKUP(1,H101:I200,0,0)"));
+    assert_display_text(ROW_7, COL_A, "Error - Ref");
+    assert_display_text(ROW_8, COL_A, "Error - Ref");
+    set_cell_value((ROW) 149, (COL) 7, strdup("nan"));
+    set_cell_value(ROW_7, COL_A, strdup("=MATCH(H150,H101:H200,0)"));
+    set_cell_value(ROW_8, COL_A, strdup("=MATCH(1000,H101:H200)"));
+    set_cell_value(ROW_9, COL_A, strdup("=MATCH(96,H101:H200,0)"));
+    assert_display_text(ROW_7, COL_A, "Error - Not");
+    assert_display_text(ROW_8, COL_A, "100");
+    assert_display_text(ROW_9, COL_A, "49");
+    set_cell_value((ROW) 149, (COL) 7, strdup("97"));
+    assert_display_text(ROW_7, COL_A, "50");
+    assert_display_text(ROW_8, COL_A, "100");
+    set_cell_value(ROW_1, COL_D, strdup("nan"));
+    set_cell_value(ROW_2, COL_D, strdup("5"));
+    set_cell_value(ROW_10, COL_A, strdup("=MATCH(5,D1:D2,0)"));
+    assert_display_text(ROW_10, COL_A, "2");
+
+    // Conditional aggregates total the rows passing a condition: equal to a
+    // value, or compared to one as written in a text. Long columns are grouped
+    // by value once, for every formula over them.
+    clear_range(ROW_1, COL_A, ROW_10, COL_E);
+    for(int i = 0; i < 100; i++){
+        char text[16];
+        snprintf(text, sizeof(text), "%d", i % 4);
+        set_cell_value((ROW) (100 + i), (COL) 10, strdup(text));
+        snprintf(text, sizeof(text), "%d", i);
+        set_cell_value((ROW) (100 + i), (COL) 11, strdup(text));
+        set_cell_value((ROW) (100 + i), (COL) 12, strdup(i % 2 == 0 ? "even" : "odd"));
+    }
+    set_cell_value(ROW_1, COL_B, strdup(">=2"));
+    set_cell_value(ROW_2, COL_B, strdup("<>1"));
+    set_cell_value(ROW_3, COL_B, strdup("ODD"));
+    set_cell_value(ROW_1, COL_A, strdup("=COUNTIF(K101:K200,2)"));
+    set_cell_value(ROW_2, COL_A, strdup("=SUMIF(K101:K200,2,L101:L200)"));
+    set_cell_value(ROW_3, COL_A, strdup("=AVERAGEIF(K101:K200,2,L101:L200)"));
+    set_cell_value(ROW_4, COL_A, strdup("=COUNTIF(K101:K200,B1)"));
+    set_cell_value(ROW_5, COL_A, strdup("=SUMIF(K101:K200,B2)"));
+    set_cell_value(ROW_6, COL_A, strdup("=COUNTIF(M101:M200,B3)"));
+    set_cell_value(ROW_7, COL_A, strdup("=AVERAGEIF(K101:K200,7)"));
+    set_cell_value(ROW_8, COL_A, strdup("=COUNTIF(K101:K105,0)"));
+    set_cell_value(ROW_9, COL_A, strdup("=SUMIF(K101:K200,2,L101:L150)"));
+    assert_display_text(ROW_1, COL_A, "25");
+    assert_display_text(ROW_2, COL_A, "1250");
+    assert_display_text(ROW_3, COL_A, "50");
+    assert_display_text(ROW_4, COL_A, "50");
+    assert_display_text(ROW_5, COL_A, "125");
+    assert_display_text(ROW_6, COL_A, "50");
+    assert_display_text(ROW_7, COL_A, "Error - Not");
+    assert_display_text(ROW_8, COL_A, "2");
+    assert_display_text(ROW_9, COL_A, "Error - For");
+    set_cell_value((ROW) 102, (COL) 10, strdup("0"));
+    assert_display_text(ROW_1, COL_A, "24");
+    assert_display_text(ROW_2, COL_A, "1248");
+    assert_display_text(ROW_4, COL_A, "49");
+    assert_display_text(ROW_5, COL_A, "123");
+    assert_display_text(ROW_8, COL_A, "3");
+    clear_cell((ROW) 106, (COL) 11);
+    assert_display_text(ROW_2, COL_A, "1242");
+    assert_display_text(ROW_3, COL_A, "54");
+    set_cell_value(ROW_1, COL_B, strdup("<1"));
+    assert_display_text(ROW_4, COL_A, "26");
+
+    // The totals of an index take a large value out again exactly enough to
+    // agree with a scan of the same rows, here split in two short ranges.
+    set_cell_value(ROW_4, COL_B, strdup("<>2"));
+    set_cell_value(ROW_1, COL_C, strdup("=SUMIF(K101:K200,2,L101:L200)"));
+    set_cell_value(ROW_2, COL_C, strdup("=SUMIF(K101:K163,2,L101:L163)+SUMIF(K164:K200,2,L164:L200)"));
+    set_cell_value(ROW_3, COL_C, strdup("=SUMIF(K101:K200,B4,L101:L200)"));
+    set_cell_value(ROW_4, COL_C, strdup("=SUMIF(K101:K163,B4,L101:L163)+SUMIF(K164:K200,B4,L164:L200)"));
+    set_cell_value((ROW) 109, (COL) 11, strdup("1e20"));
+    set_cell_value((ROW) 110, (COL) 11, strdup("1e20"));
+    set_cell_value((ROW) 109, (COL) 11, strdup("0.5"));
+    set_cell_value((ROW) 110, (COL) 11, strdup("0.1"));
+    assert_display_text(ROW_1, COL_C, "1232.1");
+    assert_display_text(ROW_2, COL_C, "1232.1");
+    assert_display_text(ROW_3, COL_C, "3693.5");
+    assert_display_text(ROW_4, COL_C, "3693.5");
+    assert_display_text(ROW_3, COL_A, "53.5696");
+
+    // Grouping writes a row per distinct key with the sum, count, minimum,
+    // maximum and mean of the values, then follows edits to the source.
+    clear_range(ROW_1, COL_A, ROW_10, COL_E);
+    set_cell_value((ROW) 300, (COL) 10, strdup("apple"));
+    set_cell_value((ROW) 300, (COL) 11, strdup("3"));
+    set_cell_value((ROW) 301, (COL) 10, strdup("pear"));
+    set_cell_value((ROW) 301, (COL) 11, strdup("5"));
+    set_cell_value((ROW) 302, (COL) 10, strdup("Apple"));
+    set_cell_value((ROW) 302, (COL) 11, strdup("4"));
+    set_cell_value((ROW) 303, (COL) 10, strdup("2"));
+    set_cell_value((ROW) 303, (COL) 11, strdup("10"));
+    set_cell_value((ROW) 304, (COL) 10, strdup("pear"));
+    set_cell_value((ROW) 304, (COL) 11, strdup("x"));
+    set_cell_value((ROW) 305, (COL) 11, strdup("7"));
+    set_cell_value((ROW) 306, (COL) 10, strdup("banana"));
+    set_cell_value((ROW) 306, (COL) 11, strdup("=L301+1"));
+    group_range((ROW) 300, (ROW) 306, (COL) 10, (COL) 11, ROW_1, COL_A);
+    assert_display_text(ROW_1, COL_A, "2");
+    assert_display_text(ROW_1, COL_B, "10");
+    assert_display_text(ROW_1, COL_C, "1");
+    assert_display_text(ROW_2, COL_A, "apple");
+    assert_display_text(ROW_2, COL_B, "7");
+    assert_display_text(ROW_2, COL_C, "2");
+    assert_display_text(ROW_2, COL_D, "3");
+    assert_display_text(ROW_2, COL_E, "4");
+    assert_edit_text(ROW_2, (COL) 5, "3.5");
+    assert_display_text(ROW_3, COL_A, "banana");
+    assert_display_text(ROW_3, COL_B, "4");
+    assert_display_text(ROW_4, COL_A, "pear");
+    set_cell_value((ROW) 300, (COL) 11, strdup("13"));
+    assert_display_text(ROW_2, COL_B, "17");
+    assert_display_text(ROW_2, COL_D, "4");
+    assert_display_text(ROW_2, COL_E, "13");
+    assert_display_text(ROW_3, COL_B, "14");
+    set_cell_value((ROW) 301, (COL) 10, strdup("banana"));
+    assert_display_text(ROW_3, COL_B, "19");
+    assert_display_text(ROW_3, COL_C, "2");
+    assert_display_text(ROW_4, COL_B, "0");
+    assert_display_text(ROW_4, COL_C, "1");
+    assert_display_text(ROW_4, COL_D, "");
+    clear_cell((ROW) 304, (COL) 10);
+    assert_display_text(ROW_4, COL_A, "");
+    assert(get_textual_value(ROW_4, COL_A) == NULL);
+    set_cell_value((ROW) 305, (COL) 10, strdup("cherry"));
+    assert_display_text(ROW_4, COL_A, "cherry");
+    assert_display_text(ROW_4, COL_B, "7");
+    insert_rows((ROW) 302, 1);
+    set_cell_value((ROW) 302, (COL) 10, strdup("APPLE"));
+    set_cell_value((ROW) 302, (COL) 11, strdup("1"));
+    assert_display_text(ROW_2, COL_B, "18");
+    assert_display_text(ROW_2, COL_C, "3");
+    assert_display_text(ROW_2, COL_D, "1");
+    set_cell_value((ROW) 300, (COL) 11, strdup("1e20"));
+    set_cell_value((ROW) 300, (COL) 11, strdup("0.5"));
+    assert_display_text(ROW_2, COL_B, "5.5");
+    assert_display_text(ROW_2, COL_D, "0.5");
+    set_cell_value(ROW_5, COL_A, strdup("=F2-1.8333333333333333"));
+    assert_display_text(ROW_5, COL_A, "0");
+    clear_cell(ROW_5, COL_A);
+    ungroup_range(ROW_1, COL_A);
+    set_cell_value((ROW) 306, (COL) 11, strdup("8"));
+    assert_display_text(ROW_4, COL_B, "7");
+
+    // Simulations draw new numbers for RAND in every trial, the same ones for
+    // the same seed; trial 0 of seed 0 is what the sheet shows.
+    clear_range(ROW_1, COL_A, ROW_10, COL_E);
+    set_cell_value(ROW_1, COL_A, strdup("=RAND()"));
+    set_cell_value(ROW_2, COL_A, strdup("=RAND()-RAND()"));
+    set_cell_value(ROW_3, COL_A, strdup("=A1+A2+1"));
+    set_cell_value(ROW_4, COL_A, strdup("=SUM(A1:A2)+1"));
+    set_cell_value(ROW_5, COL_A, strdup("=A3-A4"));
+    set_cell_value(ROW_6, COL_A, strdup("=B6+2"));
+    set_cell_value(ROW_6, COL_B, strdup("3"));
+    set_cell_value(ROW_7, COL_A, strdup("=MATCH(A1,A1:A2,0)+A8"));
+    set_cell_value(ROW_8, COL_A, strdup("x"));
+    assert_display_text(ROW_5, COL_A, "0");
+    ROW simulated_rows[] = {ROW_1, ROW_2, ROW_3, ROW_5, ROW_6, ROW_7};
+    COL simulated_cols[] = {COL_A, COL_A, COL_A, COL_A, COL_A, COL_A};
+    static double first_run[6 * 10000];
+    static double second_run[6 * 10000];
+    simulate_cells(simulated_rows, simulated_cols, 6, 10000, 42, first_run);
+    simulate_cells(simulated_rows, simulated_cols, 6, 10000, 42, second_run);
+    assert(memcmp(first_run, second_run, sizeof(first_run)) == 0);
+    double mean = 0.0;
+    for (int i = 0; i < 10000; i++) {
+        assert(first_run[6 * i] >= 0.0 && first_run[6 * i] < 1.0);
+        assert(first_run[6 * i + 1] > -1.0 && first_run[6 * i + 1] < 1.0);
+        assert(first_run[6 * i + 2] == first_run[6 * i] + first_run[6 * i + 1] + 1);
+        assert(first_run[6 * i + 3] == 0.0);
+        assert(first_run[6 * i + 4] == 5.0);
+        assert(first_run[6 * i + 5] != first_run[6 * i + 5]);
+        mean += first_run[6 * i] / 10000;
+    }
+    assert(mean > 0.48 && mean < 0.52);
+    assert(first_run[0] != first_run[6]);
+    simulate_cells(simulated_rows, simulated_cols, 6, 10000, 43, second_run);
+    assert(first_run[0] != second_run[0]);
+    simulate_cells(simulated_rows, simulated_cols, 1, 1, 0, second_run);
+    char sheet_value[32];
+    snprintf(sheet_value, sizeof(sheet_value), "%g", second_run[0]);
+    assert_display_text(ROW_1, COL_A, sheet_value);
+
+    // Data tables compute their formulas for each value of their inputs
+    // without changing them; goal seek sets an input to reach a target.
+    clear_range(ROW_1, COL_A, ROW_10, COL_E);
+    set_cell_value(ROW_1, COL_E, strdup("10"));
+    set_cell_value(ROW_2, COL_E, strdup("=E1+E1+1"));
+    set_cell_value(ROW_1, COL_B, strdup("=E2"));
+    set_cell_value(ROW_1, COL_C, strdup("=E2-E1"));
+    set_cell_value(ROW_2, COL_A, strdup("1"));
+    set_cell_value(ROW_3, COL_A, strdup("2"));
+    set_cell_value(ROW_4, COL_A, strdup("x"));
+    data_table(ROW_1, COL_A, ROW_4, COL_C, ROW_1, COL_E);
+    assert_display_text(ROW_2, COL_B, "3");
+    assert_display_text(ROW_3, COL_B, "5");
+    assert_display_text(ROW_2, COL_C, "2");
+    assert_display_text(ROW_3, COL_C, "3");
+    assert_display_text(ROW_4, COL_B, "Error - Ref");
+    assert_display_text(ROW_1, COL_B, "21");
+    assert_display_text(ROW_2, COL_E, "21");
+    set_cell_value(ROW_6, COL_A, strdup("=E2+D6"));
+    set_cell_value(ROW_6, COL_B, strdup("1"));
+    set_cell_value(ROW_6, COL_C, strdup("2"));
+    set_cell_value(ROW_7, COL_A, strdup("10"));
+    set_cell_value(ROW_8, COL_A, strdup("20"));
+    data_table_2d(ROW_6, COL_A, ROW_8, COL_C, ROW_1, COL_E, ROW_6, COL_D);
+    assert_display_text(ROW_7, COL_B, "13");
+    assert_display_text(ROW_7, COL_C, "15");
+    assert_display_text(ROW_8, COL_B, "23");
+    assert_display_text(ROW_8, COL_C, "25");
+    assert_display_text(ROW_6, COL_A, "21");
+    assert(goal_seek(ROW_2, COL_E, 41, ROW_1, COL_E));
+    assert_display_text(ROW_1, COL_E, "20");
+    assert_display_text(ROW_2, COL_E, "41");
+    assert_display_text(ROW_1, COL_B, "41");
+    assert(!goal_seek(ROW_2, COL_E, 41, ROW_3, COL_D));
+    assert(!goal_seek(ROW_6, COL_B, 3, ROW_1, COL_E));
+
+    // Iterative calculation solves cycles of references until they settle,
+    // computing the formulas on no cycle once.
+    clear_range(ROW_1, COL_A, ROW_10, COL_E);
+    set_cell_value(ROW_1, COL_B, strdup("=A1"));
+    set_cell_value(ROW_1, COL_C, strdup("=A1"));
+    set_cell_value(ROW_1, COL_A, strdup("=B1-C1+5"));
+    set_cell_value(ROW_2, COL_A, strdup("=A1+1"));
+    assert_display_text(ROW_1, COL_A, "Error - Cir");
+    set_iterative_calc(true, 100, 0.001);
+    assert_display_text(ROW_1, COL_A, "5");
+    assert_display_text(ROW_1, COL_C, "5");
+    assert_display_text(ROW_2, COL_A, "6");
+    set_cell_value(ROW_6, COL_A, strdup("4"));
+    set_cell_value(ROW_7, COL_A, strdup("5"));
+    set_cell_value(ROW_8, COL_B, strdup(">1"));
+    set_cell_value(ROW_8, COL_A, strdup("=COUNTIF(A6:A8,B8)"));
+    assert_display_text(ROW_8, COL_A, "3");
+    set_cell_value(ROW_6, COL_A, strdup("0"));
+    assert_display_text(ROW_8, COL_A, "2");
+    set_iterative_calc(true, 10, 0.001);
+    set_cell_value(ROW_4, COL_A, strdup("=A4+1"));
+    assert_display_text(ROW_4, COL_A, "10");
+    set_iterative_calc(false, 100, 0.001);
+    assert_display_text(ROW_1, COL_A, "Error - Cir");
+    assert_display_text(ROW_4, COL_A, "Error - Cir");
+
+    // Under a memory budget the cells of blocks not used lately are paged out
+    // to a spill file, and read back when used again.
+    clear_range(ROW_1, COL_A, ROW_10, COL_E);
+    assert(set_memory_budget(1, NULL));
+    for(int i = 1; i <= 200; i++){
+        char text[16];
+        snprintf(text, sizeof(text), "%d", i);
+        set_cell_value((ROW) (64 * i), COL_B, strdup(text));
+    }
+    set_cell_value((ROW) 9600, COL_C, strdup("far"));
+    set_cell_value(ROW_1, COL_A, strdup("=SUM(B2:B13000)"));
+    assert_display_text(ROW_1, COL_A, "20100");
+    set_cell_value((ROW) 6400, COL_B, strdup("0"));
+    assert_display_text(ROW_1, COL_A, "20000");
+    assert_edit_text((ROW) 9600, COL_C, "far");
+    assert(set_memory_budget(0, NULL));
+    clear_range((ROW) 64, COL_B, (ROW) 12800, COL_C);
+    assert_display_text(ROW_1, COL_A, "0");
+
+    // Blocks only read are paged out again without being written back, so a
+    // redraw and a SUM over blocks paged out leave the spill file untouched.
+    const char *spill_path = "spill_test.tmp";
+    struct stat spill;
+    assert(set_memory_budget(1, spill_path));
+    for(int i = 1; i <= 200; i++){
+        char text[16];
+        snprintf(text, sizeof(text), "%d", i);
+        set_cell_value((ROW) (64 * i), COL_B, strdup(text));
+    }
+    assert_display_text(ROW_1, COL_A, "20100");
+    set_calc_mode(CALC_LAZY);
+    set_cell_value((ROW) 64, COL_B, strdup("0"));
+    redraw_cells((ROW) 64, COL_B, (ROW) 12800, COL_B);
+    assert(utimensat(AT_FDCWD, spill_path, (const struct timespec[2]) {{0, 0}, {0, 0}}, 0) == 0);
+    redraw_cells((ROW) 64, COL_B, (ROW) 12800, COL_B);
+    redraw_cells(ROW_1, COL_A, ROW_1, COL_A);
+    assert_display_text(ROW_1, COL_A, "20099");
+    assert(stat(spill_path, &spill) == 0 && spill.st_mtime == 0);
+
+    // A formula reading more blocks than the budget holds, and cells read one
+    // after another, page out the blocks read first as they go.
+    set_cell_value((ROW) 64, COL_B, strdup("1"));
+    size_t paged = heap_in_use();
+    redraw_cells(ROW_1, COL_A, ROW_1, COL_A);
+    assert_display_text(ROW_1, COL_A, "20100");
+    size_t summed = heap_in_use();
+    for(int i = 1; i <= 200; i++){
+        free(get_textual_value((ROW) (64 * i), COL_B));
+    }
+    size_t read = heap_in_use();
+    assert(set_memory_budget((size_t) 1 << 40, NULL));
+    for(int i = 1; i <= 200; i++){
+        free(get_textual_value((ROW) (64 * i), COL_B));
+    }
+    size_t resident = heap_in_use() - paged;
+    assert(summed < paged + resident / 4 && read < paged + resident / 4);
+    assert(set_memory_budget(0, NULL));
+    set_calc_mode(CALC_EAGER);
+    unlink(spill_path);
+    clear_range((ROW) 64, COL_B, (ROW) 12800, COL_B);
+    assert_display_text(ROW_1, COL_A, "0");
+
+    // Subscribers receive the typed values of the cells of their block that
+    // changed, each once per delivery; the first delivery sends the block.
+    struct change_log on_commit = {0};
+    struct change_log on_request = {0};
+    clear_range(ROW_1, COL_A, ROW_10, COL_E);
+    set_cell_value(ROW_2, COL_A, strdup("2"));
+    set_cell_value(ROW_3, COL_A, strdup("=A2+A2"));
+    set_cell_value(ROW_4, COL_A, strdup("=A3"));
+    int watched = subscribe_range(ROW_1, COL_A, ROW_3, COL_B, 4, DELIVER_ON_COMMIT, record_changes, &on_commit);
+    int polled = subscribe_range(ROW_1, COL_B, ROW_1, COL_B, 4, DELIVER_ON_REQUEST, record_changes, &on_request);
+    assert(watched != -1 && polled != -1);
+    assert(on_commit.calls == 1 && on_commit.reset && on_commit.count == 2);
+    assert(on_commit.changes[1].row == ROW_3 && on_commit.changes[1].type == VALUE_NUMBER && on_commit.changes[1].number == 4);
+    set_cell_value(ROW_2, COL_A, strdup("5"));
+    assert(on_commit.calls == 2 && !on_commit.reset && on_commit.count == 2);
+    assert(on_commit.changes[0].number == 5 && on_commit.changes[1].number == 10);
+    set_cell_value(ROW_1, COL_B, strdup("x"));
+    assert(on_commit.calls == 3 && on_commit.count == 1 && on_commit.changes[0].type == VALUE_TEXT);
+    assert(on_request.calls == 0);
+    deliver_changes(polled);
+    assert(on_request.calls == 1 && on_request.count == 1 && strcmp(on_request.texts[0], "x") == 0);
+    // In lazy mode the dirty formulas of the block are evaluated to be
+    // delivered, and those outside it are left dirty.
+    set_calc_mode(CALC_LAZY);
+    set_cell_value(ROW_3, COL_A, strdup("=A2+B1"));
+    assert(on_commit.calls == 4 && on_commit.count == 1 && on_commit.changes[0].type == VALUE_ERROR);
+    assert_display_text(ROW_4, COL_A, "10");
+    set_calc_mode(CALC_EAGER);
+    unsubscribe_range(watched);
+    unsubscribe_range(polled);
+    set_cell_value(ROW_2, COL_A, strdup("6"));
+    assert(on_commit.calls == 4);
+
+    // Computed values are mirrored into shared memory, where other processes
+    // read them without calling the model.
+    clear_range(ROW_1, COL_A, ROW_10, COL_E);
+    set_cell_value(ROW_2, COL_B, strdup("3"));
+    assert(share_values("/spreadsheet-tests", 10, 5));
+    set_cell_value(ROW_3, COL_B, strdup("=B2+4"));
+    set_cell_value(ROW_4, COL_B, strdup("x"));
+    int shared = shm_open("/spreadsheet-tests", O_RDONLY, 0);
+    struct stat shared_stat;
+    assert(shared != -1 && fstat(shared, &shared_stat) == 0);
+    const SHARED_VALUES_HEADER *header = mmap(NULL, shared_stat.st_size, PROT_READ, MAP_SHARED, shared, 0);
+    assert(header != MAP_FAILED);
+    assert(header->magic == SHARED_VALUES_MAGIC && header->version == SHARED_VALUES_VERSION);
+    assert(header->rows == 10 && header->tiles_across == 1 && header->commits == 3);
+    const SHARED_VALUES_TILE *tile = (const void *) ((const char *) header + header->tiles_offset);
+    assert(tile->sequence % 2 == 0);
+    assert(tile->types[1 * SHARED_TILE_COLS + 1] == VALUE_NUMBER && tile->values[1 * SHARED_TILE_COLS + 1] == 3);
+    assert(tile->values[2 * SHARED_TILE_COLS + 1] == 7 && tile->types[3 * SHARED_TILE_COLS + 1] == VALUE_TEXT);
+    munmap((void *) header, shared_stat.st_size);
+    close(shared);
+    assert(share_values(NULL, 0, 0));
+    assert(shm_open("/spreadsheet-tests", O_RDONLY, 0) == -1);
+}